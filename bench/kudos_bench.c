@@ -0,0 +1,823 @@
+#include "http_client.h"
+#include "http_server.h"
+#include "http_proxy.h"
+#include "http_client_pool.h"
+#include "histogram.h"
+#include <limits.h>
+#ifdef _WIN32
+#define BENCH_THREAD_RETURN DWORD WINAPI
+typedef HANDLE bench_thread;
+#else
+#include <pthread.h>
+#define BENCH_THREAD_RETURN void*
+typedef pthread_t bench_thread;
+#endif
+
+#define BENCH_MAX_CONNECTIONS 1000
+#define BENCH_POST_LEN (1024 * 1024)
+#define BENCH_FILE_LEN (1024 * 256)
+#define BENCH_FILE_NAME "kudos-bench.bin"
+#define BENCH_DRAIN_NS 5000000000ull
+#define BENCH_FANOUT 2
+
+enum {
+  MIX_GET,
+  MIX_POST,
+  MIX_FILE,
+  MIX_LEN
+};
+
+static const char* mix_names[MIX_LEN] = { "get", "post", "file" };
+static const char* mix_paths[MIX_LEN] = { "/", "/upload", "/file" };
+
+typedef struct {
+  const char* ip;
+  const char* port;
+  const char* unix_path;
+  int connections;
+  int threads;
+  int keep_alive;
+  int depth;
+  int mix[MIX_LEN];
+  double duration;
+  uint64_t requests;
+  const char* access_log;
+  const char* tune;
+} bench_options;
+
+struct bench_worker;
+
+struct bench_conn {
+  http_client* client;
+  struct bench_worker* worker;
+  uint64_t started[HTTP_CLIENT_PIPELINE];
+  size_t inflight;
+};
+
+struct bench_worker {
+  const bench_options* options;
+  struct bench_conn* conns;
+  size_t len;
+  const char* post_body;
+  uint64_t budget;
+  uint64_t deadline;
+  uint64_t issued;
+  uint64_t completed;
+  uint64_t errors;
+  uint64_t bytes;
+  uint64_t rng;
+  struct histogram latency;
+  bench_thread thread;
+};
+
+typedef struct {
+  uint64_t completed;
+  uint64_t errors;
+  uint64_t bytes;
+  double seconds;
+  struct histogram latency;
+} bench_result;
+
+static void bench_sleep_ms(int ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+#endif
+}
+
+static int bench_thread_start(bench_thread* thread, BENCH_THREAD_RETURN (*run)(void*), void* arg) {
+#ifdef _WIN32
+  *thread = CreateThread(NULL, 0, run, arg, 0, NULL);
+  return *thread ? HTTP_SUCCESS : HTTP_FAILURE;
+#else
+  return pthread_create(thread, NULL, run, arg) ? HTTP_FAILURE : HTTP_SUCCESS;
+#endif
+}
+
+static void bench_thread_join(bench_thread thread) {
+#ifdef _WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+static int bench_pick(struct bench_worker* worker) {
+  const int* mix = worker->options->mix;
+  int total = mix[MIX_GET] + mix[MIX_POST] + mix[MIX_FILE];
+  worker->rng ^= worker->rng << 13;
+  worker->rng ^= worker->rng >> 7;
+  worker->rng ^= worker->rng << 17;
+  int roll = (int)(worker->rng % (uint64_t)total);
+  for (int kind = 0; kind < MIX_LEN; ++kind) {
+    if (roll < mix[kind])
+      return kind;
+    roll -= mix[kind];
+  }
+  return MIX_GET;
+}
+
+static void bench_on_response(http_client* client, http_response* res, void* userdata) {
+  struct bench_conn* conn = userdata;
+  struct bench_worker* worker = conn->worker;
+  /* the client already advanced past the request this response answers */
+  size_t slot = (client->head + HTTP_CLIENT_PIPELINE - 1) % HTTP_CLIENT_PIPELINE;
+  histogram_record(&worker->latency, http_clock_ns() - conn->started[slot]);
+  --conn->inflight;
+  if (res->status == HTTP_STATUS_200) {
+    ++worker->completed;
+    worker->bytes += res->body_len;
+  }
+  else
+    ++worker->errors;
+}
+
+static int bench_issue(struct bench_worker* worker, struct bench_conn* conn) {
+  http_client* client = conn->client;
+  int kind = bench_pick(worker);
+  int method = kind == MIX_POST ? METHOD_POST : METHOD_GET;
+  const char* body = kind == MIX_POST ? worker->post_body : NULL;
+  size_t body_len = kind == MIX_POST ? BENCH_POST_LEN : 0;
+  if (http_client_prepare(client, method, mix_paths[kind], body, body_len) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  if (!worker->options->keep_alive)
+    http_request_add_header(http_client_get_request(client), "Connection", "close");
+  conn->started[(client->head + client->pending) % HTTP_CLIENT_PIPELINE] = http_clock_ns();
+  ++conn->inflight;
+  ++worker->issued;
+  return http_client_send(client);
+}
+
+/* requests that were in flight when a connection died count as errors */
+static void bench_fail(struct bench_worker* worker, struct bench_conn* conn) {
+  worker->errors += conn->inflight;
+  conn->inflight = 0;
+  http_client_close(conn->client);
+}
+
+static BENCH_THREAD_RETURN bench_worker_run(void* arg) {
+  struct bench_worker* worker = arg;
+  const bench_options* options = worker->options;
+  int depth = options->keep_alive ? options->depth : 1;
+  uint64_t drain = 0;
+
+  for (;;) {
+    uint64_t now = http_clock_ns();
+    int stopping = (worker->deadline && now >= worker->deadline) ||
+                   (worker->budget && worker->issued >= worker->budget);
+    if (stopping && !drain)
+      drain = now + BENCH_DRAIN_NS;
+
+    fd_set read, write;
+    FD_ZERO(&read);
+    FD_ZERO(&write);
+    int max_socket = -1;
+    size_t busy = 0;
+    for (size_t i = 0; i < worker->len; ++i) {
+      struct bench_conn* conn = &worker->conns[i];
+      http_client* client = conn->client;
+      if (!conn_info_is(client->conn, CONN_USED)) {
+        if (stopping)
+          continue;
+        int connected = options->unix_path ? http_client_connect_unix(client, options->unix_path)
+                                           : http_client_connect(client, options->ip, options->port);
+        if (connected == HTTP_FAILURE) {
+          ++worker->errors;
+          bench_sleep_ms(10);
+          continue;
+        }
+      }
+      while (!stopping && http_client_pending(client) < (size_t)depth &&
+             !(worker->budget && worker->issued >= worker->budget)) {
+        if (bench_issue(worker, conn) == HTTP_FAILURE) {
+          bench_fail(worker, conn);
+          break;
+        }
+      }
+      if (!conn_info_is(client->conn, CONN_USED) || http_client_pending(client) == 0)
+        continue;
+      SOCKET sockfd = client->conn->sockfd;
+      FD_SET(sockfd, &read);
+      if (http_client_wants_write(client))
+        FD_SET(sockfd, &write);
+      if ((int)sockfd > max_socket) max_socket = (int)sockfd;
+      ++busy;
+    }
+    if (busy == 0 && stopping)
+      break;
+    if (drain && now >= drain) {
+      for (size_t i = 0; i < worker->len; ++i)
+        bench_fail(worker, &worker->conns[i]);
+      break;
+    }
+    if (busy == 0)
+      continue;
+
+    struct timeval timeout = { 0, 100 * 1000 };
+    if (select(max_socket + 1, &read, &write, NULL, &timeout) < 0) {
+#ifndef _WIN32
+      if (GET_ERROR() == EINTR)
+        continue;
+#endif
+      fprintf(stderr, "kudos-bench: select() failed - %d.\n", GET_ERROR());
+      break;
+    }
+    for (size_t i = 0; i < worker->len; ++i) {
+      struct bench_conn* conn = &worker->conns[i];
+      http_client* client = conn->client;
+      if (!conn_info_is(client->conn, CONN_USED) || http_client_pending(client) == 0)
+        continue;
+      SOCKET sockfd = client->conn->sockfd;
+      if (!FD_ISSET(sockfd, &read) && !FD_ISSET(sockfd, &write))
+        continue;
+      if (http_client_step(client) == HTTP_FAILURE || (!conn_info_is(client->conn, CONN_USED) && conn->inflight))
+        bench_fail(worker, conn);
+    }
+  }
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static int bench_run(const bench_options* options, bench_result* result) {
+  int threads = options->threads;
+  struct bench_worker* workers = calloc((size_t)threads, sizeof(struct bench_worker));
+  char* post_body = malloc(BENCH_POST_LEN);
+  if (!workers || !post_body) {
+    free(workers);
+    free(post_body);
+    fprintf(stderr, "kudos-bench: out of memory.\n");
+    return HTTP_FAILURE;
+  }
+  memset(post_body, 'k', BENCH_POST_LEN);
+
+  uint64_t begin = http_clock_ns();
+  int ret = HTTP_SUCCESS;
+  int started = 0;
+  for (; started < threads; ++started) {
+    struct bench_worker* worker = &workers[started];
+    worker->options   = options;
+    worker->post_body = post_body;
+    worker->rng       = 0x9E3779B97F4A7C15ull * (uint64_t)(started + 1);
+    worker->deadline  = options->duration > 0 ? begin + (uint64_t)(options->duration * 1e9) : 0;
+    worker->budget    = options->requests / (uint64_t)threads +
+                        ((uint64_t)started < options->requests % (uint64_t)threads);
+    histogram_reset(&worker->latency);
+    /* connections are split as evenly as possible between the threads */
+    worker->len   = (size_t)(options->connections / threads + (started < options->connections % threads));
+    worker->conns = calloc(worker->len, sizeof(struct bench_conn));
+    if (!worker->conns) {
+      ret = HTTP_FAILURE;
+      break;
+    }
+    for (size_t i = 0; i < worker->len; ++i) {
+      struct bench_conn* conn = &worker->conns[i];
+      conn->worker = worker;
+      conn->client = http_client_new(NULL);
+      if (!conn->client) {
+        ret = HTTP_FAILURE;
+        break;
+      }
+      http_client_set_handler(conn->client, bench_on_response, conn);
+    }
+    if (ret == HTTP_FAILURE || bench_thread_start(&worker->thread, bench_worker_run, worker) == HTTP_FAILURE) {
+      ret = HTTP_FAILURE;
+      break;
+    }
+  }
+
+  memset(result, 0, sizeof(*result));
+  histogram_reset(&result->latency);
+  for (int i = 0; i < started; ++i) {
+    bench_thread_join(workers[i].thread);
+    result->completed += workers[i].completed;
+    result->errors    += workers[i].errors;
+    result->bytes     += workers[i].bytes;
+    histogram_merge(&result->latency, &workers[i].latency);
+  }
+  result->seconds = (double)(http_clock_ns() - begin) / 1e9;
+
+  for (int i = 0; i < threads; ++i) {
+    for (size_t j = 0; workers[i].conns && j < workers[i].len; ++j) {
+      if (workers[i].conns[j].client)
+        http_client_free(workers[i].conns[j].client);
+    }
+    free(workers[i].conns);
+  }
+  free(workers);
+  free(post_body);
+  if (ret == HTTP_FAILURE)
+    fprintf(stderr, "kudos-bench: couldn't start the workers.\n");
+  return ret;
+}
+
+static void bench_format_ns(char* out, size_t len, uint64_t ns) {
+  if (ns < 1000)
+    snprintf(out, len, "%lluns", (unsigned long long)ns);
+  else if (ns < 1000000)
+    snprintf(out, len, "%.1fus", ns / 1e3);
+  else if (ns < 1000000000)
+    snprintf(out, len, "%.2fms", ns / 1e6);
+  else
+    snprintf(out, len, "%.2fs", ns / 1e9);
+}
+
+static void bench_print_header(void) {
+  printf("%-24s %10s %8s %12s %10s %10s %10s %10s %10s %10s\n",
+         "scenario", "requests", "errors", "req/s", "MB/s", "p50", "p90", "p99", "p99.9", "max");
+}
+
+static void bench_print(const char* name, const bench_result* result) {
+  static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+  char cells[5][32];
+  for (int i = 0; i < 4; ++i)
+    bench_format_ns(cells[i], sizeof(cells[i]), histogram_percentile(&result->latency, percentiles[i]));
+  bench_format_ns(cells[4], sizeof(cells[4]), result->latency.count ? result->latency.max : 0);
+  double seconds = result->seconds > 0 ? result->seconds : 1;
+  printf("%-24s %10llu %8llu %12.1f %10.2f %10s %10s %10s %10s %10s\n", name,
+         (unsigned long long)result->completed, (unsigned long long)result->errors,
+         result->completed / seconds, result->bytes / seconds / (1024.0 * 1024.0),
+         cells[0], cells[1], cells[2], cells[3], cells[4]);
+  fflush(stdout);
+}
+
+/* where the server spent its time over the whole suite, from its own instrumentation */
+static void bench_print_stats(http_server* server) {
+  http_stats stats;
+  if (http_server_stats(server, &stats) == HTTP_FAILURE)
+    return;
+  const http_counters* counters = &stats.counters;
+  double requests = counters->requests ? (double)counters->requests : 1;
+  printf("\n%-24s %10s %10s %10s %10s %10s\n", "server stage", "count", "p50", "p99", "p99.9", "max");
+  for (int stage = 0; stage < HTTP_STAGE_NONE; ++stage) {
+    const struct histogram* h = &stats.stages[stage];
+    char cells[4][32];
+    bench_format_ns(cells[0], sizeof(cells[0]), histogram_percentile(h, 50.0));
+    bench_format_ns(cells[1], sizeof(cells[1]), histogram_percentile(h, 99.0));
+    bench_format_ns(cells[2], sizeof(cells[2]), histogram_percentile(h, 99.9));
+    bench_format_ns(cells[3], sizeof(cells[3]), h->count ? h->max : 0);
+    printf("%-24s %10llu %10s %10s %10s %10s\n", http_stage_string(stage),
+           (unsigned long long)histogram_count(h), cells[0], cells[1], cells[2], cells[3]);
+  }
+  printf("requests %llu, parse failures %llu, connections %llu, syscalls/request %.2f, bytes in/out %llu/%llu\n",
+         (unsigned long long)counters->requests, (unsigned long long)counters->parse_failures,
+         (unsigned long long)counters->connections_accepted,
+         (counters->recv_calls + counters->send_calls + counters->accept_calls) / requests,
+         (unsigned long long)counters->bytes_in, (unsigned long long)counters->bytes_out);
+  printf("memory");
+  for (int category = 0; category < MEMORY_CATEGORIES; ++category)
+    printf("%s %s %.1fMB", category ? "," : "", http_memory_category_string(category),
+           http_memory_used(category) / (1024.0 * 1024.0));
+  printf(", receive buffer regions %zu\n", server->conns.pool.regions);
+}
+
+static int bench_parse_mix(const char* arg, int* mix) {
+  memset(mix, 0, sizeof(int) * MIX_LEN);
+  while (*arg) {
+    size_t len = strcspn(arg, ",=");
+    int kind = 0;
+    while (kind < MIX_LEN && !(strlen(mix_names[kind]) == len && strncmp(arg, mix_names[kind], len) == 0))
+      ++kind;
+    if (kind == MIX_LEN)
+      return HTTP_FAILURE;
+    arg += len;
+    mix[kind] = 1;
+    if (*arg == '=') {
+      char* end;
+      long weight = strtol(arg + 1, &end, 10);
+      if (end == arg + 1 || weight < 0 || weight > 1000)
+        return HTTP_FAILURE;
+      mix[kind] = (int)weight;
+      arg = end;
+    }
+    if (*arg == ',')
+      ++arg;
+    else if (*arg)
+      return HTTP_FAILURE;
+  }
+  return mix[MIX_GET] + mix[MIX_POST] + mix[MIX_FILE] > 0 ? HTTP_SUCCESS : HTTP_FAILURE;
+}
+
+/* the suite servers' socket and memory tuning, as a list like cork=0,sndbuf=262144 over their defaults */
+static int bench_parse_tune(const char* arg, http_constraints* constraints) {
+  static const char* names[] = { "nodelay", "cork", "sndbuf", "rcvbuf", "busy_poll", "huge" };
+  int* fields[] = { &constraints->tcp_nodelay, &constraints->tcp_cork, &constraints->send_buffer,
+                    &constraints->recv_buffer, &constraints->busy_poll, &constraints->huge_pages };
+  size_t len = sizeof(names) / sizeof(names[0]);
+  while (*arg) {
+    size_t name_len = strcspn(arg, "=");
+    size_t i = 0;
+    while (i < len && !(strlen(names[i]) == name_len && strncmp(arg, names[i], name_len) == 0))
+      ++i;
+    if (i == len || arg[name_len] != '=')
+      return HTTP_FAILURE;
+    char* end;
+    long value = strtol(arg + name_len + 1, &end, 10);
+    if (end == arg + name_len + 1 || value < 0 || value > INT_MAX)
+      return HTTP_FAILURE;
+    *fields[i] = (int)value;
+    arg = end;
+    if (*arg == ',')
+      ++arg;
+    else if (*arg)
+      return HTTP_FAILURE;
+  }
+  return HTTP_SUCCESS;
+}
+
+/* the in-process server used by the suite: the routes match what the request mixes ask for */
+static void bench_suite_handler(http_request* req, http_response* res) {
+  if (strcmp(req->uri, "/") == 0) {
+    http_response_set_status(res, HTTP_STATUS_200);
+    http_response_set_body(res, (const unsigned char*)"Hello from Kudos.", 17);
+  }
+  else if (strcmp(req->uri, "/upload") == 0 && req->method == METHOD_POST) {
+    http_response_set_status(res, HTTP_STATUS_200);
+    http_response_set_body(res, (const unsigned char*)"ok", 2);
+  }
+  else if (strcmp(req->uri, "/file") == 0 && http_response_set_body_file(res, BENCH_FILE_NAME) == HTTP_SUCCESS)
+    http_response_set_status(res, HTTP_STATUS_200);
+  else
+    http_response_set_status(res, HTTP_STATUS_404);
+}
+
+/* the same routes, with '/' marked fresh for a second so the caching server answers it from memory */
+static void bench_cached_handler(http_request* req, http_response* res) {
+  bench_suite_handler(req, res);
+  if (strcmp(req->uri, "/") == 0)
+    http_response_set_header(res, "Cache-Control", "max-age=1");
+}
+
+/* the fan-out server answers each request with BENCH_FANOUT calls to the suite server, made through a
+   client pool that shares its event loop */
+static struct {
+  http_server* server;
+  http_client_pool* pool;
+  const char* ip;
+  const char* port;
+} bench_fanout;
+
+struct bench_fanout_call {
+  size_t ticket;
+  int remaining;
+  int failed;
+};
+
+static void bench_fanout_done(http_response* res, void* userdata) {
+  struct bench_fanout_call* call = userdata;
+  if (!res || http_response_status_code(res->status) != 200)
+    call->failed = 1;
+  if (--call->remaining > 0)
+    return;
+  http_response* out = http_server_deferred(bench_fanout.server, call->ticket);
+  if (call->failed)
+    http_response_set_status(out, HTTP_STATUS_502);
+  else {
+    http_response_set_status(out, HTTP_STATUS_200);
+    http_response_set_body(out, (const unsigned char*)"fanned out", 10);
+  }
+  http_server_resume(bench_fanout.server, call->ticket);
+  free(call);
+}
+
+static void bench_fanout_handler(http_request* req, http_response* res) {
+  struct bench_fanout_call* call = malloc(sizeof(struct bench_fanout_call));
+  if (!call) {
+    http_response_set_status(res, HTTP_STATUS_500);
+    return;
+  }
+  call->ticket    = http_server_defer(bench_fanout.server, req);
+  call->remaining = BENCH_FANOUT;
+  call->failed    = 0;
+  for (int i = 0; i < BENCH_FANOUT; ++i) {
+    if (http_client_pool_request(bench_fanout.pool, bench_fanout.ip, bench_fanout.port, METHOD_GET, "/",
+                                 NULL, 0, bench_fanout_done, call) == HTTP_FAILURE)
+      bench_fanout_done(NULL, call);
+  }
+}
+
+static BENCH_THREAD_RETURN bench_suite_server(void* arg) {
+  http_server_listen((http_server*)arg);
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static int bench_suite_file(void) {
+  FILE* file = fopen(BENCH_FILE_NAME, "wb");
+  if (!file)
+    return HTTP_FAILURE;
+  char block[4096];
+  for (size_t i = 0; i < sizeof(block); ++i)
+    block[i] = (char)('a' + i % 26);
+  for (size_t written = 0; written < BENCH_FILE_LEN; written += sizeof(block))
+    fwrite(block, 1, sizeof(block), file);
+  return fclose(file) ? HTTP_FAILURE : HTTP_SUCCESS;
+}
+
+/* the fixed set of scenarios every change is measured against, the server runs on a thread of its own */
+static int bench_suite(const bench_options* base) {
+  static const struct {
+    const char* name;
+    const char* mix;
+    int connections;
+    int keep_alive;
+    int depth;
+    int front;
+    int unix_socket;
+  } scenarios[] = {
+    { "get-c1",             "get",                 1, 1,  1, 0, 0 },
+    { "get-c64",            "get",                64, 1,  1, 0, 0 },
+    { "get-c64-pipeline16", "get",                64, 1, 16, 0, 0 },
+    { "get-c64-close",      "get",                64, 0,  1, 0, 0 },
+    { "post1m-c8",          "post",                8, 1,  1, 0, 0 },
+    { "file256k-c8",        "file",                8, 1,  1, 0, 0 },
+    { "mixed-c32",          "get=8,post=1,file=1", 32, 1,  1, 0, 0 },
+    { "get-c1-unix",        "get",                 1, 1,  1, 0, 1 },
+    { "get-c64-unix",       "get",                64, 1,  1, 0, 1 },
+    { "get-c64-close-unix", "get",                64, 0,  1, 0, 1 },
+    { "file256k-c8-unix",   "file",                8, 1,  1, 0, 1 },
+    { "proxy-get-c64",      "get",                64, 1,  1, 1, 0 },
+    { "proxy-mixed-c32",    "get=8,post=1,file=1", 32, 1,  1, 1, 0 },
+    { "fanout2-get-c32",    "get",                32, 1,  1, 2, 0 },
+    { "cached-get-c64",     "get",                64, 1,  1, 3, 0 },
+  };
+
+  if (bench_suite_file() == HTTP_FAILURE) {
+    fprintf(stderr, "kudos-bench: couldn't write %s.\n", BENCH_FILE_NAME);
+    return HTTP_FAILURE;
+  }
+  http_constraints constraints = http_constraints_make_default();
+  constraints.listen_backlog = 1024;
+  if (base->tune)
+    bench_parse_tune(base->tune, &constraints);
+  http_server* server = http_server_new(base->ip, base->port, bench_suite_handler, &constraints);
+  /* the first server is also reachable over a Unix socket, where there are any, to compare with loopback TCP */
+  char unix_path[32];
+  snprintf(unix_path, sizeof(unix_path), "@kudos-bench-%s", base->port);
+  int unix_socket = server && http_server_add_unix(server, unix_path) == HTTP_SUCCESS;
+  struct access_log* log = NULL;
+  if (server && base->access_log) {
+    FILE* file = fopen(base->access_log, "w");
+    log = file ? access_log_open(file, ACCESS_LOG_COMMON, 1 << 16) : NULL;
+    if (!log || http_server_set_access_log(server, log) == HTTP_FAILURE) {
+      fprintf(stderr, "kudos-bench: couldn't open the access log %s.\n", base->access_log);
+      remove(BENCH_FILE_NAME);
+      return HTTP_FAILURE;
+    }
+  }
+  /* the other scenarios go through servers on the next ports: a proxy and a handler fanning out, both
+     in front of the first one, then one answering from a response cache */
+  char ports[4][8];
+  for (int p = 0; p < 4; ++p)
+    snprintf(ports[p], sizeof(ports[p]), "%d", atoi(base->port) + p);
+  http_server* proxy_server = http_server_new(base->ip, ports[1], bench_suite_handler, &constraints);
+  http_proxy* proxy = http_proxy_new(&constraints);
+  bench_fanout.server = http_server_new(base->ip, ports[2], bench_fanout_handler, &constraints);
+  bench_fanout.pool   = http_client_pool_new(&constraints);
+  bench_fanout.ip     = base->ip;
+  bench_fanout.port   = base->port;
+  http_server* cached_server = http_server_new(base->ip, ports[3], bench_cached_handler, &constraints);
+  http_cache* cache = http_cache_new(1 << 24, 0);
+  if (!proxy_server || !proxy || http_proxy_add_upstream(proxy, base->ip, base->port) == HTTP_FAILURE ||
+      http_server_set_proxy(proxy_server, proxy) == HTTP_FAILURE || !bench_fanout.server || !bench_fanout.pool ||
+      http_client_pool_set_limits(bench_fanout.pool, 64, 1) == HTTP_FAILURE ||
+      http_server_add_poller(bench_fanout.server, http_client_pool_poller(bench_fanout.pool)) == HTTP_FAILURE ||
+      !cached_server || !cache || http_server_set_cache(cached_server, cache) == HTTP_FAILURE) {
+    fprintf(stderr, "kudos-bench: couldn't set up the front servers.\n");
+    remove(BENCH_FILE_NAME);
+    return HTTP_FAILURE;
+  }
+  http_server* servers[4] = { server, proxy_server, bench_fanout.server, cached_server };
+  for (int p = 0; p < 4; ++p) {
+    bench_thread thread;
+    if (!servers[p] || bench_thread_start(&thread, bench_suite_server, servers[p]) == HTTP_FAILURE) {
+      fprintf(stderr, "kudos-bench: couldn't start the server.\n");
+      remove(BENCH_FILE_NAME);
+      return HTTP_FAILURE;
+    }
+  }
+
+  /* the listeners come up asynchronously */
+  http_client* probe = http_client_new(NULL);
+  for (int p = 0; p < 4; ++p) {
+    int ready = 0;
+    for (int i = 0; probe && i < 200 && !ready; ++i) {
+      ready = http_client_connect(probe, base->ip, ports[p]) == HTTP_SUCCESS;
+      if (ready)
+        http_client_close(probe);
+      else
+        bench_sleep_ms(10);
+    }
+    if (!ready) {
+      fprintf(stderr, "kudos-bench: the server never came up on %s:%s.\n", base->ip, ports[p]);
+      remove(BENCH_FILE_NAME);
+      return HTTP_FAILURE;
+    }
+  }
+  for (int i = 0; probe && unix_socket && i < 200; ++i) {
+    if (http_client_connect_unix(probe, unix_path) == HTTP_SUCCESS) {
+      http_client_close(probe);
+      break;
+    }
+    bench_sleep_ms(10);
+  }
+  http_client_free(probe);
+
+  int ret = HTTP_SUCCESS;
+  bench_print_header();
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i) {
+    if (scenarios[i].unix_socket && !unix_socket)
+      continue;
+    bench_options options = *base;
+    options.connections = scenarios[i].connections;
+    options.keep_alive  = scenarios[i].keep_alive;
+    options.depth       = scenarios[i].depth;
+    options.threads     = 1;
+    options.port        = ports[scenarios[i].front];
+    options.unix_path   = scenarios[i].unix_socket ? unix_path : NULL;
+    bench_parse_mix(scenarios[i].mix, options.mix);
+    bench_result result;
+    if (bench_run(&options, &result) == HTTP_FAILURE) {
+      ret = HTTP_FAILURE;
+      break;
+    }
+    bench_print(scenarios[i].name, &result);
+    if (result.errors)
+      ret = HTTP_FAILURE;
+  }
+  bench_print_stats(server);
+  if (log) {
+    /* give the log thread a moment to write out the tail */
+    bench_sleep_ms(50);
+    printf("access log records dropped: %llu\n", (unsigned long long)access_log_dropped(log));
+  }
+  remove(BENCH_FILE_NAME);
+  /* the server thread has no way to stop, it goes down with the process */
+  return ret;
+}
+
+/* the event loop's own cost: a group of 'len' idle connections, one in eight waiting to write, and how long
+   filling the fd_sets for select() takes. nothing's on the sockets, the numbers are the scan alone */
+static int bench_scan(size_t len) {
+  http_constraints constraints = http_constraints_make_default();
+  struct conn_group conns = conn_group_make(&constraints);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  for (size_t i = 0; i < len; ++i) {
+    struct conn_info* conn = conn_group_add(&conns, (SOCKET)(i % FD_SETSIZE), &addr);
+    if (!conn) {
+      fprintf(stderr, "kudos-bench: couldn't add connection %zu.\n", i);
+      conn_group_free(&conns);
+      return HTTP_FAILURE;
+    }
+    if (i % 8 == 7) {
+      conn->request.state = STATE_GOT_ALL;
+      conn_info_mark(conn, CONN_RESPONDING, 1);
+    }
+  }
+  fd_set read, write;
+  int max_socket = 0;
+  size_t rounds = 0;
+  uint64_t start = http_clock_ns(), elapsed;
+  do {
+    for (int i = 0; i < 64; ++i) {
+      FD_ZERO(&read);
+      FD_ZERO(&write);
+      conn_group_fill(&conns, &read, &write, &max_socket);
+    }
+    rounds += 64;
+    elapsed = http_clock_ns() - start;
+  } while (elapsed < 1000000000ull);
+  double per_round = (double)elapsed / rounds;
+  printf("scan of %zu connections: %.1f us per iteration, %.2f ns per connection\n",
+         len, per_round / 1000, per_round / len);
+  conn_group_free(&conns);
+  return HTTP_SUCCESS;
+}
+
+static void bench_usage(const char* name) {
+  printf("usage: %s [options]\n"
+         "  -h, --host IP          server address (default 127.0.0.1)\n"
+         "  -p, --port PORT        server port (default 8080)\n"
+         "  -u, --unix PATH        connect to a Unix socket instead, '@name' for an abstract one\n"
+         "  -c, --connections N    concurrent connections (default 32)\n"
+         "  -t, --threads N        client threads (default 1)\n"
+         "  -d, --duration SEC     run for SEC seconds (default 5, 2 per suite scenario)\n"
+         "  -n, --requests N       stop after N requests instead\n"
+         "  -P, --pipeline N       requests in flight per connection (default 1, max %d)\n"
+         "  -m, --mix MIX          weighted mix of get, post and file, e.g. get=8,post=1,file=1\n"
+         "      --no-keepalive     one request per connection\n"
+         "      --suite            run the scripted suite against an in-process server\n"
+         "      --access-log PATH  with --suite, have the server write an access log to PATH\n"
+         "      --scan N           time the event loop's scan of N idle connections, nothing is sent\n"
+         "      --tune LIST        with --suite, the servers' socket tuning, any of nodelay, cork, sndbuf,\n"
+         "                         rcvbuf and busy_poll, and huge for the buffer pools' pages, e.g.\n"
+         "                         cork=0,sndbuf=262144,huge=1\n"
+         "routes: get -> GET /, post -> POST /upload (1MB), file -> GET /file\n",
+         name, HTTP_CLIENT_PIPELINE);
+}
+
+int main(int argc, char** argv) {
+  bench_options options = {
+    .ip          = "127.0.0.1",
+    .port        = "8080",
+    .unix_path   = NULL,
+    .connections = 32,
+    .threads     = 1,
+    .keep_alive  = 1,
+    .depth       = 1,
+    .mix         = { 1, 0, 0 },
+    .duration    = 0,
+    .requests    = 0,
+    .access_log  = NULL,
+    .tune        = NULL
+  };
+  int suite = 0;
+  size_t scan = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+    int valued = 1;
+    if (strcmp(arg, "--suite") == 0)
+      suite = 1, valued = 0;
+    else if (strcmp(arg, "--no-keepalive") == 0)
+      options.keep_alive = 0, valued = 0;
+    else if (strcmp(arg, "--help") == 0) {
+      bench_usage(argv[0]);
+      return 0;
+    }
+    else if (!value)
+      valued = -1;
+    else if (strcmp(arg, "--access-log") == 0)
+      options.access_log = value;
+    else if (strcmp(arg, "--scan") == 0)
+      scan = strtoull(value, NULL, 10);
+    else if (strcmp(arg, "--tune") == 0) {
+      http_constraints check = http_constraints_make_default();
+      options.tune = value;
+      if (bench_parse_tune(value, &check) == HTTP_FAILURE)
+        valued = -1;
+    }
+    else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--host") == 0)
+      options.ip = value;
+    else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--port") == 0)
+      options.port = value;
+    else if (strcmp(arg, "-u") == 0 || strcmp(arg, "--unix") == 0)
+      options.unix_path = value;
+    else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--connections") == 0)
+      options.connections = atoi(value);
+    else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0)
+      options.threads = atoi(value);
+    else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0)
+      options.duration = atof(value);
+    else if (strcmp(arg, "-n") == 0 || strcmp(arg, "--requests") == 0)
+      options.requests = strtoull(value, NULL, 10);
+    else if (strcmp(arg, "-P") == 0 || strcmp(arg, "--pipeline") == 0)
+      options.depth = atoi(value);
+    else if (strcmp(arg, "-m") == 0 || strcmp(arg, "--mix") == 0) {
+      if (bench_parse_mix(value, options.mix) == HTTP_FAILURE)
+        valued = -1;
+    }
+    else
+      valued = -1;
+    if (valued < 0) {
+      bench_usage(argv[0]);
+      return 1;
+    }
+    i += valued;
+  }
+  if (options.duration <= 0 && options.requests == 0)
+    options.duration = suite ? 2 : 5;
+  if (options.threads < 1 || options.connections < options.threads ||
+      options.connections > BENCH_MAX_CONNECTIONS || options.depth < 1 || options.depth > HTTP_CLIENT_PIPELINE) {
+    bench_usage(argv[0]);
+    return 1;
+  }
+
+  if (http_init() == HTTP_FAILURE)
+    return 1;
+  int ret;
+  if (scan)
+    ret = bench_scan(scan);
+  else if (suite)
+    ret = bench_suite(&options);
+  else {
+    bench_result result;
+    ret = bench_run(&options, &result);
+    if (ret == HTTP_SUCCESS) {
+      bench_print_header();
+      bench_print("custom", &result);
+    }
+  }
+  http_quit();
+  return ret == HTTP_SUCCESS ? 0 : 1;
+}
@@ -1 +1,2 @@
-gcc -o http.exe src/client_info.c src/headers.c src/http.c src/main.c src/request_info.c src/request_parser.c src/response_info.c -lws2_32 
\ No newline at end of file
+gcc -O2 -o kudos.exe src/access_log.c src/buffer_pool.c src/conn_info.c src/h2.c src/handoff.c src/histogram.c src/hpack.c src/http_cache.c src/http_client.c src/http_client_pool.c src/http_headers.c src/http_memory.c src/http_metrics.c src/http_proxy.c src/http_request.c src/http_response.c src/http_server.c src/http_stats.c src/http_uri.c src/includes.c src/listener.c src/parser.c src/prefork.c src/rate_limit.c src/sse.c src/timer_heap.c src/tls.c src/websocket.c src/main.c -lws2_32
+gcc -O2 -Isrc -o kudos-bench.exe bench/kudos_bench.c src/access_log.c src/buffer_pool.c src/conn_info.c src/h2.c src/handoff.c src/histogram.c src/hpack.c src/http_cache.c src/http_client.c src/http_client_pool.c src/http_headers.c src/http_memory.c src/http_metrics.c src/http_proxy.c src/http_request.c src/http_response.c src/http_server.c src/http_stats.c src/http_uri.c src/includes.c src/listener.c src/parser.c src/prefork.c src/rate_limit.c src/sse.c src/timer_heap.c src/tls.c src/websocket.c -lws2_32
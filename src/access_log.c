@@ -0,0 +1,265 @@
+#include "access_log.h"
+#include "http_request.h"
+
+static uint64_t access_log_wall_ns(void) {
+#ifdef _WIN32
+  FILETIME ft;
+  GetSystemTimeAsFileTime(&ft);
+  uint64_t t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+  return (t - 116444736000000000ull) * 100;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void access_log_sleep(void) {
+#ifdef _WIN32
+  Sleep(5);
+#else
+  struct timespec ts = { 0, 5 * 1000 * 1000 };
+  nanosleep(&ts, NULL);
+#endif
+}
+
+static void access_log_write(struct access_log* log) {
+  if (log->batch_len == 0)
+    return;
+  fwrite(log->batch, 1, log->batch_len, log->file);
+  log->batch_len = 0;
+}
+
+/* copies the uri, escaping what would break out of a quoted string */
+static size_t access_log_uri(char* out, const struct access_record* record, int json) {
+  size_t n = 0;
+  for (size_t i = 0; i < record->uri_len; ++i) {
+    unsigned char c = (unsigned char)record->uri[i];
+    if (c == '"' || c == '\\' || c < 0x20 || c == 0x7f) {
+      if (json)
+        n += sprintf(out + n, "\\u%04x", c);
+      else
+        n += sprintf(out + n, "\\x%02x", c);
+    }
+    else
+      out[n++] = (char)c;
+  }
+  out[n] = 0;
+  return n;
+}
+
+static void access_log_format(struct access_log* log, const struct access_record* record) {
+  static const char* months[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  char uri[ACCESS_LOG_URI_LEN * 6 + 1];
+  char addr[16];
+  struct tm tm;
+  time_t seconds = (time_t)(record->time / 1000000000ull);
+#ifdef _WIN32
+  gmtime_s(&tm, &seconds);
+#else
+  gmtime_r(&seconds, &tm);
+#endif
+  uint32_t ip = ntohl(record->addr);
+  snprintf(addr, sizeof(addr), "%u.%u.%u.%u", ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff);
+  const char* method = http_request_method_string(record->method);
+  const char* version = record->version == HTTP_VERSION_2 ? "HTTP/2.0" :
+                        record->version == HTTP_VERSION_1_1 ? "HTTP/1.1" : "HTTP/1.0";
+  access_log_uri(uri, record, log->format == ACCESS_LOG_JSON);
+
+  char* out = log->batch + log->batch_len;
+  size_t room = ACCESS_LOG_BATCH - log->batch_len;
+  int n;
+  if (log->format == ACCESS_LOG_JSON)
+    n = snprintf(out, room,
+                 "{\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03uZ\",\"remote\":\"%s\",\"method\":\"%s\","
+                 "\"uri\":\"%s\",\"version\":\"%s\",\"status\":%u,\"bytes\":%llu,\"latency_us\":%llu}\n",
+                 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                 (unsigned)(record->time / 1000000 % 1000), addr, method ? method : "-", uri, version,
+                 record->status, (unsigned long long)record->bytes, (unsigned long long)(record->latency / 1000));
+  else
+    n = snprintf(out, room, "%s - - [%02d/%s/%04d:%02d:%02d:%02d +0000] \"%s %s %s\" %u %llu\n",
+                 addr, tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                 method ? method : "-", uri, version, record->status, (unsigned long long)record->bytes);
+  if (n > 0 && (size_t)n < room)
+    log->batch_len += n;
+}
+
+/* drains every ring into the batch buffer, returns how many records it took */
+static size_t access_log_drain(struct access_log* log) {
+  size_t taken = 0;
+  size_t reserved = atomic_load_explicit(&log->reserved, memory_order_acquire);
+  for (size_t i = 0; i < reserved && i < ACCESS_LOG_MAX_RINGS; ++i) {
+    struct access_ring* ring = atomic_load_explicit(&log->rings[i], memory_order_acquire);
+    if (!ring)
+      continue;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; ++tail, ++taken) {
+      /* a formatted line is bounded well below this, so there's always room after a flush */
+      if (ACCESS_LOG_BATCH - log->batch_len < ACCESS_LOG_URI_LEN * 6 + 512)
+        access_log_write(log);
+      access_log_format(log, &ring->records[tail & ring->mask]);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+  return taken;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI access_log_run(void* arg) {
+#else
+static void* access_log_run(void* arg) {
+#endif
+  struct access_log* log = arg;
+  while (atomic_load_explicit(&log->running, memory_order_acquire)) {
+    if (access_log_drain(log) == 0) {
+      access_log_write(log);
+      fflush(log->file);
+      access_log_sleep();
+    }
+  }
+  access_log_drain(log);
+  access_log_write(log);
+  fflush(log->file);
+  return 0;
+}
+
+/* starts the thread that formats and writes records, 'ring_len' is rounded up to a power of two */
+struct access_log* access_log_open(FILE* file, int format, size_t ring_len) {
+  if (!file || (format != ACCESS_LOG_COMMON && format != ACCESS_LOG_JSON) || ring_len == 0) {
+    HTTP_LOG(HTTP_LOGERR, "[access_log_open] invalid arguments.\n");
+    return NULL;
+  }
+  struct access_log* log = calloc(1, sizeof(struct access_log));
+  if (!log) {
+    HTTP_LOG(HTTP_LOGERR, "[access_log_open] calloc() failed.\n");
+    return NULL;
+  }
+  log->batch = malloc(ACCESS_LOG_BATCH);
+  if (!log->batch) {
+    free(log);
+    HTTP_LOG(HTTP_LOGERR, "[access_log_open] malloc() failed.\n");
+    return NULL;
+  }
+  size_t len = 1;
+  while (len < ring_len)
+    len <<= 1;
+  log->file     = file;
+  log->format   = format;
+  log->ring_len = len;
+  atomic_init(&log->running, 1);
+  atomic_init(&log->reserved, 0);
+  for (size_t i = 0; i < ACCESS_LOG_MAX_RINGS; ++i)
+    atomic_init(&log->rings[i], NULL);
+#ifdef _WIN32
+  log->thread = CreateThread(NULL, 0, access_log_run, log, 0, NULL);
+  int failed = log->thread == NULL;
+#else
+  int failed = pthread_create(&log->thread, NULL, access_log_run, log) != 0;
+#endif
+  if (failed) {
+    free(log->batch);
+    free(log);
+    HTTP_LOG(HTTP_LOGERR, "[access_log_open] couldn't start the log thread.\n");
+    return NULL;
+  }
+  return log;
+}
+
+/* every producer must be done pushing, what's still queued is written before this returns */
+int access_log_close(struct access_log* log) {
+  if (!log) {
+    HTTP_LOG(HTTP_LOGERR, "[access_log_close] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  atomic_store_explicit(&log->running, 0, memory_order_release);
+#ifdef _WIN32
+  WaitForSingleObject(log->thread, INFINITE);
+  CloseHandle(log->thread);
+#else
+  pthread_join(log->thread, NULL);
+#endif
+  for (size_t i = 0; i < ACCESS_LOG_MAX_RINGS; ++i) {
+    struct access_ring* ring = atomic_load(&log->rings[i]);
+    if (ring) {
+      free(ring->records);
+      free(ring);
+    }
+  }
+  free(log->batch);
+  free(log);
+  return HTTP_SUCCESS;
+}
+
+/* after fork() the child is left without the log thread, it starts its own over its copy of the log. the
+   file should be open for appending: every process then writes its batches at the end */
+int access_log_fork(struct access_log* log) {
+  if (!log) {
+    HTTP_LOG(HTTP_LOGERR, "[access_log_fork] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  /* a batch the parent was formatting is the parent's to write */
+  log->batch_len = 0;
+  atomic_store_explicit(&log->running, 1, memory_order_release);
+#ifdef _WIN32
+  log->thread = CreateThread(NULL, 0, access_log_run, log, 0, NULL);
+  int failed = log->thread == NULL;
+#else
+  int failed = pthread_create(&log->thread, NULL, access_log_run, log) != 0;
+#endif
+  if (failed) {
+    HTTP_LOG(HTTP_LOGERR, "[access_log_fork] couldn't start the log thread.\n");
+    return HTTP_FAILURE;
+  }
+  return HTTP_SUCCESS;
+}
+
+/* one ring per producing thread, rings live until the log is closed */
+struct access_ring* access_log_ring(struct access_log* log) {
+  if (!log) {
+    HTTP_LOG(HTTP_LOGERR, "[access_log_ring] passed NULL pointers for mandatory parameters.\n");
+    return NULL;
+  }
+  size_t index = atomic_fetch_add(&log->reserved, 1);
+  if (index >= ACCESS_LOG_MAX_RINGS) {
+    HTTP_LOG(HTTP_LOGERR, "[access_log_ring] too many rings.\n");
+    return NULL;
+  }
+  struct access_ring* ring = calloc(1, sizeof(struct access_ring));
+  if (!ring || !(ring->records = malloc(log->ring_len * sizeof(struct access_record)))) {
+    free(ring);
+    HTTP_LOG(HTTP_LOGERR, "[access_log_ring] failed to allocate memory.\n");
+    return NULL;
+  }
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->dropped, 0);
+  ring->mask = log->ring_len - 1;
+  atomic_store_explicit(&log->rings[index], ring, memory_order_release);
+  return ring;
+}
+
+/* never blocks: when the log thread has fallen behind the record is counted and dropped */
+int access_log_push(struct access_ring* ring, struct access_record* record) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail > ring->mask) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return HTTP_FAILURE;
+  }
+  record->time = access_log_wall_ns();
+  memcpy(&ring->records[head & ring->mask], record, sizeof(struct access_record));
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return HTTP_SUCCESS;
+}
+
+uint64_t access_log_dropped(struct access_log* log) {
+  uint64_t dropped = 0;
+  size_t reserved = atomic_load(&log->reserved);
+  for (size_t i = 0; i < reserved && i < ACCESS_LOG_MAX_RINGS; ++i) {
+    struct access_ring* ring = atomic_load(&log->rings[i]);
+    if (ring)
+      dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+  }
+  return dropped;
+}
@@ -0,0 +1,64 @@
+#ifndef ACCESS_LOG_H_
+#define ACCESS_LOG_H_
+#include "includes.h"
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#define ACCESS_LOG_URI_LEN 118
+#define ACCESS_LOG_MAX_RINGS 64
+#define ACCESS_LOG_BATCH (1024 * 64)
+
+enum {
+  ACCESS_LOG_COMMON,
+  ACCESS_LOG_JSON
+};
+
+/* fixed size so the event loop only ever copies it into a ring slot */
+struct access_record {
+  uint64_t time;
+  uint64_t latency;
+  uint64_t bytes;
+  ipv4_t   addr;
+  uint16_t status;
+  uint8_t  method;
+  uint8_t  version;
+  uint16_t uri_len;
+  char     uri[ACCESS_LOG_URI_LEN];
+};
+
+/* single producer (an event loop), single consumer (the log thread), each side's index on its own cache line */
+struct access_ring {
+  _Atomic size_t head;
+  _Atomic uint64_t dropped;
+  char pad0[64 - sizeof(size_t) - sizeof(uint64_t)];
+  _Atomic size_t tail;
+  char pad1[64 - sizeof(size_t)];
+  size_t mask;
+  struct access_record* records;
+};
+
+struct access_log {
+  FILE* file;
+  int format;
+  size_t ring_len;
+  _Atomic int running;
+  _Atomic size_t reserved;
+  _Atomic(struct access_ring*) rings[ACCESS_LOG_MAX_RINGS];
+  char* batch;
+  size_t batch_len;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+};
+
+struct access_log* access_log_open(FILE*, int, size_t);
+int access_log_close(struct access_log*);
+int access_log_fork(struct access_log*);
+struct access_ring* access_log_ring(struct access_log*);
+int access_log_push(struct access_ring*, struct access_record*);
+uint64_t access_log_dropped(struct access_log*);
+
+#endif
@@ -0,0 +1,137 @@
+#include "buffer_pool.h"
+#define BUFFER_POOL_ALIGN 64
+#define BUFFER_POOL_ROUND(n) (((n) + BUFFER_POOL_ALIGN - 1) & ~(size_t)(BUFFER_POOL_ALIGN - 1))
+#define BUFFER_POOL_FIRST BUFFER_POOL_ROUND(sizeof(struct buffer_region))
+
+/* 'huge' is one of HUGE_PAGES_*, 'category' the MEMORY_* the regions are accounted to */
+struct buffer_pool buffer_pool_make(size_t buff_len, size_t max_free, int huge, int category) {
+  struct buffer_pool pool = { 0 };
+  /* one extra byte so the parser can always terminate what it received, and a cache line per buffer
+     boundary so two connections never share one */
+  pool.buff_len   = buff_len;
+  pool.stride     = BUFFER_POOL_ROUND(buff_len + 1);
+  pool.per_region = (HTTP_MEMORY_REGION - BUFFER_POOL_FIRST) / pool.stride;
+  pool.max_free   = max_free;
+  pool.len        = 0;
+  pool.in_use     = 0;
+  pool.regions    = 0;
+  pool.huge       = huge;
+  pool.category   = category;
+  pool.partial    = NULL;
+  pool.full       = NULL;
+  return pool;
+}
+
+static struct buffer_region* buffer_pool_region(char* buffer) {
+  return (struct buffer_region*)((uintptr_t)buffer & ~(uintptr_t)(HTTP_MEMORY_REGION - 1));
+}
+
+static void buffer_pool_link(struct buffer_region** list, struct buffer_region* region) {
+  region->prev = NULL;
+  region->next = *list;
+  if (*list)
+    (*list)->prev = region;
+  *list = region;
+}
+
+static void buffer_pool_unlink(struct buffer_region** list, struct buffer_region* region) {
+  if (region->prev)
+    region->prev->next = region->next;
+  else
+    *list = region->next;
+  if (region->next)
+    region->next->prev = region->prev;
+  region->next = NULL;
+  region->prev = NULL;
+}
+
+static struct buffer_region* buffer_pool_grow(struct buffer_pool* pool) {
+  if (pool->per_region == 0) {
+    HTTP_LOG(HTTP_LOGERR, "[buffer_pool_get] buffers of %zu bytes don't fit a region.\n", pool->buff_len);
+    return NULL;
+  }
+  struct buffer_region* region = http_memory_map(HTTP_MEMORY_REGION, pool->huge);
+  if (!region)
+    return NULL;
+  region->free   = NULL;
+  region->carved = 0;
+  region->used   = 0;
+  buffer_pool_link(&pool->partial, region);
+  pool->len += pool->per_region;
+  ++pool->regions;
+  http_memory_add(pool->category, HTTP_MEMORY_REGION);
+  return region;
+}
+
+char* buffer_pool_get(struct buffer_pool* pool) {
+  if (!pool) {
+    HTTP_LOG(HTTP_LOGERR, "[buffer_pool_get] passed NULL pointers for mandatory parameters.\n");
+    return NULL;
+  }
+  struct buffer_region* region = pool->partial;
+  if (!region && !(region = buffer_pool_grow(pool)))
+    return NULL;
+  char* buffer;
+  if (region->free) {
+    buffer = region->free;
+    memcpy(&region->free, buffer, sizeof(char*));
+  }
+  else
+    buffer = (char*)region + BUFFER_POOL_FIRST + region->carved++ * pool->stride;
+  ++region->used;
+  if (!region->free && region->carved == pool->per_region) {
+    buffer_pool_unlink(&pool->partial, region);
+    buffer_pool_link(&pool->full, region);
+  }
+  --pool->len;
+  ++pool->in_use;
+  return buffer;
+}
+
+int buffer_pool_put(struct buffer_pool* pool, char* buffer) {
+  if (!pool || !buffer) {
+    HTTP_LOG(HTTP_LOGERR, "[buffer_pool_put] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct buffer_region* region = buffer_pool_region(buffer);
+  if (!region->free && region->carved == pool->per_region) {
+    buffer_pool_unlink(&pool->full, region);
+    buffer_pool_link(&pool->partial, region);
+  }
+  memcpy(buffer, &region->free, sizeof(char*));
+  region->free = buffer;
+  --region->used;
+  ++pool->len;
+  --pool->in_use;
+  if (region->used == 0 && pool->len - pool->per_region >= pool->max_free) {
+    buffer_pool_unlink(&pool->partial, region);
+    pool->len -= pool->per_region;
+    --pool->regions;
+    http_memory_unmap(region, HTTP_MEMORY_REGION);
+    http_memory_sub(pool->category, HTTP_MEMORY_REGION);
+  }
+  return HTTP_SUCCESS;
+}
+
+/* the buffers still out go with their regions */
+int buffer_pool_free(struct buffer_pool* pool) {
+  if (!pool) {
+    HTTP_LOG(HTTP_LOGERR, "[buffer_pool_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (pool->in_use) {
+    HTTP_LOG(HTTP_LOGERR, "[buffer_pool_free] %zu buffers are still in use.\n", pool->in_use);
+  }
+  struct buffer_region** lists[2] = { &pool->partial, &pool->full };
+  for (int i = 0; i < 2; ++i) {
+    while (*lists[i]) {
+      struct buffer_region* region = *lists[i];
+      buffer_pool_unlink(lists[i], region);
+      http_memory_unmap(region, HTTP_MEMORY_REGION);
+      http_memory_sub(pool->category, HTTP_MEMORY_REGION);
+      --pool->regions;
+    }
+  }
+  pool->len = 0;
+  return HTTP_SUCCESS;
+}
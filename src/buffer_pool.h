@@ -0,0 +1,37 @@
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+#include "includes.h"
+#include "http_memory.h"
+
+// internal use, the header at the start of every region, its buffers follow it
+struct buffer_region {
+  struct buffer_region* next;
+  struct buffer_region* prev;
+  char*  free;                                  /* returned buffers, each holds the next one's address */
+  size_t carved;                                /* buffers handed out at least once */
+  size_t used;
+};
+
+/* fixed size buffers carved from HTTP_MEMORY_REGION sized mappings, which keeps the ones in use on few
+   pages and, with huge pages, few TLB entries. a region that empties out is unmapped once the others
+   still have 'max_free' buffers to give */
+struct buffer_pool {
+  size_t buff_len;
+  size_t stride;
+  size_t per_region;
+  size_t max_free;
+  size_t len;                                   /* buffers the mapped regions have left */
+  size_t in_use;
+  size_t regions;
+  int    huge;
+  int    category;
+  struct buffer_region* partial;                /* the regions with a buffer left */
+  struct buffer_region* full;
+};
+
+struct buffer_pool buffer_pool_make(size_t, size_t, int, int);
+char* buffer_pool_get(struct buffer_pool*);
+int buffer_pool_put(struct buffer_pool*, char*);
+int buffer_pool_free(struct buffer_pool*);
+
+#endif
@@ -1,21 +1,125 @@
 #include "conn_info.h"
+#include "tls.h"
 
 struct conn_group conn_group_make(http_constraints* constraints) {
   struct conn_group conns = { 0 };
   conns.cap      = 0;
   conns.len      = 0;
+  conns.fds      = NULL;
+  conns.flags    = NULL;
   conns.data     = NULL;
   conns.constraints = constraints;
+  conns.pool     = buffer_pool_make(CONN_BUFF_LEN, CONN_POOL_MAX_FREE, constraints->huge_pages, MEMORY_CONNECTIONS);
   return conns;
 }
 
+static void conn_info_release_buffer(struct conn_info* conn) {
+  if (!conn->buffer)
+    return;
+  if (conn->pool && conn->buff_cap == conn->pool->buff_len)
+    buffer_pool_put(conn->pool, conn->buffer);
+  else {
+    http_memory_sub(MEMORY_CONNECTIONS, conn->buff_cap + 1);
+    free(conn->buffer);
+  }
+  conn->buffer   = NULL;
+  conn->buff_cap = 0;
+}
+
+int conn_info_reserve(struct conn_info* conn, http_constraints* constraints) {
+  if (!conn || !constraints) {
+    HTTP_LOG(HTTP_LOGERR, "[conn_info_reserve] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (!conn->buffer) {
+    conn->buffer = conn->pool ? buffer_pool_get(conn->pool) : malloc(CONN_BUFF_LEN + 1);
+    if (!conn->buffer) {
+      HTTP_LOG(HTTP_LOGERR, "[conn_info_reserve] failed to allocate memory.\n");
+      return HTTP_FAILURE;
+    }
+    conn->buff_cap = conn->pool ? conn->pool->buff_len : CONN_BUFF_LEN;
+    conn->buff_len = 0;
+    if (!conn->pool)
+      http_memory_add(MEMORY_CONNECTIONS, CONN_BUFF_LEN + 1);
+    return HTTP_SUCCESS;
+  }
+  if (conn->buff_len < conn->buff_cap)
+    return HTTP_SUCCESS;
+
+  /* the whole head of a request has to fit, so that's what bounds the growth */
+  size_t max = MAX(HTTP_REQUEST_MAX_HEADER_LEN(constraints), CONN_BUFF_LEN);
+  if (conn->buff_cap >= max)
+    return HTTP_FAILURE;
+  size_t new_cap = MIN(conn->buff_cap * 2, max);
+  char* new_buffer = malloc(new_cap + 1);
+  if (!new_buffer) {
+    HTTP_LOG(HTTP_LOGERR, "[conn_info_reserve] failed to allocate memory.\n");
+    return HTTP_FAILURE;
+  }
+  http_memory_add(MEMORY_CONNECTIONS, new_cap + 1);
+  size_t len = conn->buff_len;
+  memcpy(new_buffer, conn->buffer, len);
+  conn_info_release_buffer(conn);
+  conn->buffer   = new_buffer;
+  conn->buff_cap = new_cap;
+  conn->buff_len = len;
+  return HTTP_SUCCESS;
+}
+
+/* the connection's bytes, decrypted when it speaks TLS. both answer as recv() and send() do */
+int conn_info_recv(struct conn_info* conn, char* buffer, size_t len) {
+  if (conn->tls)
+    return tls_recv(conn, buffer, len);
+  return recv(conn->sockfd, buffer, (int)len, 0);
+}
+
+int conn_info_send(struct conn_info* conn, const char* data, size_t len) {
+  if (conn->tls)
+    return tls_send(conn, data, len);
+  return send(conn->sockfd, data, (int)len, SEND_FLAGS);
+}
+
+/* as conn_info_send(), with more to follow at once: the kernel holds a short write back to fill the segment
+   with the next one. TLS records go out as they are */
+int conn_info_send_more(struct conn_info* conn, const char* data, size_t len) {
+  if (conn->tls)
+    return tls_send(conn, data, len);
+  return send(conn->sockfd, data, (int)len, SEND_FLAGS | SEND_MORE);
+}
+
+int conn_info_shrink(struct conn_info* conn) {
+  if (!conn) {
+    HTTP_LOG(HTTP_LOGERR, "[conn_info_shrink] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  /* idle connections hold no buffer at all, the next read takes one from the pool */
+  if (conn->buff_len == 0) {
+    conn_info_release_buffer(conn);
+    return HTTP_SUCCESS;
+  }
+  if (!conn->pool || conn->buff_cap <= conn->pool->buff_len || conn->buff_len > conn->pool->buff_len)
+    return HTTP_SUCCESS;
+  char* small = buffer_pool_get(conn->pool);
+  if (!small)
+    return HTTP_SUCCESS;
+  size_t len = conn->buff_len;
+  memcpy(small, conn->buffer, len);
+  conn_info_release_buffer(conn);
+  conn->buffer   = small;
+  conn->buff_cap = conn->pool->buff_len;
+  conn->buff_len = len;
+  return HTTP_SUCCESS;
+}
+
 struct conn_info* conn_info_new(http_constraints* constraints) {
   struct conn_info* conn = malloc(sizeof(struct conn_info));
   if (!conn) {
     HTTP_LOG(HTTP_LOGERR, "[conn_info_new] malloc() failed.\n");
     return NULL;
   }
-  memset(conn, 0, sizeof(conn));
+  memset(conn, 0, sizeof(*conn));
+  conn->flags = &conn->own_flags;
+  http_memory_add(MEMORY_CONNECTIONS, sizeof(struct conn_info));
   conn_info_reset(conn, constraints);
   return conn;
 }
@@ -28,7 +132,14 @@ int conn_info_reset(struct conn_info* conn, http_constraints* constraints) {
 
   conn->sockfd = INVALID_SOCKET;
   conn->buff_len = 0;
-  conn->used = 0;
+  *conn->flags = 0;
+  conn->close = 0;
+  conn->cached = NULL;
+  conn->cache_owner = 0;
+  conn->ws = NULL;
+  conn->sse = NULL;
+  conn->h2 = NULL;
+  conn->tls = NULL;
   if (conn->request.headers) {
     http_request_reset(&conn->request, conn->sockfd, &conn->addr);
   }
@@ -61,12 +172,14 @@ struct conn_info* conn_group_add(struct conn_group* conns, SOCKET sockfd, struct
   if (len < cap) {
     struct conn_info* data = conns->data;
     for (size_t i = 0; i < cap; ++i) {
-      if (data[i].used == 0) {
+      if (!(conns->flags[i] & CONN_USED)) {
         struct conn_info* conn = &data[i];
         conn_info_reset(conn, conns->constraints);
+        conn->pool = &conns->pool;
         conn->addr = *addr;
         conn->sockfd = sockfd;
-        conn->used = 1;
+        conns->fds[i]   = sockfd;
+        conns->flags[i] = CONN_USED;
         ++conns->len;
         return conn;
       }
@@ -75,27 +188,38 @@ struct conn_info* conn_group_add(struct conn_group* conns, SOCKET sockfd, struct
 
   else {
     size_t new_cap = cap == 0 ? 8 : cap * 2;
-    struct conn_info* new_data = calloc(new_cap, sizeof(struct conn_info));
+    struct conn_info* new_data = realloc(conns->data, new_cap * sizeof(struct conn_info));
     if (new_data == NULL) {
       HTTP_LOG(HTTP_LOGERR, "[add_conn] realloc() failed.\n");
       return NULL;
     }
-    struct conn_info* old_data = conns->data;
-    size_t counter = 0;
-    for (size_t i = 0; i < cap; ++i) {
-      if (old_data[i].used == 1) {
-        new_data[counter++] = old_data[i];
-      }
-    }
-    free(old_data);
-    
     conns->data = new_data;
+    SOCKET* new_fds = realloc(conns->fds, new_cap * sizeof(SOCKET));
+    if (new_fds == NULL) {
+      HTTP_LOG(HTTP_LOGERR, "[add_conn] realloc() failed.\n");
+      return NULL;
+    }
+    conns->fds = new_fds;
+    uint8_t* new_flags = realloc(conns->flags, new_cap);
+    if (new_flags == NULL) {
+      HTTP_LOG(HTTP_LOGERR, "[add_conn] realloc() failed.\n");
+      return NULL;
+    }
+    conns->flags = new_flags;
+    /* connections keep their index when the group grows, so others can refer to them by it */
+    memset(new_data + cap, 0, (new_cap - cap) * sizeof(struct conn_info));
+    memset(new_flags + cap, 0, new_cap - cap);
+    for (size_t i = 0; i < new_cap; ++i)
+      new_data[i].flags = &new_flags[i];
+    http_memory_add(MEMORY_CONNECTIONS, (new_cap - cap) * CONN_SLOT_LEN);
     conns->cap  = new_cap;
-    struct conn_info* conn = &conns->data[counter++];
+    struct conn_info* conn = &conns->data[cap];
+    conn->pool = &conns->pool;
     conn->addr = *addr;
     conn->sockfd = sockfd;
-    conn->used = 1;
-    conns->len = counter;
+    conns->fds[cap]   = sockfd;
+    conns->flags[cap] = CONN_USED;
+    ++conns->len;
     if (http_request_make(&conn->request, conn->sockfd, &conn->addr, conns->constraints) == HTTP_FAILURE) {
       HTTP_LOG(HTTP_LOGERR, "[add_conn] http_request_make failed.\n");
       return NULL;
@@ -117,14 +241,35 @@ int conn_info_drop(struct conn_info* conn) {
     return HTTP_FAILURE;
   }
 
-  closesocket(conn->sockfd);
-  conn->sockfd = 0;
+  tls_detach(conn);
+  CLOSE_SOCKET(conn->sockfd);
+  conn_info_release_buffer(conn);
+  http_request_trim(&conn->request);
+  conn->sockfd = INVALID_SOCKET;
   conn->buff_len = 0;
-  conn->used = 0;
+  *conn->flags = 0;
+  conn->close = 0;
+  conn->cached = NULL;
+  conn->cache_owner = 0;
+  conn->ws = NULL;
+  conn->sse = NULL;
+  conn->h2 = NULL;
+  conn->tls = NULL;
   return HTTP_SUCCESS;
 }
 
+int conn_group_drop(struct conn_group* conns, struct conn_info* conn) {
+  if (!conns || !conn) {
+    HTTP_LOG(HTTP_LOGERR, "[conn_group_drop] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (conn_info_is(conn, CONN_USED))
+    --conns->len;
+  return conn_info_drop(conn);
+}
+
 int _conn_info_free(struct conn_info* conn) {
+  conn_info_release_buffer(conn);
   if (conn->request.headers) {
     if (http_request_free(&conn->request) == HTTP_FAILURE) {
       HTTP_LOG(HTTP_LOGERR, "[conn_info_free] http_request_free() failed.\n");
@@ -146,6 +291,7 @@ int conn_info_free(struct conn_info* conn) {
     return HTTP_FAILURE;
   }
   _conn_info_free(conn);
+  http_memory_sub(MEMORY_CONNECTIONS, sizeof(struct conn_info));
   free(conn);
   return HTTP_SUCCESS; 
 }
@@ -159,41 +305,83 @@ int conn_group_free(struct conn_group* conns) {
   for (size_t i = 0; i < cap; ++i) {
     _conn_info_free(&conns->data[i]);
   }
+  http_memory_sub(MEMORY_CONNECTIONS, cap * CONN_SLOT_LEN);
+  free(conns->fds);
+  free(conns->flags);
   free(conns->data);
+  buffer_pool_free(&conns->pool);
   conns->cap = 0;
   conns->len = 0;
+  conns->fds = NULL;
+  conns->flags = NULL;
   conns->data = NULL;
   return HTTP_SUCCESS;
 }
 
-int conn_group_wait(struct conn_group* conns, SOCKET server_sockfd, fd_set* read) {
-  if (!conns) {
-    HTTP_LOG(HTTP_LOGERR, "[ready_conns] passed NULL pointers for mandatory parameters.\n");
-    return HTTP_FAILURE;
-  }
+/* adds the group's sockets to 'read' and 'write' as each one waits, raising 'max_socket' to match.
+   returns 1 when OpenSSL already holds data for one of them. only the hot arrays are read */
+int conn_group_fill(struct conn_group* conns, fd_set* read, fd_set* write, int* max_socket) {
   const size_t cap = conns->cap;
-  const struct conn_info* data = conns->data;
-  FD_ZERO(read);
-  FD_SET(server_sockfd, read); 
-  fd_set wr = { 0 };
-  FD_ZERO(&wr);
-  int max_socket = (int)server_sockfd;
+  const SOCKET* fds = conns->fds;
+  const uint8_t* flags = conns->flags;
+  int pending = 0;
   for (size_t i = 0; i < cap; ++i) {
-    if (data[i].used == 1) {
-      SOCKET sockfd = data[i].sockfd;
-      if (data[i].request.state == STATE_GOT_NOTHING)
-        FD_SET(sockfd, read);
-      else
-        FD_SET(sockfd, &wr); 
-      if (sockfd > max_socket) max_socket = (int)sockfd;
+    uint8_t flag = flags[i];
+    /* a deferred response is written by someone else, nothing to wait for until it's handed back */
+    if ((flag & (CONN_USED | CONN_DEFERRED)) != CONN_USED)
+      continue;
+    SOCKET sockfd = fds[i];
+    /* an upgraded connection always reads, and writes only while it has something queued. so does one
+       in the middle of a TLS handshake */
+    if (flag & (CONN_UPGRADED | CONN_HANDSHAKING)) {
+      FD_SET(sockfd, read);
+      if (flag & CONN_WRITE_PENDING)
+        FD_SET(sockfd, write);
     }
+    else if (!(flag & CONN_RESPONDING))
+      FD_SET(sockfd, read);
+    else
+      FD_SET(sockfd, write); 
+    if ((int)sockfd > *max_socket) *max_socket = (int)sockfd;
+    if ((flag & CONN_TLS) && tls_pending(&conns->data[i]))
+      pending = 1;
+  }
+  return pending;
+}
+
+/* adds the group to sockets the caller already put in 'read' and 'write', up to 'max_socket', and waits
+   on all of them. a NULL timeout waits the default interval */
+int conn_group_wait(struct conn_group* conns, SOCKET server_sockfd, fd_set* read, fd_set* write,
+                    int max_socket, struct timeval* timeout) {
+  if (!conns || !read || !write) {
+    HTTP_LOG(HTTP_LOGERR, "[ready_conns] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (server_sockfd != INVALID_SOCKET && (int)server_sockfd > max_socket) {
+    max_socket = (int)server_sockfd;
   }
-  struct timeval timeout = { 0 };
-  timeout.tv_sec = SELECT_SEC;
-  timeout.tv_usec = SELECT_USEC;
-  if (select(max_socket + 1, read, &wr, NULL, &timeout) < 0) {
+  if (server_sockfd != INVALID_SOCKET)
+    FD_SET(server_sockfd, read);
+  int pending = conn_group_fill(conns, read, write, &max_socket);
+  struct timeval wait = { 0 };
+  wait.tv_sec  = SELECT_SEC;
+  wait.tv_usec = SELECT_USEC;
+  /* data OpenSSL already holds won't wake select(), it only checks */
+  if (pending) {
+    wait.tv_sec  = 0;
+    wait.tv_usec = 0;
+    timeout = &wait;
+  }
+  if (select(max_socket + 1, read, write, NULL, timeout ? timeout : &wait) < 0) {
+#ifndef _WIN32
+    if (GET_ERROR() == EINTR) {
+      FD_ZERO(read);
+      FD_ZERO(write);
+      return HTTP_SUCCESS;
+    }
+#endif
     HTTP_LOG(HTTP_LOGERR, "[ready_conns] select() failed - %d.\n", GET_ERROR());
     return HTTP_FAILURE;
   }
   return HTTP_SUCCESS;
-}
\ No newline at end of file
+}
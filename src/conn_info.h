@@ -3,33 +3,93 @@
 #include "includes.h" 
 #include "http_request.h"
 #include "http_response.h"
+#include "buffer_pool.h"
+#include "http_stats.h"
 #define CONN_BUFF_LEN 1024
+#define CONN_POOL_MAX_FREE 256
+#define CONN_SLOT_LEN (sizeof(struct conn_info) + sizeof(SOCKET) + 1)
+struct http_cache_entry;
+struct ws_conn;
+struct sse_conn;
+struct h2_conn;
+struct ssl_st;
+
+/* what the event loop asks of every connection on every turn. a group keeps them in an array of their own,
+   one byte per connection, next to the sockets: the scan reads the rest only of the ones that are ready */
+#define CONN_USED          0x01
+#define CONN_DEFERRED      0x02                 /* the response is written by someone else */
+#define CONN_UPGRADED      0x04
+#define CONN_HANDSHAKING   0x08
+#define CONN_WRITE_PENDING 0x10
+#define CONN_RESPONDING    0x20                 /* the request is in, as request.state == STATE_GOT_ALL */
+#define CONN_TLS           0x40
 
 struct conn_info {
   SOCKET               sockfd;
+  uint8_t*             flags;                   /* into the group's array, or at 'own_flags' */
+  uint8_t              own_flags;
+  char                 close;
+  char                 cache_owner;
   struct sockaddr_in   addr;
-  char                 buffer[CONN_BUFF_LEN + 1];
+  char*                buffer;
   size_t               buff_len;
+  size_t               buff_cap;
+  struct buffer_pool*  pool;
   size_t               buff_used; 
-  char                 used;
+  struct http_cache_entry* cached;
+  struct ws_conn*      ws;
+  struct sse_conn*     sse;
+  struct h2_conn*      h2;
+  struct ssl_st*       tls;
+  struct http_timing   timing;
+  size_t               bytes_sent;
   http_request  request;
   http_response response; 
 };
 
+/* sockets someone else owns that an event loop waits on along with its own: 'fill' adds them and returns
+   how many nanoseconds the loop may sleep, 'dispatch' handles the ones that are ready */
+struct http_poller {
+  void* ctx;
+  uint64_t (*fill) (void*, fd_set*, fd_set*, int*);
+  int (*dispatch) (void*, fd_set*, fd_set*);
+};
+
 struct conn_group {
   size_t         len;
   size_t         cap;
   http_constraints* constraints; 
+  struct buffer_pool pool;
+  SOCKET*        fds;                           /* data[i].sockfd while data[i] is used */
+  uint8_t*       flags;
   struct conn_info* data;
 };
 
+static inline int conn_info_is(const struct conn_info* conn, uint8_t flag) {
+  return (*conn->flags & flag) != 0;
+}
+
+static inline void conn_info_mark(struct conn_info* conn, uint8_t flag, int on) {
+  if (on)
+    *conn->flags |= flag;
+  else
+    *conn->flags &= (uint8_t)~flag;
+}
+
 struct conn_info* conn_group_add(struct conn_group*, SOCKET, struct sockaddr_in* s);
 int conn_info_drop(struct conn_info*);
+int conn_group_drop(struct conn_group*, struct conn_info*);
 struct conn_group conn_group_make(http_constraints*);
 struct conn_info* conn_info_new(http_constraints*);
 int conn_info_free(struct conn_info*);
 int conn_group_free(struct conn_group*);
-int conn_group_wait(struct conn_group*, SOCKET, fd_set*);
+int conn_group_fill(struct conn_group*, fd_set*, fd_set*, int*);
+int conn_group_wait(struct conn_group*, SOCKET, fd_set*, fd_set*, int, struct timeval*);
 int conn_info_reset(struct conn_info*, http_constraints*);
+int conn_info_reserve(struct conn_info*, http_constraints*);
+int conn_info_shrink(struct conn_info*);
+int conn_info_recv(struct conn_info*, char*, size_t);
+int conn_info_send(struct conn_info*, const char*, size_t);
+int conn_info_send_more(struct conn_info*, const char*, size_t);
 
 #endif
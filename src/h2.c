@@ -0,0 +1,1024 @@
+#include "h2.h"
+
+struct h2_decode {
+  struct h2_conn*   h2;
+  struct h2_stream* stream;
+  char   malformed;
+  char   regular;
+  char   method;
+  char   path;
+  char   scheme;
+  char   authority;
+  size_t count;
+};
+
+static uint32_t h2_read32(const unsigned char* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void h2_write32(unsigned char* p, uint32_t v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+/* the client's first bytes: the connection preface, the start of one, or plain HTTP/1 */
+int h2_preface(const char* buffer, size_t len) {
+  size_t n = MIN(len, H2_PREFACE_LEN);
+  if (memcmp(buffer, H2_PREFACE, n) != 0)
+    return H2_PREFACE_NONE;
+  return n == H2_PREFACE_LEN ? H2_PREFACE_FULL : H2_PREFACE_PARTIAL;
+}
+
+static int h2_reserve(struct h2_conn* h2, size_t len) {
+  if (h2->out_sent && h2->out_sent == h2->out_len) {
+    h2->out_sent = 0;
+    h2->out_len  = 0;
+  }
+  if (h2->out_len + len <= h2->out_cap)
+    return HTTP_SUCCESS;
+  size_t cap = MAX(h2->out_len + len, h2->out_cap * 2);
+  char* out = realloc(h2->out, cap);
+  if (!out) {
+    HTTP_LOG(HTTP_LOGERR, "[h2_reserve] realloc() failed.\n");
+    return HTTP_FAILURE;
+  }
+  h2->out     = out;
+  h2->out_cap = cap;
+  return HTTP_SUCCESS;
+}
+
+/* queues a frame header and returns where its payload goes */
+static unsigned char* h2_frame(struct h2_conn* h2, uint8_t type, uint8_t flags, uint32_t stream, size_t len) {
+  if (h2_reserve(h2, H2_FRAME_HEAD + len) == HTTP_FAILURE) {
+    h2->failed = 1;
+    return NULL;
+  }
+  unsigned char* p = (unsigned char*)h2->out + h2->out_len;
+  p[0] = (unsigned char)(len >> 16);
+  p[1] = (unsigned char)(len >> 8);
+  p[2] = (unsigned char)len;
+  p[3] = type;
+  p[4] = flags;
+  h2_write32(p + 5, stream & H2_WINDOW_MAX);
+  h2->out_len += H2_FRAME_HEAD + len;
+  return p + H2_FRAME_HEAD;
+}
+
+static void h2_window_update(struct h2_conn* h2, uint32_t stream, uint32_t increment) {
+  unsigned char* p = h2_frame(h2, H2_WINDOW_UPDATE, 0, stream, 4);
+  if (p)
+    h2_write32(p, increment);
+}
+
+static void h2_rst(struct h2_conn* h2, uint32_t stream, uint32_t code) {
+  unsigned char* p = h2_frame(h2, H2_RST_STREAM, 0, stream, 4);
+  if (p)
+    h2_write32(p, code);
+}
+
+/* a connection error: the peer is told why, nothing more is read and the socket goes once it's flushed */
+static void h2_error(struct h2_conn* h2, uint32_t code) {
+  if (h2->closing)
+    return;
+  unsigned char* p = h2_frame(h2, H2_GOAWAY, 0, 0, 8);
+  if (p) {
+    h2_write32(p, h2->last_stream);
+    h2_write32(p + 4, code);
+  }
+  h2->closing = 1;
+}
+
+static struct h2_stream* h2_find(struct h2_conn* h2, uint32_t id) {
+  for (size_t i = 0; i < h2->streams_len; ++i) {
+    if (h2->streams[i]->id == id)
+      return h2->streams[i];
+  }
+  return NULL;
+}
+
+static struct h2_stream* h2_stream_new(struct h2_conn* h2, uint32_t id) {
+  http_server* server = h2->server;
+  struct conn_info* conn = &server->conns.data[h2->index];
+  if (h2->streams_len == h2->streams_cap) {
+    size_t cap = h2->streams_cap ? h2->streams_cap * 2 : 8;
+    struct h2_stream** streams = realloc(h2->streams, cap * sizeof(struct h2_stream*));
+    if (!streams) {
+      HTTP_LOG(HTTP_LOGERR, "[h2_stream_new] realloc() failed.\n");
+      return NULL;
+    }
+    h2->streams     = streams;
+    h2->streams_cap = cap;
+  }
+  struct h2_stream* stream = h2->spare;
+  if (stream) {
+    h2->spare = stream->next;
+    --h2->spare_len;
+    http_request_reset(&stream->request, conn->sockfd, &conn->addr);
+    http_response_reset(&stream->response);
+  }
+  else {
+    stream = (struct h2_stream*)calloc(1, sizeof(struct h2_stream));
+    if (!stream) {
+      HTTP_LOG(HTTP_LOGERR, "[h2_stream_new] failed to allocate memory.\n");
+      return NULL;
+    }
+    if (http_request_make(&stream->request, conn->sockfd, &conn->addr, &server->constraints) == HTTP_FAILURE) {
+      free(stream);
+      return NULL;
+    }
+    if (http_response_make(&stream->response, &server->constraints) == HTTP_FAILURE) {
+      http_request_free(&stream->request);
+      free(stream);
+      return NULL;
+    }
+  }
+  stream->id          = id;
+  stream->state       = H2_STREAM_OPEN;
+  stream->urgency     = H2_URGENCY_DEFAULT;
+  stream->incremental = 0;
+  stream->too_large   = 0;
+  stream->eof         = 0;
+  stream->send_window = h2->peer_window;
+  stream->recv_window = H2_WINDOW;
+  stream->sent        = 0;
+  stream->bytes       = 0;
+  stream->next        = NULL;
+  http_timing_reset(&stream->timing, http_clock_ns());
+  stream->timing.first_byte = stream->timing.start;
+  stream->request.version   = HTTP_VERSION_2;
+  stream->response.version  = HTTP_VERSION_2;
+  h2->streams[h2->streams_len++] = stream;
+  ++server->stats.counters.h2_streams;
+  return stream;
+}
+
+static void h2_stream_free(struct h2_stream* stream) {
+  http_request_free(&stream->request);
+  http_response_free(&stream->response);
+  free(stream);
+}
+
+/* the stream is gone either way, a few are kept so their request buffers are reused */
+static void h2_stream_close(struct h2_conn* h2, struct h2_stream* stream) {
+  for (size_t i = 0; i < h2->streams_len; ++i) {
+    if (h2->streams[i] == stream) {
+      h2->streams[i] = h2->streams[--h2->streams_len];
+      break;
+    }
+  }
+  if (stream->response.body_file) {
+    fclose(stream->response.body_file);
+    stream->response.body_file = NULL;
+  }
+  if (h2->spare_len < H2_SPARE_STREAMS) {
+    stream->next = h2->spare;
+    h2->spare    = stream;
+    ++h2->spare_len;
+  }
+  else
+    h2_stream_free(stream);
+}
+
+static void h2_stream_done(struct h2_conn* h2, struct h2_stream* stream) {
+  http_server* server = h2->server;
+  struct conn_info* conn = &server->conns.data[h2->index];
+  http_server_complete(server, &stream->request, &stream->response, &stream->timing, conn->addr.SIN_ADDR,
+                       stream->bytes);
+  h2_stream_close(h2, stream);
+}
+
+/* RFC 9218 priorities: "u=<0-7>" and "i" in a structured field list, anything else is ignored */
+static void h2_priority(struct h2_stream* stream, const char* value, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && (value[i] == ' ' || value[i] == ','))
+      ++i;
+    if (i + 2 < len && value[i] == 'u' && value[i + 1] == '=' && value[i + 2] >= '0' && value[i + 2] <= '7')
+      stream->urgency = (char)(value[i + 2] - '0');
+    else if (value[i] == 'i' && (i + 1 == len || value[i + 1] == ',' || value[i + 1] == ' '))
+      stream->incremental = 1;
+    else if (i + 3 < len && !memcmp(value + i, "i=?", 3))
+      stream->incremental = value[i + 3] == '1';
+    while (i < len && value[i] != ',')
+      ++i;
+  }
+}
+
+/* a method the build profile leaves out is unknown here too, the request is malformed as over HTTP/1.1 */
+static int h2_method(const char* value) {
+  for (int method = 0; method < METHOD_NONE; ++method) {
+    if (HTTP_METHOD_ENABLED(method) && strcmp(http_request_method_string(method), value) == 0)
+      return method;
+  }
+  return METHOD_NONE;
+}
+
+/* maps a decoded field onto the stream's request, a malformed request is noted and the rest is still
+   decoded so the table stays in step */
+static int h2_emit(void* ud, const char* name, size_t name_len, const char* value, size_t value_len) {
+  struct h2_decode* d = (struct h2_decode*)ud;
+  struct h2_stream* stream = d->stream;
+  if (!stream || d->malformed)
+    return HTTP_SUCCESS;
+  http_request* req = &stream->request;
+  http_constraints* constraints = &d->h2->server->constraints;
+  if (name[0] == ':') {
+    char* seen = NULL;
+    if (d->regular)
+      d->malformed = 1;
+    else if (strcmp(name, ":method") == 0) {
+      seen = &d->method;
+      req->method = (char)h2_method(value);
+      if (req->method == METHOD_NONE || req->method == METHOD_CONNECT)
+        d->malformed = 1;
+    }
+    else if (strcmp(name, ":path") == 0) {
+      seen = &d->path;
+      if (value[0] != '/' || value_len > HTTP_REQUEST_MAX_URI_LEN(constraints) ||
+          http_request_set_target(req, value, value_len) == HTTP_FAILURE)
+        d->malformed = 1;
+    }
+    else if (strcmp(name, ":scheme") == 0)
+      seen = &d->scheme;
+    else if (strcmp(name, ":authority") == 0) {
+      seen = &d->authority;
+      http_headers_set(req->headers, "Host", value);
+    }
+    else
+      d->malformed = 1;
+    if (seen && (*seen)++)
+      d->malformed = 1;
+    return HTTP_SUCCESS;
+  }
+  d->regular = 1;
+  for (size_t i = 0; i < name_len; ++i) {
+    if (name[i] >= 'A' && name[i] <= 'Z')
+      d->malformed = 1;
+  }
+  if (++d->count > HTTP_REQUEST_MAX_HEADERS(constraints) || strcmp(name, "connection") == 0 ||
+      strcmp(name, "keep-alive") == 0 || strcmp(name, "proxy-connection") == 0 ||
+      strcmp(name, "transfer-encoding") == 0 || strcmp(name, "upgrade") == 0 ||
+      (strcmp(name, "te") == 0 && strcmp(value, "trailers") != 0))
+    d->malformed = 1;
+  if (d->malformed)
+    return HTTP_SUCCESS;
+  if (strcmp(name, "priority") == 0)
+    h2_priority(stream, value, value_len);
+  if (strcmp(name, "host") == 0 && d->authority)
+    return HTTP_SUCCESS;
+  return http_headers_set(req->headers, name, value);
+}
+
+/* queues the response head, split into CONTINUATION frames past the peer's frame size. the block is
+   encoded in the buffer incoming blocks use, no block is pending while a stream is answered */
+static int h2_send_headers(struct h2_conn* h2, struct h2_stream* stream, int end_stream) {
+  http_response* res = &stream->response;
+  size_t bound = 8;
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  while (http_headers_next(res->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    for (; val; val = val->next)
+      bound += HPACK_FIELD_BOUND(key.len, val->len);
+  }
+  if (bound > h2->block_cap) {
+    unsigned char* block = realloc(h2->block, bound);
+    if (!block) {
+      HTTP_LOG(HTTP_LOGERR, "[h2_send_headers] realloc() failed.\n");
+      return HTTP_FAILURE;
+    }
+    h2->block     = block;
+    h2->block_cap = bound;
+  }
+  unsigned char* out = h2->block;
+  size_t n = hpack_encode_status(out, http_response_status_code(res->status));
+  iter = 0;
+  while (http_headers_next(res->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    if (http_headers_hop_by_hop(res->headers, key.v) || strcasecmp(key.v, "Transfer-Encoding") == 0 ||
+        strcasecmp(key.v, "Keep-Alive") == 0 || strcasecmp(key.v, "Upgrade") == 0 ||
+        strcasecmp(key.v, "Connection") == 0)
+      continue;
+    for (; val; val = val->next)
+      n += hpack_encode_field(out + n, key.v, key.len, val->v, val->len);
+  }
+  size_t at = 0;
+  do {
+    size_t len = MIN(n - at, h2->peer_frame);
+    uint8_t type  = at ? H2_CONTINUATION : H2_HEADERS;
+    uint8_t flags = (at + len == n ? H2_FLAG_END_HEADERS : 0) | (!at && end_stream ? H2_FLAG_END_STREAM : 0);
+    unsigned char* p = h2_frame(h2, type, flags, stream->id, len);
+    if (!p)
+      return HTTP_FAILURE;
+    memcpy(p, out + at, len);
+    at += len;
+  } while (at < n);
+  return HTTP_SUCCESS;
+}
+
+/* the request is complete: the handler answers it and the head goes out, the body follows from the
+   scheduler */
+static void h2_answer(struct h2_conn* h2, struct h2_stream* stream) {
+  http_server* server = h2->server;
+  struct conn_info* conn = &server->conns.data[h2->index];
+  http_request* req  = &stream->request;
+  http_response* res = &stream->response;
+  req->body[req->body_len] = 0;
+  req->state = STATE_GOT_ALL;
+  stream->timing.headers = stream->timing.headers ? stream->timing.headers : http_clock_ns();
+  if (stream->too_large)
+    http_response_set_status(res, HTTP_STATUS_413);
+  else
+    http_server_answer(server, req, res, &stream->timing, conn->addr.SIN_ADDR);
+  int empty = req->method == METHOD_HEAD || res->body_type == BODYTYPE_NONE ||
+              (res->body_type == BODYTYPE_STRING && res->body_len == 0) ||
+              (res->body_type == BODYTYPE_FILE && !res->body_file) || res->body_type == BODYTYPE_STREAM;
+  stream->state = H2_STREAM_SENDING;
+  if (h2_send_headers(h2, stream, empty) == HTTP_FAILURE) {
+    h2->failed = 1;
+    return;
+  }
+  if (empty)
+    h2_stream_done(h2, stream);
+}
+
+static void h2_block_done(struct h2_conn* h2) {
+  http_server* server = h2->server;
+  uint32_t id = h2->block_stream;
+  struct h2_stream* stream = h2_find(h2, id);
+  struct h2_decode d = { 0 };
+  d.h2 = h2;
+  int trailers = stream != NULL;
+  int refused  = 0;
+  if (!stream && id > h2->last_stream) {
+    h2->last_stream = id;
+    size_t limit = server->constraints.h2_max_streams;
+    /* the block is still decoded, the table has to see every one */
+    if (h2->streams_len >= limit || h2->goaway_received || h2->draining)
+      refused = 1;
+    else if (!(stream = h2_stream_new(h2, id))) {
+      h2->failed = 1;
+      return;
+    }
+  }
+  d.stream = trailers ? NULL : stream;
+  if (hpack_decode(&h2->decoder, h2->block, h2->block_len, h2->scratch, h2->scratch_len, h2_emit, &d)
+      == HTTP_FAILURE) {
+    h2_error(h2, H2_COMPRESSION_ERROR);
+    return;
+  }
+  h2->block_len = 0;
+  int end_stream = h2->block_flags & H2_FLAG_END_STREAM;
+  if (refused) {
+    h2_rst(h2, id, H2_REFUSED_STREAM);
+    return;
+  }
+  if (!stream)
+    return;
+  if (trailers) {
+    /* trailers end the request, they're decoded and dropped */
+    if (!end_stream) {
+      h2_rst(h2, id, H2_PROTOCOL_ERROR);
+      h2_stream_close(h2, stream);
+    }
+    else
+      h2_answer(h2, stream);
+    return;
+  }
+  stream->timing.headers = http_clock_ns();
+  if (d.malformed || !d.method || !d.path || !d.scheme) {
+    h2_rst(h2, id, H2_PROTOCOL_ERROR);
+    h2_stream_close(h2, stream);
+    return;
+  }
+  if (end_stream)
+    h2_answer(h2, stream);
+}
+
+static int h2_settings(struct h2_conn* h2, const unsigned char* p, size_t len) {
+  for (size_t i = 0; i + 6 <= len; i += 6) {
+    uint16_t id = (uint16_t)(p[i] << 8 | p[i + 1]);
+    uint32_t value = h2_read32(p + i + 2);
+    switch (id) {
+    case H2_SETTINGS_ENABLE_PUSH:
+      if (value > 1)
+        return H2_PROTOCOL_ERROR;
+      break;
+    case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+      if (value > H2_WINDOW_MAX)
+        return H2_FLOW_CONTROL_ERROR;
+      /* the change applies to every open stream's window, even below zero */
+      for (size_t s = 0; s < h2->streams_len; ++s)
+        h2->streams[s]->send_window += (int64_t)value - h2->peer_window;
+      h2->peer_window = value;
+      break;
+    case H2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < H2_FRAME_MAX || value > 0xffffff)
+        return H2_PROTOCOL_ERROR;
+      h2->peer_frame = value;
+      break;
+    default:
+      /* responses are never indexed, so the peer's table size doesn't matter */
+      break;
+    }
+  }
+  return H2_NO_ERROR;
+}
+
+/* consumes a DATA frame's place in both receive windows and opens them again once half is used */
+static int h2_consume(struct h2_conn* h2, struct h2_stream* stream, size_t len) {
+  h2->recv_window -= len;
+  if (h2->recv_window < 0)
+    return HTTP_FAILURE;
+  if (h2->recv_window < H2_CONN_WINDOW / 2) {
+    h2_window_update(h2, 0, (uint32_t)(H2_CONN_WINDOW - h2->recv_window));
+    h2->recv_window = H2_CONN_WINDOW;
+  }
+  if (stream) {
+    stream->recv_window -= len;
+    if (stream->recv_window < 0)
+      return HTTP_FAILURE;
+  }
+  return HTTP_SUCCESS;
+}
+
+static void h2_data(struct h2_conn* h2, uint8_t flags, uint32_t id, const unsigned char* p, size_t len) {
+  http_constraints* constraints = &h2->server->constraints;
+  size_t frame_len = len;
+  if (flags & H2_FLAG_PADDED) {
+    if (len < 1 || p[0] >= len) {
+      h2_error(h2, H2_PROTOCOL_ERROR);
+      return;
+    }
+    len -= 1 + p[0];
+    ++p;
+  }
+  if (id == 0 || id > h2->last_stream) {
+    h2_error(h2, H2_PROTOCOL_ERROR);
+    return;
+  }
+  struct h2_stream* stream = h2_find(h2, id);
+  if (stream && stream->state != H2_STREAM_OPEN)
+    stream = NULL;
+  if (h2_consume(h2, stream, frame_len) == HTTP_FAILURE) {
+    h2_error(h2, H2_FLOW_CONTROL_ERROR);
+    return;
+  }
+  if (!stream) {
+    h2_rst(h2, id, H2_STREAM_CLOSED);
+    return;
+  }
+  http_request* req = &stream->request;
+  size_t max = HTTP_REQUEST_MAX_BODY_LEN(constraints);
+  if (http_body_reserve(&req->body, &req->body_cap, req->body_len + len, max) == HTTP_FAILURE)
+    stream->too_large = 1;
+  else {
+    memcpy(req->body + req->body_len, p, len);
+    req->body_len += len;
+  }
+  if (flags & H2_FLAG_END_STREAM)
+    h2_answer(h2, stream);
+  else if (stream->recv_window < H2_WINDOW / 2) {
+    h2_window_update(h2, id, (uint32_t)(H2_WINDOW - stream->recv_window));
+    stream->recv_window = H2_WINDOW;
+  }
+}
+
+static void h2_headers(struct h2_conn* h2, uint8_t type, uint8_t flags, uint32_t id, const unsigned char* p,
+                       size_t len) {
+  if (type == H2_HEADERS) {
+    if (id == 0 || !(id & 1)) {
+      h2_error(h2, H2_PROTOCOL_ERROR);
+      return;
+    }
+    struct h2_stream* stream = h2_find(h2, id);
+    if (id <= h2->last_stream && (!stream || stream->state != H2_STREAM_OPEN)) {
+      h2_error(h2, H2_STREAM_CLOSED);
+      return;
+    }
+    size_t pad = 0;
+    if (flags & H2_FLAG_PADDED) {
+      if (len < 1) {
+        h2_error(h2, H2_PROTOCOL_ERROR);
+        return;
+      }
+      pad = p[0];
+      ++p;
+      --len;
+    }
+    /* the deprecated priority tree is skipped, RFC 9218 priorities come as a header */
+    if (flags & H2_FLAG_PRIORITY) {
+      if (len < 5) {
+        h2_error(h2, H2_PROTOCOL_ERROR);
+        return;
+      }
+      p   += 5;
+      len -= 5;
+    }
+    if (pad > len) {
+      h2_error(h2, H2_PROTOCOL_ERROR);
+      return;
+    }
+    len -= pad;
+    h2->block_stream = id;
+    h2->block_flags  = flags;
+    h2->block_len    = 0;
+  }
+  else if (!h2->block_stream || id != h2->block_stream) {
+    h2_error(h2, H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (h2->block_len + len > h2->scratch_len) {
+    h2_error(h2, H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (h2->block_len + len > h2->block_cap) {
+    size_t cap = MAX(h2->block_len + len, h2->block_cap * 2);
+    unsigned char* block = realloc(h2->block, cap);
+    if (!block) {
+      HTTP_LOG(HTTP_LOGERR, "[h2_headers] realloc() failed.\n");
+      h2->failed = 1;
+      return;
+    }
+    h2->block     = block;
+    h2->block_cap = cap;
+  }
+  memcpy(h2->block + h2->block_len, p, len);
+  h2->block_len += len;
+  if (flags & H2_FLAG_END_HEADERS) {
+    h2_block_done(h2);
+    h2->block_stream = 0;
+  }
+}
+
+static void h2_frame_in(struct h2_conn* h2, uint8_t type, uint8_t flags, uint32_t id, const unsigned char* p,
+                        size_t len) {
+  /* nothing may come between a header block's frames */
+  if (h2->block_stream && type != H2_CONTINUATION) {
+    h2_error(h2, H2_PROTOCOL_ERROR);
+    return;
+  }
+  if (!h2->settings_seen && (type != H2_SETTINGS || (flags & H2_FLAG_ACK))) {
+    h2_error(h2, H2_PROTOCOL_ERROR);
+    return;
+  }
+  switch (type) {
+  case H2_DATA:
+    h2_data(h2, flags, id, p, len);
+    break;
+  case H2_HEADERS:
+  case H2_CONTINUATION:
+    h2_headers(h2, type, flags, id, p, len);
+    break;
+  case H2_PRIORITY:
+    if (id == 0)
+      h2_error(h2, H2_PROTOCOL_ERROR);
+    else if (len != 5)
+      h2_rst(h2, id, H2_FRAME_SIZE_ERROR);
+    break;
+  case H2_RST_STREAM: {
+    if (id == 0 || id > h2->last_stream || len != 4) {
+      h2_error(h2, len != 4 ? H2_FRAME_SIZE_ERROR : H2_PROTOCOL_ERROR);
+      break;
+    }
+    struct h2_stream* stream = h2_find(h2, id);
+    if (stream)
+      h2_stream_close(h2, stream);
+    break;
+  }
+  case H2_SETTINGS: {
+    if (id != 0 || (flags & H2_FLAG_ACK ? len != 0 : len % 6 != 0)) {
+      h2_error(h2, id != 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+      break;
+    }
+    h2->settings_seen = 1;
+    if (flags & H2_FLAG_ACK)
+      break;
+    int code = h2_settings(h2, p, len);
+    if (code != H2_NO_ERROR)
+      h2_error(h2, code);
+    else
+      h2_frame(h2, H2_SETTINGS, H2_FLAG_ACK, 0, 0);
+    break;
+  }
+  case H2_PING: {
+    if (id != 0 || len != 8) {
+      h2_error(h2, id != 0 ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+      break;
+    }
+    if (flags & H2_FLAG_ACK)
+      break;
+    unsigned char* out = h2_frame(h2, H2_PING, H2_FLAG_ACK, 0, 8);
+    if (out)
+      memcpy(out, p, 8);
+    break;
+  }
+  case H2_GOAWAY:
+    if (id != 0)
+      h2_error(h2, H2_PROTOCOL_ERROR);
+    h2->goaway_received = 1;
+    break;
+  case H2_WINDOW_UPDATE: {
+    if (len != 4) {
+      h2_error(h2, H2_FRAME_SIZE_ERROR);
+      break;
+    }
+    uint32_t increment = h2_read32(p) & H2_WINDOW_MAX;
+    if (id == 0) {
+      if (increment == 0 || h2->send_window + increment > H2_WINDOW_MAX)
+        h2_error(h2, increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+      else
+        h2->send_window += increment;
+      break;
+    }
+    struct h2_stream* stream = h2_find(h2, id);
+    if (!stream)
+      break;
+    if (increment == 0 || stream->send_window + increment > H2_WINDOW_MAX) {
+      h2_rst(h2, id, increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+      h2_stream_close(h2, stream);
+    }
+    else
+      stream->send_window += increment;
+    break;
+  }
+  case H2_PRIORITY_UPDATE: {
+    if (id != 0 || len < 4) {
+      h2_error(h2, H2_PROTOCOL_ERROR);
+      break;
+    }
+    struct h2_stream* stream = h2_find(h2, h2_read32(p) & H2_WINDOW_MAX);
+    if (stream)
+      h2_priority(stream, (const char*)p + 4, len - 4);
+    break;
+  }
+  case H2_PUSH_PROMISE:
+    h2_error(h2, H2_PROTOCOL_ERROR);
+    break;
+  default:
+    /* unknown frame types are ignored */
+    break;
+  }
+}
+
+static void h2_parse(struct h2_conn* h2) {
+  const unsigned char* p = (const unsigned char*)h2->in;
+  const size_t len = h2->in_len;
+  size_t q = 0;
+  if (h2->preface) {
+    if (h2_preface(h2->in, len) != H2_PREFACE_FULL) {
+      if (h2_preface(h2->in, len) == H2_PREFACE_NONE)
+        h2_error(h2, H2_PROTOCOL_ERROR);
+      return;
+    }
+    h2->preface = 0;
+    q = H2_PREFACE_LEN;
+  }
+  while (len - q >= H2_FRAME_HEAD && !h2->closing && !h2->failed) {
+    size_t frame_len = (size_t)p[q] << 16 | (size_t)p[q + 1] << 8 | p[q + 2];
+    if (frame_len > H2_FRAME_MAX) {
+      h2_error(h2, H2_FRAME_SIZE_ERROR);
+      break;
+    }
+    if (len - q < H2_FRAME_HEAD + frame_len)
+      break;
+    h2_frame_in(h2, p[q + 3], p[q + 4], h2_read32(p + q + 5) & H2_WINDOW_MAX, p + q + H2_FRAME_HEAD, frame_len);
+    q += H2_FRAME_HEAD + frame_len;
+  }
+  h2->in_len = len - q;
+  if (h2->in_len && q)
+    memmove(h2->in, h2->in + q, h2->in_len);
+}
+
+/* the next stream to get a DATA frame: the most urgent first, within an urgency non-incremental streams one
+   at a time in the order they were opened, then incremental ones taking turns */
+static struct h2_stream* h2_pick(struct h2_conn* h2) {
+  struct h2_stream* best = NULL;
+  uint64_t best_key = UINT64_MAX;
+  for (size_t i = 0; i < h2->streams_len; ++i) {
+    struct h2_stream* stream = h2->streams[i];
+    if (stream->state != H2_STREAM_SENDING || stream->send_window <= 0)
+      continue;
+    uint64_t order = stream->id;
+    if (stream->incremental && stream->id <= h2->scheduled)
+      order += (uint64_t)1 << 32;
+    uint64_t key = (uint64_t)stream->urgency << 34 | (uint64_t)stream->incremental << 33 | order;
+    if (key < best_key) {
+      best     = stream;
+      best_key = key;
+    }
+  }
+  return best;
+}
+
+/* fills the output with DATA frames as far as the windows and the watermark allow */
+static void h2_schedule(struct h2_conn* h2) {
+  while (!h2->failed && h2->send_window > 0 && h2->out_len - h2->out_sent < H2_OUT_WATERMARK) {
+    struct h2_stream* stream = h2_pick(h2);
+    if (!stream)
+      break;
+    http_response* res = &stream->response;
+    /* a larger frame the peer allows would overshoot the watermark by up to 16MB, and delay other streams */
+    size_t room = (size_t)MIN(MIN(stream->send_window, h2->send_window), (int64_t)H2_FRAME_MAX);
+    size_t len;
+    unsigned char* p;
+    if (res->body_type == BODYTYPE_FILE) {
+      if (!(p = h2_frame(h2, H2_DATA, 0, stream->id, room)))
+        return;
+      len = fread(p, 1, room, res->body_file);
+      if (len < room) {
+        if (ferror(res->body_file)) {
+          HTTP_LOG(HTTP_LOGERR, "[h2_schedule] fread() failed.\n");
+        }
+        stream->eof = 1;
+      }
+      /* the frame was sized for a full read */
+      h2->out_len -= room - len;
+      p[-9] = (unsigned char)(len >> 16);
+      p[-8] = (unsigned char)(len >> 8);
+      p[-7] = (unsigned char)len;
+    }
+    else {
+      len = MIN(res->body_len - stream->sent, room);
+      if (!(p = h2_frame(h2, H2_DATA, 0, stream->id, len)))
+        return;
+      memcpy(p, res->body_string + stream->sent, len);
+      stream->eof = stream->sent + len == res->body_len;
+    }
+    stream->sent        += len;
+    stream->bytes       += len;
+    stream->send_window -= len;
+    h2->send_window     -= len;
+    h2->scheduled        = stream->id;
+    if (stream->eof) {
+      p[-5] |= H2_FLAG_END_STREAM;
+      h2_stream_done(h2, stream);
+    }
+  }
+}
+
+static void h2_flush(struct h2_conn* h2) {
+  http_server* server = h2->server;
+  struct conn_info* conn = &server->conns.data[h2->index];
+  size_t budget = HTTP_SEND_LEN(&server->constraints);
+  while (!h2->failed && budget > 0) {
+    h2_schedule(h2);
+    if (h2->out_sent == h2->out_len)
+      break;
+    size_t len = MIN(h2->out_len - h2->out_sent, budget);
+    int ret = conn_info_send(conn, h2->out + h2->out_sent, len);
+    ++server->stats.counters.send_calls;
+    if (ret == SOCKET_ERROR) {
+      if (!WOULD_BLOCK(GET_ERROR())) {
+        HTTP_LOG(HTTP_LOGERR, "[h2_flush] send() failed - %d.\n", GET_ERROR());
+        h2->failed = 1;
+      }
+      break;
+    }
+    h2->out_sent += ret;
+    budget       -= ret;
+    server->stats.counters.bytes_out += ret;
+    if ((size_t)ret < len)
+      break;
+  }
+  conn_info_mark(conn, CONN_WRITE_PENDING, h2->out_sent < h2->out_len);
+  if (h2->out_len - h2->out_sent > H2_MAX_BACKLOG)
+    h2->failed = 1;
+}
+
+static struct h2_conn* h2_new(http_server* server, struct conn_info* conn) {
+  struct h2_conn* h2 = (struct h2_conn*)calloc(1, sizeof(struct h2_conn));
+  if (!h2) {
+    HTTP_LOG(HTTP_LOGERR, "[h2_new] failed to allocate memory.\n");
+    return NULL;
+  }
+  h2->scratch_len = HTTP_REQUEST_MAX_HEADER_LEN(&server->constraints);
+  h2->scratch = malloc(h2->scratch_len);
+  h2->in      = malloc(H2_IN_LEN);
+  if (!h2->scratch || !h2->in) {
+    HTTP_LOG(HTTP_LOGERR, "[h2_new] failed to allocate memory.\n");
+    free(h2->scratch);
+    free(h2->in);
+    free(h2);
+    return NULL;
+  }
+  h2->server      = server;
+  h2->index       = (size_t)(conn - server->conns.data);
+  h2->preface     = 1;
+  h2->send_window = H2_WINDOW;
+  h2->recv_window = H2_CONN_WINDOW;
+  h2->peer_window = H2_WINDOW;
+  h2->peer_frame  = H2_FRAME_MAX;
+  h2->decoder     = hpack_table_make(HPACK_TABLE_SIZE);
+  return h2;
+}
+
+/* prior knowledge: the client opened with the connection preface, which is still in the buffer */
+int h2_start(http_server* server, struct conn_info* conn) {
+  if (!server || !conn) {
+    HTTP_LOG(HTTP_LOGERR, "[h2_start] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  conn->h2 = h2_new(server, conn);
+  return conn->h2 ? HTTP_SUCCESS : HTTP_FAILURE;
+}
+
+static size_t h2_base64url(const char* s, unsigned char* out, size_t cap) {
+  uint32_t bits = 0;
+  int nbits = 0;
+  size_t n = 0;
+  for (; *s && *s != '='; ++s) {
+    int v;
+    if (*s >= 'A' && *s <= 'Z')
+      v = *s - 'A';
+    else if (*s >= 'a' && *s <= 'z')
+      v = *s - 'a' + 26;
+    else if (*s >= '0' && *s <= '9')
+      v = *s - '0' + 52;
+    else if (*s == '-' || *s == '_')
+      v = *s == '-' ? 62 : 63;
+    else
+      return (size_t)-1;
+    bits = bits << 6 | (uint32_t)v;
+    nbits += 6;
+    if (nbits >= 8) {
+      nbits -= 8;
+      if (n == cap)
+        return (size_t)-1;
+      out[n++] = (unsigned char)(bits >> nbits);
+    }
+  }
+  return n;
+}
+
+/* an HTTP/1.1 request asked for h2c: it becomes stream 1 and is answered once the 101 is out. returns
+   HTTP_FAILURE when it didn't ask or asked wrongly, the request is then answered as HTTP/1.1 */
+int h2_upgrade(http_server* server, struct conn_info* conn) {
+  if (!server || !conn) {
+    HTTP_LOG(HTTP_LOGERR, "[h2_upgrade] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  http_request* req = &conn->request;
+  http_hdv* settings = http_headers_get(req->headers, "HTTP2-Settings");
+  if (req->version != HTTP_VERSION_1_1 || !settings || settings->next ||
+      !http_headers_has_token(req->headers, "Upgrade", "h2c") ||
+      !http_headers_has_token(req->headers, "Connection", "upgrade") ||
+      !http_headers_has_token(req->headers, "Connection", "HTTP2-Settings"))
+    return HTTP_FAILURE;
+  unsigned char payload[256];
+  size_t len = h2_base64url(settings->v, payload, sizeof(payload));
+  if (len == (size_t)-1 || len % 6 != 0)
+    return HTTP_FAILURE;
+  struct h2_conn* h2 = h2_new(server, conn);
+  if (!h2)
+    return HTTP_FAILURE;
+  struct h2_stream* stream = NULL;
+  conn->h2 = h2;
+  if (h2_settings(h2, payload, len) != H2_NO_ERROR || !(stream = h2_stream_new(h2, 1))) {
+    h2_detach(server, conn);
+    return HTTP_FAILURE;
+  }
+  h2->last_stream = 1;
+
+  /* the stream's request is a copy with the connection's own headers left behind */
+  http_request* copy = &stream->request;
+  size_t target = (size_t)(req->query - req->uri) + req->query_len + 1;
+  memcpy(copy->uri, req->uri, target);
+  copy->uri_len   = req->uri_len;
+  copy->query     = copy->uri + (req->query - req->uri);
+  copy->query_len = req->query_len;
+  copy->method    = req->method;
+  size_t max = HTTP_REQUEST_MAX_BODY_LEN(&server->constraints);
+  if (http_body_reserve(&copy->body, &copy->body_cap, req->body_len, max) == HTTP_FAILURE) {
+    h2_detach(server, conn);
+    return HTTP_FAILURE;
+  }
+  memcpy(copy->body, req->body, req->body_len);
+  copy->body_len  = req->body_len;
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  while (http_headers_next(req->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    if (http_headers_hop_by_hop(req->headers, key.v) || strcasecmp(key.v, "HTTP2-Settings") == 0 ||
+        strcasecmp(key.v, "Upgrade") == 0 || strcasecmp(key.v, "Connection") == 0)
+      continue;
+    for (; val; val = val->next)
+      http_headers_set(copy->headers, key.v, val->v);
+  }
+  stream->timing = conn->timing;
+
+  http_response* res = &conn->response;
+  http_response_set_status(res, HTTP_STATUS_101);
+  http_response_set_header(res, "Connection", "Upgrade");
+  http_response_set_header(res, "Upgrade", "h2c");
+  return HTTP_SUCCESS;
+}
+
+/* the connection speaks HTTP/2 from here: our settings go first, then the upgraded request's answer if
+   there is one, and whatever already arrived is read. a failed connection is dropped on its next step */
+int h2_open(http_server* server, struct conn_info* conn) {
+  struct h2_conn* h2 = conn->h2;
+  conn_info_mark(conn, CONN_UPGRADED, 1);
+  ++server->h2_conns;
+
+  unsigned char* p = h2_frame(h2, H2_SETTINGS, 0, 0, 18);
+  if (!p)
+    return HTTP_FAILURE;
+  const uint16_t ids[3] = { H2_SETTINGS_MAX_CONCURRENT_STREAMS, H2_SETTINGS_ENABLE_PUSH,
+                            H2_SETTINGS_MAX_HEADER_LIST_SIZE };
+  const uint32_t values[3] = { (uint32_t)server->constraints.h2_max_streams, 0,
+                               (uint32_t)HTTP_REQUEST_MAX_HEADER_LEN(&server->constraints) };
+  for (int i = 0; i < 3; ++i) {
+    p[6 * i]     = (unsigned char)(ids[i] >> 8);
+    p[6 * i + 1] = (unsigned char)ids[i];
+    h2_write32(p + 6 * i + 2, values[i]);
+  }
+  h2_window_update(h2, 0, H2_CONN_WINDOW - H2_WINDOW);
+  if (h2->streams_len)
+    h2_answer(h2, h2->streams[0]);
+  /* one recv can bring more than the input buffer holds */
+  for (size_t at = 0; at < conn->buff_len && !h2->closing && !h2->failed;) {
+    size_t len = MIN(conn->buff_len - at, H2_IN_LEN - h2->in_len);
+    memcpy(h2->in + h2->in_len, conn->buffer + at, len);
+    h2->in_len += len;
+    at         += len;
+    h2_parse(h2);
+  }
+  conn->buff_len = 0;
+  conn_info_shrink(conn);
+  h2_flush(h2);
+  return h2->failed ? HTTP_FAILURE : HTTP_SUCCESS;
+}
+
+/* reads and writes what the socket allows. HTTP_FAILURE means the connection is done with and goes */
+int h2_step(http_server* server, struct conn_info* conn, int readable, int writable) {
+  struct h2_conn* h2 = conn->h2;
+  size_t budget = HTTP_RECV_LEN(&server->constraints);
+  while (readable && !h2->closing && !h2->failed && budget > 0) {
+    size_t space = MIN(H2_IN_LEN - h2->in_len, budget);
+    int ret = conn_info_recv(conn, h2->in + h2->in_len, space);
+    ++server->stats.counters.recv_calls;
+    if (ret < 0) {
+      if (WOULD_BLOCK(GET_ERROR()))
+        break;
+      return HTTP_FAILURE;
+    }
+    if (ret == 0)
+      return HTTP_FAILURE;
+    h2->in_len += ret;
+    budget     -= ret;
+    server->stats.counters.bytes_in += ret;
+    h2_parse(h2);
+    if ((size_t)ret < space)
+      break;
+  }
+  if (writable || readable || h2->out_sent < h2->out_len)
+    h2_flush(h2);
+  if (h2->failed)
+    return HTTP_FAILURE;
+  /* after a GOAWAY either way, the connection lasts until what's owed is sent */
+  if ((h2->closing || ((h2->goaway_received || h2->draining) && h2->streams_len == 0)) &&
+      !conn_info_is(conn, CONN_WRITE_PENDING))
+    return HTTP_FAILURE;
+  return HTTP_SUCCESS;
+}
+
+/* the server is stopping: the client learns the last stream that will be answered, the connection goes once
+   those are */
+void h2_shutdown(http_server* server, struct conn_info* conn) {
+  struct h2_conn* h2 = conn->h2;
+  if (h2->closing || h2->draining)
+    return;
+  unsigned char* p = h2_frame(h2, H2_GOAWAY, 0, 0, 8);
+  if (p) {
+    h2_write32(p, h2->last_stream);
+    h2_write32(p + 4, H2_NO_ERROR);
+  }
+  h2->draining = 1;
+  h2_flush(h2);
+}
+
+void h2_detach(http_server* server, struct conn_info* conn) {
+  struct h2_conn* h2 = conn->h2;
+  if (!h2)
+    return;
+  if (conn_info_is(conn, CONN_UPGRADED))
+    --server->h2_conns;
+  while (h2->streams_len)
+    h2_stream_free(h2->streams[--h2->streams_len]);
+  while (h2->spare) {
+    struct h2_stream* next = h2->spare->next;
+    h2_stream_free(h2->spare);
+    h2->spare = next;
+  }
+  hpack_table_free(&h2->decoder);
+  free(h2->streams);
+  free(h2->block);
+  free(h2->scratch);
+  free(h2->in);
+  free(h2->out);
+  free(h2);
+  conn->h2            = NULL;
+  conn_info_mark(conn, CONN_UPGRADED | CONN_WRITE_PENDING, 0);
+}
@@ -0,0 +1,141 @@
+#ifndef H2_H_
+#define H2_H_
+#include "includes.h"
+#include "http_server.h"
+#include "hpack.h"
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEAD 9
+#define H2_FRAME_MAX 16384                      /* what we accept, the protocol's default */
+#define H2_IN_LEN (2 * (H2_FRAME_HEAD + H2_FRAME_MAX))
+#define H2_WINDOW 65535
+#define H2_CONN_WINDOW (1024 * 1024 * 16)       /* the connection's receive window, streams keep the default */
+#define H2_WINDOW_MAX 0x7fffffff
+#define H2_OUT_WATERMARK (1024 * 64)            /* DATA is scheduled until this much is queued */
+#define H2_MAX_BACKLOG (1024 * 1024 * 4)
+#define H2_SPARE_STREAMS 8
+#define H2_URGENCY_DEFAULT 3
+
+enum {
+  H2_DATA            = 0x0,
+  H2_HEADERS         = 0x1,
+  H2_PRIORITY        = 0x2,
+  H2_RST_STREAM      = 0x3,
+  H2_SETTINGS        = 0x4,
+  H2_PUSH_PROMISE    = 0x5,
+  H2_PING            = 0x6,
+  H2_GOAWAY          = 0x7,
+  H2_WINDOW_UPDATE   = 0x8,
+  H2_CONTINUATION    = 0x9,
+  H2_PRIORITY_UPDATE = 0x10
+};
+
+enum {
+  H2_FLAG_END_STREAM  = 0x1,
+  H2_FLAG_ACK         = 0x1,
+  H2_FLAG_END_HEADERS = 0x4,
+  H2_FLAG_PADDED      = 0x8,
+  H2_FLAG_PRIORITY    = 0x20
+};
+
+enum {
+  H2_SETTINGS_HEADER_TABLE_SIZE      = 0x1,
+  H2_SETTINGS_ENABLE_PUSH            = 0x2,
+  H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+  H2_SETTINGS_INITIAL_WINDOW_SIZE    = 0x4,
+  H2_SETTINGS_MAX_FRAME_SIZE         = 0x5,
+  H2_SETTINGS_MAX_HEADER_LIST_SIZE   = 0x6
+};
+
+enum {
+  H2_NO_ERROR          = 0x0,
+  H2_PROTOCOL_ERROR    = 0x1,
+  H2_INTERNAL_ERROR    = 0x2,
+  H2_FLOW_CONTROL_ERROR = 0x3,
+  H2_STREAM_CLOSED     = 0x5,
+  H2_FRAME_SIZE_ERROR  = 0x6,
+  H2_REFUSED_STREAM    = 0x7,
+  H2_CANCEL            = 0x8,
+  H2_COMPRESSION_ERROR = 0x9
+};
+
+enum {
+  H2_PREFACE_NONE,
+  H2_PREFACE_PARTIAL,
+  H2_PREFACE_FULL
+};
+
+enum {
+  H2_STREAM_OPEN,       /* the request is still arriving                 */
+  H2_STREAM_SENDING,    /* answered, the body goes out as windows allow */
+};
+
+/* one request/response exchange. the request and response are the ones handlers know, so the handler API
+   doesn't change */
+struct h2_stream {
+  uint32_t id;
+  char     state;
+  char     urgency;
+  char     incremental;
+  char     too_large;
+  char     eof;
+  int64_t  send_window;
+  int64_t  recv_window;
+  size_t   sent;
+  size_t   bytes;
+  struct http_timing timing;
+  http_request  request;
+  http_response response;
+  struct h2_stream* next;
+};
+
+struct h2_conn {
+  http_server* server;
+  size_t   index;
+  char     preface;
+  char     settings_seen;
+  char     closing;
+  char     goaway_received;
+  char     draining;
+  char     failed;
+  uint32_t last_stream;
+  uint32_t scheduled;
+  int64_t  send_window;
+  int64_t  recv_window;
+  uint32_t peer_window;
+  uint32_t peer_frame;
+
+  struct hpack_table decoder;
+  char*    scratch;
+  size_t   scratch_len;
+  // a header block waiting for its CONTINUATION frames
+  unsigned char* block;
+  size_t   block_len;
+  size_t   block_cap;
+  uint32_t block_stream;
+  uint8_t  block_flags;
+
+  struct h2_stream** streams;
+  size_t   streams_len;
+  size_t   streams_cap;
+  struct h2_stream* spare;
+  size_t   spare_len;
+
+  char*    in;
+  size_t   in_len;
+  char*    out;
+  size_t   out_len;
+  size_t   out_sent;
+  size_t   out_cap;
+};
+
+// internal use, driven by the server's event loop
+int h2_preface(const char*, size_t);
+int h2_start(http_server*, struct conn_info*);
+int h2_upgrade(http_server*, struct conn_info*);
+int h2_open(http_server*, struct conn_info*);
+int h2_step(http_server*, struct conn_info*, int, int);
+void h2_shutdown(http_server*, struct conn_info*);
+void h2_detach(http_server*, struct conn_info*);
+
+#endif
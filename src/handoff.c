@@ -0,0 +1,149 @@
+#include "handoff.h"
+#ifndef _WIN32
+#include <sys/un.h>
+
+static int handoff_addr(const char* path, struct sockaddr_un* addr) {
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    HTTP_LOG(HTTP_LOGERR, "[handoff_addr] invalid arguments - the path is too long.\n");
+    return HTTP_FAILURE;
+  }
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  return HTTP_SUCCESS;
+}
+
+/* the socket the next process connects to. a stale one from a process that's gone is replaced */
+SOCKET handoff_open(const char* path) {
+  struct sockaddr_un addr;
+  if (handoff_addr(path, &addr) == HTTP_FAILURE)
+    return INVALID_SOCKET;
+  SOCKET control = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (control < 0) {
+    HTTP_LOG(HTTP_LOGERR, "[handoff_open] socket() failed - %d.\n", GET_ERROR());
+    return INVALID_SOCKET;
+  }
+  unlink(path);
+  if (bind(control, (struct sockaddr*)&addr, sizeof(addr)) || listen(control, 4) ||
+      http_socket_set_nonblocking(control) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[handoff_open] couldn't listen on %s - %d.\n", path, GET_ERROR());
+    CLOSE_SOCKET(control);
+    return INVALID_SOCKET;
+  }
+  return control;
+}
+
+/* hands the 'len' listeners to a process waiting on 'control'. HTTP_FAILURE when none was waiting or the pass
+   failed, the listeners are still ours then */
+int handoff_give(SOCKET control, const SOCKET* listeners, size_t len) {
+  if (len == 0 || len > HANDOFF_MAX_SOCKETS)
+    return HTTP_FAILURE;
+  SOCKET peer = accept(control, NULL, NULL);
+  if (peer < 0)
+    return HTTP_FAILURE;
+  /* the accepted socket may inherit the control socket's non-blocking mode, one byte fits its buffer anyway */
+  char tag = 'L';
+  struct iovec iov = { &tag, 1 };
+  union {
+    struct cmsghdr align;
+    char data[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKETS)];
+  } control_data;
+  memset(&control_data, 0, sizeof(control_data));
+  struct msghdr msg = { 0 };
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control_data.data;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * len);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * len);
+  for (size_t i = 0; i < len; ++i) {
+    int fd = (int)listeners[i];
+    memcpy(CMSG_DATA(cmsg) + i * sizeof(int), &fd, sizeof(int));
+  }
+  int ret = sendmsg(peer, &msg, SEND_FLAGS) == 1 ? HTTP_SUCCESS : HTTP_FAILURE;
+  if (ret == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[handoff_give] sendmsg() failed - %d.\n", GET_ERROR());
+  }
+  CLOSE_SOCKET(peer);
+  return ret;
+}
+
+/* asks the process serving 'path' for its listeners, up to 'cap' of them land in 'listeners'. 0 when nobody
+   is there, the caller then binds its own */
+size_t handoff_take(const char* path, SOCKET* listeners, size_t cap) {
+  struct sockaddr_un addr;
+  if (handoff_addr(path, &addr) == HTTP_FAILURE)
+    return 0;
+  SOCKET peer = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (peer < 0)
+    return 0;
+  struct timeval timeout = { HANDOFF_TIMEOUT_MS / 1000, HANDOFF_TIMEOUT_MS % 1000 * 1000 };
+  setsockopt(peer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (connect(peer, (struct sockaddr*)&addr, sizeof(addr))) {
+    CLOSE_SOCKET(peer);
+    return 0;
+  }
+  char tag = 0;
+  struct iovec iov = { &tag, 1 };
+  union {
+    struct cmsghdr align;
+    char data[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_SOCKETS)];
+  } control_data;
+  struct msghdr msg = { 0 };
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control_data.data;
+  msg.msg_controllen = sizeof(control_data.data);
+  ssize_t ret = recvmsg(peer, &msg, 0);
+  CLOSE_SOCKET(peer);
+  struct cmsghdr* cmsg = ret == 1 && tag == 'L' ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len < CMSG_LEN(0)) {
+    HTTP_LOG(HTTP_LOGERR, "[handoff_take] no listener came from %s.\n", path);
+    return 0;
+  }
+  size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int), len = 0;
+  for (size_t i = 0; i < received; ++i) {
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+    int accepting = 0;
+    socklen_t opt_len = sizeof(accepting);
+    if (len == cap || getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &opt_len) || !accepting) {
+      HTTP_LOG(HTTP_LOGERR, "[handoff_take] dropped a socket from %s that isn't a listener or doesn't fit.\n", path);
+      CLOSE_SOCKET(fd);
+      continue;
+    }
+    listeners[len++] = fd;
+  }
+  return len;
+}
+
+/* the path stays when the listener was handed over, by then it's the next process' */
+void handoff_close(SOCKET control, const char* path, int handed_over) {
+  if (control == INVALID_SOCKET)
+    return;
+  CLOSE_SOCKET(control);
+  if (!handed_over)
+    unlink(path);
+}
+
+#else
+
+SOCKET handoff_open(const char* path) {
+  HTTP_LOG(HTTP_LOGERR, "[handoff_open] listening sockets can't be handed over on this system.\n");
+  return INVALID_SOCKET;
+}
+
+int handoff_give(SOCKET control, const SOCKET* listeners, size_t len) {
+  return HTTP_FAILURE;
+}
+
+size_t handoff_take(const char* path, SOCKET* listeners, size_t cap) {
+  return 0;
+}
+
+void handoff_close(SOCKET control, const char* path, int handed_over) {
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+#include "includes.h"
+#define HANDOFF_TIMEOUT_MS 5000                 /* how long a new process waits for the running one to answer */
+#define HANDOFF_MAX_SOCKETS 8
+
+/* passes the listening sockets from a running process to the one replacing it over a Unix socket, so they
+   never stop accepting. only on POSIX systems, elsewhere nothing is ever handed over */
+SOCKET handoff_open(const char*);
+int handoff_give(SOCKET, const SOCKET*, size_t);
+size_t handoff_take(const char*, SOCKET*, size_t);
+void handoff_close(SOCKET, const char*, int);
+
+#endif
@@ -0,0 +1,93 @@
+#include "histogram.h"
+
+static int histogram_msb(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(v);
+#else
+  int bit = 0;
+  while (v >>= 1) ++bit;
+  return bit;
+#endif
+}
+
+static size_t histogram_index(uint64_t v) {
+  const uint64_t linear = 2 << HISTOGRAM_SUB_BITS;
+  if (v < linear)
+    return (size_t)v;
+  int shift = histogram_msb(v) - HISTOGRAM_SUB_BITS;
+  if (shift > HISTOGRAM_MAX_SHIFT)
+    return HISTOGRAM_BUCKETS - 1;
+  size_t sub = (size_t)(v >> shift) - (1 << HISTOGRAM_SUB_BITS);
+  return (size_t)linear + (size_t)(shift - 1) * (1 << HISTOGRAM_SUB_BITS) + sub;
+}
+
+/* the highest value that still lands in the bucket, so percentiles never under-report */
+static uint64_t histogram_value(size_t index) {
+  const size_t linear = 2 << HISTOGRAM_SUB_BITS;
+  if (index < linear)
+    return index;
+  int shift = (int)((index - linear) >> HISTOGRAM_SUB_BITS) + 1;
+  uint64_t sub = ((index - linear) & ((1 << HISTOGRAM_SUB_BITS) - 1)) + (1 << HISTOGRAM_SUB_BITS);
+  return ((sub + 1) << shift) - 1;
+}
+
+void histogram_reset(struct histogram* h) {
+  memset(h, 0, sizeof(*h));
+  h->min = UINT64_MAX;
+}
+
+void histogram_record(struct histogram* h, uint64_t v) {
+  ++h->counts[histogram_index(v)];
+  ++h->count;
+  h->sum += v;
+  if (v < h->min) h->min = v;
+  if (v > h->max) h->max = v;
+}
+
+void histogram_merge(struct histogram* dst, const struct histogram* src) {
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    dst->counts[i] += src->counts[i];
+  dst->count += src->count;
+  dst->sum   += src->sum;
+  if (src->min < dst->min) dst->min = src->min;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t histogram_percentile(const struct histogram* h, double percentile) {
+  if (h->count == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(percentile / 100.0 * (double)h->count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > h->count) rank = h->count;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    seen += h->counts[i];
+    if (seen >= rank)
+      return MIN(histogram_value(i), h->max);
+  }
+  return h->max;
+}
+
+/* how many values fall at or below each of the ascending bounds, in a single pass over the buckets */
+void histogram_cumulative(const struct histogram* h, const uint64_t* bounds, size_t len, uint64_t* counts) {
+  uint64_t seen = 0;
+  size_t bound = 0;
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS && bound < len; ++i) {
+    if (!h->counts[i])
+      continue;
+    uint64_t value = histogram_value(i);
+    while (bound < len && bounds[bound] < value)
+      counts[bound++] = seen;
+    seen += h->counts[i];
+  }
+  while (bound < len)
+    counts[bound++] = seen;
+}
+
+uint64_t histogram_count(const struct histogram* h) {
+  return h->count;
+}
+
+uint64_t histogram_mean(const struct histogram* h) {
+  return h->count ? h->sum / h->count : 0;
+}
@@ -0,0 +1,26 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+#include "includes.h"
+
+/* log-linear buckets: exact below 128, then 64 sub-buckets per power of two (~1.6% error) */
+#define HISTOGRAM_SUB_BITS 6
+#define HISTOGRAM_MAX_SHIFT 34
+#define HISTOGRAM_BUCKETS ((2 << HISTOGRAM_SUB_BITS) + HISTOGRAM_MAX_SHIFT * (1 << HISTOGRAM_SUB_BITS))
+
+struct histogram {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+void histogram_reset(struct histogram*);
+void histogram_record(struct histogram*, uint64_t);
+void histogram_merge(struct histogram*, const struct histogram*);
+uint64_t histogram_percentile(const struct histogram*, double);
+uint64_t histogram_count(const struct histogram*);
+void histogram_cumulative(const struct histogram*, const uint64_t*, size_t, uint64_t*);
+uint64_t histogram_mean(const struct histogram*);
+
+#endif
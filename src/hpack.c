@@ -0,0 +1,418 @@
+#include "hpack.h"
+
+static const struct {
+  const char* name;
+  const char* value;
+} hpack_static[HPACK_STATIC_LEN + 1] = {
+  { NULL, NULL },
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" },
+};
+
+/* the canonical Huffman code of RFC 7541 appendix B: symbols ordered by code length, and for every length
+   the first code and where its symbols start */
+static const uint16_t hpack_huff_symbols[257] = {
+   48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,
+   45,  46,  47,  51,  52,  53,  54,  55,  56,  57,  61,  65,
+   95,  98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+   58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+   77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+  106, 107, 113, 118, 119, 120, 121, 122,  38,  42,  44,  59,
+   88,  90,  33,  34,  40,  41,  63,  39,  43, 124,  35,  62,
+    0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+  167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+  132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+  173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+  233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+  151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+  183, 188, 191, 197, 231, 239,   9, 142, 144, 145, 148, 159,
+  171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+  200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+  255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+  246, 247, 248, 250, 251, 252, 253, 254,   2,   3,   4,   5,
+    6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+   21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220,
+  249,  10,  13,  22, 256
+};
+
+static const uint32_t hpack_huff_first[31] = {
+  0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+  0x00000014, 0x0000005c, 0x000000f8, 0x000001fc, 0x000003f8, 0x000007fa,
+  0x00000ffa, 0x00001ff8, 0x00003ffc, 0x00007ffc, 0x0000fffe, 0x0001fffc,
+  0x0003fff8, 0x0007fff0, 0x000fffe6, 0x001fffdc, 0x003fffd2, 0x007fffd8,
+  0x00ffffea, 0x01ffffec, 0x03ffffe0, 0x07ffffde, 0x0fffffe2, 0x1ffffffe,
+  0x3ffffffc
+};
+
+static const uint16_t hpack_huff_count[31] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+  0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const uint16_t hpack_huff_offset[31] = {
+  0, 0, 0, 0, 0, 0, 10, 36, 68, 74, 74, 79, 82, 84, 90, 92,
+  95, 95, 95, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 253, 253
+};
+
+struct hpack_table hpack_table_make(size_t limit) {
+  struct hpack_table table = { 0 };
+  table.data     = NULL;
+  table.head     = 0;
+  table.len      = 0;
+  table.cap      = 0;
+  table.size     = 0;
+  table.max_size = limit;
+  table.limit    = limit;
+  return table;
+}
+
+int hpack_table_free(struct hpack_table* table) {
+  if (!table) {
+    HTTP_LOG(HTTP_LOGERR, "[hpack_table_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  for (size_t i = 0; i < table->len; ++i)
+    free(table->data[(table->head + i) % table->cap].name);
+  free(table->data);
+  table->data = NULL;
+  table->len  = 0;
+  table->cap  = 0;
+  table->size = 0;
+  return HTTP_SUCCESS;
+}
+
+static void hpack_evict(struct hpack_table* table, size_t max) {
+  while (table->len && table->size > max) {
+    struct hpack_entry* oldest = &table->data[(table->head + table->len - 1) % table->cap];
+    table->size -= oldest->name_len + oldest->value_len + 32;
+    free(oldest->name);
+    --table->len;
+  }
+}
+
+/* the entry is copied before anything is evicted, its name may live in an entry that goes */
+static int hpack_insert(struct hpack_table* table, const char* name, size_t name_len, const char* value,
+                        size_t value_len) {
+  size_t size = name_len + value_len + 32;
+  if (size > table->max_size) {
+    hpack_evict(table, 0);
+    return HTTP_SUCCESS;
+  }
+  char* data = malloc(name_len + value_len + 2);
+  if (!data) {
+    HTTP_LOG(HTTP_LOGERR, "[hpack_insert] failed to allocate memory.\n");
+    return HTTP_FAILURE;
+  }
+  memcpy(data, name, name_len);
+  data[name_len] = 0;
+  memcpy(data + name_len + 1, value, value_len);
+  data[name_len + 1 + value_len] = 0;
+  hpack_evict(table, table->max_size - size);
+  if (table->len == table->cap) {
+    size_t cap = table->cap ? table->cap * 2 : 16;
+    struct hpack_entry* entries = malloc(cap * sizeof(struct hpack_entry));
+    if (!entries) {
+      HTTP_LOG(HTTP_LOGERR, "[hpack_insert] failed to allocate memory.\n");
+      free(data);
+      return HTTP_FAILURE;
+    }
+    for (size_t i = 0; i < table->len; ++i)
+      entries[i] = table->data[(table->head + i) % table->cap];
+    free(table->data);
+    table->data = entries;
+    table->cap  = cap;
+    table->head = 0;
+  }
+  table->head = (table->head + table->cap - 1) % table->cap;
+  struct hpack_entry* entry = &table->data[table->head];
+  entry->name      = data;
+  entry->name_len  = name_len;
+  entry->value     = data + name_len + 1;
+  entry->value_len = value_len;
+  table->size += size;
+  ++table->len;
+  return HTTP_SUCCESS;
+}
+
+static int hpack_lookup(struct hpack_table* table, size_t index, const char** name, size_t* name_len,
+                        const char** value, size_t* value_len) {
+  if (index == 0)
+    return HTTP_FAILURE;
+  if (index <= HPACK_STATIC_LEN) {
+    *name      = hpack_static[index].name;
+    *name_len  = strlen(*name);
+    *value     = hpack_static[index].value;
+    *value_len = strlen(*value);
+    return HTTP_SUCCESS;
+  }
+  index -= HPACK_STATIC_LEN + 1;
+  if (index >= table->len)
+    return HTTP_FAILURE;
+  struct hpack_entry* entry = &table->data[(table->head + index) % table->cap];
+  *name      = entry->name;
+  *name_len  = entry->name_len;
+  *value     = entry->value;
+  *value_len = entry->value_len;
+  return HTTP_SUCCESS;
+}
+
+static int hpack_int(const unsigned char** p, const unsigned char* end, int prefix, size_t* out) {
+  const size_t max = ((size_t)1 << prefix) - 1;
+  size_t value = *(*p)++ & max;
+  if (value < max) {
+    *out = value;
+    return HTTP_SUCCESS;
+  }
+  for (int shift = 0; *p < end && shift <= 28; shift += 7) {
+    unsigned char b = *(*p)++;
+    value += (size_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *out = value;
+      return HTTP_SUCCESS;
+    }
+  }
+  return HTTP_FAILURE;
+}
+
+/* the code is canonical, so the codes of one length are a contiguous range starting at its first code */
+static int hpack_huffman(const unsigned char* p, size_t len, char* out, size_t cap, size_t* out_len) {
+  uint64_t bits = 0;
+  int nbits = 0;
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i) {
+    bits = bits << 8 | p[i];
+    nbits += 8;
+    while (nbits >= 5) {
+      int found = 0;
+      for (int l = 5; l <= 30 && l <= nbits; ++l) {
+        uint32_t code = (uint32_t)(bits >> (nbits - l)) & (((uint32_t)1 << l) - 1);
+        if (code - hpack_huff_first[l] < hpack_huff_count[l]) {
+          uint16_t symbol = hpack_huff_symbols[hpack_huff_offset[l] + code - hpack_huff_first[l]];
+          /* EOS is never part of a string */
+          if (symbol == 256 || n + 1 >= cap)
+            return HTTP_FAILURE;
+          out[n++] = (char)symbol;
+          nbits -= l;
+          bits &= ((uint64_t)1 << nbits) - 1;
+          found = 1;
+          break;
+        }
+      }
+      if (!found) {
+        if (nbits >= 30)
+          return HTTP_FAILURE;
+        break;
+      }
+    }
+  }
+  /* padding is the shortest prefix of EOS: fewer than eight one bits */
+  if (nbits > 7 || bits != (((uint64_t)1 << nbits) - 1))
+    return HTTP_FAILURE;
+  *out_len = n;
+  return HTTP_SUCCESS;
+}
+
+static int hpack_string(const unsigned char** p, const unsigned char* end, char* out, size_t cap, size_t* out_len) {
+  if (*p >= end)
+    return HTTP_FAILURE;
+  int huffman = **p & 0x80;
+  size_t len;
+  if (hpack_int(p, end, 7, &len) == HTTP_FAILURE || len > (size_t)(end - *p))
+    return HTTP_FAILURE;
+  if (huffman) {
+    if (hpack_huffman(*p, len, out, cap, out_len) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+  }
+  else {
+    if (len + 1 > cap)
+      return HTTP_FAILURE;
+    memcpy(out, *p, len);
+    *out_len = len;
+  }
+  out[*out_len] = 0;
+  *p += len;
+  return HTTP_SUCCESS;
+}
+
+/* decodes a whole header block, strings are unpacked into 'scratch'. any failure is a compression error,
+   the table can't be trusted after it */
+int hpack_decode(struct hpack_table* table, const unsigned char* block, size_t len, char* scratch, size_t scratch_len,
+                 hpack_emit emit, void* ud) {
+  if (!table || (!block && len) || !scratch || !emit) {
+    HTTP_LOG(HTTP_LOGERR, "[hpack_decode] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  const unsigned char* p = block;
+  const unsigned char* end = block + len;
+  int fields = 0;
+  while (p < end) {
+    unsigned char b = *p;
+    size_t index;
+    const char* name;
+    const char* value;
+    size_t name_len, value_len;
+    if (b & 0x80) {
+      if (hpack_int(&p, end, 7, &index) == HTTP_FAILURE ||
+          hpack_lookup(table, index, &name, &name_len, &value, &value_len) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      if (emit(ud, name, name_len, value, value_len) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      ++fields;
+      continue;
+    }
+    if ((b & 0xe0) == 0x20) {
+      /* size updates only come first in a block */
+      size_t size;
+      if (fields || hpack_int(&p, end, 5, &size) == HTTP_FAILURE || size > table->limit)
+        return HTTP_FAILURE;
+      table->max_size = size;
+      hpack_evict(table, size);
+      continue;
+    }
+    int indexing = (b & 0xc0) == 0x40;
+    if (hpack_int(&p, end, indexing ? 6 : 4, &index) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+    size_t used = 0;
+    if (index) {
+      const char* ignored;
+      size_t ignored_len;
+      if (hpack_lookup(table, index, &name, &name_len, &ignored, &ignored_len) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+    }
+    else {
+      if (hpack_string(&p, end, scratch, scratch_len, &name_len) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      name = scratch;
+      used = name_len + 1;
+    }
+    if (hpack_string(&p, end, scratch + used, scratch_len - used, &value_len) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+    value = scratch + used;
+    if (emit(ud, name, name_len, value, value_len) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+    if (indexing && hpack_insert(table, name, name_len, value, value_len) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+    ++fields;
+  }
+  return HTTP_SUCCESS;
+}
+
+static size_t hpack_encode_int(unsigned char* out, unsigned char flags, int prefix, size_t value) {
+  const size_t max = ((size_t)1 << prefix) - 1;
+  if (value < max) {
+    out[0] = (unsigned char)(flags | value);
+    return 1;
+  }
+  size_t n = 0;
+  out[n++] = (unsigned char)(flags | max);
+  value -= max;
+  while (value >= 0x80) {
+    out[n++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (unsigned char)value;
+  return n;
+}
+
+static size_t hpack_encode_string(unsigned char* out, const char* s, size_t len, int lower) {
+  size_t n = hpack_encode_int(out, 0, 7, len);
+  for (size_t i = 0; i < len; ++i)
+    out[n + i] = lower ? (unsigned char)tolower((unsigned char)s[i]) : (unsigned char)s[i];
+  return n + len;
+}
+
+/* ':status' for the given code, indexed when the static table has it */
+size_t hpack_encode_status(unsigned char* out, int code) {
+  if (!out) {
+    HTTP_LOG(HTTP_LOGERR, "[hpack_encode_status] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  char digits[8];
+  snprintf(digits, sizeof(digits), "%03u", (unsigned)code % 1000);
+  for (int i = 8; i <= 14; ++i) {
+    if (strcmp(hpack_static[i].value, digits) == 0)
+      return hpack_encode_int(out, 0x80, 7, i);
+  }
+  size_t n = hpack_encode_int(out, 0x00, 4, 8);
+  return n + hpack_encode_string(out + n, digits, 3, 0);
+}
+
+/* a literal never added to the peer's table, the name lowercased and indexed when the static table has it.
+   writes at most HPACK_FIELD_BOUND() bytes */
+size_t hpack_encode_field(unsigned char* out, const char* name, size_t name_len, const char* value, size_t value_len) {
+  if (!out || !name || !value) {
+    HTTP_LOG(HTTP_LOGERR, "[hpack_encode_field] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  size_t index = 0;
+  for (size_t i = 15; i <= HPACK_STATIC_LEN; ++i) {
+    if (strlen(hpack_static[i].name) == name_len && strncasecmp(hpack_static[i].name, name, name_len) == 0) {
+      index = i;
+      break;
+    }
+  }
+  size_t n = hpack_encode_int(out, 0x00, 4, index);
+  if (!index)
+    n += hpack_encode_string(out + n, name, name_len, 1);
+  return n + hpack_encode_string(out + n, value, value_len, 0);
+}
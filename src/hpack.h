@@ -0,0 +1,36 @@
+#ifndef HPACK_H_
+#define HPACK_H_
+#include "includes.h"
+#define HPACK_TABLE_SIZE 4096
+#define HPACK_STATIC_LEN 61
+/* the most a header field takes encoded, literals are never Huffman coded */
+#define HPACK_FIELD_BOUND(name_len, value_len) ((name_len) + (value_len) + 16)
+
+struct hpack_entry {
+  char*  name;
+  size_t name_len;
+  char*  value;
+  size_t value_len;
+};
+
+/* the decoder's dynamic table: a ring with the newest entry at 'head', sized as RFC 7541 counts it */
+struct hpack_table {
+  struct hpack_entry* data;
+  size_t head;
+  size_t len;
+  size_t cap;
+  size_t size;
+  size_t max_size;
+  size_t limit;
+};
+
+/* gets every decoded field, both strings are NUL-terminated and only valid during the call */
+typedef int (*hpack_emit) (void*, const char*, size_t, const char*, size_t);
+
+struct hpack_table hpack_table_make(size_t);
+int hpack_table_free(struct hpack_table*);
+int hpack_decode(struct hpack_table*, const unsigned char*, size_t, char*, size_t, hpack_emit, void*);
+size_t hpack_encode_status(unsigned char*, int);
+size_t hpack_encode_field(unsigned char*, const char*, size_t, const char*, size_t);
+
+#endif
@@ -0,0 +1,444 @@
+#include "http_cache.h"
+#include "http_memory.h"
+#define CACHE_INITIAL_BUCKETS 64
+
+static uint64_t http_cache_hash(const char* key, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char)key[i];
+    h *= 0x100000001b3ull;
+  }
+  /* FNV barely touches the high bits for keys that differ at the end, they pick the shard */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+http_cache* http_cache_new(size_t max_bytes, size_t shards) {
+  if (max_bytes == 0) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_new] invalid arguments - the cache needs room.\n");
+    return NULL;
+  }
+  if (shards == 0)
+    shards = HTTP_CACHE_SHARDS;
+  http_cache* cache = (http_cache*)calloc(1, sizeof(http_cache));
+  if (!cache) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_new] failed to allocate memory.\n");
+    return NULL;
+  }
+  cache->shards = (struct http_cache_shard*)calloc(shards, sizeof(struct http_cache_shard));
+  if (!cache->shards) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_new] failed to allocate memory.\n");
+    free(cache);
+    return NULL;
+  }
+  cache->shard_bytes = MAX(max_bytes / shards, 1);
+  for (; cache->shards_len < shards; ++cache->shards_len) {
+    struct http_cache_shard* shard = &cache->shards[cache->shards_len];
+    shard->buckets = (struct http_cache_entry**)calloc(CACHE_INITIAL_BUCKETS, sizeof(struct http_cache_entry*));
+    if (!shard->buckets || CACHE_LOCK_INIT(&shard->lock) != 0) {
+      HTTP_LOG(HTTP_LOGERR, "[http_cache_new] failed to set up a shard.\n");
+      free(shard->buckets);
+      http_cache_free(cache);
+      return NULL;
+    }
+    shard->cap = CACHE_INITIAL_BUCKETS;
+  }
+  return cache;
+}
+
+/* 'size' is only set once the entry is stored, that's when it was accounted */
+static void http_cache_entry_free(struct http_cache_entry* entry) {
+  http_memory_sub(MEMORY_CACHES, entry->size);
+  free(entry->head);
+  free(entry);
+}
+
+/* the servers using the cache have to be gone, entries still pinned by their connections are freed too */
+int http_cache_free(http_cache* cache) {
+  if (!cache) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  for (size_t i = 0; i < cache->shards_len; ++i) {
+    struct http_cache_shard* shard = &cache->shards[i];
+    for (size_t j = 0; j < shard->cap; ++j) {
+      struct http_cache_entry* entry = shard->buckets[j];
+      while (entry) {
+        struct http_cache_entry* next = entry->next;
+        http_cache_entry_free(entry);
+        entry = next;
+      }
+    }
+    free(shard->buckets);
+    CACHE_LOCK_FREE(&shard->lock);
+  }
+  free(cache->shards);
+  free(cache);
+  return HTTP_SUCCESS;
+}
+
+/* adds a request header whose value is part of the key. responses that vary on a header not named
+   here aren't stored */
+int http_cache_vary(http_cache* cache, const char* header) {
+  if (!cache || !header) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_vary] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (cache->vary_len == HTTP_CACHE_MAX_VARY) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_vary] too many headers.\n");
+    return HTTP_FAILURE;
+  }
+  cache->vary[cache->vary_len++] = header;
+  return HTTP_SUCCESS;
+}
+
+size_t http_cache_bytes(http_cache* cache) {
+  if (!cache) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_bytes] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  size_t bytes = 0;
+  for (size_t i = 0; i < cache->shards_len; ++i) {
+    struct http_cache_shard* shard = &cache->shards[i];
+    CACHE_LOCK(&shard->lock);
+    bytes += shard->bytes;
+    CACHE_UNLOCK(&shard->lock);
+  }
+  return bytes;
+}
+
+/* the method (HEAD is served from GET), the normalized path, the raw query and the values of the
+   vary headers. 0 when it doesn't fit */
+static size_t http_cache_key(http_cache* cache, http_request* req, char* key) {
+  size_t n = 0;
+  size_t need = 4 + req->uri_len + 1 + req->query_len;
+  if (need > HTTP_CACHE_KEY_LEN)
+    return 0;
+  memcpy(key, "GET ", 4);
+  n += 4;
+  memcpy(key + n, req->uri, req->uri_len);
+  n += req->uri_len;
+  if (req->query_len) {
+    key[n++] = '?';
+    memcpy(key + n, req->query, req->query_len);
+    n += req->query_len;
+  }
+  for (size_t i = 0; i < cache->vary_len; ++i) {
+    if (n == HTTP_CACHE_KEY_LEN)
+      return 0;
+    key[n++] = '\n';
+    for (http_hdv* val = http_headers_get(req->headers, cache->vary[i]); val; val = val->next) {
+      if (n + val->len + 1 > HTTP_CACHE_KEY_LEN)
+        return 0;
+      memcpy(key + n, val->v, val->len);
+      n += val->len;
+      key[n++] = ',';
+    }
+  }
+  return n;
+}
+
+static void http_cache_lru_remove(struct http_cache_shard* shard, struct http_cache_entry* entry) {
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    shard->newest = entry->older;
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    shard->oldest = entry->newer;
+  entry->newer = entry->older = NULL;
+}
+
+static void http_cache_lru_push(struct http_cache_shard* shard, struct http_cache_entry* entry) {
+  entry->newer = NULL;
+  entry->older = shard->newest;
+  if (shard->newest)
+    shard->newest->newer = entry;
+  else
+    shard->oldest = entry;
+  shard->newest = entry;
+}
+
+/* takes the entry out of the table, it's freed now unless a connection still holds it. the shard is locked */
+static void http_cache_unlink(struct http_cache_shard* shard, struct http_cache_entry* entry) {
+  struct http_cache_entry** link = &shard->buckets[entry->hash & (shard->cap - 1)];
+  while (*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+  entry->next = NULL;
+  if (entry->state == CACHE_ENTRY_READY) {
+    http_cache_lru_remove(shard, entry);
+    shard->bytes -= entry->size;
+  }
+  entry->linked = 0;
+  --shard->len;
+  if (entry->refs == 0) {
+    http_cache_entry_free(entry);
+  }
+}
+
+static void http_cache_grow(struct http_cache_shard* shard) {
+  size_t cap = shard->cap * 2;
+  struct http_cache_entry** buckets = (struct http_cache_entry**)calloc(cap, sizeof(struct http_cache_entry*));
+  if (!buckets)
+    return;
+  for (size_t i = 0; i < shard->cap; ++i) {
+    struct http_cache_entry* entry = shard->buckets[i];
+    while (entry) {
+      struct http_cache_entry* next = entry->next;
+      entry->next = buckets[entry->hash & (cap - 1)];
+      buckets[entry->hash & (cap - 1)] = entry;
+      entry = next;
+    }
+  }
+  free(shard->buckets);
+  shard->buckets = buckets;
+  shard->cap     = cap;
+}
+
+/* finds the response for 'req'. on a hit or a wait 'out' is pinned, on a miss it's a new pending entry
+   the caller fills or abandons once it answered. only GET misses are collapsed */
+int http_cache_lookup(http_cache* cache, http_request* req, uint64_t now, struct http_cache_entry** out) {
+  if (!cache || !req || !out) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_lookup] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_CACHE_BYPASS;
+  }
+  *out = NULL;
+  if (req->method != METHOD_GET && req->method != METHOD_HEAD)
+    return HTTP_CACHE_BYPASS;
+  if (http_headers_get(req->headers, "Authorization") ||
+      http_headers_has_token(req->headers, "Cache-Control", "no-cache") ||
+      http_headers_has_token(req->headers, "Cache-Control", "no-store") ||
+      http_headers_has_token(req->headers, "Pragma", "no-cache"))
+    return HTTP_CACHE_BYPASS;
+
+  char key[HTTP_CACHE_KEY_LEN];
+  size_t key_len = http_cache_key(cache, req, key);
+  if (key_len == 0)
+    return HTTP_CACHE_BYPASS;
+  uint64_t hash = http_cache_hash(key, key_len);
+  struct http_cache_shard* shard = &cache->shards[(hash >> 32) % cache->shards_len];
+
+  CACHE_LOCK(&shard->lock);
+  struct http_cache_entry* entry = shard->buckets[hash & (shard->cap - 1)];
+  while (entry && (entry->hash != hash || entry->key_len != key_len || memcmp(entry->key, key, key_len) != 0))
+    entry = entry->next;
+  if (entry && entry->state == CACHE_ENTRY_READY && entry->expires <= now) {
+    http_cache_unlink(shard, entry);
+    entry = NULL;
+  }
+  if (entry) {
+    ++entry->refs;
+    int ret = HTTP_CACHE_WAIT;
+    if (entry->state == CACHE_ENTRY_READY) {
+      http_cache_lru_remove(shard, entry);
+      http_cache_lru_push(shard, entry);
+      ret = HTTP_CACHE_HIT;
+    }
+    CACHE_UNLOCK(&shard->lock);
+    *out = entry;
+    return ret;
+  }
+  if (req->method != METHOD_GET) {
+    CACHE_UNLOCK(&shard->lock);
+    return HTTP_CACHE_BYPASS;
+  }
+
+  entry = (struct http_cache_entry*)calloc(1, sizeof(struct http_cache_entry) + key_len);
+  if (!entry) {
+    CACHE_UNLOCK(&shard->lock);
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_lookup] failed to allocate memory.\n");
+    return HTTP_CACHE_BYPASS;
+  }
+  entry->shard   = shard;
+  entry->hash    = hash;
+  entry->refs    = 1;
+  entry->state   = CACHE_ENTRY_PENDING;
+  entry->linked  = 1;
+  entry->key_len = key_len;
+  memcpy(entry->key, key, key_len);
+  struct http_cache_entry** bucket = &shard->buckets[hash & (shard->cap - 1)];
+  entry->next = *bucket;
+  *bucket = entry;
+  if (++shard->len > shard->cap)
+    http_cache_grow(shard);
+  CACHE_UNLOCK(&shard->lock);
+  *out = entry;
+  return HTTP_CACHE_MISS;
+}
+
+/* seconds from 'name=' in a Cache-Control directive list, -1 when it isn't there */
+static long long http_cache_directive(const char* list, const char* name) {
+  size_t name_len = strlen(name);
+  const char* q = list;
+  while (*q) {
+    while (*q == ' ' || *q == '\t' || *q == ',') ++q;
+    if (strncasecmp(q, name, name_len) == 0 && q[name_len] == '=') {
+      q += name_len + 1;
+      if (*q == '"') ++q;
+      char* end;
+      long long value = strtoll(q, &end, 10);
+      return end == q || value < 0 ? -1 : value;
+    }
+    while (*q && *q != ',') ++q;
+  }
+  return -1;
+}
+
+/* how long a shared cache may keep the response, 0 when it can't be stored at all */
+static uint64_t http_cache_ttl(http_cache* cache, http_response* res) {
+  int code = http_response_status_code(res->status);
+  if (code < 200 || code == 206)
+    return 0;
+  if (res->body_type != BODYTYPE_STRING && (res->body_type != BODYTYPE_NONE || res->body_len != 0))
+    return 0;
+  http_headers* headers = res->headers;
+  if (http_headers_get(headers, "Set-Cookie") || http_headers_get(headers, "Transfer-Encoding") ||
+      http_headers_has_token(headers, "Cache-Control", "no-store") ||
+      http_headers_has_token(headers, "Cache-Control", "no-cache") ||
+      http_headers_has_token(headers, "Cache-Control", "private") ||
+      http_headers_has_token(headers, "Vary", "*"))
+    return 0;
+
+  for (http_hdv* val = http_headers_get(headers, "Vary"); val; val = val->next) {
+    const char* q = val->v;
+    while (*q) {
+      while (*q == ' ' || *q == '\t' || *q == ',') ++q;
+      const char* begin = q;
+      while (*q && *q != ',' && *q != ' ' && *q != '\t') ++q;
+      if (q == begin)
+        continue;
+      size_t i = 0;
+      while (i < cache->vary_len && (strlen(cache->vary[i]) != (size_t)(q - begin) ||
+                                     strncasecmp(cache->vary[i], begin, q - begin) != 0))
+        ++i;
+      if (i == cache->vary_len)
+        return 0;
+    }
+  }
+
+  long long max_age = -1;
+  for (http_hdv* val = http_headers_get(headers, "Cache-Control"); val; val = val->next) {
+    long long s_maxage = http_cache_directive(val->v, "s-maxage");
+    if (s_maxage >= 0) {
+      max_age = s_maxage;
+      break;
+    }
+    long long age = http_cache_directive(val->v, "max-age");
+    if (age >= 0)
+      max_age = age;
+  }
+  if (max_age <= 0)
+    return 0;
+  return (uint64_t)MIN(max_age, 365ll * 24 * 3600) * 1000000000ull;
+}
+
+/* stores the answer a miss produced and wakes the requests collapsed onto it, or abandons the entry
+   when the response isn't cacheable. the caller still releases its own pin */
+int http_cache_fill(http_cache* cache, struct http_cache_entry* entry, http_response* res, uint64_t now) {
+  if (!cache || !entry || !res) {
+    HTTP_LOG(HTTP_LOGERR, "[http_cache_fill] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  uint64_t ttl = http_cache_ttl(cache, res);
+  const char* status_string = http_response_status_string(res->status);
+  if (ttl == 0 || !status_string) {
+    http_cache_abandon(entry);
+    return HTTP_FAILURE;
+  }
+
+  size_t head_len = strlen(status_string) + 16;
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  while (http_headers_next(res->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    for (; val; val = val->next)
+      head_len += key.len + val->len + 4;
+  }
+  size_t body_len = res->body_type == BODYTYPE_STRING ? res->body_len : 0;
+  size_t size = sizeof(struct http_cache_entry) + entry->key_len + head_len + body_len;
+  char* data = size <= cache->shard_bytes ? (char*)malloc(head_len + body_len + 1) : NULL;
+  if (!data) {
+    http_cache_abandon(entry);
+    return HTTP_FAILURE;
+  }
+
+  /* the connection headers belong to each answer, they're added when it's sent */
+  size_t n = snprintf(data, head_len, "HTTP/1.1 %d %s\r\n", http_response_status_code(res->status), status_string);
+  iter = 0;
+  while (http_headers_next(res->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    if (strcasecmp(key.v, "Age") == 0 || http_headers_hop_by_hop(res->headers, key.v))
+      continue;
+    for (; val; val = val->next) {
+      memcpy(data + n, key.v, key.len);
+      n += key.len;
+      memcpy(data + n, ": ", 2);
+      n += 2;
+      memcpy(data + n, val->v, val->len);
+      n += val->len;
+      memcpy(data + n, "\r\n", 2);
+      n += 2;
+    }
+  }
+  if (body_len)
+    memcpy(data + n, res->body_string, body_len);
+
+  struct http_cache_shard* shard = entry->shard;
+  CACHE_LOCK(&shard->lock);
+  if (entry->state != CACHE_ENTRY_PENDING || !entry->linked) {
+    CACHE_UNLOCK(&shard->lock);
+    free(data);
+    return HTTP_FAILURE;
+  }
+  entry->status   = res->status;
+  entry->head     = data;
+  entry->head_len = n;
+  entry->body     = data + n;
+  entry->body_len = body_len;
+  entry->stored   = now;
+  entry->expires  = now + ttl;
+  entry->size     = size;
+  entry->state    = CACHE_ENTRY_READY;
+  http_memory_add(MEMORY_CACHES, size);
+  http_cache_lru_push(shard, entry);
+  shard->bytes += size;
+  while (shard->bytes > cache->shard_bytes && shard->oldest != entry)
+    http_cache_unlink(shard, shard->oldest);
+  CACHE_UNLOCK(&shard->lock);
+  return HTTP_SUCCESS;
+}
+
+int http_cache_state(struct http_cache_entry* entry) {
+  struct http_cache_shard* shard = entry->shard;
+  CACHE_LOCK(&shard->lock);
+  int state = entry->state;
+  CACHE_UNLOCK(&shard->lock);
+  return state;
+}
+
+/* the miss won't be answered through the cache, requests waiting on it go to the handler themselves */
+void http_cache_abandon(struct http_cache_entry* entry) {
+  struct http_cache_shard* shard = entry->shard;
+  CACHE_LOCK(&shard->lock);
+  if (entry->state == CACHE_ENTRY_PENDING) {
+    entry->state = CACHE_ENTRY_ABANDONED;
+    if (entry->linked)
+      http_cache_unlink(shard, entry);
+  }
+  CACHE_UNLOCK(&shard->lock);
+}
+
+void http_cache_release(struct http_cache_entry* entry) {
+  struct http_cache_shard* shard = entry->shard;
+  CACHE_LOCK(&shard->lock);
+  int last = --entry->refs == 0 && !entry->linked;
+  CACHE_UNLOCK(&shard->lock);
+  if (last) {
+    http_cache_entry_free(entry);
+  }
+}
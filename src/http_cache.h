@@ -0,0 +1,94 @@
+#ifndef HTTP_CACHE_H_
+#define HTTP_CACHE_H_
+#include "includes.h"
+#include "http_request.h"
+#include "http_response.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#define HTTP_CACHE_SHARDS 16
+#define HTTP_CACHE_MAX_VARY 8
+#define HTTP_CACHE_KEY_LEN 2048
+#define HTTP_CACHE_WAIT_NS (1000 * 1000)
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION cache_lock;
+#define CACHE_LOCK_INIT(l) (InitializeCriticalSection(l), 0)
+#define CACHE_LOCK_FREE(l) DeleteCriticalSection(l)
+#define CACHE_LOCK(l) EnterCriticalSection(l)
+#define CACHE_UNLOCK(l) LeaveCriticalSection(l)
+#else
+typedef pthread_mutex_t cache_lock;
+#define CACHE_LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define CACHE_LOCK_FREE(l) pthread_mutex_destroy(l)
+#define CACHE_LOCK(l) pthread_mutex_lock(l)
+#define CACHE_UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+enum {
+  HTTP_CACHE_HIT,
+  HTTP_CACHE_MISS,      /* the caller answers the request and fills the entry */
+  HTTP_CACHE_WAIT,      /* another request is filling the entry */
+  HTTP_CACHE_BYPASS
+};
+
+enum {
+  CACHE_ENTRY_PENDING,
+  CACHE_ENTRY_READY,
+  CACHE_ENTRY_ABANDONED
+};
+
+/* a serialized response: the status line and headers without the blank line, then the body. pinned by
+   every connection sending it, so eviction only unlinks it and the last release frees it */
+struct http_cache_entry {
+  struct http_cache_entry* next;
+  struct http_cache_entry* newer;
+  struct http_cache_entry* older;
+  struct http_cache_shard* shard;
+  uint64_t hash;
+  uint64_t stored;
+  uint64_t expires;
+  size_t   refs;
+  size_t   size;
+  char     state;
+  char     linked;
+  int      status;
+  char*    head;
+  size_t   head_len;
+  char*    body;
+  size_t   body_len;
+  size_t   key_len;
+  char     key[];
+};
+
+struct http_cache_shard {
+  cache_lock lock;
+  struct http_cache_entry** buckets;
+  size_t cap;
+  size_t len;
+  size_t bytes;
+  struct http_cache_entry* newest;
+  struct http_cache_entry* oldest;
+};
+
+typedef struct http_cache {
+  struct http_cache_shard* shards;
+  size_t shards_len;
+  size_t shard_bytes;
+  const char* vary[HTTP_CACHE_MAX_VARY];
+  size_t vary_len;
+} http_cache;
+
+http_cache* http_cache_new(size_t, size_t);
+int http_cache_free(http_cache*);
+int http_cache_vary(http_cache*, const char*);
+size_t http_cache_bytes(http_cache*);
+
+// internal use, driven by the server
+int http_cache_lookup(http_cache*, http_request*, uint64_t, struct http_cache_entry**);
+int http_cache_fill(http_cache*, struct http_cache_entry*, http_response*, uint64_t);
+int http_cache_state(struct http_cache_entry*);
+void http_cache_abandon(struct http_cache_entry*);
+void http_cache_release(struct http_cache_entry*);
+
+#endif
@@ -1,4 +1,20 @@
 #include "http_client.h"
+#include "parser.h"
+#include "http_uri.h"
+#include "listener.h"
+
+static void http_client_start(http_client* client) {
+  struct conn_info* conn = client->conn;
+  conn_info_mark(conn, CONN_USED, 1);
+  conn->close      = 0;
+  conn->buff_len   = 0;
+  client->pending  = 0;
+  client->head     = 0;
+  client->out_len  = 0;
+  client->out_sent = 0;
+  client->paused   = 0;
+  http_response_reset(&conn->response);
+}
 
 http_client* http_client_new(http_constraints* constraints) {
   http_client* client = malloc(sizeof(http_client));
@@ -6,9 +22,14 @@ http_client* http_client_new(http_constraints* constraints) {
     HTTP_LOG(HTTP_LOGERR, "[http_client_new] malloc() failed.\n");
     return NULL;
   }
-  memset(client, 0, sizeof(client));
-  client->constraints = *constraints;
-  client->conn        = conn_info_new(constraints);
+  memset(client, 0, sizeof(*client));
+  client->constraints = constraints ? *constraints : http_constraints_make_default();
+  client->conn        = conn_info_new(&client->constraints);
+  if (!client->conn) {
+    free(client);
+    HTTP_LOG(HTTP_LOGERR, "[http_client_new] conn_info_new() failed.\n");
+    return NULL;
+  }
   return client;
 }
 
@@ -17,10 +38,13 @@ int http_client_free(http_client* client) {
     HTTP_LOG(HTTP_LOGERR, "[http_client_free] passed NULL pointers for mandatory parameters.\n");
     return HTTP_FAILURE;
   }
+  if (conn_info_is(client->conn, CONN_USED))
+    http_client_close(client);
   if (conn_info_free(client->conn) == HTTP_FAILURE) {
     HTTP_LOG(HTTP_LOGERR, "[http_client_free] conn_info_free() failed.\n");
     return HTTP_FAILURE;
   }
+  free(client->out);
   free(client);
   return HTTP_SUCCESS;
 }
@@ -43,15 +67,108 @@ int http_client_connect(http_client* client, const char* ip, const char* port) {
   conn->sockfd = socket(binder->ai_family, binder->ai_socktype, binder->ai_protocol);
   if (conn->sockfd == INVALID_SOCKET) {
     HTTP_LOG(HTTP_LOGERR, "[http_client_connect] socket() failed - %d.\n", GET_ERROR());
+    freeaddrinfo(binder);
     return HTTP_FAILURE;
   }
   if (connect(conn->sockfd, binder->ai_addr, binder->ai_addrlen) == SOCKET_ERROR) {
     HTTP_LOG(HTTP_LOGERR, "[http_client_connect] connect() failed - %d.\n", GET_ERROR());
+    CLOSE_SOCKET(conn->sockfd);
+    freeaddrinfo(binder);
     return HTTP_FAILURE;
   }
-  conn->addr   = *(struct sockaddr_in*)binder->ai_addr;
-  conn->used   = 1; 
+  /* the connection is established blocking, everything after it never waits */
+  if (http_socket_set_nonblocking(conn->sockfd) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect] couldn't make the socket non-blocking - %d.\n", GET_ERROR());
+    CLOSE_SOCKET(conn->sockfd);
+    freeaddrinfo(binder);
+    return HTTP_FAILURE;
+  }
+  /* pipelined requests are written as they're queued, they shouldn't wait on each other's ACKs */
+  int nodelay = 1;
+  setsockopt(conn->sockfd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+  conn->addr = *(struct sockaddr_in*)binder->ai_addr;
+  snprintf(client->host, sizeof(client->host), "%s:%s", ip, port);
   freeaddrinfo(binder);
+  client->connecting = 0;
+  http_client_start(client);
+  return HTTP_SUCCESS;
+}
+
+/* a server on the same host behind a Unix socket, '@name' for one in the abstract namespace. established
+   blocking, as http_client_connect() is */
+int http_client_connect_unix(http_client* client, const char* path) {
+  if (!client || !path) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect_unix] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct http_listener target;
+  if (listener_unix(&target, path) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  struct conn_info* conn = client->conn;
+  conn->sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (conn->sockfd == INVALID_SOCKET) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect_unix] socket() failed - %d.\n", GET_ERROR());
+    return HTTP_FAILURE;
+  }
+  if (connect(conn->sockfd, (struct sockaddr*)&target.addr, (int)target.addr_len) == SOCKET_ERROR ||
+      http_socket_set_nonblocking(conn->sockfd) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect_unix] couldn't connect to %s - %d.\n", path, GET_ERROR());
+    CLOSE_SOCKET(conn->sockfd);
+    return HTTP_FAILURE;
+  }
+  memset(&conn->addr, 0, sizeof(conn->addr));
+  conn->addr.sin_family = AF_UNIX;
+  snprintf(client->host, sizeof(client->host), "localhost");
+  client->connecting = 0;
+  http_client_start(client);
+  return HTTP_SUCCESS;
+}
+
+/* starts connecting without waiting for it, requests can be queued meanwhile and go out once it's up */
+int http_client_connect_addr(http_client* client, const struct sockaddr_in* addr) {
+  if (!client || !addr) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect_addr] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct conn_info* conn = client->conn;
+  conn->sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (conn->sockfd == INVALID_SOCKET) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect_addr] socket() failed - %d.\n", GET_ERROR());
+    return HTTP_FAILURE;
+  }
+#ifndef _WIN32
+  if (conn->sockfd >= FD_SETSIZE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect_addr] out of selectable descriptors.\n");
+    CLOSE_SOCKET(conn->sockfd);
+    return HTTP_FAILURE;
+  }
+#endif
+  if (http_socket_set_nonblocking(conn->sockfd) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_connect_addr] couldn't make the socket non-blocking - %d.\n", GET_ERROR());
+    CLOSE_SOCKET(conn->sockfd);
+    return HTTP_FAILURE;
+  }
+  int nodelay = 1;
+  setsockopt(conn->sockfd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+  client->connecting = 0;
+  if (connect(conn->sockfd, (const struct sockaddr*)addr, sizeof(*addr)) == SOCKET_ERROR) {
+    int err = GET_ERROR();
+#ifdef _WIN32
+    if (err != WSAEWOULDBLOCK) {
+#else
+    if (err != EINPROGRESS) {
+#endif
+      HTTP_LOG(HTTP_LOGERR, "[http_client_connect_addr] connect() failed - %d.\n", err);
+      CLOSE_SOCKET(conn->sockfd);
+      return HTTP_FAILURE;
+    }
+    client->connecting = 1;
+  }
+  char ip[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+  snprintf(client->host, sizeof(client->host), "%s:%u", ip, ntohs(addr->sin_port));
+  conn->addr = *addr;
+  http_client_start(client);
   return HTTP_SUCCESS;
 }
 
@@ -61,9 +178,16 @@ int http_client_close(http_client* client) {
     return HTTP_FAILURE;
   }
   struct conn_info* conn = client->conn;
-  shutdown(conn->sockfd, 2); 
-  CLOSE_SOCKET(conn->sockfd);
-  conn->used = 0;
+  if (conn_info_is(conn, CONN_USED)) {
+    shutdown(conn->sockfd, 2);
+    CLOSE_SOCKET(conn->sockfd);
+  }
+  conn_info_mark(conn, CONN_USED, 0);
+  conn->buff_len = 0;
+  client->connecting = 0;
+  client->pending  = 0;
+  client->out_len  = 0;
+  client->out_sent = 0;
   return HTTP_SUCCESS;
 }
 
@@ -83,9 +207,352 @@ http_response* http_client_get_response(http_client* client) {
   return &client->conn->response;
 }
 
+int http_client_set_handler(http_client* client, response_handler handler, void* userdata) {
+  if (!client) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_set_handler] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  client->handler  = handler;
+  client->userdata = userdata;
+  return HTTP_SUCCESS;
+}
+
+/* a streaming client hands each response over once its head is in and again for every piece of the
+   body, the body only holds what arrived since the last call */
+int http_client_set_stream(http_client* client, int stream) {
+  if (!client) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_set_stream] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  client->stream = stream != 0;
+  return HTTP_SUCCESS;
+}
+
+/* a paused client leaves responses in the socket, so a slow consumer pushes back on the peer */
+int http_client_pause(http_client* client, int paused) {
+  if (!client) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pause] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  client->paused = paused != 0;
+  return HTTP_SUCCESS;
+}
+
+int http_client_prepare(http_client* client, int method, const char* uri, const char* body, size_t body_len) {
+  if (!client || !uri || (!body && body_len)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_prepare] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct conn_info* conn = client->conn;
+  http_request* req = &conn->request;
+  size_t uri_len = strlen(uri);
+  if (method < 0 || method >= METHOD_NONE || uri_len > HTTP_REQUEST_MAX_URI_LEN(&client->constraints) ||
+      body_len > HTTP_REQUEST_MAX_BODY_LEN(&client->constraints)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_prepare] invalid arguments - method, uri or body out of bounds.\n");
+    return HTTP_FAILURE;
+  }
+  size_t max = HTTP_REQUEST_MAX_BODY_LEN(&client->constraints);
+  if (http_body_reserve(&req->body, &req->body_cap, body_len, max) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  http_request_reset(req, conn->sockfd, &conn->addr);
+  req->method  = method;
+  req->version = HTTP_VERSION_1_1;
+  memcpy(req->uri, uri, uri_len + 1);
+  req->uri_len = uri_len;
+  if (body_len)
+    memcpy(req->body, body, body_len);
+  req->body_len = body_len;
+  return HTTP_SUCCESS;
+}
+
+static int http_client_reserve(http_client* client, size_t len) {
+  if (client->out_cap >= len)
+    return HTTP_SUCCESS;
+  size_t cap = MAX(len, client->out_cap * 2);
+  char* out = realloc(client->out, cap);
+  if (!out) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_reserve] realloc() failed.\n");
+    return HTTP_FAILURE;
+  }
+  client->out     = out;
+  client->out_cap = cap;
+  return HTTP_SUCCESS;
+}
+
+static int http_client_flush(http_client* client) {
+  if (client->connecting)
+    return HTTP_SUCCESS;
+  while (client->out_sent < client->out_len) {
+    int ret = send(client->conn->sockfd, client->out + client->out_sent,
+                   (int)(client->out_len - client->out_sent), SEND_FLAGS);
+    if (ret == SOCKET_ERROR) {
+      if (WOULD_BLOCK(GET_ERROR()))
+        return HTTP_SUCCESS;
+      HTTP_LOG(HTTP_LOGERR, "[http_client_flush] send() failed - %d.\n", GET_ERROR());
+      return HTTP_FAILURE;
+    }
+    client->out_sent += ret;
+  }
+  client->out_len  = 0;
+  client->out_sent = 0;
+  return HTTP_SUCCESS;
+}
+
+/* what's copied into the request line has no spaces or control characters, a field has a token for a name
+   and a value without control characters: nothing a client sent can end the request early or start another
+   one on a connection others share. a forwarded path is encoded again, it isn't checked */
+static int http_client_check(http_request* req, int forward) {
+  const char* parts[2]  = { req->query, forward ? NULL : req->uri };
+  size_t      lens[2]   = { req->query_len, forward ? 0 : req->uri_len };
+  for (int p = 0; p < 2; ++p) {
+    for (size_t i = 0; i < lens[p]; ++i) {
+      unsigned char c = (unsigned char)parts[p][i];
+      if (c <= 0x20 || c == 0x7f)
+        return HTTP_FAILURE;
+    }
+  }
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  while (http_headers_next(req->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    if (!http_headers_valid_name(key.v, key.len))
+      return HTTP_FAILURE;
+    for (; val; val = val->next) {
+      if (!http_headers_valid_value(val->v, val->len))
+        return HTTP_FAILURE;
+    }
+  }
+  return HTTP_SUCCESS;
+}
+
+/* HTTP_FAILURE when 'req' can't be forwarded as it is, see http_client_check() */
+int http_client_forwardable(http_request* req) {
+  if (!req) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_forwardable] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  return http_client_check(req, 1);
+}
+
+/* serializes 'req' behind whatever is still queued, so requests can be pipelined. a forwarded request
+   was parsed by a server: its path is encoded again and its framing and hop-by-hop headers are redone */
+static int http_client_queue(http_client* client, http_request* req, int forward) {
+  struct conn_info* conn = client->conn;
+  if (!conn_info_is(conn, CONN_USED) || client->pending == HTTP_CLIENT_PIPELINE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_queue] not connected or too many requests in flight.\n");
+    return HTTP_FAILURE;
+  }
+  const char* method = http_request_method_string(req->method);
+  if (!method) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_queue] invalid method.\n");
+    return HTTP_FAILURE;
+  }
+  if (http_client_check(req, forward) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_queue] invalid arguments - control characters in the target or a field.\n");
+    return HTTP_FAILURE;
+  }
+
+  int has_host   = http_headers_get(req->headers, "Host") != NULL;
+  int has_length = !forward && (http_headers_get(req->headers, "Content-Length") != NULL ||
+                                http_headers_get(req->headers, "Transfer-Encoding") != NULL);
+  size_t len = strlen(method) + 3 * req->uri_len + req->query_len + strlen(client->host) + 64 + req->body_len;
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  while (http_headers_next(req->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    for (; val; val = val->next)
+      len += key.len + val->len + 4;
+  }
+  if (http_client_reserve(client, client->out_len + len) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+
+  char* out = client->out + client->out_len;
+  size_t n = sprintf(out, "%s ", method);
+  if (forward) {
+    n += http_uri_encode(req->uri, req->uri_len, out + n);
+    if (req->query_len) {
+      out[n++] = '?';
+      memcpy(out + n, req->query, req->query_len);
+      n += req->query_len;
+    }
+  }
+  else {
+    memcpy(out + n, req->uri, req->uri_len);
+    n += req->uri_len;
+  }
+  n += sprintf(out + n, " HTTP/1.1\r\n");
+  if (!has_host)
+    n += sprintf(out + n, "Host: %s\r\n", client->host);
+  if (!has_length && (req->body_len || req->method == METHOD_POST || req->method == METHOD_PUT))
+    n += sprintf(out + n, "Content-Length: %zu\r\n", req->body_len);
+  iter = 0;
+  while (http_headers_next(req->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    if (forward && (http_headers_hop_by_hop(req->headers, key.v) || strcasecmp(key.v, "Content-Length") == 0 ||
+                    strcasecmp(key.v, "Expect") == 0))
+      continue;
+    for (; val; val = val->next) {
+      memcpy(out + n, key.v, key.len);
+      n += key.len;
+      memcpy(out + n, ": ", 2);
+      n += 2;
+      memcpy(out + n, val->v, val->len);
+      n += val->len;
+      memcpy(out + n, "\r\n", 2);
+      n += 2;
+    }
+  }
+  memcpy(out + n, "\r\n", 2);
+  n += 2;
+  memcpy(out + n, req->body, req->body_len);
+  n += req->body_len;
+  client->out_len += n;
+
+  client->methods[(client->head + client->pending) % HTTP_CLIENT_PIPELINE] = req->method;
+  ++client->pending;
+  return http_client_flush(client);
+}
+
 int http_client_send(http_client* client) {
   if (!client) {
     HTTP_LOG(HTTP_LOGERR, "[http_client_send] passed NULL pointers for mandatory parameters.\n");
     return HTTP_FAILURE;
   }
-}
\ No newline at end of file
+  return http_client_queue(client, &client->conn->request, 0);
+}
+
+/* forwards a request a server parsed, as a proxy would */
+int http_client_send_request(http_client* client, http_request* req) {
+  if (!client || !req) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_send_request] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  return http_client_queue(client, req, 1);
+}
+
+static void http_client_complete(http_client* client) {
+  struct conn_info* conn = client->conn;
+  http_response* res = &conn->response;
+  client->head = (client->head + 1) % HTTP_CLIENT_PIPELINE;
+  --client->pending;
+  if (res->version == HTTP_VERSION_1 || http_headers_has_token(res->headers, "Connection", "close"))
+    conn->close = 1;
+  if (client->handler)
+    client->handler(client, res, client->userdata);
+}
+
+static int http_client_process(http_client* client) {
+  struct conn_info* conn = client->conn;
+  http_response* res = &conn->response;
+  while (client->pending > 0) {
+    /* the last response is kept around for the caller until the next one starts */
+    if (res->state == STATE_GOT_ALL)
+      http_response_reset(res);
+    char state = res->state;
+    if (parse_response(res, client->methods[client->head], conn->buffer, &conn->buff_len, &client->constraints) == HTTP_FAILURE) {
+      HTTP_LOG(HTTP_LOGERR, "[http_client_process] parse_response() failed.\n");
+      return HTTP_FAILURE;
+    }
+    if (res->state != STATE_GOT_ALL) {
+      if (client->stream && client->handler && res->state == STATE_GOT_HEADERS &&
+          (state != STATE_GOT_HEADERS || res->body_len > 0)) {
+        client->handler(client, res, client->userdata);
+        res->body_len = 0;
+      }
+      break;
+    }
+    http_client_complete(client);
+  }
+  return HTTP_SUCCESS;
+}
+
+/* makes whatever progress is possible without blocking: flushes requests and parses responses */
+int http_client_step(http_client* client) {
+  if (!client) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_step] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct conn_info* conn = client->conn;
+  if (!conn_info_is(conn, CONN_USED))
+    return HTTP_FAILURE;
+  if (client->connecting) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(conn->sockfd, SOL_SOCKET, SO_ERROR, (char*)&err, &len) == SOCKET_ERROR || err) {
+      HTTP_LOG(HTTP_LOGERR, "[http_client_step] connect() failed - %d.\n", err);
+      return HTTP_FAILURE;
+    }
+    client->connecting = 0;
+  }
+  if (http_client_flush(client) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+
+  while (conn_info_is(conn, CONN_USED) && client->pending > 0 && !client->paused) {
+    if (conn_info_reserve(conn, &client->constraints) == HTTP_FAILURE) {
+      HTTP_LOG(HTTP_LOGERR, "[http_client_step] response head too large.\n");
+      return HTTP_FAILURE;
+    }
+    size_t space = MIN(conn->buff_cap - conn->buff_len, HTTP_RECV_LEN(&client->constraints));
+    int ret = recv(conn->sockfd, conn->buffer + conn->buff_len, (int)space, 0);
+    if (ret < 0) {
+      if (WOULD_BLOCK(GET_ERROR()))
+        break;
+      HTTP_LOG(HTTP_LOGERR, "[http_client_step] recv() failed - %d.\n", GET_ERROR());
+      return HTTP_FAILURE;
+    }
+    if (ret == 0) {
+      http_response* res = &conn->response;
+      if (res->state == STATE_GOT_HEADERS && res->framing.termination == BODYTERMI_CLOSE) {
+        res->framing.chunk_state = CHUNK_DONE;
+        res->state       = STATE_GOT_ALL;
+        res->body_string = (const unsigned char*)res->body_buffer;
+        http_client_complete(client);
+      }
+      http_client_close(client);
+      break;
+    }
+    conn->buff_len += ret;
+    if (http_client_process(client) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+  }
+
+  if (conn_info_is(conn, CONN_USED) && conn->close && client->pending == 0)
+    http_client_close(client);
+  return HTTP_SUCCESS;
+}
+
+int http_client_wait(http_client* client) {
+  if (!client) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_wait] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct conn_info* conn = client->conn;
+  while (client->pending > 0) {
+    if (!conn_info_is(conn, CONN_USED))
+      return HTTP_FAILURE;
+    fd_set read, write;
+    FD_ZERO(&read);
+    FD_ZERO(&write);
+    FD_SET(conn->sockfd, &read);
+    if (http_client_wants_write(client))
+      FD_SET(conn->sockfd, &write);
+    if (select((int)conn->sockfd + 1, &read, &write, NULL, NULL) < 0) {
+#ifndef _WIN32
+      if (GET_ERROR() == EINTR)
+        continue;
+#endif
+      HTTP_LOG(HTTP_LOGERR, "[http_client_wait] select() failed - %d.\n", GET_ERROR());
+      return HTTP_FAILURE;
+    }
+    if (http_client_step(client) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+  }
+  return HTTP_SUCCESS;
+}
+
+int http_client_wants_write(http_client* client) {
+  return client && (client->connecting || client->out_sent < client->out_len);
+}
+
+size_t http_client_pending(http_client* client) {
+  return client ? client->pending : 0;
+}
@@ -2,18 +2,49 @@
 #define HTTP_CLIENT_H_
 #include "includes.h"
 #include "conn_info.h"
+#define HTTP_CLIENT_PIPELINE 64
 
-typedef struct {
-	struct conn_info* conn;
-	http_constraints constraints;
-} http_client;
+typedef struct http_client http_client;
+typedef void (*response_handler) (http_client*, http_response*, void*);
+
+struct http_client {
+  struct conn_info* conn;
+  http_constraints constraints;
+  char host[256];
+  response_handler handler;
+  void* userdata;
+  char stream;
+  char paused;
+
+  // internal use
+  char*  out;
+  size_t out_len;
+  size_t out_cap;
+  size_t out_sent;
+  char   methods[HTTP_CLIENT_PIPELINE];
+  size_t pending;
+  size_t head;
+  char   connecting;
+};
 
 http_client* http_client_new(http_constraints*);
 int http_client_free(http_client*);
 http_request* http_client_get_request(http_client*);
 http_response* http_client_get_response(http_client*);
 int http_client_connect(http_client*, const char*, const char*);
+int http_client_connect_addr(http_client*, const struct sockaddr_in*);
+int http_client_connect_unix(http_client*, const char*);
 int http_client_close(http_client*);
+int http_client_prepare(http_client*, int, const char*, const char*, size_t);
 int http_client_send(http_client*);
+int http_client_send_request(http_client*, http_request*);
+int http_client_forwardable(http_request*);
+int http_client_step(http_client*);
+int http_client_wait(http_client*);
+int http_client_set_handler(http_client*, response_handler, void*);
+int http_client_set_stream(http_client*, int);
+int http_client_pause(http_client*, int);
+int http_client_wants_write(http_client*);
+size_t http_client_pending(http_client*);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,495 @@
+#include "http_client_pool.h"
+
+struct http_pool_result {
+  int    done;
+  int    failed;
+  int    status;
+  char*  body;
+  size_t body_len;
+};
+
+static uint64_t http_pool_poll_fill(void* pool, fd_set* read, fd_set* write, int* max_socket) {
+  return http_client_pool_fill(pool, read, write, max_socket);
+}
+
+static int http_pool_poll_dispatch(void* pool, fd_set* read, fd_set* write) {
+  return http_client_pool_dispatch(pool, read, write);
+}
+
+http_client_pool* http_client_pool_new(http_constraints* constraints) {
+  http_client_pool* pool = malloc(sizeof(http_client_pool));
+  if (!pool) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_new] malloc() failed.\n");
+    return NULL;
+  }
+  memset(pool, 0, sizeof(*pool));
+  pool->constraints   = constraints ? *constraints : http_constraints_make_default();
+  pool->max_conns     = HTTP_POOL_MAX_CONNS;
+  pool->depth         = HTTP_POOL_DEPTH;
+  pool->poller.ctx      = pool;
+  pool->poller.fill     = http_pool_poll_fill;
+  pool->poller.dispatch = http_pool_poll_dispatch;
+  return pool;
+}
+
+static void http_pool_call_free(struct http_pool_call* call) {
+  free(call->body);
+  free(call);
+}
+
+int http_client_pool_free(http_client_pool* pool) {
+  if (!pool) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  for (size_t h = 0; h < pool->hosts_len; ++h) {
+    struct http_pool_host* host = pool->hosts[h];
+    for (size_t i = 0; i < pool->max_conns; ++i) {
+      struct http_pool_conn* conn = &host->conns[i];
+      for (size_t n = 0; n < HTTP_CLIENT_PIPELINE; ++n) {
+        if (conn->calls[n])
+          http_pool_call_free(conn->calls[n]);
+      }
+      if (conn->client)
+        http_client_free(conn->client);
+    }
+    while (host->queue) {
+      struct http_pool_call* next = host->queue->next;
+      http_pool_call_free(host->queue);
+      host->queue = next;
+    }
+    free(host->conns);
+    free(host);
+  }
+  free(pool->hosts);
+  free(pool);
+  return HTTP_SUCCESS;
+}
+
+/* up to 'max_conns' connections per host with up to 'depth' requests pipelined on each, before the
+   first request only */
+int http_client_pool_set_limits(http_client_pool* pool, size_t max_conns, size_t depth) {
+  if (!pool) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_set_limits] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (pool->hosts_len || max_conns == 0 || depth == 0 || depth > HTTP_CLIENT_PIPELINE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_set_limits] invalid arguments - limits out of bounds or pool in use.\n");
+    return HTTP_FAILURE;
+  }
+  pool->max_conns = max_conns;
+  pool->depth     = depth;
+  return HTTP_SUCCESS;
+}
+
+/* fails requests that got no response within 'timeout' milliseconds of being made, 0 waits forever */
+int http_client_pool_set_timeout(http_client_pool* pool, uint64_t timeout) {
+  if (!pool) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_set_timeout] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  pool->timeout = timeout * 1000000;
+  return HTTP_SUCCESS;
+}
+
+size_t http_client_pool_pending(http_client_pool* pool) {
+  return pool ? pool->pending : 0;
+}
+
+struct http_poller* http_client_pool_poller(http_client_pool* pool) {
+  return pool ? &pool->poller : NULL;
+}
+
+static int http_pool_idempotent(int method) {
+  return method != METHOD_POST && method != METHOD_PATCH && method != METHOD_CONNECT;
+}
+
+static struct http_pool_host* http_pool_host(http_client_pool* pool, const char* name, const char* port) {
+  for (size_t h = 0; h < pool->hosts_len; ++h) {
+    struct http_pool_host* host = pool->hosts[h];
+    if (strcmp(host->name, name) == 0 && strcmp(host->port, port) == 0)
+      return host;
+  }
+  if (strlen(name) >= sizeof(((struct http_pool_host*)0)->name) || strlen(port) >= sizeof(((struct http_pool_host*)0)->port)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_pool_host] invalid arguments - host or port too long.\n");
+    return NULL;
+  }
+  if (pool->hosts_len == pool->hosts_cap) {
+    size_t cap = pool->hosts_cap ? pool->hosts_cap * 2 : 4;
+    struct http_pool_host** hosts = realloc(pool->hosts, cap * sizeof(*hosts));
+    if (!hosts) {
+      HTTP_LOG(HTTP_LOGERR, "[http_pool_host] realloc() failed.\n");
+      return NULL;
+    }
+    pool->hosts     = hosts;
+    pool->hosts_cap = cap;
+  }
+
+  /* the name is resolved once, when the host is first used */
+  struct addrinfo hints, *binder;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(name, port, &hints, &binder)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_pool_host] getaddrinfo() failed.\n");
+    return NULL;
+  }
+  struct http_pool_host* host = calloc(1, sizeof(struct http_pool_host));
+  struct http_pool_conn* conns = calloc(pool->max_conns, sizeof(struct http_pool_conn));
+  if (!host || !conns) {
+    HTTP_LOG(HTTP_LOGERR, "[http_pool_host] calloc() failed.\n");
+    free(host);
+    free(conns);
+    freeaddrinfo(binder);
+    return NULL;
+  }
+  strcpy(host->name, name);
+  strcpy(host->port, port);
+  host->addr  = *(struct sockaddr_in*)binder->ai_addr;
+  host->conns = conns;
+  for (size_t i = 0; i < pool->max_conns; ++i) {
+    conns[i].pool = pool;
+    conns[i].host = host;
+  }
+  freeaddrinfo(binder);
+  pool->hosts[pool->hosts_len++] = host;
+  return host;
+}
+
+static void http_pool_response(http_client* client, http_response* res, void* userdata) {
+  struct http_pool_conn* conn = userdata;
+  struct http_pool_call* call = conn->calls[conn->head];
+  conn->calls[conn->head] = NULL;
+  conn->head = (conn->head + 1) % HTTP_CLIENT_PIPELINE;
+  ++conn->served;
+  --conn->pool->pending;
+  call->handler(res, call->userdata);
+  http_pool_call_free(call);
+}
+
+static size_t http_pool_inflight(struct http_pool_conn* conn) {
+  size_t n = 0;
+  while (n < HTTP_CLIENT_PIPELINE && conn->calls[(conn->head + n) % HTTP_CLIENT_PIPELINE])
+    ++n;
+  return n;
+}
+
+/* drops the connection. requests a reused connection never answered are made again, as a keep-alive
+   connection the peer just closed is indistinguishable from a failed one, the rest fail */
+static void http_pool_fail(http_client_pool* pool, struct http_pool_conn* conn, int retry) {
+  struct http_pool_host* host = conn->host;
+  struct http_pool_call* failed = NULL;
+  struct http_pool_call* retried = NULL;
+  struct http_pool_call* last = NULL;
+  retry = retry && conn->served > 0;
+  /* everything is detached first, the handlers may well make new requests on this host */
+  for (size_t n = 0; n < HTTP_CLIENT_PIPELINE; ++n) {
+    size_t i = (conn->head + n) % HTTP_CLIENT_PIPELINE;
+    struct http_pool_call* call = conn->calls[i];
+    if (!call)
+      break;
+    conn->calls[i] = NULL;
+    if (retry && call->attempts < 2 && http_pool_idempotent(call->method)) {
+      if (last)
+        last->next = call;
+      else
+        retried = call;
+      last = call;
+    }
+    else {
+      call->next = failed;
+      failed     = call;
+    }
+  }
+  if (retried) {
+    last->next = host->queue;
+    if (!host->queue)
+      host->tail = last;
+    host->queue = retried;
+  }
+  http_client_free(conn->client);
+  conn->client = NULL;
+  conn->head   = 0;
+  conn->served = 0;
+  while (failed) {
+    struct http_pool_call* next = failed->next;
+    --pool->pending;
+    failed->handler(NULL, failed->userdata);
+    http_pool_call_free(failed);
+    failed = next;
+  }
+}
+
+static struct http_pool_conn* http_pool_pick(http_client_pool* pool, struct http_pool_host* host, int method) {
+  struct http_pool_conn* best  = NULL;
+  struct http_pool_conn* spare = NULL;
+  size_t best_len = 0;
+  size_t limit = http_pool_idempotent(method) ? pool->depth : 1;
+  for (size_t i = 0; i < pool->max_conns; ++i) {
+    struct http_pool_conn* conn = &host->conns[i];
+    if (!conn->client) {
+      if (!spare)
+        spare = conn;
+      continue;
+    }
+    size_t len = http_pool_inflight(conn);
+    if (conn_info_is(conn->client->conn, CONN_USED) && len < limit && (!best || len < best_len)) {
+      best     = conn;
+      best_len = len;
+    }
+  }
+  /* an idle connection beats a new one, and a new one beats queueing behind another request */
+  if (best && best_len == 0)
+    return best;
+  if (spare) {
+    http_client* client = http_client_new(&pool->constraints);
+    if (client && http_client_connect_addr(client, &host->addr) == HTTP_SUCCESS) {
+      http_client_set_handler(client, http_pool_response, spare);
+      spare->client = client;
+      spare->head   = 0;
+      spare->served = 0;
+      return spare;
+    }
+    if (client)
+      http_client_free(client);
+    if (!best)
+      return NULL;
+  }
+  return best;
+}
+
+static int http_pool_issue(http_client_pool* pool, struct http_pool_conn* conn, struct http_pool_call* call) {
+  http_client* client = conn->client;
+  size_t pending = http_client_pending(client);
+  if (http_client_prepare(client, call->method, call->uri, call->body, call->body_len) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  size_t slot = (conn->head + http_pool_inflight(conn)) % HTTP_CLIENT_PIPELINE;
+  conn->calls[slot] = call;
+  ++call->attempts;
+  /* once the request is queued a broken connection is left for the event loop to find, this may
+     run from a handler in the middle of reading from it */
+  if (http_client_send(client) == HTTP_FAILURE && http_client_pending(client) == pending) {
+    conn->calls[slot] = NULL;
+    return HTTP_FAILURE;
+  }
+  return HTTP_SUCCESS;
+}
+
+/* hands queued requests to connections as they free up */
+static void http_pool_pump(http_client_pool* pool, struct http_pool_host* host) {
+  while (host->queue) {
+    struct http_pool_call* call = host->queue;
+    struct http_pool_conn* conn = http_pool_pick(pool, host, call->method);
+    int spare = 0;
+    for (size_t i = 0; !conn && i < pool->max_conns; ++i)
+      spare |= host->conns[i].client == NULL;
+    if (!conn && !spare)
+      return;
+    host->queue = call->next;
+    if (!host->queue)
+      host->tail = NULL;
+    call->next = NULL;
+    if (!conn || http_pool_issue(pool, conn, call) == HTTP_FAILURE) {
+      HTTP_LOG(HTTP_LOGERR, "[http_pool_pump] couldn't send a request.\n");
+      --pool->pending;
+      call->handler(NULL, call->userdata);
+      http_pool_call_free(call);
+    }
+  }
+}
+
+/* queues a request to host:port, 'handler' gets the response once it's in. nothing blocks but resolving
+   a host the first time it's used */
+int http_client_pool_request(http_client_pool* pool, const char* name, const char* port, int method, const char* uri,
+                             const char* body, size_t body_len, pool_handler handler, void* userdata) {
+  if (!pool || !name || !port || !uri || !handler || (!body && body_len)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_request] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  size_t uri_len = strlen(uri);
+  if (method < 0 || method >= METHOD_NONE || uri_len > HTTP_REQUEST_MAX_URI_LEN(&pool->constraints) ||
+      body_len > HTTP_REQUEST_MAX_BODY_LEN(&pool->constraints)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_request] invalid arguments - method, uri or body out of bounds.\n");
+    return HTTP_FAILURE;
+  }
+  struct http_pool_host* host = http_pool_host(pool, name, port);
+  if (!host)
+    return HTTP_FAILURE;
+  struct http_pool_call* call = malloc(sizeof(struct http_pool_call) + uri_len + 1);
+  char* copy = body_len ? malloc(body_len) : NULL;
+  if (!call || (body_len && !copy)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_request] malloc() failed.\n");
+    free(call);
+    free(copy);
+    return HTTP_FAILURE;
+  }
+  if (body_len)
+    memcpy(copy, body, body_len);
+  memcpy(call->uri, uri, uri_len + 1);
+  call->next     = NULL;
+  call->handler  = handler;
+  call->userdata = userdata;
+  call->start    = http_clock_ns();
+  call->method   = method;
+  call->attempts = 0;
+  call->body     = copy;
+  call->body_len = body_len;
+  if (host->tail)
+    host->tail->next = call;
+  else
+    host->queue = call;
+  host->tail = call;
+  ++pool->pending;
+  http_pool_pump(pool, host);
+  return HTTP_SUCCESS;
+}
+
+uint64_t http_client_pool_fill(http_client_pool* pool, fd_set* read, fd_set* write, int* max_socket) {
+  uint64_t now  = http_clock_ns();
+  uint64_t next = (uint64_t)SELECT_SEC * 1000000000;
+  for (size_t h = 0; h < pool->hosts_len; ++h) {
+    struct http_pool_host* host = pool->hosts[h];
+    for (size_t i = 0; i < pool->max_conns; ++i) {
+      struct http_pool_conn* conn = &host->conns[i];
+      if (!conn->client || !conn_info_is(conn->client->conn, CONN_USED))
+        continue;
+      /* idle connections are watched too, they only become readable when the peer closes them */
+      SOCKET sockfd = conn->client->conn->sockfd;
+      FD_SET(sockfd, read);
+      if (http_client_wants_write(conn->client))
+        FD_SET(sockfd, write);
+      if ((int)sockfd > *max_socket)
+        *max_socket = (int)sockfd;
+      if (pool->timeout && conn->calls[conn->head]) {
+        uint64_t due  = conn->calls[conn->head]->start + pool->timeout;
+        uint64_t wait = due > now ? due - now : 0;
+        next = MIN(next, wait);
+      }
+    }
+  }
+  return next;
+}
+
+int http_client_pool_dispatch(http_client_pool* pool, fd_set* read, fd_set* write) {
+  if (!pool || !read || !write) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_dispatch] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  uint64_t now = http_clock_ns();
+  for (size_t h = 0; h < pool->hosts_len; ++h) {
+    struct http_pool_host* host = pool->hosts[h];
+    for (size_t i = 0; i < pool->max_conns; ++i) {
+      struct http_pool_conn* conn = &host->conns[i];
+      http_client* client = conn->client;
+      if (!client)
+        continue;
+      SOCKET sockfd = client->conn->sockfd;
+      if (conn_info_is(client->conn, CONN_USED) && (FD_ISSET(sockfd, read) || FD_ISSET(sockfd, write))) {
+        if (!conn->calls[conn->head]) {
+          http_client_free(client);
+          conn->client = NULL;
+          continue;
+        }
+        if (http_client_step(client) == HTTP_FAILURE) {
+          HTTP_LOG(HTTP_LOGERR, "[http_client_pool_dispatch] a connection failed.\n");
+          http_pool_fail(pool, conn, 1);
+          continue;
+        }
+      }
+      if (!conn_info_is(client->conn, CONN_USED)) {
+        if (conn->calls[conn->head])
+          http_pool_fail(pool, conn, 1);
+        else {
+          http_client_free(client);
+          conn->client = NULL;
+        }
+      }
+      else if (pool->timeout && conn->calls[conn->head] && now - conn->calls[conn->head]->start >= pool->timeout) {
+        HTTP_LOG(HTTP_LOGERR, "[http_client_pool_dispatch] a request timed out.\n");
+        http_pool_fail(pool, conn, 0);
+      }
+    }
+    http_pool_pump(pool, host);
+  }
+  return HTTP_SUCCESS;
+}
+
+/* the pool's own event loop, for when it isn't driven by a server's: runs until '*done' is set, or
+   until nothing is pending without one */
+static int http_pool_run(http_client_pool* pool, int* done) {
+  while (done ? !*done : pool->pending > 0) {
+    fd_set read, write;
+    FD_ZERO(&read);
+    FD_ZERO(&write);
+    int max_socket = -1;
+    uint64_t next = http_client_pool_fill(pool, &read, &write, &max_socket);
+    if (max_socket < 0) {
+      HTTP_LOG(HTTP_LOGERR, "[http_pool_run] requests are pending without a connection.\n");
+      return HTTP_FAILURE;
+    }
+    struct timeval timeout = { 0 };
+    timeout.tv_sec  = (long)(next / 1000000000);
+    timeout.tv_usec = (long)(next % 1000000000 / 1000);
+    if (select(max_socket + 1, &read, &write, NULL, &timeout) < 0) {
+#ifndef _WIN32
+      if (GET_ERROR() == EINTR)
+        continue;
+#endif
+      HTTP_LOG(HTTP_LOGERR, "[http_pool_run] select() failed - %d.\n", GET_ERROR());
+      return HTTP_FAILURE;
+    }
+    if (http_client_pool_dispatch(pool, &read, &write) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+  }
+  return HTTP_SUCCESS;
+}
+
+/* blocks until every request made so far is answered or failed */
+int http_client_pool_wait(http_client_pool* pool) {
+  if (!pool) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_wait] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  return http_pool_run(pool, NULL);
+}
+
+static void http_pool_collect(http_response* res, void* userdata) {
+  struct http_pool_result* result = userdata;
+  result->done = 1;
+  if (!res) {
+    result->failed = 1;
+    return;
+  }
+  result->status = http_response_status_code(res->status);
+  if (res->body_len) {
+    result->body = malloc(res->body_len + 1);
+    if (!result->body) {
+      result->failed = 1;
+      return;
+    }
+    memcpy(result->body, res->body_buffer, res->body_len);
+    result->body[res->body_len] = 0;
+    result->body_len = res->body_len;
+  }
+}
+
+/* makes a request and blocks until it's answered, other requests progress meanwhile. the body is
+   allocated for the caller and NUL terminated, NULL when empty */
+int http_client_pool_fetch(http_client_pool* pool, const char* name, const char* port, int method, const char* uri,
+                           const char* body, size_t body_len, int* status, char** res_body, size_t* res_len) {
+  if (!status || !res_body || !res_len) {
+    HTTP_LOG(HTTP_LOGERR, "[http_client_pool_fetch] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct http_pool_result result = { 0 };
+  if (http_client_pool_request(pool, name, port, method, uri, body, body_len, http_pool_collect, &result) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  if (http_pool_run(pool, &result.done) == HTTP_FAILURE || result.failed) {
+    free(result.body);
+    return HTTP_FAILURE;
+  }
+  *status   = result.status;
+  *res_body = result.body;
+  *res_len  = result.body_len;
+  return HTTP_SUCCESS;
+}
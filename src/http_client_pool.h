@@ -0,0 +1,69 @@
+#ifndef HTTP_CLIENT_POOL_H_
+#define HTTP_CLIENT_POOL_H_
+#include "includes.h"
+#include "conn_info.h"
+#include "http_client.h"
+#define HTTP_POOL_MAX_CONNS 8
+#define HTTP_POOL_DEPTH 1
+
+/* called once per request with the response, or NULL when it failed. the response is only valid
+   during the call */
+typedef void (*pool_handler) (http_response*, void*);
+
+struct http_pool_call {
+  struct http_pool_call* next;
+  pool_handler handler;
+  void*    userdata;
+  uint64_t start;
+  int      method;
+  int      attempts;
+  char*    body;
+  size_t   body_len;
+  char     uri[];
+};
+
+struct http_pool_conn {
+  struct http_client_pool* pool;
+  struct http_pool_host*   host;
+  http_client*             client;
+  struct http_pool_call*   calls[HTTP_CLIENT_PIPELINE];
+  size_t head;
+  size_t served;
+};
+
+struct http_pool_host {
+  char   name[256];
+  char   port[8];
+  struct sockaddr_in addr;
+  struct http_pool_conn* conns;
+  struct http_pool_call* queue;
+  struct http_pool_call* tail;
+};
+
+typedef struct http_client_pool {
+  http_constraints constraints;
+  struct http_pool_host** hosts;
+  size_t hosts_len;
+  size_t hosts_cap;
+  size_t max_conns;
+  size_t depth;
+  uint64_t timeout;
+  size_t pending;
+  struct http_poller poller;
+} http_client_pool;
+
+http_client_pool* http_client_pool_new(http_constraints*);
+int http_client_pool_free(http_client_pool*);
+int http_client_pool_set_limits(http_client_pool*, size_t, size_t);
+int http_client_pool_set_timeout(http_client_pool*, uint64_t);
+int http_client_pool_request(http_client_pool*, const char*, const char*, int, const char*, const char*, size_t,
+                             pool_handler, void*);
+int http_client_pool_fetch(http_client_pool*, const char*, const char*, int, const char*, const char*, size_t,
+                           int*, char**, size_t*);
+int http_client_pool_wait(http_client_pool*);
+size_t http_client_pool_pending(http_client_pool*);
+struct http_poller* http_client_pool_poller(http_client_pool*);
+uint64_t http_client_pool_fill(http_client_pool*, fd_set*, fd_set*, int*);
+int http_client_pool_dispatch(http_client_pool*, fd_set*, fd_set*);
+
+#endif
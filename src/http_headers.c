@@ -1,4 +1,5 @@
 #include "http_headers.h"
+#include "http_memory.h"
 #define LOAD_FACTOR_MAX 0.6
 #define LOAD_FACTOR_MIN 0.1
 #define INITIAL_BUCKETS 16
@@ -23,9 +24,25 @@ http_headers* http_headers_make(void) {
   }
   ret->cap = INITIAL_BUCKETS;
   ret->len = 0;
+  http_memory_add(MEMORY_HEADERS, sizeof(http_headers) + INITIAL_BUCKETS * sizeof(struct bucket));
   return ret;
 }
 
+/* a key takes its length and a terminator, a value the same after its http_hdv */
+static void http_headers_free_values(http_hdv* val) {
+  while (val) {
+    http_hdv* next = val->next;
+    http_memory_sub(MEMORY_HEADERS, sizeof(http_hdv) + val->len + 1);
+    free(val);
+    val = next;
+  }
+}
+
+static void http_headers_free_key(struct bucket* bucket) {
+  http_memory_sub(MEMORY_HEADERS, bucket->key.len + 1);
+  free(bucket->key.v);
+}
+
 static inline unsigned int murmur_scramble(unsigned int k) {
   k *= 0xcc9e2d51;
   k = (k << 15) | (k >> 17);
@@ -112,17 +129,13 @@ static int http_headers_resize(http_headers* map, size_t resize_by)
     }
 
     else if (curr->state == STATE_DELETED) {
-      free(curr->key.v);
-      http_hdv* val  = curr->val;
-      http_hdv* next = NULL;
-      while(val) {
-        next = val->next;
-        free(val);
-        val = next;
-      }
+      http_headers_free_key(curr);
+      http_headers_free_values(curr->val);
     }
   }
   free(old_buckets);
+  http_memory_add(MEMORY_HEADERS, map->cap * sizeof(struct bucket));
+  http_memory_sub(MEMORY_HEADERS, (size_t)old_cap * sizeof(struct bucket));
 
   return HTTP_SUCCESS;
 }
@@ -137,15 +150,14 @@ int http_headers_set(http_headers* map, const char* key, const char* val) {
   struct bucket* bucket = NULL;
 
   while ((bucket = &map->buckets[i])->state != STATE_UNUSED && compare(key, bucket->key.v) != 0) {
-    if (bucket->state == STATE_DELETED)
+    if (bucket->state == STATE_DELETED && !deleted_bucket)
       deleted_bucket = bucket;
     i = (i + 1) & (map->cap - 1);
   }
-  if (deleted_bucket) {
-    if (bucket->state == STATE_USED)
-      bucket->state = STATE_DELETED;
+  /* a live key keeps its bucket so its earlier values survive, otherwise reuse the first tombstone */
+  if (deleted_bucket && bucket->state != STATE_USED)
     bucket = deleted_bucket;
-  }
+  char added = bucket->state != STATE_USED;
 
   size_t keylen = strlen(key);
   size_t vallen = strlen(val);
@@ -166,28 +178,28 @@ int http_headers_set(http_headers* map, const char* key, const char* val) {
       HTTP_LOG(HTTP_LOGERR, "[set_header] failed to allocate memory.\n");
       return HTTP_FAILURE;
     }
+    http_memory_add(MEMORY_HEADERS, keylen + 1);
   }
   else	{
-    if (bucket->key.len < keylen) {
-      free(bucket->key.v);
-      bucket->key.v = (char*)malloc(keylen + 1);
-      if (!bucket->key.v) {
+    /* the same key comes back with the same length, a tombstone taken over by another one is reallocated
+       to the new length so what it holds stays accounted exactly */
+    if (bucket->key.len != keylen) {
+      char* key_v = (char*)malloc(keylen + 1);
+      if (!key_v) {
         free(v);
         HTTP_LOG(HTTP_LOGERR, "[set_header] failed to allocate memory.\n");
         return HTTP_FAILURE;
       }
+      http_headers_free_key(bucket);
+      bucket->key.v = key_v;
+      http_memory_add(MEMORY_HEADERS, keylen + 1);
     }
     if (bucket->state == STATE_DELETED) {
-      http_hdv* valhdv = bucket->val;
-      http_hdv* next = NULL;
-      while (valhdv) {
-        next = valhdv->next;
-        free(valhdv); // also deallocates the string
-        valhdv = next;
-      }
+      http_headers_free_values(bucket->val);
       bucket->val = NULL; 
     }
   }
+  http_memory_add(MEMORY_HEADERS, sizeof(http_hdv) + vallen + 1);
   bucket->key.len       = keylen; 
   bucket->key.v[keylen] = 0; 
   memcpy(bucket->key.v, key, keylen);
@@ -198,7 +210,8 @@ int http_headers_set(http_headers* map, const char* key, const char* val) {
     v->next = bucket->val;
     bucket->val = v;
   }
-  ++map->len;
+  if (added)
+    ++map->len;
 
   if ((float)map->len / map->cap >= LOAD_FACTOR_MAX) {
     if (http_headers_resize(map, map->cap * MULTIPLY_SPACE)) {
@@ -224,7 +237,7 @@ http_hdv* http_headers_get(http_headers* map, const char* key)
 
 int http_headers_remove(http_headers* map, const char* key)
 {
-  if (!map || key) {
+  if (!map || !key) {
     HTTP_LOG(HTTP_LOGERR, "[remove_header] passed NULL pointers for mandatory parameters.\n");
     return HTTP_FAILURE;
   }
@@ -272,7 +285,7 @@ int http_headers_reset(http_headers* map)
     HTTP_LOG(HTTP_LOGERR, "[reset_headers] passed NULL pointers for mandatory parameters.\n");
     return HTTP_FAILURE;
   }
-  for (int i = 0; i < map->cap; ++i) {
+  for (size_t i = 0; i < map->cap; ++i) {
     struct bucket* bucket = &map->buckets[i];
     if (bucket->state != STATE_UNUSED)
       bucket->state = STATE_DELETED;
@@ -286,8 +299,82 @@ int http_headers_free(http_headers* map) {
     HTTP_LOG(HTTP_LOGERR, "[free_headers] passed NULL pointers for mandatory parameters.\n");
     return HTTP_FAILURE;
   }
-  http_headers_reset(map);
+  for (size_t i = 0; i < map->cap; ++i) {
+    struct bucket* bucket = &map->buckets[i];
+    if (bucket->state == STATE_UNUSED)
+      continue;
+    http_headers_free_key(bucket);
+    http_headers_free_values(bucket->val);
+  }
+  http_memory_sub(MEMORY_HEADERS, sizeof(http_headers) + map->cap * sizeof(struct bucket));
   free(map->buckets);
   free(map);
   return HTTP_SUCCESS;
-}
\ No newline at end of file
+}
+
+/* looks for a token in the comma separated values of a header, ignoring case */
+int http_headers_has_token(http_headers* map, const char* key, const char* token)
+{
+  if (!map || !key || !token) {
+    HTTP_LOG(HTTP_LOGERR, "[has_token_headers] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  size_t token_len = strlen(token);
+  for (http_hdv* val = http_headers_get(map, key); val; val = val->next) {
+    const char* q = val->v;
+    while (*q) {
+      while (*q == ' ' || *q == '\t' || *q == ',') ++q;
+      const char* begin = q;
+      while (*q && *q != ',') ++q;
+      const char* end = q;
+      while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) --end;
+      if ((size_t)(end - begin) == token_len) {
+        size_t i = 0;
+        while (i < token_len && tolower((unsigned char)begin[i]) == tolower((unsigned char)token[i])) ++i;
+        if (i == token_len)
+          return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* true for the headers that describe a single connection and mustn't be forwarded by a proxy */
+int http_headers_hop_by_hop(http_headers* map, const char* key)
+{
+  static const char* const hop[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate", "Proxy-Authorization",
+    "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+  };
+  if (!map || !key) {
+    HTTP_LOG(HTTP_LOGERR, "[hop_by_hop_headers] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  for (size_t i = 0; i < sizeof(hop) / sizeof(hop[0]); ++i) {
+    if (compare(key, hop[i]) == 0)
+      return 1;
+  }
+  return http_headers_has_token(map, "Connection", key);
+}
+
+/* a field name is a token, nothing else may come before the colon */
+int http_headers_valid_name(const char* name, size_t len) {
+  if (len == 0)
+    return 0;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)name[i];
+    if (!isalnum(c) && (c == 0 || !strchr("!#$%&'*+-.^_`|~", c)))
+      return 0;
+  }
+  return 1;
+}
+
+/* a field value holds no control characters but tabs, a stray CR or LF would end it for someone else */
+int http_headers_valid_value(const char* value, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)value[i];
+    if ((c < 0x20 && c != '\t') || c == 0x7f)
+      return 0;
+  }
+  return 1;
+}
@@ -31,6 +31,10 @@ http_hdv* http_headers_get(http_headers*, const char*);
 int http_headers_remove(http_headers*, const char*);
 int http_headers_next(http_headers*, size_t*, http_hdk*, http_hdv**);
 int http_headers_reset(http_headers*);
+int http_headers_has_token(http_headers*, const char*, const char*);
+int http_headers_hop_by_hop(http_headers*, const char*);
+int http_headers_valid_name(const char*, size_t);
+int http_headers_valid_value(const char*, size_t);
 int http_headers_free(http_headers*);
 
 #endif
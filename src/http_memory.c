@@ -0,0 +1,108 @@
+#include "http_memory.h"
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* the process' bytes in every category. each thread counts in a slot of its own so the counts stay off
+   shared cache lines, the ones past the last slot share slot 0 and pay for an atomic add */
+static struct memory_slot memory_slots[HTTP_MEMORY_SLOTS];
+static _Atomic size_t memory_slots_len = 1;
+static _Thread_local struct memory_slot* memory_slot;
+
+static struct memory_slot* http_memory_slot(void) {
+  if (!memory_slot) {
+    size_t i = atomic_fetch_add_explicit(&memory_slots_len, 1, memory_order_relaxed);
+    memory_slot = i < HTTP_MEMORY_SLOTS ? &memory_slots[i] : &memory_slots[0];
+  }
+  return memory_slot;
+}
+
+/* a thread may free what another one allocated, its own slot goes below zero then: the counts wrap and
+   only their sum means anything */
+static void http_memory_count(int category, size_t delta) {
+  struct memory_slot* slot = http_memory_slot();
+  _Atomic size_t* bytes = &slot->bytes[category];
+  if (slot == &memory_slots[0])
+    atomic_fetch_add_explicit(bytes, delta, memory_order_relaxed);
+  else
+    atomic_store_explicit(bytes, atomic_load_explicit(bytes, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+void http_memory_add(int category, size_t len) {
+  http_memory_count(category, len);
+}
+
+void http_memory_sub(int category, size_t len) {
+  http_memory_count(category, (size_t)0 - len);
+}
+
+/* slots are read while their threads write them, so it's a close estimate rather than a snapshot */
+size_t http_memory_used(int category) {
+  if (category < 0 || category >= MEMORY_CATEGORIES)
+    return 0;
+  size_t len = atomic_load_explicit(&memory_slots_len, memory_order_relaxed);
+  len = MIN(len, HTTP_MEMORY_SLOTS);
+  size_t sum = 0;
+  for (size_t i = 0; i < len; ++i)
+    sum += atomic_load_explicit(&memory_slots[i].bytes[category], memory_order_relaxed);
+  return (ptrdiff_t)sum < 0 ? 0 : sum;
+}
+
+size_t http_memory_total(void) {
+  size_t total = 0;
+  for (int category = 0; category < MEMORY_CATEGORIES; ++category)
+    total += http_memory_used(category);
+  return total;
+}
+
+const char* http_memory_category_string(int category) {
+  static const char* names[MEMORY_CATEGORIES] = { "connections", "headers", "bodies", "caches" };
+  return category >= 0 && category < MEMORY_CATEGORIES ? names[category] : NULL;
+}
+
+/* 'len' bytes aligned to HTTP_MEMORY_REGION, a multiple of it. 'huge' is one of HUGE_PAGES_*, NULL when
+   nothing could be mapped */
+void* http_memory_map(size_t len, int huge) {
+#ifdef _WIN32
+  return _aligned_malloc(len, HTTP_MEMORY_REGION);
+#else
+  void* region;
+#ifdef MAP_HUGETLB
+  if (huge == HUGE_PAGES_RESERVED) {
+    region = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region != MAP_FAILED)
+      return region;
+  }
+#endif
+  /* mapped with a region to spare and trimmed, a huge page can only back an aligned range */
+  size_t span = len + HTTP_MEMORY_REGION;
+  char* raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    HTTP_LOG(HTTP_LOGERR, "[http_memory_map] mmap() failed - %d.\n", GET_ERROR());
+    return NULL;
+  }
+  char* aligned = (char*)(((uintptr_t)raw + HTTP_MEMORY_REGION - 1) & ~(uintptr_t)(HTTP_MEMORY_REGION - 1));
+  if (aligned > raw)
+    munmap(raw, aligned - raw);
+  if (raw + span > aligned + len)
+    munmap(aligned + len, raw + span - (aligned + len));
+  region = aligned;
+#ifdef MADV_HUGEPAGE
+  if (huge != HUGE_PAGES_OFF)
+    madvise(region, len, MADV_HUGEPAGE);
+#endif
+  return region;
+#endif
+}
+
+void http_memory_unmap(void* region, size_t len) {
+  if (!region)
+    return;
+#ifdef _WIN32
+  _aligned_free(region);
+#else
+  munmap(region, len);
+#endif
+}
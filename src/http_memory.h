@@ -0,0 +1,37 @@
+#ifndef HTTP_MEMORY_H_
+#define HTTP_MEMORY_H_
+#include "includes.h"
+#include <stdatomic.h>
+#define HTTP_MEMORY_REGION (1024 * 1024 * 2)    /* a huge page on x86-64 and arm64 */
+#define HTTP_MEMORY_SLOTS 64
+
+/* what the accounted bytes are held for */
+enum {
+  MEMORY_CONNECTIONS,                           /* connection slots, receive and websocket buffers */
+  MEMORY_HEADERS,                               /* request and response header tables */
+  MEMORY_BODIES,                                /* request bodies, serialized and proxied responses */
+  MEMORY_CACHES,                                /* response cache entries */
+  MEMORY_CATEGORIES
+};
+
+enum {
+  HUGE_PAGES_OFF,
+  HUGE_PAGES_TRANSPARENT,                       /* madvise(MADV_HUGEPAGE), promoted when the kernel can */
+  HUGE_PAGES_RESERVED                           /* MAP_HUGETLB, transparent ones when none are reserved */
+};
+
+// internal use, one event loop's counts, written by its thread alone
+struct memory_slot {
+  _Atomic size_t bytes[MEMORY_CATEGORIES];
+  char pad[64 - sizeof(size_t) * MEMORY_CATEGORIES];
+};
+
+void http_memory_add(int, size_t);
+void http_memory_sub(int, size_t);
+size_t http_memory_used(int);
+size_t http_memory_total(void);
+const char* http_memory_category_string(int);
+void* http_memory_map(size_t, int);
+void http_memory_unmap(void*, size_t);
+
+#endif
@@ -0,0 +1,161 @@
+#include "http_metrics.h"
+
+/* upper bounds of the exported latency buckets, in nanoseconds */
+static const uint64_t metrics_bounds[] = {
+  100000ull, 250000ull, 500000ull,
+  1000000ull, 2500000ull, 5000000ull,
+  10000000ull, 25000000ull, 50000000ull,
+  100000000ull, 250000000ull, 500000000ull,
+  1000000000ull, 2500000000ull, 5000000000ull, 10000000000ull
+};
+#define METRICS_BOUNDS (sizeof(metrics_bounds) / sizeof(metrics_bounds[0]))
+
+struct metrics_writer {
+  char** buffer;
+  size_t* len;
+  size_t* cap;
+  int failed;
+};
+
+/* appends in place, the buffer only grows when a scrape outgrows every earlier one */
+static void metrics_printf(struct metrics_writer* w, const char* format, ...) {
+  if (w->failed)
+    return;
+  for (;;) {
+    size_t room = *w->cap - *w->len;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(*w->buffer ? *w->buffer + *w->len : NULL, room, format, args);
+    va_end(args);
+    if (n < 0) {
+      w->failed = 1;
+      return;
+    }
+    if ((size_t)n < room) {
+      *w->len += n;
+      return;
+    }
+    if (http_body_reserve(w->buffer, w->cap, *w->len + n + 1024, SIZE_MAX) == HTTP_FAILURE) {
+      w->failed = 1;
+      return;
+    }
+  }
+}
+
+static void metrics_counter(struct metrics_writer* w, const char* name, const char* help, uint64_t value) {
+  metrics_printf(w, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+static void metrics_gauge(struct metrics_writer* w, const char* name, const char* help, uint64_t value) {
+  metrics_printf(w, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+static void metrics_stages(struct metrics_writer* w, const http_stats* stats) {
+  metrics_printf(w, "# HELP kudos_request_stage_seconds Time spent in each stage of a request.\n"
+                    "# TYPE kudos_request_stage_seconds histogram\n");
+  uint64_t counts[METRICS_BOUNDS];
+  for (int stage = 0; stage < HTTP_STAGE_NONE; ++stage) {
+    const struct histogram* h = &stats->stages[stage];
+    const char* name = http_stage_string(stage);
+    histogram_cumulative(h, metrics_bounds, METRICS_BOUNDS, counts);
+    for (size_t i = 0; i < METRICS_BOUNDS; ++i)
+      metrics_printf(w, "kudos_request_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                     name, metrics_bounds[i] / 1e9, (unsigned long long)counts[i]);
+    metrics_printf(w, "kudos_request_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                      "kudos_request_stage_seconds_sum{stage=\"%s\"} %.9f\n"
+                      "kudos_request_stage_seconds_count{stage=\"%s\"} %llu\n",
+                   name, (unsigned long long)histogram_count(h),
+                   name, h->sum / 1e9,
+                   name, (unsigned long long)histogram_count(h));
+  }
+}
+
+/* renders the server's state in the Prometheus text format into a buffer the caller keeps between scrapes */
+int http_metrics_render(http_server* server, char** buffer, size_t* len, size_t* cap) {
+  if (!server || !buffer || !len || !cap) {
+    HTTP_LOG(HTTP_LOGERR, "[http_metrics_render] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct metrics_writer w = { buffer, len, cap, 0 };
+  const http_stats* stats = &server->stats;
+  const http_counters* counters = &stats->counters;
+  const struct conn_group* conns = &server->conns;
+  *len = 0;
+
+  metrics_gauge(&w, "kudos_connections_active", "Connections currently open.", conns->len);
+  metrics_gauge(&w, "kudos_connection_slots", "Connection slots allocated.", conns->cap);
+  metrics_gauge(&w, "kudos_connections_max", "Connections allowed at once.", server->constraints.max_connections);
+  metrics_gauge(&w, "kudos_websockets_open", "Connections upgraded to WebSocket.", server->websockets);
+  metrics_gauge(&w, "kudos_sse_subscribers", "Connections subscribed to an event stream.", server->sse_subscribers);
+  metrics_gauge(&w, "kudos_h2_connections_open", "Connections speaking HTTP/2.", server->h2_conns);
+  metrics_counter(&w, "kudos_connections_accepted_total", "Connections accepted.", counters->connections_accepted);
+  metrics_counter(&w, "kudos_connections_closed_total", "Connections closed.", counters->connections_closed);
+  metrics_counter(&w, "kudos_parse_failures_total", "Requests rejected while parsing.", counters->parse_failures);
+  metrics_counter(&w, "kudos_rate_limited_total", "Requests and connections turned away by the per-client limits.",
+                  counters->rate_limited);
+  metrics_counter(&w, "kudos_memory_shed_total", "Connections turned away past the memory limit.", counters->memory_shed);
+  metrics_counter(&w, "kudos_sse_events_total", "Events published to at least one subscriber.", counters->sse_events);
+  metrics_counter(&w, "kudos_sse_dropped_total", "Subscribers disconnected for a full backlog.", counters->sse_dropped);
+  metrics_counter(&w, "kudos_sse_coalesced_total", "Backlogs cut down to the newest event.", counters->sse_coalesced);
+  metrics_counter(&w, "kudos_h2_streams_total", "HTTP/2 streams opened.", counters->h2_streams);
+  metrics_counter(&w, "kudos_tls_handshakes_total", "TLS handshakes completed.", counters->tls_handshakes);
+  metrics_counter(&w, "kudos_tls_resumed_total", "TLS handshakes that resumed a session.", counters->tls_resumed);
+  metrics_counter(&w, "kudos_tls_failures_total", "TLS handshakes that failed.", counters->tls_failures);
+  metrics_counter(&w, "kudos_tls_ktls_total", "TLS connections handed to kernel TLS for sending.", counters->tls_ktls);
+  metrics_counter(&w, "kudos_received_bytes_total", "Bytes received.", counters->bytes_in);
+  metrics_counter(&w, "kudos_sent_bytes_total", "Bytes sent.", counters->bytes_out);
+
+  metrics_printf(&w, "# HELP kudos_syscalls_total Socket calls made by the event loop.\n"
+                     "# TYPE kudos_syscalls_total counter\n"
+                     "kudos_syscalls_total{call=\"accept\"} %llu\n"
+                     "kudos_syscalls_total{call=\"recv\"} %llu\n"
+                     "kudos_syscalls_total{call=\"send\"} %llu\n",
+                 (unsigned long long)counters->accept_calls,
+                 (unsigned long long)counters->recv_calls,
+                 (unsigned long long)counters->send_calls);
+
+  metrics_printf(&w, "# HELP kudos_requests_total Requests answered, by method.\n"
+                     "# TYPE kudos_requests_total counter\n");
+  for (int method = 0; method <= METHOD_NONE; ++method) {
+    if (!stats->methods[method])
+      continue;
+    const char* name = method < METHOD_NONE ? http_request_method_string(method) : "invalid";
+    metrics_printf(&w, "kudos_requests_total{method=\"%s\"} %llu\n", name, (unsigned long long)stats->methods[method]);
+  }
+  metrics_printf(&w, "# HELP kudos_responses_total Responses sent, by status code.\n"
+                     "# TYPE kudos_responses_total counter\n");
+  for (int status = 0; status <= HTTP_STATUS_NONE; ++status) {
+    if (!stats->statuses[status])
+      continue;
+    int code = status < HTTP_STATUS_NONE ? http_response_status_code(status) : 0;
+    metrics_printf(&w, "kudos_responses_total{code=\"%d\"} %llu\n", code, (unsigned long long)stats->statuses[status]);
+  }
+
+  metrics_gauge(&w, "kudos_buffer_pool_in_use", "Receive buffers held by connections.", conns->pool.in_use);
+  metrics_gauge(&w, "kudos_buffer_pool_free", "Receive buffers kept for reuse.", conns->pool.len);
+  metrics_gauge(&w, "kudos_buffer_pool_buffer_bytes", "Size of a pooled receive buffer.", conns->pool.buff_len);
+  metrics_gauge(&w, "kudos_buffer_pool_regions", "Regions the receive buffers are carved from.", conns->pool.regions);
+
+  metrics_printf(&w, "# HELP kudos_memory_bytes Bytes the process holds, by what they're for.\n"
+                     "# TYPE kudos_memory_bytes gauge\n");
+  for (int category = 0; category < MEMORY_CATEGORIES; ++category)
+    metrics_printf(&w, "kudos_memory_bytes{category=\"%s\"} %llu\n", http_memory_category_string(category),
+                   (unsigned long long)http_memory_used(category));
+
+  if (server->cache) {
+    metrics_counter(&w, "kudos_cache_hits_total", "Requests answered from the response cache.", counters->cache_hits);
+    metrics_counter(&w, "kudos_cache_misses_total", "Cacheable requests that went to the handler.", counters->cache_misses);
+    metrics_counter(&w, "kudos_cache_collapsed_total", "Requests that waited on an identical one instead of the handler.",
+                    counters->cache_collapsed);
+    metrics_gauge(&w, "kudos_cache_bytes", "Bytes held by the response cache.", http_cache_bytes(server->cache));
+  }
+
+  if (server->access_log)
+    metrics_counter(&w, "kudos_access_log_dropped_total", "Access log records dropped because the log thread fell behind.",
+                    access_log_dropped(server->access_log));
+
+  metrics_stages(&w, stats);
+  if (w.failed)
+    return HTTP_FAILURE;
+  return HTTP_SUCCESS;
+}
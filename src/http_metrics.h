@@ -0,0 +1,8 @@
+#ifndef HTTP_METRICS_H_
+#define HTTP_METRICS_H_
+#include "includes.h"
+#include "http_server.h"
+
+int http_metrics_render(http_server*, char**, size_t*, size_t*);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef HTTP_PROFILE_H_
+#define HTTP_PROFILE_H_
+
+/* an optional build profile, for servers that know what they'll be asked: compiled with
+   -DHTTP_PROFILE='"name.h"' that header defines any of the HTTP_PROFILE_* below first, see
+   src/profiles/. a limit it sets is a constant to the parser and the event loop whatever the constraints
+   say, http_constraints_make_default() reports it. a feature it turns off is compiled out, requests that
+   need it fail to parse and get the error handler's answer */
+#ifdef HTTP_PROFILE
+#include HTTP_PROFILE
+#endif
+
+/* features, 0 = out */
+#ifndef HTTP_PROFILE_CHUNKED_REQUESTS
+#define HTTP_PROFILE_CHUNKED_REQUESTS 1
+#endif
+#ifndef HTTP_PROFILE_HTTP10
+#define HTTP_PROFILE_HTTP10 1
+#endif
+/* the methods requests may use, HTTP_METHOD_BIT(METHOD_GET) | ... */
+#define HTTP_METHOD_BIT(m) (1u << (m))
+#ifndef HTTP_PROFILE_METHODS
+#define HTTP_PROFILE_METHODS (~0u)
+#endif
+#define HTTP_METHOD_ENABLED(m) ((HTTP_PROFILE_METHODS & HTTP_METHOD_BIT(m)) != 0)
+
+/* limits, read through these wherever the constraints' field would be */
+#ifdef HTTP_PROFILE_REQUEST_MAX_BODY_LEN
+#define HTTP_REQUEST_MAX_BODY_LEN(c) ((void)(c), (size_t)(HTTP_PROFILE_REQUEST_MAX_BODY_LEN))
+#else
+#define HTTP_REQUEST_MAX_BODY_LEN(c) ((c)->request_max_body_len)
+#endif
+#ifdef HTTP_PROFILE_REQUEST_MAX_URI_LEN
+#define HTTP_REQUEST_MAX_URI_LEN(c) ((void)(c), (size_t)(HTTP_PROFILE_REQUEST_MAX_URI_LEN))
+#else
+#define HTTP_REQUEST_MAX_URI_LEN(c) ((c)->request_max_uri_len)
+#endif
+#ifdef HTTP_PROFILE_REQUEST_MAX_HEADERS
+#define HTTP_REQUEST_MAX_HEADERS(c) ((void)(c), (size_t)(HTTP_PROFILE_REQUEST_MAX_HEADERS))
+#else
+#define HTTP_REQUEST_MAX_HEADERS(c) ((c)->request_max_headers)
+#endif
+#ifdef HTTP_PROFILE_REQUEST_MAX_HEADER_LEN
+#define HTTP_REQUEST_MAX_HEADER_LEN(c) ((void)(c), (size_t)(HTTP_PROFILE_REQUEST_MAX_HEADER_LEN))
+#else
+#define HTTP_REQUEST_MAX_HEADER_LEN(c) ((c)->request_max_header_len)
+#endif
+#ifdef HTTP_PROFILE_RECV_LEN
+#define HTTP_RECV_LEN(c) ((void)(c), (size_t)(HTTP_PROFILE_RECV_LEN))
+#else
+#define HTTP_RECV_LEN(c) ((c)->recv_len)
+#endif
+#ifdef HTTP_PROFILE_SEND_LEN
+#define HTTP_SEND_LEN(c) ((void)(c), (size_t)(HTTP_PROFILE_SEND_LEN))
+#else
+#define HTTP_SEND_LEN(c) ((c)->send_len)
+#endif
+#ifdef HTTP_PROFILE_TCP_CORK
+#define HTTP_TCP_CORK(c) ((void)(c), (HTTP_PROFILE_TCP_CORK))
+#else
+#define HTTP_TCP_CORK(c) ((c)->tcp_cork)
+#endif
+
+#endif
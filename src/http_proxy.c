@@ -0,0 +1,526 @@
+#include "http_proxy.h"
+#define HTTP_PROXY_HEALTH_INTERVAL 2000
+
+http_proxy* http_proxy_new(http_constraints* constraints) {
+  http_proxy* proxy = malloc(sizeof(http_proxy));
+  if (!proxy) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_new] malloc() failed.\n");
+    return NULL;
+  }
+  memset(proxy, 0, sizeof(*proxy));
+  proxy->constraints = constraints ? *constraints : http_constraints_make_default();
+  /* upstream bodies are passed through as they arrive, only the heads have to fit */
+  proxy->constraints.response_max_body_len = SIZE_MAX;
+  proxy->health_interval = (uint64_t)HTTP_PROXY_HEALTH_INTERVAL * 1000000;
+  return proxy;
+}
+
+int http_proxy_free(http_proxy* proxy) {
+  if (!proxy) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  for (size_t i = 0; i < proxy->exchanges_len; ++i) {
+    if (proxy->exchanges[i].client)
+      http_client_free(proxy->exchanges[i].client);
+  }
+  for (size_t i = 0; i < proxy->upstreams_len; ++i) {
+    struct http_upstream* up = &proxy->upstreams[i];
+    for (size_t j = 0; j < up->idle_len; ++j)
+      http_client_free(up->idle[j]);
+    if (up->probe)
+      http_client_free(up->probe);
+  }
+  free(proxy->exchanges);
+  free(proxy);
+  return HTTP_SUCCESS;
+}
+
+int http_proxy_add_upstream(http_proxy* proxy, const char* ip, const char* port) {
+  if (!proxy || !ip || !port) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_add_upstream] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (proxy->upstreams_len == HTTP_PROXY_MAX_UPSTREAMS) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_add_upstream] too many upstreams.\n");
+    return HTTP_FAILURE;
+  }
+  struct addrinfo hints, *binder;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(ip, port, &hints, &binder)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_add_upstream] getaddrinfo() failed.\n");
+    return HTTP_FAILURE;
+  }
+  struct http_upstream* up = &proxy->upstreams[proxy->upstreams_len++];
+  memset(up, 0, sizeof(*up));
+  up->addr    = *(struct sockaddr_in*)binder->ai_addr;
+  up->healthy = 1;
+  up->checked = http_clock_ns();
+  freeaddrinfo(binder);
+  return HTTP_SUCCESS;
+}
+
+/* probes 'path' on every upstream each 'interval' milliseconds, a 2xx or 3xx answer marks it healthy.
+   without a path an upstream that kept failing is simply tried again after the interval */
+int http_proxy_set_health_check(http_proxy* proxy, const char* path, uint64_t interval) {
+  if (!proxy || !interval) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_set_health_check] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  proxy->health_path     = path;
+  proxy->health_interval = interval * 1000000;
+  return HTTP_SUCCESS;
+}
+
+/* answers 504 when an upstream takes longer than 'timeout' milliseconds to respond, 0 waits forever */
+int http_proxy_set_timeout(http_proxy* proxy, uint64_t timeout) {
+  if (!proxy) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_set_timeout] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  proxy->timeout = timeout * 1000000;
+  return HTTP_SUCCESS;
+}
+
+static uint64_t http_proxy_poll_fill(void* proxy, fd_set* read, fd_set* write, int* max_socket) {
+  return http_proxy_fill(proxy, read, write, max_socket);
+}
+
+static int http_proxy_poll_dispatch(void* proxy, fd_set* read, fd_set* write) {
+  return http_proxy_dispatch(proxy, read, write);
+}
+
+/* exchanges are indexed like the server's connections, which never outnumber max_connections */
+int http_proxy_attach(http_proxy* proxy, http_server* server) {
+  if (!proxy || !server) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_attach] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (proxy->server) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_attach] the proxy already serves another server.\n");
+    return HTTP_FAILURE;
+  }
+  size_t len = server->constraints.max_connections;
+  proxy->exchanges = calloc(len, sizeof(struct http_exchange));
+  if (!proxy->exchanges) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_attach] calloc() failed.\n");
+    return HTTP_FAILURE;
+  }
+  for (size_t i = 0; i < len; ++i)
+    proxy->exchanges[i].proxy = proxy;
+  proxy->exchanges_len    = len;
+  proxy->server           = server;
+  proxy->poller.ctx       = proxy;
+  proxy->poller.fill      = http_proxy_poll_fill;
+  proxy->poller.dispatch  = http_proxy_poll_dispatch;
+  return HTTP_SUCCESS;
+}
+
+/* least connections, ties go round robin so an idle pool still spreads the load */
+static struct http_upstream* http_proxy_pick(http_proxy* proxy) {
+  struct http_upstream* best = NULL;
+  const size_t len = proxy->upstreams_len;
+  for (size_t n = 0; n < len; ++n) {
+    struct http_upstream* up = &proxy->upstreams[(proxy->next + n) % len];
+    if (up->healthy && (!best || up->active < best->active))
+      best = up;
+  }
+  ++proxy->next;
+  return best;
+}
+
+static void http_proxy_failed(http_proxy* proxy, struct http_upstream* up) {
+  if (++up->failures >= HTTP_PROXY_MAX_FAILURES && up->healthy) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_failed] an upstream stopped answering.\n");
+    up->healthy = 0;
+    up->checked = http_clock_ns();
+  }
+}
+
+static void http_proxy_release(struct http_upstream* up, http_client* client, int reuse) {
+  if (reuse && conn_info_is(client->conn, CONN_USED) && !client->conn->close && http_client_pending(client) == 0 &&
+      up->idle_len < HTTP_PROXY_MAX_IDLE) {
+    http_client_set_handler(client, NULL, NULL);
+    http_client_pause(client, 0);
+    up->idle[up->idle_len++] = client;
+    return;
+  }
+  http_client_free(client);
+}
+
+/* an answer the proxy makes up itself, before anything came from the upstream */
+static void http_proxy_reply(struct conn_info* conn, int status) {
+  http_response* res = &conn->response;
+  http_response_reset(res);
+  http_response_set_status(res, status);
+  http_response_set_header(res, "Content-Length", "0");
+  http_server_keep_alive(conn);
+  conn->timing.handler_end = http_clock_ns();
+  conn_info_mark(conn, CONN_DEFERRED, 0);
+}
+
+static void http_proxy_finish(http_proxy* proxy, struct http_exchange* ex, int reuse) {
+  http_proxy_release(ex->upstream, ex->client, reuse);
+  --ex->upstream->active;
+  --proxy->active;
+  ex->client   = NULL;
+  ex->upstream = NULL;
+}
+
+static int http_proxy_append(http_response* res, const char* data, size_t len, int chunked) {
+  if (http_body_reserve(&res->body_buffer, &res->body_cap, res->body_len + len + 32, SIZE_MAX) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  char* out = res->body_buffer + res->body_len;
+  size_t n = 0;
+  if (chunked)
+    n += sprintf(out, "%zx\r\n", len);
+  memcpy(out + n, data, len);
+  n += len;
+  if (chunked) {
+    memcpy(out + n, "\r\n", 2);
+    n += 2;
+  }
+  res->body_len += n;
+  return HTTP_SUCCESS;
+}
+
+/* copies the upstream's status and end-to-end headers, the framing towards the client is redone */
+static int http_proxy_head(struct http_exchange* ex, struct conn_info* conn, http_response* up) {
+  http_request* req  = &conn->request;
+  http_response* res = &conn->response;
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  res->status = up->status;
+  while (http_headers_next(up->headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    if (http_headers_hop_by_hop(up->headers, key.v))
+      continue;
+    /* the list is newest first and setting prepends, so the values keep their order */
+    for (; val; val = val->next) {
+      if (http_headers_set(res->headers, key.v, val->v) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+    }
+  }
+  if (up->framing.termination == BODYTERMI_CHUNKED || up->framing.termination == BODYTERMI_CLOSE) {
+    /* an HTTP/1.0 client can only be told where the body ends by closing the connection */
+    if (req->version == HTTP_VERSION_1_1) {
+      if (http_headers_set(res->headers, "Transfer-Encoding", "chunked") == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      ex->chunked = 1;
+    }
+    else if (http_headers_set(res->headers, "Connection", "close") == HTTP_FAILURE)
+      return HTTP_FAILURE;
+  }
+  res->body_type = BODYTYPE_STREAM;
+  http_server_keep_alive(conn);
+  conn->timing.handler_end = http_clock_ns();
+  ex->head = 1;
+  return HTTP_SUCCESS;
+}
+
+/* streams what the upstream sent since the last call into the client's response */
+static void http_proxy_response(http_client* client, http_response* up, void* userdata) {
+  struct http_exchange* ex = userdata;
+  http_proxy* proxy = ex->proxy;
+  struct conn_info* conn = &proxy->server->conns.data[ex - proxy->exchanges];
+  http_response* res = &conn->response;
+  if (ex->failed)
+    return;
+  if (!ex->head && http_proxy_head(ex, conn, up) == HTTP_FAILURE) {
+    ex->failed = 1;
+    return;
+  }
+  if (up->body_len && http_proxy_append(res, up->body_buffer, up->body_len, ex->chunked) == HTTP_FAILURE) {
+    ex->failed = 1;
+    return;
+  }
+  if (up->state == STATE_GOT_ALL) {
+    if (ex->chunked && http_proxy_append(res, "0\r\n\r\n", 5, 0) == HTTP_FAILURE) {
+      ex->failed = 1;
+      return;
+    }
+    res->stream_done = 1;
+    ex->done = 1;
+  }
+  conn_info_mark(conn, CONN_DEFERRED, 0);
+  /* a slow client stops the reads from the upstream instead of growing the buffer */
+  if (res->body_len >= HTTP_PROXY_BACKLOG)
+    http_client_pause(client, 1);
+}
+
+static http_client* http_proxy_connect(http_proxy* proxy, struct http_upstream* up, int reuse) {
+  while (reuse && up->idle_len > 0) {
+    http_client* client = up->idle[--up->idle_len];
+    if (conn_info_is(client->conn, CONN_USED))
+      return client;
+    http_client_free(client);
+  }
+  http_client* client = http_client_new(&proxy->constraints);
+  if (!client)
+    return NULL;
+  if (http_client_connect_addr(client, &up->addr) == HTTP_FAILURE) {
+    http_client_free(client);
+    http_proxy_failed(proxy, up);
+    return NULL;
+  }
+  http_client_set_stream(client, 1);
+  return client;
+}
+
+static int http_proxy_send(http_proxy* proxy, struct http_exchange* ex, struct conn_info* conn,
+                           struct http_upstream* up, int reuse) {
+  int idle = reuse && up->idle_len > 0;
+  http_client* client = http_proxy_connect(proxy, up, reuse);
+  if (!client)
+    return HTTP_FAILURE;
+  if (http_client_send_request(client, &conn->request) == HTTP_FAILURE) {
+    http_client_free(client);
+    http_proxy_failed(proxy, up);
+    return HTTP_FAILURE;
+  }
+  http_client_set_handler(client, http_proxy_response, ex);
+  ex->client   = client;
+  ex->upstream = up;
+  ex->reused   = idle;
+  ++ex->attempts;
+  ++up->active;
+  ++proxy->active;
+  return HTTP_SUCCESS;
+}
+
+/* the client's address is appended to the chain of proxies it came through, however long that is */
+static int http_proxy_forwarded_for(http_request* req, const struct sockaddr_in* peer) {
+  char addr[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &peer->sin_addr, addr, sizeof(addr));
+  size_t addr_len = strlen(addr);
+  http_hdv* previous = http_headers_get(req->headers, "X-Forwarded-For");
+  size_t len = addr_len + 1;
+  for (http_hdv* val = previous; val; val = val->next)
+    len += val->len + 2;
+  char* forwarded = malloc(len);
+  if (!forwarded) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_forwarded_for] malloc() failed.\n");
+    return HTTP_FAILURE;
+  }
+  /* the latest value comes first in the list, the chain is written back to front to keep the order */
+  size_t n = len - addr_len - 1;
+  memcpy(forwarded + n, addr, addr_len + 1);
+  for (http_hdv* val = previous; val; val = val->next) {
+    n -= val->len + 2;
+    memcpy(forwarded + n, val->v, val->len);
+    memcpy(forwarded + n + val->len, ", ", 2);
+  }
+  if (previous)
+    http_headers_remove(req->headers, "X-Forwarded-For");
+  int ret = http_headers_set(req->headers, "X-Forwarded-For", forwarded);
+  free(forwarded);
+  return ret;
+}
+
+/* hands a complete request to an upstream, the connection's response is deferred until it answers */
+int http_proxy_forward(http_proxy* proxy, struct conn_info* conn) {
+  if (!proxy || !conn || !proxy->server) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_forward] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct http_exchange* ex = &proxy->exchanges[conn - proxy->server->conns.data];
+  http_request* req = &conn->request;
+  ex->start    = http_clock_ns();
+  ex->head     = 0;
+  ex->chunked  = 0;
+  ex->done     = 0;
+  ex->failed   = 0;
+  ex->attempts = 0;
+  conn_info_mark(conn, CONN_DEFERRED, 1);
+  if (http_proxy_forwarded_for(req, &conn->addr) == HTTP_FAILURE) {
+    http_proxy_reply(conn, HTTP_STATUS_500);
+    return HTTP_SUCCESS;
+  }
+  /* refused before an upstream is picked, it isn't the upstream's failure */
+  if (http_client_forwardable(req) == HTTP_FAILURE) {
+    http_proxy_reply(conn, HTTP_STATUS_400);
+    return HTTP_SUCCESS;
+  }
+  struct http_upstream* up = http_proxy_pick(proxy);
+  if (!up)
+    http_proxy_reply(conn, HTTP_STATUS_503);
+  else if (http_proxy_send(proxy, ex, conn, up, 1) == HTTP_FAILURE)
+    http_proxy_reply(conn, HTTP_STATUS_502);
+  return HTTP_SUCCESS;
+}
+
+/* the exchange broke down. the request is sent again when it can't have reached the upstream: over a
+   fresh connection when a pooled one went stale, to another upstream when the connect was refused.
+   otherwise it's answered with 'status' if nothing was sent yet, or the client connection is cut short */
+static void http_proxy_error(http_proxy* proxy, struct http_exchange* ex, int status) {
+  struct conn_info* conn = &proxy->server->conns.data[ex - proxy->exchanges];
+  struct http_upstream* up = ex->upstream;
+  int retry = !ex->head && !ex->failed && status == HTTP_STATUS_502 &&
+              (size_t)ex->attempts <= proxy->upstreams_len;
+  int stale = ex->reused;
+  if (retry && !stale && !ex->client->connecting)
+    retry = 0;
+  if (!stale)
+    http_proxy_failed(proxy, up);
+  http_proxy_finish(proxy, ex, 0);
+  if (retry && !stale)
+    up = http_proxy_pick(proxy);
+  if (retry && up && http_proxy_send(proxy, ex, conn, up, 0) == HTTP_SUCCESS)
+    return;
+  if (!ex->head)
+    http_proxy_reply(conn, status);
+  else {
+    conn->close = 1;
+    conn->response.stream_done = 1;
+    conn_info_mark(conn, CONN_DEFERRED, 0);
+  }
+}
+
+void http_proxy_detach(http_proxy* proxy, struct conn_info* conn) {
+  if (!proxy || !conn || !proxy->server)
+    return;
+  struct http_exchange* ex = &proxy->exchanges[conn - proxy->server->conns.data];
+  if (ex->client)
+    http_proxy_finish(proxy, ex, 0);
+}
+
+static void http_proxy_health(http_client* client, http_response* res, void* userdata) {
+  struct http_upstream* up = userdata;
+  int code = http_response_status_code(res->status);
+  up->healthy = code >= 200 && code < 400;
+  if (up->healthy)
+    up->failures = 0;
+}
+
+static void http_proxy_probe(http_proxy* proxy, struct http_upstream* up) {
+  http_client* probe = http_client_new(&proxy->constraints);
+  if (!probe)
+    return;
+  if (http_client_connect_addr(probe, &up->addr) == HTTP_FAILURE ||
+      http_client_prepare(probe, METHOD_GET, proxy->health_path, NULL, 0) == HTTP_FAILURE ||
+      http_client_send(probe) == HTTP_FAILURE) {
+    http_client_free(probe);
+    up->healthy = 0;
+    return;
+  }
+  http_client_set_handler(probe, http_proxy_health, up);
+  up->probe = probe;
+}
+
+static void http_proxy_watch(http_client* client, fd_set* read, fd_set* write, int* max_socket) {
+  SOCKET sockfd = client->conn->sockfd;
+  if (!client->paused)
+    FD_SET(sockfd, read);
+  if (http_client_wants_write(client))
+    FD_SET(sockfd, write);
+  if ((int)sockfd > *max_socket)
+    *max_socket = (int)sockfd;
+}
+
+/* adds the upstream sockets the loop has to wait on, returns how long it may wait in nanoseconds */
+uint64_t http_proxy_fill(http_proxy* proxy, fd_set* read, fd_set* write, int* max_socket) {
+  uint64_t now  = http_clock_ns();
+  uint64_t next = (uint64_t)SELECT_SEC * 1000000000;
+  for (size_t i = 0; i < proxy->upstreams_len; ++i) {
+    struct http_upstream* up = &proxy->upstreams[i];
+    /* an idle connection only becomes readable when the upstream closes it */
+    for (size_t j = 0; j < up->idle_len; ++j)
+      http_proxy_watch(up->idle[j], read, write, max_socket);
+    if (up->probe)
+      http_proxy_watch(up->probe, read, write, max_socket);
+    if (proxy->health_path || !up->healthy) {
+      uint64_t due  = up->checked + proxy->health_interval;
+      uint64_t wait = due > now ? due - now : 0;
+      next = MIN(next, wait);
+    }
+  }
+  if (proxy->active == 0)
+    return next;
+  struct conn_info* conns = proxy->server->conns.data;
+  for (size_t i = 0; i < proxy->exchanges_len; ++i) {
+    struct http_exchange* ex = &proxy->exchanges[i];
+    if (!ex->client)
+      continue;
+    /* the client caught up, the upstream can be read from again */
+    if (ex->client->paused && conns[i].response.body_len == 0)
+      http_client_pause(ex->client, 0);
+    http_proxy_watch(ex->client, read, write, max_socket);
+    if (proxy->timeout && !ex->head) {
+      uint64_t due  = ex->start + proxy->timeout;
+      uint64_t wait = due > now ? due - now : 0;
+      next = MIN(next, wait);
+    }
+  }
+  return next;
+}
+
+static void http_proxy_check(http_proxy* proxy, struct http_upstream* up, fd_set* read, fd_set* write, uint64_t now) {
+  for (size_t j = 0; j < up->idle_len;) {
+    http_client* client = up->idle[j];
+    if (FD_ISSET(client->conn->sockfd, read)) {
+      http_client_free(client);
+      up->idle[j] = up->idle[--up->idle_len];
+    }
+    else
+      ++j;
+  }
+  if (up->probe) {
+    http_client* probe = up->probe;
+    SOCKET sockfd = probe->conn->sockfd;
+    if ((FD_ISSET(sockfd, read) || FD_ISSET(sockfd, write)) && http_client_step(probe) == HTTP_FAILURE)
+      up->healthy = 0;
+    else if (http_client_pending(probe) > 0 && conn_info_is(probe->conn, CONN_USED) &&
+             now < up->checked + proxy->health_interval)
+      return;
+    else if (http_client_pending(probe) > 0)
+      up->healthy = 0;
+    http_client_free(probe);
+    up->probe = NULL;
+    return;
+  }
+  if (now < up->checked + proxy->health_interval)
+    return;
+  up->checked = now;
+  if (proxy->health_path)
+    http_proxy_probe(proxy, up);
+  else if (!up->healthy) {
+    up->healthy  = 1;
+    up->failures = HTTP_PROXY_MAX_FAILURES - 1;
+  }
+}
+
+/* moves every upstream exchange that's ready forward, along with the health checks */
+int http_proxy_dispatch(http_proxy* proxy, fd_set* read, fd_set* write) {
+  if (!proxy || !read || !write) {
+    HTTP_LOG(HTTP_LOGERR, "[http_proxy_dispatch] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  uint64_t now = http_clock_ns();
+  for (size_t i = 0; i < proxy->upstreams_len; ++i)
+    http_proxy_check(proxy, &proxy->upstreams[i], read, write, now);
+  for (size_t i = 0; i < proxy->exchanges_len && proxy->active > 0; ++i) {
+    struct http_exchange* ex = &proxy->exchanges[i];
+    http_client* client = ex->client;
+    if (!client)
+      continue;
+    SOCKET sockfd = client->conn->sockfd;
+    if (FD_ISSET(sockfd, read) || FD_ISSET(sockfd, write)) {
+      int failed = http_client_step(client) == HTTP_FAILURE || ex->failed;
+      if (!failed && ex->done) {
+        ex->upstream->failures = 0;
+        http_proxy_finish(proxy, ex, 1);
+        continue;
+      }
+      if (failed || !conn_info_is(client->conn, CONN_USED)) {
+        HTTP_LOG(HTTP_LOGERR, "[http_proxy_dispatch] the upstream exchange failed.\n");
+        http_proxy_error(proxy, ex, HTTP_STATUS_502);
+        continue;
+      }
+    }
+    if (proxy->timeout && !ex->head && now - ex->start >= proxy->timeout)
+      http_proxy_error(proxy, ex, HTTP_STATUS_504);
+  }
+  return HTTP_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#ifndef HTTP_PROXY_H_
+#define HTTP_PROXY_H_
+#include "includes.h"
+#include "conn_info.h"
+#include "http_client.h"
+#include "http_server.h"
+#define HTTP_PROXY_MAX_UPSTREAMS 32
+#define HTTP_PROXY_MAX_IDLE 64
+#define HTTP_PROXY_BACKLOG (1024 * 256)
+#define HTTP_PROXY_MAX_FAILURES 3
+
+struct http_upstream {
+  struct sockaddr_in addr;
+  size_t   active;
+  size_t   failures;
+  char     healthy;
+  uint64_t checked;
+  http_client* probe;
+  http_client* idle[HTTP_PROXY_MAX_IDLE];
+  size_t   idle_len;
+};
+
+/* a request forwarded on behalf of the server connection at the same index */
+struct http_exchange {
+  struct http_proxy*    proxy;
+  http_client*          client;
+  struct http_upstream* upstream;
+  uint64_t start;
+  char     head;
+  char     chunked;
+  char     reused;
+  char     attempts;
+  char     done;
+  char     failed;
+};
+
+typedef struct http_proxy {
+  http_server* server;
+  http_constraints constraints;
+  struct http_upstream upstreams[HTTP_PROXY_MAX_UPSTREAMS];
+  size_t upstreams_len;
+  size_t next;
+  struct http_exchange* exchanges;
+  size_t exchanges_len;
+  size_t active;
+  const char* health_path;
+  uint64_t health_interval;
+  uint64_t timeout;
+  struct http_poller poller;
+} http_proxy;
+
+http_proxy* http_proxy_new(http_constraints*);
+int http_proxy_free(http_proxy*);
+int http_proxy_add_upstream(http_proxy*, const char*, const char*);
+int http_proxy_set_health_check(http_proxy*, const char*, uint64_t);
+int http_proxy_set_timeout(http_proxy*, uint64_t);
+
+// internal use, driven by the server's event loop
+int http_proxy_attach(http_proxy*, http_server*);
+int http_proxy_forward(http_proxy*, struct conn_info*);
+void http_proxy_detach(http_proxy*, struct conn_info*);
+uint64_t http_proxy_fill(http_proxy*, fd_set*, fd_set*, int*);
+int http_proxy_dispatch(http_proxy*, fd_set*, fd_set*);
+
+#endif
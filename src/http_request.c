@@ -1,4 +1,5 @@
 #include "http_request.h"
+#include "http_memory.h"
 
 int http_request_make(http_request* req, SOCKET conn_socket, struct sockaddr_in *conn_address, http_constraints* constraints) {
   if (!req) {
@@ -7,7 +8,7 @@ int http_request_make(http_request* req, SOCKET conn_socket, struct sockaddr_in
   }
 
   req->method = METHOD_NONE;
-  req->uri = malloc(constraints->request_max_uri_len + 1);
+  req->uri = malloc(HTTP_REQUEST_MAX_URI_LEN(constraints) + 1);
   if (!req->uri) {
     HTTP_LOG(HTTP_LOGERR, "[make_request_info] malloc() failed.\n");
     return HTTP_FAILURE;
@@ -18,23 +19,28 @@ int http_request_make(http_request* req, SOCKET conn_socket, struct sockaddr_in
     HTTP_LOG(HTTP_LOGERR, "[make_request_info] make_headers() failed.\n");
     return HTTP_FAILURE;
   }
-  req->body = malloc(constraints->request_max_body_len + 1);
-  if (!req->body) {
+  /* the body grows to what requests actually send, up to request_max_body_len */
+  req->body     = NULL;
+  req->body_cap = 0;
+  if (http_body_reserve(&req->body, &req->body_cap, 0, HTTP_REQUEST_MAX_BODY_LEN(constraints)) == HTTP_FAILURE) {
     free(req->uri);
     http_headers_free(req->headers);
     HTTP_LOG(HTTP_LOGERR, "[make_request_info] malloc() failed.\n");
     return HTTP_FAILURE;
   }
+  http_memory_add(MEMORY_HEADERS, HTTP_REQUEST_MAX_URI_LEN(constraints) + 1);
+  req->uri_cap          = HTTP_REQUEST_MAX_URI_LEN(constraints);
   req->uri_len          = 0;
+  req->query            = req->uri;
+  req->query_len        = 0;
   req->body_len         = 0;
-  req->uri[constraints->request_max_uri_len] = 0;
+  req->uri[HTTP_REQUEST_MAX_URI_LEN(constraints)] = 0;
   req->version          = HTTP_VERSION_NONE;
   req->conn_socket      = conn_socket;
   req->conn_address     = *conn_address;
   req->state            = STATE_GOT_NOTHING;
-  req->body_termination = BODYTERMI_NONE;
-  req->length           = 0;
-  req->chunk            = 0; 
+  http_framing_reset(&req->framing);
+  req->expect           = EXPECT_NONE;
   return HTTP_SUCCESS;
 }
 
@@ -43,12 +49,26 @@ int http_request_free(http_request* req) {
     HTTP_LOG(HTTP_LOGERR, "[free_request_info] passed NULL pointers for mandatory parameters.\n");
     return HTTP_FAILURE; 
   }
+  http_memory_sub(MEMORY_HEADERS, req->uri_cap + 1);
   free(req->uri);
-  free(req->body);
+  http_body_release(&req->body, &req->body_cap);
   http_headers_free(req->headers); 
   return HTTP_SUCCESS; 
 }
 
+/* a body grown past HTTP_REQUEST_BODY_KEEP is let go with the connection, the next one to take the slot
+   may never send one */
+void http_request_trim(http_request* req) {
+  if (req->body_cap <= HTTP_REQUEST_BODY_KEEP)
+    return;
+  char* body = realloc(req->body, HTTP_REQUEST_BODY_KEEP + 1);
+  if (!body)
+    return;
+  http_memory_sub(MEMORY_BODIES, req->body_cap - HTTP_REQUEST_BODY_KEEP);
+  req->body     = body;
+  req->body_cap = HTTP_REQUEST_BODY_KEEP;
+}
+
 int http_request_reset(http_request* req, SOCKET conn_socket, struct sockaddr_in *conn_address) {
   if (!req) {
     HTTP_LOG(HTTP_LOGERR, "[reset_request_info] passed NULL pointers for mandatory parameters.\n");
@@ -60,11 +80,12 @@ int http_request_reset(http_request* req, SOCKET conn_socket, struct sockaddr_in
   req->version  = HTTP_VERSION_NONE;
   req->body_len = 0;
   req->uri_len  = 0;
+  req->query    = req->uri;
+  req->query_len = 0;
   req->conn_socket    = conn_socket;
   req->conn_address   = *conn_address;
-  req->body_termination = BODYTERMI_NONE;
-  req->length = 0;
-  req->chunk  = 0; 
+  http_framing_reset(&req->framing);
+  req->expect = EXPECT_NONE;
   return HTTP_SUCCESS;
 }
 
@@ -76,3 +97,74 @@ int http_request_add_header(http_request* req, const char* header, const char* v
   http_headers_set(req->headers, header, value);
   return HTTP_SUCCESS;
 }
+
+/* a control character in a target, sent as is or percent-encoded, could only be meant to end a line a
+   handler or an upstream writes it into */
+static int http_request_clean_target(const char* s, size_t len, unsigned char lowest) {
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if (c < lowest || c == 0x7f)
+      return HTTP_FAILURE;
+  }
+  return HTTP_SUCCESS;
+}
+
+/* the path is decoded and normalized in place, the query is kept raw right after it. the caller has checked
+   'len' against request_max_uri_len */
+int http_request_set_target(http_request* req, const char* target, size_t len) {
+  if (!req || !target) {
+    HTTP_LOG(HTTP_LOGERR, "[http_request_set_target] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (http_request_clean_target(target, len, 0x21) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  const char* query = memchr(target, '?', len);
+  size_t path_len = query ? (size_t)(query - target) : len;
+  memcpy(req->uri, target, len);
+  req->uri[path_len] = 0;
+  req->query     = req->uri + MIN(path_len + 1, len);
+  req->query_len = query ? len - path_len - 1 : 0;
+  req->query[req->query_len] = 0;
+  if (http_uri_decode(req->uri, &path_len, 0) == HTTP_FAILURE ||
+      http_request_clean_target(req->uri, path_len, 0x20) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  if (http_uri_normalize(req->uri, &path_len) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  req->uri_len = path_len;
+  return HTTP_SUCCESS;
+}
+
+int http_request_query_next(http_request* req, size_t* iter, http_span* key, http_span* val) {
+  if (!req || !iter || !key || !val) {
+    HTTP_LOG(HTTP_LOGERR, "[http_request_query_next] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  return http_query_next(req->query, req->query_len, iter, key, val);
+}
+
+int http_request_query_get(http_request* req, const char* name, http_span* val) {
+  if (!req || !name || !val) {
+    HTTP_LOG(HTTP_LOGERR, "[http_request_query_get] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  return http_query_get(req->query, req->query_len, name, val);
+}
+
+const char* http_request_method_string(int method) {
+  static const char* methods[METHOD_NONE] = {
+    [METHOD_GET]     = "GET",
+    [METHOD_POST]    = "POST",
+    [METHOD_HEAD]    = "HEAD",
+    [METHOD_PUT]     = "PUT",
+    [METHOD_DELETE]  = "DELETE",
+    [METHOD_CONNECT] = "CONNECT",
+    [METHOD_OPTIONS] = "OPTIONS",
+    [METHOD_TRACE]   = "TRACE",
+    [METHOD_PATCH]   = "PATCH",
+  };
+  if (method < 0 || method >= METHOD_NONE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_request_method_string] invalid method.\n");
+    return NULL;
+  }
+  return methods[method];
+}
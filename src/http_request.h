@@ -2,6 +2,8 @@
 #define HTTP_REQUEST_H_
 
 #include "includes.h"
+#include "http_uri.h"
+#define HTTP_REQUEST_BODY_KEEP (1024 * 64)
 
 enum {
   METHOD_GET,
@@ -21,22 +23,30 @@ typedef struct {
   char   version;
   char*  uri;
   size_t uri_len;
+  char*  query;
+  size_t query_len;
   char*  body;
   size_t body_len; 
   http_headers* headers;
 
   // internal use 
+  size_t uri_cap;
+  size_t body_cap;
   char state;
   SOCKET conn_socket;
   struct sockaddr_in conn_address;
-  int body_termination;
-  size_t length;
-  size_t chunk; 
+  http_framing framing;
+  int expect;
 } http_request;
 
 int http_request_make(http_request*, SOCKET, struct sockaddr_in*, http_constraints*);
 int http_request_free(http_request*);
 int http_request_reset(http_request*, SOCKET, struct sockaddr_in*);
+void http_request_trim(http_request*);
 int http_request_add_header(http_request*, const char*, const char*);
+int http_request_set_target(http_request*, const char*, size_t);
+int http_request_query_next(http_request*, size_t*, http_span*, http_span*);
+int http_request_query_get(http_request*, const char*, http_span*);
+const char* http_request_method_string(int);
 
 #endif
@@ -1,4 +1,6 @@
 #include "http_response.h" 
+#include "http_memory.h"
+#include <sys/stat.h>
 
 struct status
 {
@@ -81,11 +83,17 @@ int http_response_make(http_response* res, http_constraints* constraints) {
   res->body_len      = 0;
   res->body_type     = BODYTYPE_NONE;
   res->state         = STATE_GOT_NOTHING;
-  res->current_val   = NULL;
-  res->headers_iter  = 0;
   res->sent          = 0; 
-  res->send_key      = 1;
   res->constraints   = constraints; 
+  res->body_file     = NULL;
+  res->out           = NULL;
+  res->out_len       = 0;
+  res->out_cap       = 0;
+  res->version       = HTTP_VERSION_NONE;
+  res->body_buffer   = NULL;
+  res->body_cap      = 0;
+  res->stream_done   = 0;
+  http_framing_reset(&res->framing);
   return HTTP_SUCCESS; 
 }
 
@@ -94,7 +102,13 @@ int http_response_free(http_response* response) {
     HTTP_LOG(HTTP_LOGERR, "[http_response_free] passed NULL pointers for mandatory parameters.\n");
     return HTTP_FAILURE;
   }
-  http_header_free(response->headers);
+  if (response->body_file)
+    fclose(response->body_file);
+  http_memory_sub(MEMORY_BODIES, response->out_cap);
+  free(response->out);
+  http_body_release(&response->body_buffer, &response->body_cap);
+  http_headers_free(response->headers);
+  return HTTP_SUCCESS;
 }
 
 int http_response_set_status(http_response* res, int status) {
@@ -146,7 +160,7 @@ int http_response_set_body_file(http_response* res, char* file_name) {
         HTTP_LOG(HTTP_LOGERR, "[http_response_set_body_file] failed to allocate memory.\n");
         return HTTP_FAILURE;
       }
-      snprintf(dir, len, "%s/%s", public_folder, file_name);
+      snprintf(dir, len + 10, "%s/%s", public_folder, file_name);
   }
   res->body_file = fopen(dir, "rb");
   if (!res->body_file) {
@@ -156,7 +170,24 @@ int http_response_set_body_file(http_response* res, char* file_name) {
   }
   if (dir != file_name) free(dir);
   res->body_type = BODYTYPE_FILE; 
-  if (http_headers_set(res->headers, "Transfer-Encoding", "Chunked") == HTTP_FAILURE) {
+  /* a regular file's length is known up front, which lets it be sent without passing through user space */
+#ifdef _WIN32
+  struct _stat64 st;
+  int known = _fstat64(_fileno(res->body_file), &st) == 0 && (st.st_mode & _S_IFREG);
+#else
+  struct stat st;
+  int known = fstat(fileno(res->body_file), &st) == 0 && S_ISREG(st.st_mode);
+#endif
+  if (known) {
+    char length[24];
+    snprintf(length, sizeof(length), "%llu", (unsigned long long)st.st_size);
+    res->body_len = (size_t)st.st_size;
+    if (http_headers_set(res->headers, "Content-Length", length) == HTTP_FAILURE) {
+      HTTP_LOG(HTTP_LOGERR, "[http_response_set_body_file] set_header() failed.\n");
+      return HTTP_FAILURE;
+    }
+  }
+  else if (http_headers_set(res->headers, "Transfer-Encoding", "Chunked") == HTTP_FAILURE) {
       HTTP_LOG(HTTP_LOGERR, "[http_response_set_body_file] set_header() failed.\n");
       return HTTP_FAILURE;
   }
@@ -189,6 +220,14 @@ int http_response_status_code(int status) {
   return status_info[status].code;
 }
 
+int http_response_status_from_code(int code) {
+  for (int status = 0; status < HTTP_STATUS_NONE; ++status) {
+    if (status_info[status].code == code)
+      return status;
+  }
+  return HTTP_STATUS_NONE;
+}
+
 const char* http_response_status_string(int status) {
   if (status < 0 || status >= HTTP_STATUS_NONE) {
     HTTP_LOG(HTTP_LOGERR, "[http_response_status_info] invalid status code.\n"); 
@@ -208,9 +247,14 @@ int http_response_reset(http_response* res) {
   res->body_len = 0;
   res->body_type = BODYTYPE_NONE;
   res->state = STATE_GOT_NOTHING;
-  res->current_val = NULL;
-  res->headers_iter = 0;
   res->sent = 0;
-  res->send_key = 1;
+  if (res->body_file) {
+    fclose(res->body_file);
+    res->body_file = NULL;
+  }
+  res->out_len = 0;
+  res->stream_done = 0;
+  res->version = HTTP_VERSION_NONE;
+  http_framing_reset(&res->framing);
   return HTTP_SUCCESS;
 }
\ No newline at end of file
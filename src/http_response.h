@@ -5,6 +5,7 @@
 enum {
   BODYTYPE_FILE,
   BODYTYPE_STRING,
+  BODYTYPE_STREAM,
   BODYTYPE_NONE,
 };
 
@@ -78,13 +79,16 @@ typedef struct {
 
   // internal use
   char state;
-  http_hdk current_key;
-  http_hdv* current_val;
-  size_t headers_iter;
   size_t sent; 
-  int send_key;
   http_constraints* constraints; 
-  int body_termination;
+  char version;
+  http_framing framing;
+  char* body_buffer;
+  size_t body_cap;
+  char stream_done;
+  char* out;
+  size_t out_len;
+  size_t out_cap;
 } http_response;
 
 int http_response_make(http_response*, http_constraints*);
@@ -94,6 +98,7 @@ int http_response_set_body_file(http_response*, char* file_name);
 int http_response_set_header(http_response*, const char*, const char*);
 const char* http_response_status_string(int);
 int http_response_status_code(int);
+int http_response_status_from_code(int);
 int http_response_reset(http_response*);
 int http_response_free(http_response*);
 #endif
@@ -1,6 +1,22 @@
 #include "http_server.h" 
 #include "conn_info.h"
 #include "parser.h"
+#include "http_metrics.h"
+#include "http_proxy.h"
+#include "websocket.h"
+#include "sse.h"
+#include "h2.h"
+#include "tls.h"
+#include "handoff.h"
+#include "prefork.h"
+#include <signal.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#define HTTP_FILE_CHUNK (1024 * 16)
+#define HTTP_INLINE_BODY (1024 * 4)
+#define HTTP_STOP_QUIET (100ull * 1000 * 1000)   /* ns an idle connection is left alone before a stop closes it */
+#define HTTP_ACCEPT_RETRY (100ull * 1000 * 1000) /* ns accepting stays paused when out of descriptors or memory */
 
 int http_init(void) {
 #ifdef _WIN32
@@ -26,189 +42,418 @@ void http_default_error_handler(http_request* req, http_response* res) {
   http_response_set_status(res, HTTP_STATUS_400);
 }
 
-http_server* http_server_new(const char* ip, const char* port, request_handler request_handler, http_constraints* constraints) {
-  if (!ip || !port || !request_handler) {
-    HTTP_LOG(HTTP_LOGERR, "[http_server_new] passed NULL pointers for mandatory parameters");
-    return NULL;
-  }
-  
-  if (strcmp(ip, "0.0.0.0") == 0)
-    ip = 0;
-  
-  struct addrinfo hints;
-  struct addrinfo* binder;
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family   = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_flags    = AI_PASSIVE;
-  int res = getaddrinfo(ip, port, &hints, &binder);
-  if (res) {
-    HTTP_LOG(HTTP_LOGERR, "[http_server_new] getaddrinfo failed - %d.\n", res);
-    return NULL;
+/* a loopback datagram socket connected to itself: http_server_stop() sends it a byte so a select() waiting
+   on it returns, from any thread or a signal handler */
+static SOCKET http_server_wake_socket(void) {
+  SOCKET wake = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (wake == INVALID_SOCKET)
+    return INVALID_SOCKET;
+  struct sockaddr_in addr = { 0 };
+  socklen_t len = sizeof(addr);
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(wake, (struct sockaddr*)&addr, sizeof(addr)) || getsockname(wake, (struct sockaddr*)&addr, &len) ||
+      connect(wake, (struct sockaddr*)&addr, sizeof(addr)) || http_socket_set_nonblocking(wake) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_wake_socket] couldn't set up the wake socket - %d.\n", GET_ERROR());
+    CLOSE_SOCKET(wake);
+    return INVALID_SOCKET;
   }
-  
+  return wake;
+}
+
+static http_server* http_server_make(request_handler request_handler, http_constraints* constraints) {
   http_server* server = malloc(sizeof(http_server));
   if (!server) {
-    freeaddrinfo(binder);
     HTTP_LOG(HTTP_LOGERR, "[http_server_new] failed to allocate memory.\n");
     return NULL; 
   }
   
-  server->ip              = ntohl(((struct sockaddr_in*)&binder->ai_addr)->SIN_ADDR);
-  server->port            = ntohs(((struct sockaddr_in*)&binder->ai_addr)->sin_port);
-  server->sockfd          = -1;
+  server->ip              = 0;
+  server->port            = 0;
+  server->listeners_len   = 0;
   server->request_handler = request_handler;
   server->error_handler   = http_default_error_handler; 
-  server->addr            = *(struct sockaddr_in*)binder->ai_addr;
+  server->expect_handler  = NULL;
+  server->metrics_path    = NULL;
+  server->access_log      = NULL;
+  server->access_ring     = NULL;
+  server->proxy           = NULL;
+  server->cache           = NULL;
+  server->tls             = NULL;
+  server->cache_waiting   = 0;
+  server->pollers_len     = 0;
+  server->timers          = timer_heap_make();
+  server->ws_serial       = 0;
+  server->websockets      = 0;
+  server->sse_channels    = NULL;
+  server->sse_channels_len = 0;
+  server->sse_channels_cap = 0;
+  server->sse_subscribers = 0;
+  server->h2_conns        = 0;
+  server->handoff_path    = NULL;
+  server->handoff_fd      = INVALID_SOCKET;
+  server->wake_fd         = http_server_wake_socket();
+  atomic_init(&server->stopping, 0);
   server->constraints     = constraints ? *constraints : http_constraints_make_default();
   server->conns           = conn_group_make(&server->constraints); 
-  freeaddrinfo(binder);
+  server->ws_pool         = buffer_pool_make(WS_POOL_BUFF, WS_POOL_MAX_FREE, server->constraints.huge_pages,
+                                             MEMORY_CONNECTIONS);
+  http_constraints* limits = &server->constraints;
+  server->limiter         = rate_limit_make((uint32_t)limits->rate_limit,
+                                            (uint32_t)(limits->rate_burst ? limits->rate_burst : limits->rate_limit),
+                                            (uint32_t)limits->max_connections_per_ip);
+  http_stats_reset(&server->stats);
+  return server;
+}
+
+http_server* http_server_new(const char* ip, const char* port, request_handler request_handler, http_constraints* constraints) {
+  if (!ip || !port || !request_handler) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_new] passed NULL pointers for mandatory parameters");
+    return NULL;
+  }
+  http_server* server = http_server_make(request_handler, constraints);
+  if (server && http_server_add_listener(server, ip, port) == HTTP_FAILURE) {
+    http_server_free(server);
+    return NULL;
+  }
   return server;
 }
 
+/* a server reached only through a Unix socket, see http_server_add_unix() */
+http_server* http_server_new_unix(const char* path, request_handler request_handler, http_constraints* constraints) {
+  if (!path || !request_handler) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_new_unix] passed NULL pointers for mandatory parameters");
+    return NULL;
+  }
+  http_server* server = http_server_make(request_handler, constraints);
+  if (server && http_server_add_unix(server, path) == HTTP_FAILURE) {
+    http_server_free(server);
+    return NULL;
+  }
+  return server;
+}
+
+/* one more address the same loop accepts on, before http_server_listen() */
+int http_server_add_listener(http_server* server, const char* ip, const char* port) {
+  if (!server || !ip || !port) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_add_listener] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (server->listeners_len == HTTP_SERVER_MAX_LISTENERS) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_add_listener] too many listeners.\n");
+    return HTTP_FAILURE;
+  }
+  struct http_listener* listener = &server->listeners[server->listeners_len];
+  if (listener_tcp(listener, ip, port) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  if (server->listeners_len++ == 0) {
+    const struct sockaddr_in* addr = (const struct sockaddr_in*)&listener->addr;
+    server->ip   = ntohl(addr->SIN_ADDR);
+    server->port = ntohs(addr->sin_port);
+  }
+  return HTTP_SUCCESS;
+}
+
+/* a Unix socket at 'path', or in the abstract namespace for an '@name'. clients on the same host skip the
+   TCP/IP stack, they have no address: the per-address limits don't apply to them. POSIX only */
+int http_server_add_unix(http_server* server, const char* path) {
+  if (!server || !path) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_add_unix] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (server->listeners_len == HTTP_SERVER_MAX_LISTENERS) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_add_unix] too many listeners.\n");
+    return HTTP_FAILURE;
+  }
+  if (listener_unix(&server->listeners[server->listeners_len], path) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  ++server->listeners_len;
+  return HTTP_SUCCESS;
+}
+
+static void http_server_uncache(http_server* server, struct conn_info* conn) {
+  if (!conn->cached)
+    return;
+  if (conn->cache_owner)
+    http_cache_abandon(conn->cached);
+  else if (conn_info_is(conn, CONN_DEFERRED))
+    --server->cache_waiting;
+  http_cache_release(conn->cached);
+  conn->cached      = NULL;
+  conn->cache_owner = 0;
+}
+
 int http_server_free(http_server* server) {
   if (!server) {
     HTTP_LOG(HTTP_LOGERR, "[http_server_free] passed NULL pointers for mandatory parameters");
     return HTTP_FAILURE;
   }
 
+  for (size_t i = 0; i < server->conns.cap; ++i) {
+    if (!(server->conns.flags[i] & CONN_USED))
+      continue;
+    http_server_uncache(server, &server->conns.data[i]);
+    ws_detach(server, &server->conns.data[i]);
+    sse_detach(server, &server->conns.data[i]);
+    h2_detach(server, &server->conns.data[i]);
+    tls_detach(&server->conns.data[i]);
+  }
+  if (server->wake_fd != INVALID_SOCKET)
+    CLOSE_SOCKET(server->wake_fd);
+  sse_free_channels(server);
   conn_group_free(&server->conns); 
+  rate_limit_free(&server->limiter);
+  timer_heap_free(&server->timers);
+  buffer_pool_free(&server->ws_pool);
   free(server);
   return HTTP_SUCCESS;
 }
 
-int http_send_response(struct conn_info* conn, http_constraints* constraints) {
+static int http_response_reserve(http_response* res, size_t len) {
+  if (res->out_cap >= len)
+    return HTTP_SUCCESS;
+  size_t cap = MAX(len, res->out_cap * 2);
+  char* out = realloc(res->out, cap);
+  if (!out) {
+    HTTP_LOG(HTTP_LOGERR, "[http_response_reserve] realloc() failed.\n");
+    return HTTP_FAILURE;
+  }
+  http_memory_add(MEMORY_BODIES, cap - res->out_cap);
+  res->out     = out;
+  res->out_cap = cap;
+  return HTTP_SUCCESS;
+}
+
+static size_t http_headers_bytes(http_headers* headers) {
+  size_t len = 0;
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  while (http_headers_next(headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    for (; val; val = val->next)
+      len += key.len + val->len + 4;
+  }
+  return len;
+}
+
+static size_t http_headers_write(http_headers* headers, char* out) {
+  size_t n = 0;
+  size_t iter = 0;
+  http_hdk key;
+  http_hdv* val;
+  while (http_headers_next(headers, &iter, &key, &val) == HTTP_SUCCESS) {
+    for (; val; val = val->next) {
+      memcpy(out + n, key.v, key.len);
+      n += key.len;
+      memcpy(out + n, ": ", 2);
+      n += 2;
+      memcpy(out + n, val->v, val->len);
+      n += val->len;
+      memcpy(out + n, "\r\n", 2);
+      n += 2;
+    }
+  }
+  return n;
+}
+
+/* writes the status line and the headers into res->out so they can be sent in pieces */
+static int http_serialize_head(http_request* req, http_response* res) {
+  const char* status_string = http_response_status_string(res->status);
+  int status_code = http_response_status_code(res->status);
+  if (status_string == NULL) {
+    HTTP_LOG(HTTP_LOGERR, "[http_serialize_head] invalid status code.\n");
+    return HTTP_FAILURE;
+  }
+
+  /* small bodies go out in the same segment as the head */
+  int inline_body = req->method != METHOD_HEAD && res->body_type == BODYTYPE_STRING && res->body_len <= HTTP_INLINE_BODY;
+  size_t len = strlen(status_string) + 32 + (inline_body ? res->body_len : 0) + http_headers_bytes(res->headers);
+  if (http_response_reserve(res, len + 1) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+
+  char* out = res->out;
+  size_t n = snprintf(out, len, "%s %d %s\r\n",
+                      req->version == HTTP_VERSION_1_1 ? "HTTP/1.1" : "HTTP/1.0",
+                      status_code,
+                      status_string);
+  n += http_headers_write(res->headers, out + n);
+  memcpy(out + n, "\r\n", 2);
+  n += 2;
+  if (inline_body) {
+    memcpy(out + n, res->body_string, res->body_len);
+    n += res->body_len;
+  }
+  res->out_len = n;
+  res->sent    = 0;
+  return HTTP_SUCCESS;
+}
+
+/* frames the next piece of the file as a chunk, the data is read behind room for the size line */
+static int http_serialize_file_chunk(http_response* res) {
+  const size_t room = 2 * sizeof(size_t) + 2;
+  if (http_response_reserve(res, room + HTTP_FILE_CHUNK + 2) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  char* out = res->out;
+  size_t n = fread(out + room, 1, HTTP_FILE_CHUNK, res->body_file);
+  if (n == 0) {
+    if (ferror(res->body_file)) {
+      HTTP_LOG(HTTP_LOGERR, "[http_serialize_file_chunk] fread() failed.\n");
+      return HTTP_FAILURE;
+    }
+    fclose(res->body_file);
+    res->body_file = NULL;
+    memcpy(out, "0\r\n\r\n", 5);
+    res->sent    = 0;
+    res->out_len = 5;
+    return HTTP_SUCCESS;
+  }
+  char hex[32];
+  int hex_len = snprintf(hex, sizeof(hex), "%zx\r\n", n);
+  memcpy(out + room - hex_len, hex, hex_len);
+  memcpy(out + room + n, "\r\n", 2);
+  res->sent    = room - hex_len;
+  res->out_len = room + n + 2;
+  return HTTP_SUCCESS;
+}
+
+/* sends the next piece of a file of known length. plain sockets on Linux and kTLS ones take it straight from
+   the page cache, anything else reads it into 'out' first and reads it again if the send came up short.
+   answers as send() does */
+static int http_send_file(struct conn_info* conn, http_response* res, size_t budget) {
+  size_t len = MIN(res->body_len - res->sent, budget);
+#ifdef __linux__
+  if (!conn->tls || tls_zero_copy(conn)) {
+    off_t offset = (off_t)res->sent;
+    int ret = !conn->tls ? (int)sendfile(conn->sockfd, fileno(res->body_file), &offset, len)
+                         : tls_sendfile(conn, res->body_file, res->sent, len);
+    /* nothing left to send while the response promised more: the file shrank under it */
+    if (ret == 0) {
+      HTTP_LOG(HTTP_LOGERR, "[http_send_file] sendfile() sent nothing.\n");
+      errno = EIO;
+      return SOCKET_ERROR;
+    }
+    return ret;
+  }
+#endif
+  len = MIN(len, HTTP_FILE_CHUNK);
+  if (http_response_reserve(res, len) == HTTP_FAILURE)
+    return SOCKET_ERROR;
+#ifdef _WIN32
+  int moved = _fseeki64(res->body_file, (long long)res->sent, SEEK_SET);
+#else
+  int moved = fseeko(res->body_file, (off_t)res->sent, SEEK_SET);
+#endif
+  size_t n = moved == 0 ? fread(res->out, 1, len, res->body_file) : 0;
+  if (n == 0) {
+    /* the file shrank under the response or can't be read */
+    HTTP_LOG(HTTP_LOGERR, "[http_send_file] fread() failed.\n");
+#ifdef _WIN32
+    WSASetLastError(WSAECONNABORTED);
+#else
+    errno = EIO;
+#endif
+    return SOCKET_ERROR;
+  }
+  return conn_info_send(conn, res->out, n);
+}
+
+/* nothing follows the head, or the body is already in it */
+static int http_head_only(http_request* req, http_response* res) {
+  return req->method == METHOD_HEAD || res->body_type == BODYTYPE_NONE ||
+         (res->body_type == BODYTYPE_STRING && res->body_len <= HTTP_INLINE_BODY);
+}
+
+int http_send_response(http_server* server, struct conn_info* conn) {
   http_response* res = &conn->response;
   http_request* req  = &conn->request;
-  size_t sent = 0;
-  size_t max_send = constraints->send_len;
-  char* buffer = conn->buffer;
-  SOCKET sockfd = conn->sockfd;
-  int ret = 0;
-  char hex[20]; 
-  while (sent < max_send && res->state != STATE_GOT_ALL) {
+  size_t budget = HTTP_SEND_LEN(&server->constraints);
+  while (budget > 0 && res->state != STATE_GOT_ALL) {
+    const char* data = NULL;
+    size_t len = 0;
+    int more = 0;
     if (res->state == STATE_GOT_NOTHING) {
-        const char* status_string = http_response_status_string(res->status);
-        int status_code = http_response_status_code(res->status);
-        if (status_string == NULL) {
-          HTTP_LOG(HTTP_LOGERR, "[http_send_response] invalid status code.\n");
-          return HTTP_FAILURE;
-        }
-      snprintf(buffer, CONN_BUFF_LEN, "%s %d %s\r\n",
-               req->version == HTTP_VERSION_1_1 ? "HTTP/1.1" : "HTTP/1.0",
-               status_code,
-               status_string);
-      if ((ret = send(sockfd, buffer, (int)strlen(buffer), 0)) == SOCKET_ERROR) {
-        HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-        return HTTP_FAILURE; 
-      } 
+      if (http_serialize_head(req, res) == HTTP_FAILURE)
+        return HTTP_FAILURE;
       res->state = STATE_GOT_LINE;
-      if (http_headers_next(res->headers, &res->headers_iter, &res->current_key, &res->current_val) == HTTP_FAILURE)
-        res->state = STATE_GOT_HEADERS;
-      sent += ret;
+      continue;
     }
     else if (res->state == STATE_GOT_LINE) {
-      http_hdk* key = &res->current_key;
-      http_hdv* val = res->current_val;
-      if (res->send_key) {
-        if (key->len == res->sent) {
-          if ((ret = send(sockfd, ": ", 2, 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
-          }
-          sent += ret;
-          res->sent = 0;
-          res->send_key = 0;
-        }
-        else {
-          if ((ret = send(sockfd, key->v + res->sent, (int)MIN(max_send - sent, key->len - res->sent), 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
-          }
-          sent += ret;
-          res->sent += ret; 
-        }
+      if (res->sent == res->out_len) {
+        res->state   = http_head_only(req, res) ? STATE_GOT_ALL : STATE_GOT_HEADERS;
+        res->sent    = 0;
+        res->out_len = 0;
+        continue;
       }
-      else {
-        if (val->len == res->sent) {
-          if ((ret = send(sockfd, "\r\n", 2, 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
-          }
-          sent += ret; 
-          if (val->next)
-            res->current_val = val->next; 
-          else {
-            if (http_headers_next(res->headers, &res->headers_iter, &res->current_key, &res->current_val) == HTTP_FAILURE) {
-              if ((ret = send(sockfd, "\r\n", 2, 0)) == SOCKET_ERROR) {
-                HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-                return HTTP_FAILURE;
-              }
-              res->state = STATE_GOT_HEADERS; 
-            }
-          }
-          res->send_key = 1;
-          res->sent = 0;
-        }
-        else {
-          if ((ret = send(sockfd, val->v + res->sent, (int)MIN(max_send - sent, val->len - res->sent), 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
-          }
-          sent += ret;
-          res->sent += ret;
+      data = res->out;
+      len  = res->out_len;
+      /* the body is written right after, the head waits for it and the two share the first segment. not
+         ahead of a stream, its body may be a while coming */
+      more = HTTP_TCP_CORK(&server->constraints) && !http_head_only(req, res) &&
+             res->body_type != BODYTYPE_STREAM &&
+             (res->body_len > 0 || res->framing.termination != BODYTERMI_LENGTH);
+    }
+    else if (res->body_type == BODYTYPE_STREAM) {
+      /* whatever the producer appended to the body buffer goes out, then the connection waits on it again */
+      if (res->sent == res->body_len) {
+        res->sent     = 0;
+        res->body_len = 0;
+        if (res->stream_done) {
+          res->state = STATE_GOT_ALL;
+          continue;
         }
+        conn_info_mark(conn, CONN_DEFERRED, 1);
+        return HTTP_SUCCESS;
       }
+      data = res->body_buffer;
+      len  = res->body_len;
     }
-    else if (res->state == STATE_GOT_HEADERS) {
-        if (res->body_type == BODYTYPE_STRING) {
-          if (res->body_len == res->sent) {
-            res->state = STATE_GOT_ALL;
-            res->sent = 0;
-          }
-          else {
-          if ((ret = send(sockfd, res->body_string + res->sent, (int)MIN(max_send - sent, res->body_len - res->sent), 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
-          }
-          sent += ret;
-          res->sent += ret;
-        } 
+    else if (res->body_type == BODYTYPE_STRING) {
+      if (res->sent == res->body_len) {
+        res->state = STATE_GOT_ALL;
+        continue;
       }
-      else {    
-        int ret2;
-        ret2 = (int)fread(buffer, 1, CONN_BUFF_LEN, res->body_file);
-        ret = ret2;
-        buffer[ret2] = 0; 
-        if (ret2 == 0) {
-            res->state = STATE_GOT_ALL;
-            strcpy(hex, "0\r\n");
-        }
-        else 
-            snprintf(hex, 20, "%.x\r\n", ret2);
-        if ((ret = send(sockfd, hex, (int)strlen(hex), 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
-        }
-        sent += ret;
-        res->sent += ret;
-        if (ret2 > 0) {
-          if ((ret = send(sockfd, buffer, ret2, 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
-          }
-          sent += ret2;
-          res->sent += ret2;
-        }
-        if ((ret = send(sockfd, "\r\n", 2, 0)) == SOCKET_ERROR) {
-            HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
-            return HTTP_FAILURE;
+      data = (const char*)res->body_string;
+      len  = res->body_len;
+    }
+    else if (res->framing.termination == BODYTERMI_LENGTH) {
+      if (res->sent == res->body_len) {
+        res->state = STATE_GOT_ALL;
+        continue;
+      }
+    }
+    else {
+      if (res->sent == res->out_len) {
+        if (!res->body_file) {
+          res->state = STATE_GOT_ALL;
+          continue;
         }
-        sent += 2;
-        res->sent += 2;
+        if (http_serialize_file_chunk(res) == HTTP_FAILURE)
+          return HTTP_FAILURE;
       }
+      data = res->out;
+      len  = res->out_len;
+    }
+
+    size_t n = MIN(len - res->sent, budget);
+    int ret;
+    if (!data)
+      ret = http_send_file(conn, res, budget);
+    else if (more)
+      ret = conn_info_send_more(conn, data + res->sent, n);
+    else
+      ret = conn_info_send(conn, data + res->sent, n);
+    ++server->stats.counters.send_calls;
+    if (ret == SOCKET_ERROR) {
+      if (WOULD_BLOCK(GET_ERROR()))
+        return HTTP_SUCCESS;
+      HTTP_LOG(HTTP_LOGERR, "[http_send_response] send() failed - %d.\n", GET_ERROR());
+      return HTTP_FAILURE;
     }
-  } 
+    res->sent += ret;
+    budget    -= ret;
+    server->stats.counters.bytes_out += ret;
+    conn->bytes_sent += ret;
+  }
   return HTTP_SUCCESS;
 }
 
@@ -226,9 +471,10 @@ int http_validate_response(http_response* res) {
       HTTP_LOG(HTTP_LOGERR, "[http_validate_response] invalid headers - both 'Content-Length' and 'Transfer-Encoding' are set.\n");
       return HTTP_FAILURE;
     }
-    size_t len = strtoul(length, 0, 10);
-    if (len == 0) {
-      HTTP_LOG(HTTP_LOGERR, "[http_validate_response] invalid headers - 'Content-Length' is set to 0 or non-number.\n");
+    char* end;
+    size_t len = strtoul(length->v, &end, 10);
+    if (end == length->v) {
+      HTTP_LOG(HTTP_LOGERR, "[http_validate_response] invalid headers - 'Content-Length' is set to a non-number.\n");
       return HTTP_FAILURE;
     }
     if (res->body_len != 0 && len > res->body_len) {
@@ -236,103 +482,693 @@ int http_validate_response(http_response* res) {
       return HTTP_FAILURE;
     } 
     res->body_len = len;
-    res->body_termination = BODYTERMI_LENGTH;
+    res->framing.termination = BODYTERMI_LENGTH;
   }
-  else {
-
+  else if (!tren && res->body_type == BODYTYPE_NONE && res->status > HTTP_STATUS_101 &&
+           res->status != HTTP_STATUS_204 && res->status != HTTP_STATUS_304) {
+    /* keep-alive clients need to know where an empty response ends */
+    if (http_headers_set(headers, "Content-Length", "0") == HTTP_FAILURE) {
+      HTTP_LOG(HTTP_LOGERR, "[http_validate_response] http_headers_set() failed.\n");
+      return HTTP_FAILURE;
+    }
   }
 
   return HTTP_SUCCESS;
 }
 
-int http_server_listen(http_server* server) {
-  if (!server) {
-    HTTP_LOG(HTTP_LOGERR, "[http_server_listen] passed NULL pointers for mandatory parameters");
+/* answers an 'Expect' header before the body is read: either an interim 100 or a final response */
+int http_server_expect(http_server* server, struct conn_info* conn) {
+  http_request* req  = &conn->request;
+  http_response* res = &conn->response;
+  if (req->expect == EXPECT_UNKNOWN)
+    http_response_set_status(res, HTTP_STATUS_417);
+  else if (req->framing.termination == BODYTERMI_LENGTH &&
+           req->framing.length > HTTP_REQUEST_MAX_BODY_LEN(&server->constraints))
+    http_response_set_status(res, HTTP_STATUS_413);
+  else if (server->expect_handler) {
+    conn->timing.handler_start = http_clock_ns();
+    server->expect_handler(req, res);
+    conn->timing.handler_end = http_clock_ns();
+  }
+
+  if (res->status != HTTP_STATUS_NONE) {
+    /* the body was never read, so the connection can't be reused for another request */
+    http_response_set_header(res, "Connection", "close");
+    req->state  = STATE_GOT_ALL;
+    conn->close = 1;
+    return HTTP_SUCCESS;
+  }
+
+  char line[64];
+  int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n\r\n",
+                     http_response_status_code(HTTP_STATUS_100),
+                     http_response_status_string(HTTP_STATUS_100));
+  if (conn_info_send(conn, line, len) == SOCKET_ERROR) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_expect] send() failed - %d.\n", GET_ERROR());
     return HTTP_FAILURE;
   }
+  req->expect = EXPECT_NONE;
+  return HTTP_SUCCESS;
+}
+
+/* HTTP/1.1 connections persist unless either side says 'close', HTTP/1.0 ones only when asked to */
+void http_server_keep_alive(struct conn_info* conn) {
+  http_request* req  = &conn->request;
+  http_response* res = &conn->response;
+  if (http_headers_has_token(res->headers, "Connection", "close"))
+    conn->close = 1;
+  else if (http_headers_has_token(req->headers, "Connection", "close") ||
+           (HTTP_PROFILE_HTTP10 && req->version == HTTP_VERSION_1 &&
+            !http_headers_has_token(req->headers, "Connection", "keep-alive"))) {
+    http_response_set_header(res, "Connection", "close");
+    conn->close = 1;
+  }
+  else if (HTTP_PROFILE_HTTP10 && req->version == HTTP_VERSION_1)
+    http_response_set_header(res, "Connection", "keep-alive");
+}
+
+/* a stopping server answers what it already has, but nothing more on the connection */
+static void http_server_persist(http_server* server, struct conn_info* conn) {
+  http_server_keep_alive(conn);
+  if (atomic_load_explicit(&server->stopping, memory_order_relaxed) && conn->response.status != HTTP_STATUS_101 &&
+      !http_headers_has_token(conn->response.headers, "Connection", "close")) {
+    http_response_set_header(&conn->response, "Connection", "close");
+    conn->close = 1;
+  }
+}
 
-  int retval = HTTP_SUCCESS;
-  server->sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (server->sockfd < 0) {
-    HTTP_LOG(HTTP_LOGERR, "[http_server_listen] socket() failed - %d.\n", GET_ERROR());
+/* answers a scrape from the event loop itself, rendered into the connection's own body buffer */
+static void http_server_metrics(http_server* server, http_response* res) {
+  size_t len = 0;
+  if (http_metrics_render(server, &res->body_buffer, &len, &res->body_cap) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_metrics] http_metrics_render() failed.\n");
+    http_response_set_status(res, HTTP_STATUS_500);
+    return;
+  }
+  char size[24];
+  snprintf(size, sizeof(size), "%zu", len);
+  http_response_set_status(res, HTTP_STATUS_200);
+  http_response_set_header(res, "Content-Type", "text/plain; version=0.0.4");
+  http_response_set_header(res, "Content-Length", size);
+  res->body_string = (const unsigned char*)res->body_buffer;
+  res->body_len    = len;
+  res->body_type   = BODYTYPE_STRING;
+}
+
+/* answers from a stored response. the head is copied so this connection's own headers can follow it, the
+   body is sent straight from the entry, which stays pinned until the last byte is out */
+static int http_server_cache_serve(http_server* server, struct conn_info* conn) {
+  struct http_cache_entry* entry = conn->cached;
+  http_request* req  = &conn->request;
+  http_response* res = &conn->response;
+  res->status = entry->status;
+  http_server_persist(server, conn);
+  int inline_body = req->method != METHOD_HEAD && entry->body_len <= HTTP_INLINE_BODY;
+  size_t len = entry->head_len + 32 + (inline_body ? entry->body_len : 0) + http_headers_bytes(res->headers);
+  if (http_response_reserve(res, len) == HTTP_FAILURE)
     return HTTP_FAILURE;
+
+  uint64_t now = http_clock_ns();
+  char* out = res->out;
+  memcpy(out, entry->head, entry->head_len);
+  if (req->version != HTTP_VERSION_1_1)
+    out[7] = '0';
+  size_t n = entry->head_len;
+  n += snprintf(out + n, 32, "Age: %llu\r\n", (unsigned long long)((now - entry->stored) / 1000000000));
+  n += http_headers_write(res->headers, out + n);
+  memcpy(out + n, "\r\n", 2);
+  n += 2;
+  if (inline_body) {
+    memcpy(out + n, entry->body, entry->body_len);
+    n += entry->body_len;
+  }
+  res->out_len     = n;
+  res->sent        = 0;
+  res->body_string = (const unsigned char*)entry->body;
+  res->body_len    = entry->body_len;
+  res->body_type   = entry->body_len ? BODYTYPE_STRING : BODYTYPE_NONE;
+  res->state       = STATE_GOT_LINE;
+  conn->timing.handler_end = now;
+  ++server->stats.counters.cache_hits;
+  return HTTP_SUCCESS;
+}
+
+/* true when the request was answered from the cache or is waiting on an identical one that's in the
+   handler. on a miss the connection owns the new entry and the handler runs */
+static int http_server_cache_lookup(http_server* server, struct conn_info* conn) {
+  struct http_cache_entry* entry;
+  switch (http_cache_lookup(server->cache, &conn->request, http_clock_ns(), &entry)) {
+  case HTTP_CACHE_HIT:
+    conn->cached = entry;
+    if (http_server_cache_serve(server, conn) == HTTP_SUCCESS)
+      return 1;
+    http_cache_release(entry);
+    conn->cached = NULL;
+    return 0;
+  case HTTP_CACHE_WAIT:
+    conn->cached   = entry;
+    conn_info_mark(conn, CONN_DEFERRED, 1);
+    ++server->cache_waiting;
+    ++server->stats.counters.cache_collapsed;
+    return 1;
+  case HTTP_CACHE_MISS:
+    conn->cached      = entry;
+    conn->cache_owner = 1;
+    ++server->stats.counters.cache_misses;
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+/* the handler answered a miss: its response is stored if it may be, either way the waiters move on */
+static void http_server_cache_store(http_server* server, struct conn_info* conn) {
+  if (!conn->cache_owner)
+    return;
+  http_cache_fill(server->cache, conn->cached, &conn->response, http_clock_ns());
+  http_cache_release(conn->cached);
+  conn->cached      = NULL;
+  conn->cache_owner = 0;
+}
+
+/* the client used up its request budget, it's told when to come back and the handler never sees it */
+static void http_server_throttle(http_server* server, http_response* res, uint64_t wait) {
+  char seconds[24];
+  snprintf(seconds, sizeof(seconds), "%llu", (unsigned long long)((wait + 999999999) / 1000000000));
+  http_response_set_status(res, HTTP_STATUS_429);
+  http_response_set_header(res, "Retry-After", seconds);
+  ++server->stats.counters.rate_limited;
+}
+
+/* a response the handler left unusable is replaced, the connection doesn't outlive it */
+static void http_server_internal_error(struct conn_info* conn) {
+  http_response_reset(&conn->response);
+  http_response_set_status(&conn->response, HTTP_STATUS_500);
+  http_response_set_header(&conn->response, "Content-Length", "0");
+  http_response_set_header(&conn->response, "Connection", "close");
+  conn->close = 1;
+}
+
+static int http_server_advance(http_server* server, struct conn_info* conn) {
+  http_request* req  = &conn->request;
+  http_response* res = &conn->response;
+  struct http_timing* timing = &conn->timing;
+  if (!timing->first_byte)
+    timing->first_byte = http_clock_ns();
+  /* a client with prior knowledge opens with the HTTP/2 preface instead of a request */
+  if (req->state == STATE_GOT_NOTHING && server->constraints.h2_max_streams && !server->proxy) {
+    int preface = h2_preface(conn->buffer, conn->buff_len);
+    if (preface == H2_PREFACE_PARTIAL)
+      return HTTP_SUCCESS;
+    if (preface == H2_PREFACE_FULL && h2_start(server, conn) == HTTP_SUCCESS) {
+      h2_open(server, conn);
+      return HTTP_SUCCESS;
+    }
   }
-  if (bind(server->sockfd, (struct sockaddr*)&server->addr, (int)sizeof(server->addr))) {
-    HTTP_LOG(HTTP_LOGERR, "[http_server_listen] bind() failed - %d.\n", GET_ERROR());
-    goto fail; 
+  int failed = parse_request(req, conn->buffer, &conn->buff_len, &server->constraints) == HTTP_FAILURE;
+  if (!timing->headers && (failed || req->state >= STATE_GOT_HEADERS))
+    timing->headers = http_clock_ns();
+  if (failed) {
+    ++server->stats.counters.parse_failures;
+    timing->handler_start = timing->headers;
+    server->error_handler(req, res);
+    timing->handler_end = http_clock_ns();
+    http_response_set_header(res, "Connection", "close");
+    req->state  = STATE_GOT_ALL;
+    conn->close = 1;
   }
-  if (listen(server->sockfd, 10)) {
-    HTTP_LOG(HTTP_LOGERR, "[http_server_listen] listen() failed - %d.\n", GET_ERROR());
-    goto fail; 
+  else if (req->state == STATE_GOT_HEADERS && req->expect != EXPECT_NONE) {
+    if (http_server_expect(server, conn) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+    /* the client may have sent the body without waiting for the interim response */
+    if (req->expect == EXPECT_NONE)
+      return http_server_advance(server, conn);
   }
-  HTTP_LOG(HTTP_LOGOUT, "listening...\n");
+  else if (req->state == STATE_GOT_ALL) {
+    timing->handler_start = http_clock_ns();
+    uint64_t wait = rate_limit_request(&server->limiter, conn->addr.SIN_ADDR, timing->handler_start);
+    if (wait)
+      http_server_throttle(server, res, wait);
+    else if (server->constraints.h2_max_streams && !server->proxy &&
+             !atomic_load_explicit(&server->stopping, memory_order_relaxed) && h2_upgrade(server, conn) == HTTP_SUCCESS) {
+      /* answered again on stream 1 once the 101 is out */
+    }
+    else if (server->metrics_path && (req->method == METHOD_GET || req->method == METHOD_HEAD) &&
+        strcmp(req->uri, server->metrics_path) == 0)
+      http_server_metrics(server, res);
+    else if (server->proxy) {
+      /* the proxy answers once the upstream does, the response is left alone until then */
+      http_proxy_forward(server->proxy, conn);
+      return HTTP_SUCCESS;
+    }
+    else if (server->cache && http_server_cache_lookup(server, conn))
+      return HTTP_SUCCESS;
+    else
+      server->request_handler(req, res);
+    /* the handler answers later through http_server_resume() */
+    if (conn_info_is(conn, CONN_DEFERRED))
+      return HTTP_SUCCESS;
+    timing->handler_end = http_clock_ns();
+    http_server_persist(server, conn);
+  }
+  else
+    return HTTP_SUCCESS;
+
+  if (req->state == STATE_GOT_ALL && http_validate_response(res) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_process] http_validate_response() failed.\n");
+    http_server_internal_error(conn);
+  }
+  http_server_cache_store(server, conn);
+  return HTTP_SUCCESS;
+}
+
+/* takes the request as far as what's buffered allows. the event loop's scan knows a connection waits to
+   write by its flag, it's kept in step with the request's state here */
+int http_server_process(http_server* server, struct conn_info* conn) {
+  int ret = http_server_advance(server, conn);
+  conn_info_mark(conn, CONN_RESPONDING, conn->request.state == STATE_GOT_ALL);
+  return ret;
+}
+
+/* hands the finished request to the log thread, the event loop never formats or writes it */
+static void http_server_log(http_server* server, http_request* req, http_response* res, struct http_timing* timing,
+                            ipv4_t addr, size_t bytes, uint64_t now) {
+  struct access_record record;
+  size_t uri_len = MIN(req->uri_len, ACCESS_LOG_URI_LEN);
+  memcpy(record.uri, req->uri, uri_len);
+  if (req->query_len && uri_len < ACCESS_LOG_URI_LEN) {
+    record.uri[uri_len++] = '?';
+    size_t query_len = MIN(req->query_len, ACCESS_LOG_URI_LEN - uri_len);
+    memcpy(record.uri + uri_len, req->query, query_len);
+    uri_len += query_len;
+  }
+  record.uri_len = (uint16_t)uri_len;
+  record.latency = timing->first_byte && now > timing->first_byte ? now - timing->first_byte : 0;
+  record.bytes   = bytes;
+  record.addr    = addr;
+  record.status  = (uint16_t)http_response_status_code(res->status);
+  record.method  = req->method;
+  record.version = req->version;
+  access_log_push(server->access_ring, &record);
+}
+
+/* the last byte of a response went out: it is logged and counted, and the next request's timeline starts */
+void http_server_complete(http_server* server, http_request* req, http_response* res, struct http_timing* timing,
+                          ipv4_t addr, size_t bytes) {
+  uint64_t now = http_clock_ns();
+  if (server->access_ring)
+    http_server_log(server, req, res, timing, addr, bytes, now);
+  http_stats_record(&server->stats, timing, req->method, res->status, now);
+}
+
+/* answers a request that isn't tied to a connection of its own, as HTTP/2 streams are: only the limits, the
+   metrics endpoint and the handler apply, the response is always final */
+void http_server_answer(http_server* server, http_request* req, http_response* res, struct http_timing* timing,
+                        ipv4_t addr) {
+  timing->handler_start = http_clock_ns();
+  uint64_t wait = rate_limit_request(&server->limiter, addr, timing->handler_start);
+  if (wait)
+    http_server_throttle(server, res, wait);
+  else if (server->metrics_path && (req->method == METHOD_GET || req->method == METHOD_HEAD) &&
+           strcmp(req->uri, server->metrics_path) == 0)
+    http_server_metrics(server, res);
+  else
+    server->request_handler(req, res);
+  timing->handler_end = http_clock_ns();
+  if (http_validate_response(res) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_answer] http_validate_response() failed.\n");
+    http_response_reset(res);
+    http_response_set_status(res, HTTP_STATUS_500);
+    http_validate_response(res);
+  }
+}
+
+static void http_server_drop(http_server* server, struct conn_info* conn) {
+  ++server->stats.counters.connections_closed;
+  if (server->proxy)
+    http_proxy_detach(server->proxy, conn);
+  http_server_uncache(server, conn);
+  ws_detach(server, conn);
+  sse_detach(server, conn);
+  h2_detach(server, conn);
+  rate_limit_disconnect(&server->limiter, conn->addr.SIN_ADDR);
+  conn_group_drop(&server->conns, conn);
+}
+
+static void http_server_accept_retry(void* ctx, size_t id, uint32_t serial) {
+  http_server* server = (http_server*)ctx;
+  (void)id;
+  (void)serial;
+  server->accept_limit = server->constraints.max_connections;
+}
+
+/* out of descriptors or memory: accepting pauses until one of the open connections goes away, or a while
+   has passed, with none open nothing else would resume it. without a timer it never pauses below a slot */
+static void http_server_accept_pause(http_server* server) {
+  server->accept_limit = server->conns.len;
+  if (timer_heap_push(&server->timers, http_clock_ns() + HTTP_ACCEPT_RETRY, http_server_accept_retry, server,
+                      0, 0) == HTTP_FAILURE)
+    server->accept_limit = MAX(server->conns.len, 1);
+}
+
+/* accepts every pending connection, stopping early instead of failing when out of resources */
+static int http_server_accept(http_server* server, struct http_listener* listener) {
+  struct conn_group* conns = &server->conns;
+  int tcp = listener->family == AF_INET;
+  while (conns->len < server->accept_limit) {
+    struct sockaddr_storage peer;
+    socklen_t addrlen = sizeof(peer);
+#ifdef __linux__
+    SOCKET conn_socket = accept4(listener->sockfd, (struct sockaddr*)&peer, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    ++server->stats.counters.accept_calls;
+#else
+    SOCKET conn_socket = accept(listener->sockfd, (struct sockaddr*)&peer, &addrlen);
+    ++server->stats.counters.accept_calls;
+    if (conn_socket != INVALID_SOCKET && http_socket_set_nonblocking(conn_socket) == HTTP_FAILURE) {
+      CLOSE_SOCKET(conn_socket);
+      continue;
+    }
+#endif
+    if (conn_socket == INVALID_SOCKET) {
+      int err = GET_ERROR();
+      if (WOULD_BLOCK(err))
+        return HTTP_SUCCESS;
+#ifndef _WIN32
+      if (err == EINTR || err == ECONNABORTED)
+        continue;
+#endif
+      HTTP_LOG(HTTP_LOGERR, "[http_server_accept] accept() failed - %d.\n", err);
+      http_server_accept_pause(server);
+      return HTTP_SUCCESS;
+    }
+#ifndef _WIN32
+    if (conn_socket >= FD_SETSIZE) {
+      CLOSE_SOCKET(conn_socket);
+      http_server_accept_pause(server);
+      return HTTP_SUCCESS;
+    }
+#endif
+    /* a Unix peer has no address, it's left at 0.0.0.0 and the per-address limits pass it */
+    struct sockaddr_in conn_addr = { 0 };
+    if (tcp)
+      memcpy(&conn_addr, &peer, sizeof(conn_addr));
+    else
+      conn_addr.sin_family = AF_UNIX;
+    /* past the memory ceiling a new connection would only push the process closer to the OOM killer, it's
+       turned away before it costs anything, without an answer over TLS. those already open are served */
+    size_t limit = server->constraints.memory_limit;
+    if (limit && http_memory_total() >= limit) {
+      static const char shed[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nRetry-After: 1\r\n"
+                                 "Content-Length: 0\r\n\r\n";
+      if (!server->tls)
+        send(conn_socket, shed, sizeof(shed) - 1, SEND_FLAGS);
+      CLOSE_SOCKET(conn_socket);
+      ++server->stats.counters.memory_shed;
+      continue;
+    }
+    uint64_t now = http_clock_ns();
+    if (rate_limit_connect(&server->limiter, conn_addr.SIN_ADDR, now) == HTTP_FAILURE) {
+      /* the address holds all the connections it may, it's told so in one segment without taking a slot. a
+         TLS client would read plaintext as a broken record, it's only closed on */
+      static const char refusal[] = "HTTP/1.1 429 Too Many Requests\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+      if (!server->tls)
+        send(conn_socket, refusal, sizeof(refusal) - 1, SEND_FLAGS);
+      CLOSE_SOCKET(conn_socket);
+      ++server->stats.counters.rate_limited;
+      continue;
+    }
+#ifndef __linux__
+    /* responses are written whole, Nagle would only hold back the tail of each one. Linux connections
+       have it from the listener */
+    if (tcp && server->constraints.tcp_nodelay)
+      setsockopt(conn_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&server->constraints.tcp_nodelay, sizeof(int));
+#endif
+    struct conn_info* conn = conn_group_add(conns, conn_socket, &conn_addr);
+    if (!conn) {
+      HTTP_LOG(HTTP_LOGERR, "[http_server_accept] conn_group_add() failed.\n");
+      rate_limit_disconnect(&server->limiter, conn_addr.SIN_ADDR);
+      CLOSE_SOCKET(conn_socket);
+      http_server_accept_pause(server);
+      return HTTP_SUCCESS;
+    }
+    /* the handshake runs on the event loop like any other read */
+    if (server->tls && tls_accept(server->tls, conn, server->constraints.h2_max_streams && !server->proxy)
+        == HTTP_FAILURE) {
+      rate_limit_disconnect(&server->limiter, conn_addr.SIN_ADDR);
+      conn_group_drop(conns, conn);
+      continue;
+    }
+    server->accept_limit = server->constraints.max_connections;
+    http_timing_reset(&conn->timing, now);
+    conn->bytes_sent = 0;
+    ++server->stats.counters.connections_accepted;
+    HTTP_LOG(HTTP_LOGOUT, "accepted a client.\n");
+#ifdef HTTP_DEBUG
+    print_addr(&conn->addr);
+#endif
+  }
+  return HTTP_SUCCESS;
+}
+
+static int http_server_hand_over(http_server* server) {
+  SOCKET sockets[HTTP_SERVER_MAX_LISTENERS];
+  for (size_t i = 0; i < server->listeners_len; ++i)
+    sockets[i] = server->listeners[i].sockfd;
+  if (handoff_give(server->handoff_fd, sockets, server->listeners_len) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  HTTP_LOG(HTTP_LOGOUT, "handed the listening sockets over.\n");
+  return HTTP_SUCCESS;
+}
+
+/* while stopping: idle connections go now, the rest finish the exchange they're in. upgraded ones are told
+   in their own protocol and go when it's done */
+static void http_server_wind_down(http_server* server, struct conn_info* conn) {
+  if (conn_info_is(conn, CONN_UPGRADED)) {
+    if (conn->h2)
+      h2_shutdown(server, conn);
+    else if (conn->ws)
+      ws_close(conn->ws, WS_CLOSE_GOING_AWAY, "server stopping");
+    else
+      http_server_drop(server, conn);
+    return;
+  }
+  conn->close = 1;
+  if (conn_info_is(conn, CONN_DEFERRED | CONN_HANDSHAKING) || conn->request.state != STATE_GOT_NOTHING ||
+      conn->buff_len)
+    return;
+  /* just accepted or just answered, the client may be sending right now */
+  if (http_clock_ns() - conn->timing.start < HTTP_STOP_QUIET)
+    return;
+  /* a request already sent but not read yet isn't idle, closing on it would reset the client */
+  char peek;
+  if (tls_pending(conn) || recv(conn->sockfd, &peek, 1, MSG_PEEK) >= 0 || !WOULD_BLOCK(GET_ERROR()))
+    return;
+  http_server_drop(server, conn);
+}
+
+/* the event loop, on the listening socket http_server_listen() set up */
+static int http_server_serve(http_server* server, int* handed_over) {
+  uint64_t deadline = 0;
+  http_constraints* constraints = &server->constraints;
+  server->accept_limit = constraints->max_connections;
   struct conn_group* conns = &server->conns; 
   while (1) {
-    fd_set read;
-    if (conn_group_wait(conns, server->sockfd, &read) == HTTP_FAILURE) {
-      HTTP_LOG(HTTP_LOGERR, "[http_server_listen] conn_group_wait() failed.\n");
-      goto fail; 
+    fd_set read, write;
+    FD_ZERO(&read);
+    FD_ZERO(&write);
+    int max_socket = -1;
+    struct timeval timeout = { 0 }, *wait = NULL;
+    if (!deadline && atomic_load_explicit(&server->stopping, memory_order_acquire)) {
+      /* nothing new is accepted, whoever took the socket over keeps the backlog */
+      deadline = http_clock_ns() + (uint64_t)constraints->shutdown_grace * 1000000;
+      for (size_t i = 0; i < server->listeners_len; ++i)
+        listener_close(&server->listeners[i], 1);
+      HTTP_LOG(HTTP_LOGOUT, "stopping...\n");
     }
-    
-    if (FD_ISSET(server->sockfd, &read)) {
-      struct sockaddr_in conn_addr = { 0 };
-      int addrlen = sizeof(conn_addr);
-      SOCKET conn_socket = accept(server->sockfd, (struct sockaddr*)&conn_addr, &addrlen);
-      if (conn_socket < 0) {
-        HTTP_LOG(HTTP_LOGERR, "[http_server_listen] accept() failed - %d.\n", GET_ERROR());
-        goto fail; 
+    if (deadline) {
+      for (size_t i = 0; i < conns->cap; ++i) {
+        if (conns->flags[i] & CONN_USED)
+          http_server_wind_down(server, &conns->data[i]);
       }
-      struct conn_info* conn = conn_group_add(conns, conn_socket, &conn_addr);
-      if (!conn) {
-        HTTP_LOG(HTTP_LOGERR, "[http_server_listen] conn_group_add() failed.\n");
-        goto fail;
+      if (conns->len == 0 || http_clock_ns() >= deadline)
+        break;
+    }
+    if (server->wake_fd != INVALID_SOCKET) {
+      FD_SET(server->wake_fd, &read);
+      max_socket = MAX(max_socket, (int)server->wake_fd);
+    }
+    if (server->handoff_fd != INVALID_SOCKET && !deadline) {
+      FD_SET(server->handoff_fd, &read);
+      max_socket = MAX(max_socket, (int)server->handoff_fd);
+    }
+    if (server->pollers_len || server->timers.len || deadline) {
+      uint64_t next = (uint64_t)SELECT_SEC * 1000000000;
+      /* the connections still quiet get another look soon */
+      if (deadline)
+        next = MIN(next, HTTP_STOP_QUIET);
+      for (size_t i = 0; i < server->pollers_len; ++i) {
+        struct http_poller* poller = server->pollers[i];
+        uint64_t due = poller->fill(poller->ctx, &read, &write, &max_socket);
+        next = MIN(next, due);
+      }
+      uint64_t due = timer_heap_next(&server->timers, http_clock_ns());
+      next = MIN(next, due);
+      timeout.tv_sec  = (long)(next / 1000000000);
+      timeout.tv_usec = (long)(next % 1000000000 / 1000);
+      wait = &timeout;
+    }
+    /* at capacity the listening sockets aren't watched, pending clients wait in the backlog */
+    int accepting = conns->len < server->accept_limit;
+    for (size_t i = 0; accepting && i < server->listeners_len; ++i) {
+      SOCKET sockfd = server->listeners[i].sockfd;
+      if (sockfd != INVALID_SOCKET) {
+        FD_SET(sockfd, &read);
+        max_socket = MAX(max_socket, (int)sockfd);
       }
-      HTTP_LOG(HTTP_LOGOUT, "accepted a client.\n");
-#ifdef HTTP_DEBUG
-      print_addr(&conn->addr);
-#endif
+    }
+    if (conn_group_wait(conns, INVALID_SOCKET, &read, &write, max_socket, wait) == HTTP_FAILURE) {
+      HTTP_LOG(HTTP_LOGERR, "[http_server_listen] conn_group_wait() failed.\n");
+      return HTTP_FAILURE;
     }
     
+    if (server->wake_fd != INVALID_SOCKET && FD_ISSET(server->wake_fd, &read)) {
+      char drain[16];
+      while (recv(server->wake_fd, drain, sizeof(drain), 0) > 0)
+        ;
+    }
+    /* the next process is up and asking for the socket: it accepts from here on, this one winds down */
+    if (server->handoff_fd != INVALID_SOCKET && !deadline && FD_ISSET(server->handoff_fd, &read) &&
+        http_server_hand_over(server) == HTTP_SUCCESS) {
+      *handed_over = 1;
+      http_server_stop(server);
+      continue;
+    }
+    for (size_t i = 0; accepting && i < server->listeners_len; ++i) {
+      struct http_listener* listener = &server->listeners[i];
+      if (listener->sockfd != INVALID_SOCKET && FD_ISSET(listener->sockfd, &read))
+        http_server_accept(server, listener);
+    }
+    if (conns->len < server->accept_limit && server->accept_limit < constraints->max_connections)
+      server->accept_limit = constraints->max_connections;
+    for (size_t i = 0; i < server->pollers_len; ++i)
+      server->pollers[i]->dispatch(server->pollers[i]->ctx, &read, &write);
+    if (server->timers.len)
+      timer_heap_run(&server->timers, http_clock_ns());
+    
     const size_t cap = conns->cap;
     for (size_t i = 0; i < cap; ++i) {
+      /* the hot arrays tell which connections have something to do, the others aren't touched. an
+         upgraded one may have writes queued whether its socket is ready or not */
+      uint8_t flag = conns->flags[i];
+      if ((flag & (CONN_USED | CONN_DEFERRED)) != CONN_USED)
+        continue; 
+      SOCKET sockfd = conns->fds[i];
+      if (!(flag & (CONN_UPGRADED | CONN_TLS)) && !FD_ISSET(sockfd, &read) && !FD_ISSET(sockfd, &write))
+        continue;
       struct conn_info* conn = &conns->data[i];
-      if (conn->used == 0) continue; 
+      if (conn_info_is(conn, CONN_HANDSHAKING)) {
+        if (!FD_ISSET(conn->sockfd, &read) && !FD_ISSET(conn->sockfd, &write))
+          continue;
+        if (tls_handshake(conn, &server->stats.counters) == HTTP_FAILURE) {
+          http_server_drop(server, conn);
+          continue;
+        }
+        /* the first request may have come with the client's last handshake message */
+        if (conn_info_is(conn, CONN_HANDSHAKING) || !tls_pending(conn))
+          continue;
+      }
+      if (conn_info_is(conn, CONN_UPGRADED)) {
+        int readable = FD_ISSET(conn->sockfd, &read) || tls_pending(conn);
+        int writable = FD_ISSET(conn->sockfd, &write);
+        int ret = conn->h2   ? h2_step(server, conn, readable, writable)
+                : conn->ws ? ws_step(server, conn, readable, writable)
+                           : sse_step(server, conn, readable, writable);
+        if (ret == HTTP_FAILURE)
+          http_server_drop(server, conn);
+        continue;
+      }
       if (conn->request.state == STATE_GOT_ALL) {
-        if (http_send_response(conn, &server->constraints) == HTTP_FAILURE) {
+        if (!FD_ISSET(conn->sockfd, &write))
+          continue;
+        if (http_send_response(server, conn) == HTTP_FAILURE) {
           HTTP_LOG(HTTP_LOGERR, "[http_listen] http_send_response() failed.\n");
-          goto fail;
+          http_server_drop(server, conn);
+          continue;
         }
         if (conn->response.state == STATE_GOT_ALL) {
-            http_request_reset(&conn->request, conn->sockfd, &conn->addr);
-            http_response_reset(&conn->response);
-            conn->buff_len = 0;
+          http_server_complete(server, &conn->request, &conn->response, &conn->timing, conn->addr.SIN_ADDR,
+                               conn->bytes_sent);
+          conn->bytes_sent = 0;
+          http_server_uncache(server, conn);
+          /* the upgrade is answered, the same request is answered again on stream 1 */
+          if (conn->h2 && conn->response.status == HTTP_STATUS_101) {
+            if (h2_open(server, conn) == HTTP_FAILURE)
+              http_server_drop(server, conn);
+            continue;
+          }
+          /* the handshake is answered, from here on the socket speaks WebSocket */
+          if (conn->ws && conn->response.status == HTTP_STATUS_101) {
+            if (ws_open(server, conn) == HTTP_FAILURE)
+              http_server_drop(server, conn);
+            continue;
+          }
+          /* an event stream outlives its response, even a close-delimited HTTP/1.0 one */
+          if (conn->sse && conn->response.status == HTTP_STATUS_200) {
+            if (sse_open(server, conn) == HTTP_FAILURE)
+              http_server_drop(server, conn);
+            continue;
+          }
+          ws_detach(server, conn);
+          sse_detach(server, conn);
+          h2_detach(server, conn);
+          if (conn->close) {
+            http_server_drop(server, conn);
+            continue;
+          }
+          http_request_reset(&conn->request, conn->sockfd, &conn->addr);
+          http_response_reset(&conn->response);
+          conn_info_mark(conn, CONN_RESPONDING, 0);
+          conn_info_shrink(conn);
+          /* pipelined requests that already arrived don't wait for the socket to become readable */
+          /* a failure is this connection's alone, the interim response couldn't be sent */
+          if (conn->buff_len > 0 && http_server_process(server, conn) == HTTP_FAILURE) {
+            HTTP_LOG(HTTP_LOGERR, "[http_server_listen] http_server_process() failed.\n");
+            http_server_drop(server, conn);
+          }
         }
       }
-      else if (FD_ISSET(conn->sockfd, &read)) {
-        int res = recv(conn->sockfd, conn->buffer + conn->buff_len, (int)(CONN_BUFF_LEN - conn->buff_len), 0);
+      else if (FD_ISSET(conn->sockfd, &read) || tls_pending(conn)) {
+        if (conn_info_reserve(conn, constraints) == HTTP_FAILURE) {
+          /* the head of the request outgrew the largest buffer allowed */
+          http_response_set_status(&conn->response, HTTP_STATUS_431);
+          http_response_set_header(&conn->response, "Connection", "close");
+          conn->request.state = STATE_GOT_ALL;
+          conn->close = 1;
+          /* framed like every other answer, not by the close */
+          if (http_validate_response(&conn->response) == HTTP_FAILURE)
+            http_server_internal_error(conn);
+          conn_info_mark(conn, CONN_RESPONDING, 1);
+          ++server->stats.counters.parse_failures;
+          continue;
+        }
+        size_t space = MIN(conn->buff_cap - conn->buff_len, HTTP_RECV_LEN(constraints));
+        int res = conn_info_recv(conn, conn->buffer + conn->buff_len, space);
+        ++server->stats.counters.recv_calls;
         if (res < 0) {
+          if (WOULD_BLOCK(GET_ERROR()))
+            continue;
           HTTP_LOG(HTTP_LOGOUT, "client disconnected disgracefully.\n");
 #ifdef HTTP_DEBUG
           print_addr(&conn->addr);
 #endif
-          conn_info_drop(conn);
+          http_server_drop(server, conn);
         }
         else if (res > 0) {
           conn->buff_len += res;
-          if (parse_request(conn, conn->buffer, &conn->buff_len, &server->constraints) == HTTP_FAILURE) {
-            server->error_handler(&conn->request, &conn->response);
-            if (http_validate_response(&conn->response) == HTTP_FAILURE) {
-              HTTP_LOG(HTTP_LOGERR, "[http_server_listen] http_validate_response() failed.\n");
-              goto fail;
-            }
-            conn->request.state = STATE_GOT_ALL; 
-          }
-          else if (conn->request.state == STATE_GOT_ALL) {
-            server->request_handler(&conn->request, &conn->response);
-            if (http_validate_response(&conn->response) == HTTP_FAILURE) {
-                HTTP_LOG(HTTP_LOGERR, "[http_server_listen] http_validate_response() failed.\n");
-                goto fail;
-            }
+          server->stats.counters.bytes_in += res;
+          if (http_server_process(server, conn) == HTTP_FAILURE) {
+            HTTP_LOG(HTTP_LOGERR, "[http_server_listen] http_server_process() failed.\n");
+            http_server_drop(server, conn);
           }
         }
         else {
@@ -340,23 +1176,340 @@ int http_server_listen(http_server* server) {
 #ifdef HTTP_DEBUG
           print_addr(&conn->addr);
 #endif
-          conn_info_drop(conn);
+          http_server_drop(server, conn);
         }
       }
     }
   }
   
-  goto cleanup;
- fail:
-  retval = HTTP_FAILURE;
+  /* whatever outlived the grace period goes now */
+  for (size_t i = 0; i < conns->cap; ++i) {
+    if (conns->flags[i] & CONN_USED)
+      http_server_drop(server, &conns->data[i]);
+  }
+  return HTTP_SUCCESS;
+}
+
+#ifndef _WIN32
+static http_server* http_worker;
+
+static void http_server_worker_stop(int sig) {
+  http_server_stop(http_worker);
+}
+#endif
+
+/* a prefork worker, in a process of its own and already pinned */
+static int http_server_work(void* ctx) {
+  http_server* server = ctx;
+  /* the supervisor's control sockets stay the supervisor's */
+  if (server->handoff_fd != INVALID_SOCKET)
+    CLOSE_SOCKET(server->handoff_fd);
+  server->handoff_fd = INVALID_SOCKET;
+  if (server->wake_fd != INVALID_SOCKET)
+    CLOSE_SOCKET(server->wake_fd);
+  server->wake_fd = http_server_wake_socket();
+  if (server->access_log && access_log_fork(server->access_log) == HTTP_FAILURE) {
+    server->access_log  = NULL;
+    server->access_ring = NULL;
+  }
+#ifndef _WIN32
+  http_worker = server;
+  signal(SIGTERM, http_server_worker_stop);
+  signal(SIGINT, http_server_worker_stop);
+#endif
+  int handed_over = 0;
+  int ret = http_server_serve(server, &handed_over);
+  if (server->access_log)
+    access_log_close(server->access_log);
+  return ret;
+}
+
+/* prefork: the workers accept from the same listening socket, each with its own loop, connections and
+   buffers. this process only restarts the ones that die and stops them all, and gives the socket to the
+   next process on a restart */
+static int http_server_supervise(http_server* server, int* handed_over) {
+  http_constraints* constraints = &server->constraints;
+  struct prefork prefork;
+  if (prefork_init(&prefork, constraints->workers, constraints->worker_affinity, http_server_work, server) ==
+      HTTP_FAILURE)
+    return HTTP_FAILURE;
+  HTTP_LOG(HTTP_LOGOUT, "starting %zu workers...\n", constraints->workers);
+  while (!atomic_load_explicit(&server->stopping, memory_order_acquire)) {
+    uint64_t now = http_clock_ns();
+    prefork_reap(&prefork, now);
+    prefork_spawn(&prefork, now);
+    fd_set read;
+    FD_ZERO(&read);
+    int max_socket = -1;
+    if (server->wake_fd != INVALID_SOCKET) {
+      FD_SET(server->wake_fd, &read);
+      max_socket = MAX(max_socket, (int)server->wake_fd);
+    }
+    if (server->handoff_fd != INVALID_SOCKET) {
+      FD_SET(server->handoff_fd, &read);
+      max_socket = MAX(max_socket, (int)server->handoff_fd);
+    }
+    /* a worker dying interrupts select(), the timeout only covers one due to be started again */
+    uint64_t next = MIN((uint64_t)SELECT_SEC * 1000000000, prefork_next(&prefork, http_clock_ns()));
+    struct timeval timeout = { (long)(next / 1000000000), (long)(next % 1000000000 / 1000) };
+    if (select(max_socket + 1, &read, NULL, NULL, &timeout) <= 0)
+      continue;
+    if (server->wake_fd != INVALID_SOCKET && FD_ISSET(server->wake_fd, &read)) {
+      char drain[16];
+      while (recv(server->wake_fd, drain, sizeof(drain), 0) > 0)
+        ;
+    }
+    if (server->handoff_fd != INVALID_SOCKET && FD_ISSET(server->handoff_fd, &read) &&
+        http_server_hand_over(server) == HTTP_SUCCESS) {
+      *handed_over = 1;
+      break;
+    }
+  }
+  HTTP_LOG(HTTP_LOGOUT, "stopping %zu workers...\n", constraints->workers);
+  prefork_stop(&prefork, (uint64_t)constraints->shutdown_grace * 1000000);
+  prefork_free(&prefork);
+  return HTTP_SUCCESS;
+}
+
+int http_server_listen(http_server* server) {
+  if (!server) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_listen] passed NULL pointers for mandatory parameters");
+    return HTTP_FAILURE;
+  }
+
+  int retval = HTTP_SUCCESS, handed_over = 0;
+  if (server->listeners_len == 0) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_listen] there's nothing to listen on.\n");
+    return HTTP_FAILURE;
+  }
+  /* a process already serving the addresses hands its sockets over instead of this one binding others.
+     what it had and this one doesn't listen on is closed, what it didn't have is bound here */
+  SOCKET taken[HANDOFF_MAX_SOCKETS];
+  size_t taken_len = server->handoff_path ? handoff_take(server->handoff_path, taken, HANDOFF_MAX_SOCKETS) : 0;
+  for (size_t i = 0; i < server->listeners_len; ++i) {
+    struct http_listener* listener = &server->listeners[i];
+    if (listener_adopt(listener, taken, taken_len) == HTTP_SUCCESS) {
+      HTTP_LOG(HTTP_LOGOUT, "took over a listening socket from %s.\n", server->handoff_path);
+    }
+    else if (listener_open(listener, &server->constraints) == HTTP_FAILURE)
+      retval = HTTP_FAILURE;
+  }
+  for (size_t i = 0; i < taken_len; ++i) {
+    if (taken[i] != INVALID_SOCKET)
+      CLOSE_SOCKET(taken[i]);
+  }
+  if (retval == HTTP_FAILURE)
+    goto cleanup;
+  if (server->handoff_path)
+    server->handoff_fd = handoff_open(server->handoff_path);
+  HTTP_LOG(HTTP_LOGOUT, "listening...\n");
+  if (server->constraints.workers > 0)
+    retval = http_server_supervise(server, &handed_over);
+  else
+    retval = http_server_serve(server, &handed_over);
  cleanup: 
-  CLOSE_SOCKET(server->sockfd);
-  server->sockfd = -1;
+  for (size_t i = 0; i < server->listeners_len; ++i)
+    listener_close(&server->listeners[i], handed_over);
+  handoff_close(server->handoff_fd, server->handoff_path, handed_over);
+  server->handoff_fd = INVALID_SOCKET;
+  atomic_store_explicit(&server->stopping, 0, memory_order_release);
   return retval; 
 }
 
+/* stops accepting and lets http_server_listen() return once the connections in flight are answered, or
+   after 'shutdown_grace' ms. idle keep-alive connections are closed right away, WebSocket peers are sent
+   1001 and HTTP/2 ones a GOAWAY. safe from any thread and from a signal handler */
+int http_server_stop(http_server* server) {
+  if (!server) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_stop] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  atomic_store_explicit(&server->stopping, 1, memory_order_release);
+  if (server->wake_fd != INVALID_SOCKET)
+    send(server->wake_fd, "", 1, 0);
+  return HTTP_SUCCESS;
+}
+
+/* zero-downtime restarts: a server listening with the same 'path' takes the running one's socket over
+   through it instead of binding, and the running one winds down as http_server_stop() does. POSIX only */
+int http_server_set_handoff(http_server* server, const char* path) {
+  if (!server || !path) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_handoff] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  server->handoff_path = path;
+  return HTTP_SUCCESS;
+}
+
+/* a copy of the counters and stage histograms, taken from another thread it may be slightly torn */
+int http_server_stats(http_server* server, http_stats* stats) {
+  if (!server || !stats) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_stats] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  memcpy(stats, &server->stats, sizeof(http_stats));
+  return HTTP_SUCCESS;
+}
+
+/* serves metrics at 'path' without involving the request handler, NULL turns it off */
+int http_server_set_metrics(http_server* server, const char* path) {
+  if (!server) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_metrics] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  server->metrics_path = path;
+  return HTTP_SUCCESS;
+}
+
+/* forwards every request but the metrics scrape to 'proxy', which has to outlive the server */
+int http_server_set_proxy(http_server* server, struct http_proxy* proxy) {
+  if (!server || !proxy) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_proxy] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (server->pollers_len == HTTP_SERVER_MAX_POLLERS || http_proxy_attach(proxy, server) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_proxy] http_proxy_attach() failed.\n");
+    return HTTP_FAILURE;
+  }
+  server->proxy = proxy;
+  return http_server_add_poller(server, &proxy->poller);
+}
+
+/* has the event loop wait on and drive sockets of its own, such as a client pool's */
+int http_server_add_poller(http_server* server, struct http_poller* poller) {
+  if (!server || !poller || !poller->fill || !poller->dispatch) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_add_poller] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (server->pollers_len == HTTP_SERVER_MAX_POLLERS) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_add_poller] too many pollers.\n");
+    return HTTP_FAILURE;
+  }
+  server->pollers[server->pollers_len++] = poller;
+  return HTTP_SUCCESS;
+}
+
+/* called from the request handler to answer later, the connection waits until the returned ticket
+   is passed to http_server_resume(). the response is reached through http_server_deferred() meanwhile,
+   as the pointer the handler got may move */
+size_t http_server_defer(http_server* server, http_request* req) {
+  if (!server || !req) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_defer] passed NULL pointers for mandatory parameters.\n");
+    return (size_t)-1;
+  }
+  /* an HTTP/2 stream shares its connection, it is answered before the handler returns */
+  if (req->version == HTTP_VERSION_2) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_defer] invalid arguments - HTTP/2 streams can't be deferred.\n");
+    return (size_t)-1;
+  }
+  struct conn_info* conn = (struct conn_info*)((char*)req - offsetof(struct conn_info, request));
+  conn_info_mark(conn, CONN_DEFERRED, 1);
+  return (size_t)(conn - server->conns.data);
+}
+
+http_response* http_server_deferred(http_server* server, size_t ticket) {
+  if (!server || ticket >= server->conns.cap || !(server->conns.flags[ticket] & CONN_DEFERRED)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_deferred] invalid arguments - not a deferred response.\n");
+    return NULL;
+  }
+  return &server->conns.data[ticket].response;
+}
+
+int http_server_resume(http_server* server, size_t ticket) {
+  if (!server || ticket >= server->conns.cap || !(server->conns.flags[ticket] & CONN_DEFERRED)) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_resume] invalid arguments - not a deferred response.\n");
+    return HTTP_FAILURE;
+  }
+  struct conn_info* conn = &server->conns.data[ticket];
+  conn_info_mark(conn, CONN_DEFERRED, 0);
+  conn->timing.handler_end = http_clock_ns();
+  http_server_persist(server, conn);
+  if (http_validate_response(&conn->response) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_resume] http_validate_response() failed.\n");
+    http_server_internal_error(conn);
+  }
+  http_server_cache_store(server, conn);
+  return HTTP_SUCCESS;
+}
+
+static uint64_t http_server_cache_fill(void* ctx, fd_set* read, fd_set* write, int* max_socket) {
+  http_server* server = (http_server*)ctx;
+  (void)read;
+  (void)write;
+  (void)max_socket;
+  return server->cache_waiting ? HTTP_CACHE_WAIT_NS : (uint64_t)SELECT_SEC * 1000000000;
+}
+
+/* requests collapsed onto another one's miss are answered once it's stored, or handled on their own
+   when it was abandoned. the owner may live on another thread, so they're polled */
+static int http_server_cache_dispatch(void* ctx, fd_set* read, fd_set* write) {
+  http_server* server = (http_server*)ctx;
+  (void)read;
+  (void)write;
+  for (size_t i = 0; server->cache_waiting && i < server->conns.cap; ++i) {
+    struct conn_info* conn = &server->conns.data[i];
+    if (!conn_info_is(conn, CONN_USED) || !conn_info_is(conn, CONN_DEFERRED) || !conn->cached || conn->cache_owner)
+      continue;
+    int state = http_cache_state(conn->cached);
+    if (state == CACHE_ENTRY_PENDING)
+      continue;
+    conn_info_mark(conn, CONN_DEFERRED, 0);
+    --server->cache_waiting;
+    if (state == CACHE_ENTRY_READY && http_server_cache_serve(server, conn) == HTTP_SUCCESS)
+      continue;
+    http_cache_release(conn->cached);
+    conn->cached = NULL;
+    if (http_server_process(server, conn) == HTTP_FAILURE)
+      http_server_drop(server, conn);
+  }
+  return HTTP_SUCCESS;
+}
+
+/* terminates TLS on every connection accepted from here on, 'tls' can be shared by servers on other threads
+   and has to outlive them all */
+int http_server_set_tls(http_server* server, struct tls_context* tls) {
+  if (!server || !tls) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_tls] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  server->tls = tls;
+  return HTTP_SUCCESS;
+}
+
+/* answers cacheable GET and HEAD requests from 'cache', which can be shared by servers on other threads
+   and has to outlive them all */
+int http_server_set_cache(http_server* server, struct http_cache* cache) {
+  if (!server || !cache) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_cache] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  server->cache_poller.ctx      = server;
+  server->cache_poller.fill     = http_server_cache_fill;
+  server->cache_poller.dispatch = http_server_cache_dispatch;
+  if (http_server_add_poller(server, &server->cache_poller) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  server->cache = cache;
+  return HTTP_SUCCESS;
+}
+
+/* the server takes a ring of its own from 'log', which has to outlive the server */
+int http_server_set_access_log(http_server* server, struct access_log* log) {
+  if (!server || !log) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_access_log] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct access_ring* ring = access_log_ring(log);
+  if (!ring) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_access_log] access_log_ring() failed.\n");
+    return HTTP_FAILURE;
+  }
+  server->access_log  = log;
+  server->access_ring = ring;
+  return HTTP_SUCCESS;
+}
+
 int http_server_set_error_handler(http_server* server, request_handler error_handler) {
-  if (!server || error_handler) {
+  if (!server || !error_handler) {
     HTTP_LOG(HTTP_LOGERR, "[http_server_set_error_handler] passed NULL pointers for mandatory parameters");
     return HTTP_FAILURE;
   }
@@ -364,3 +1517,14 @@ int http_server_set_error_handler(http_server* server, request_handler error_han
   server->error_handler = error_handler; 
   return HTTP_SUCCESS; 
 }
+
+
+int http_server_set_expect_handler(http_server* server, request_handler expect_handler) {
+  if (!server) {
+    HTTP_LOG(HTTP_LOGERR, "[http_server_set_expect_handler] passed NULL pointers for mandatory parameters");
+    return HTTP_FAILURE;
+  }
+
+  server->expect_handler = expect_handler;
+  return HTTP_SUCCESS;
+}
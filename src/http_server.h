@@ -5,25 +5,85 @@
 #include "http_request.h"
 #include "http_response.h"
 #include "http_headers.h"
+#include "http_stats.h"
+#include "access_log.h"
+#include "http_cache.h"
+#include "rate_limit.h"
+#include "timer_heap.h"
+#include "listener.h"
+#include <stdatomic.h>
+#define HTTP_SERVER_MAX_POLLERS 8
+#define HTTP_SERVER_MAX_LISTENERS 8
 typedef void (*request_handler) (http_request*, http_response*);
+struct http_proxy;
+struct sse_channel;
+struct tls_context;
 
 typedef struct {
-  struct sockaddr_in addr; 
   uint16_t    port;
   ipv4_t      ip;
-  SOCKET      sockfd;
+  struct http_listener listeners[HTTP_SERVER_MAX_LISTENERS];
+  size_t      listeners_len;
   request_handler request_handler;
   request_handler error_handler; 
+  request_handler expect_handler;
   struct conn_group conns;
   http_constraints constraints;
+  size_t accept_limit;
+  struct rate_limit limiter;
+  http_stats stats;
+  const char* metrics_path;
+  struct access_log* access_log;
+  struct access_ring* access_ring;
+  struct http_proxy* proxy;
+  struct http_cache* cache;
+  struct tls_context* tls;
+  struct http_poller cache_poller;
+  size_t cache_waiting;
+  struct http_poller* pollers[HTTP_SERVER_MAX_POLLERS];
+  size_t pollers_len;
+  struct timer_heap timers;
+  struct buffer_pool ws_pool;
+  uint32_t ws_serial;
+  size_t websockets;
+  struct sse_channel** sse_channels;
+  size_t sse_channels_len;
+  size_t sse_channels_cap;
+  size_t sse_subscribers;
+  size_t h2_conns;
+  const char* handoff_path;
+  SOCKET handoff_fd;
+  SOCKET wake_fd;
+  atomic_int stopping;
 } http_server;
 
 int http_init(void);
 int http_quit(void);
 http_server* http_server_new(const char*, const char*, request_handler, http_constraints*);
+http_server* http_server_new_unix(const char*, request_handler, http_constraints*);
+int http_server_add_listener(http_server*, const char*, const char*);
+int http_server_add_unix(http_server*, const char*);
 int http_server_free(http_server*);
 int http_server_set_error_handler(http_server*, request_handler);
+int http_server_set_expect_handler(http_server*, request_handler);
 int http_server_listen(http_server*);
+int http_server_stop(http_server*);
+int http_server_set_handoff(http_server*, const char*);
+int http_server_stats(http_server*, http_stats*);
+int http_server_set_metrics(http_server*, const char*);
+int http_server_set_access_log(http_server*, struct access_log*);
+int http_server_set_proxy(http_server*, struct http_proxy*);
+int http_server_set_cache(http_server*, struct http_cache*);
+int http_server_set_tls(http_server*, struct tls_context*);
+int http_server_add_poller(http_server*, struct http_poller*);
+size_t http_server_defer(http_server*, http_request*);
+http_response* http_server_deferred(http_server*, size_t);
+int http_server_resume(http_server*, size_t);
+void http_server_keep_alive(struct conn_info*);
+
+// internal use, for protocols that carry several requests over one connection
+void http_server_answer(http_server*, http_request*, http_response*, struct http_timing*, ipv4_t);
+void http_server_complete(http_server*, http_request*, http_response*, struct http_timing*, ipv4_t, size_t);
 http_constraints http_make_default_constraints();
 
 #endif 
@@ -0,0 +1,60 @@
+#include "http_stats.h"
+
+static const char* stage_strings[HTTP_STAGE_NONE] = {
+  "wait", "read", "body", "handler", "send", "total"
+};
+
+void http_stats_reset(http_stats* stats) {
+  memset(&stats->counters, 0, sizeof(stats->counters));
+  memset(stats->methods, 0, sizeof(stats->methods));
+  memset(stats->statuses, 0, sizeof(stats->statuses));
+  for (int i = 0; i < HTTP_STAGE_NONE; ++i)
+    histogram_reset(&stats->stages[i]);
+}
+
+void http_stats_merge(http_stats* dst, const http_stats* src) {
+  const uint64_t* from = (const uint64_t*)&src->counters;
+  uint64_t* to = (uint64_t*)&dst->counters;
+  for (size_t i = 0; i < sizeof(http_counters) / sizeof(uint64_t); ++i)
+    to[i] += from[i];
+  for (int i = 0; i <= METHOD_NONE; ++i)
+    dst->methods[i] += src->methods[i];
+  for (int i = 0; i <= HTTP_STATUS_NONE; ++i)
+    dst->statuses[i] += src->statuses[i];
+  for (int i = 0; i < HTTP_STAGE_NONE; ++i)
+    histogram_merge(&dst->stages[i], &src->stages[i]);
+}
+
+static void http_stats_stage(http_stats* stats, int stage, uint64_t from, uint64_t to) {
+  if (from && to >= from)
+    histogram_record(&stats->stages[stage], to - from);
+}
+
+/* closes the timeline of a request whose last byte went out at 'now', and starts the next one */
+void http_stats_record(http_stats* stats, struct http_timing* timing, int method, int status, uint64_t now) {
+  ++stats->counters.requests;
+  /* requests that failed to parse are counted under the 'none' slots */
+  ++stats->methods[method >= 0 && method < METHOD_NONE ? method : METHOD_NONE];
+  ++stats->statuses[status >= 0 && status < HTTP_STATUS_NONE ? status : HTTP_STATUS_NONE];
+  http_stats_stage(stats, HTTP_STAGE_WAIT, timing->start, timing->first_byte);
+  http_stats_stage(stats, HTTP_STAGE_READ, timing->first_byte, timing->headers);
+  http_stats_stage(stats, HTTP_STAGE_BODY, timing->headers, timing->handler_start);
+  http_stats_stage(stats, HTTP_STAGE_HANDLER, timing->handler_start, timing->handler_end);
+  http_stats_stage(stats, HTTP_STAGE_SEND, timing->handler_end, now);
+  http_stats_stage(stats, HTTP_STAGE_TOTAL, timing->first_byte, now);
+  http_timing_reset(timing, now);
+}
+
+const char* http_stage_string(int stage) {
+  if (stage < 0 || stage >= HTTP_STAGE_NONE)
+    return NULL;
+  return stage_strings[stage];
+}
+
+void http_timing_reset(struct http_timing* timing, uint64_t start) {
+  timing->start         = start;
+  timing->first_byte    = 0;
+  timing->headers       = 0;
+  timing->handler_start = 0;
+  timing->handler_end   = 0;
+}
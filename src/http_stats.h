@@ -0,0 +1,67 @@
+#ifndef HTTP_STATS_H_
+#define HTTP_STATS_H_
+#include "includes.h"
+#include "histogram.h"
+#include "http_request.h"
+#include "http_response.h"
+
+/* the stages a request goes through, each one ends where the next starts */
+enum {
+  HTTP_STAGE_WAIT,      /* accept, or the previous response, to the first byte */
+  HTTP_STAGE_READ,      /* first byte to headers parsed                        */
+  HTTP_STAGE_BODY,      /* headers parsed to handler start                     */
+  HTTP_STAGE_HANDLER,   /* handler start to handler end                        */
+  HTTP_STAGE_SEND,      /* handler end to the last byte sent                   */
+  HTTP_STAGE_TOTAL,     /* first byte to the last byte sent                    */
+  HTTP_STAGE_NONE
+};
+
+/* nanosecond timestamps taken by the event loop, 0 when the point wasn't reached yet */
+struct http_timing {
+  uint64_t start;
+  uint64_t first_byte;
+  uint64_t headers;
+  uint64_t handler_start;
+  uint64_t handler_end;
+};
+
+typedef struct {
+  uint64_t accept_calls;
+  uint64_t connections_accepted;
+  uint64_t connections_closed;
+  uint64_t requests;
+  uint64_t parse_failures;
+  uint64_t recv_calls;
+  uint64_t send_calls;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_collapsed;
+  uint64_t rate_limited;
+  uint64_t memory_shed;
+  uint64_t sse_events;
+  uint64_t sse_dropped;
+  uint64_t sse_coalesced;
+  uint64_t h2_streams;
+  uint64_t tls_handshakes;
+  uint64_t tls_resumed;
+  uint64_t tls_failures;
+  uint64_t tls_ktls;
+} http_counters;
+
+/* owned by one event loop and only ever written by it, so nothing is locked or atomic */
+typedef struct {
+  http_counters counters;
+  uint64_t methods[METHOD_NONE + 1];
+  uint64_t statuses[HTTP_STATUS_NONE + 1];
+  struct histogram stages[HTTP_STAGE_NONE];
+} http_stats;
+
+void http_stats_reset(http_stats*);
+void http_stats_merge(http_stats*, const http_stats*);
+void http_stats_record(http_stats*, struct http_timing*, int, int, uint64_t);
+const char* http_stage_string(int);
+void http_timing_reset(struct http_timing*, uint64_t);
+
+#endif
@@ -0,0 +1,206 @@
+#include "http_uri.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline int hexval(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/* returns the offset of the first '%' (or '+' when plus is set), len if there is none */
+static size_t http_uri_find_escape(const char* s, size_t len, int plus) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i pct = _mm_set1_epi8('%');
+  const __m128i pls = _mm_set1_epi8(plus ? '+' : '%');
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, pls)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < len; ++i) {
+    if (s[i] == '%' || (plus && s[i] == '+'))
+      return i;
+  }
+  return len;
+}
+
+int http_uri_decode(char* s, size_t* len, int plus) {
+  if (!s || !len) {
+    HTTP_LOG(HTTP_LOGERR, "[http_uri_decode] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  const size_t n = *len;
+  size_t r = http_uri_find_escape(s, n, plus);
+  if (r == n)
+    return HTTP_SUCCESS;
+
+  size_t w = r;
+  while (r < n) {
+    char c = s[r];
+    if (c == '%') {
+      if (r + 2 >= n)
+        return HTTP_FAILURE;
+      int hi = hexval(s[r + 1]);
+      int lo = hexval(s[r + 2]);
+      if (hi < 0 || lo < 0 || (hi == 0 && lo == 0))
+        return HTTP_FAILURE;
+      s[w++] = (char)(hi << 4 | lo);
+      r += 3;
+    }
+    else {
+      s[w++] = (plus && c == '+') ? ' ' : c;
+      ++r;
+    }
+  }
+  s[w] = 0;
+  *len = w;
+  return HTTP_SUCCESS;
+}
+
+int http_uri_normalize(char* path, size_t* len) {
+  if (!path || !len) {
+    HTTP_LOG(HTTP_LOGERR, "[http_uri_normalize] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  const size_t n = *len;
+  if (n == 0 || path[0] != '/')
+    return HTTP_FAILURE;
+
+  size_t r = 0;
+  size_t w = 0;
+  while (r < n) {
+    size_t seg = r + 1;
+    size_t end = seg;
+    while (end < n && path[end] != '/') ++end;
+    size_t seglen = end - seg;
+    if (seglen == 0 || (seglen == 1 && path[seg] == '.')) {
+      if (end == n)
+        path[w++] = '/';
+    }
+    else if (seglen == 2 && path[seg] == '.' && path[seg + 1] == '.') {
+      /* pop the last output segment, ".." above the root stays at the root */
+      while (w > 0 && path[--w] != '/');
+      if (end == n)
+        path[w++] = '/';
+    }
+    else {
+      path[w++] = '/';
+      memmove(path + w, path + seg, seglen);
+      w += seglen;
+    }
+    r = end;
+  }
+  if (w == 0)
+    path[w++] = '/';
+  path[w] = 0;
+  *len = w;
+  return HTTP_SUCCESS;
+}
+
+int http_query_next(const char* query, size_t len, size_t* iter, http_span* key, http_span* val) {
+  if (!query || !iter || !key || !val) {
+    HTTP_LOG(HTTP_LOGERR, "[http_query_next] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  while (*iter < len) {
+    const char* begin = query + *iter;
+    const char* end = memchr(begin, '&', len - *iter);
+    if (!end)
+      end = query + len;
+    *iter = (size_t)(end - query) + 1;
+    if (end == begin)
+      continue;
+
+    const char* eq = memchr(begin, '=', end - begin);
+    key->v = begin;
+    if (eq) {
+      key->len = eq - begin;
+      val->v   = eq + 1;
+      val->len = end - eq - 1;
+    }
+    else {
+      key->len = end - begin;
+      val->v   = end;
+      val->len = 0;
+    }
+    return HTTP_SUCCESS;
+  }
+  return HTTP_FAILURE;
+}
+
+/* compares the encoded span against a plain string without decoding into a buffer */
+static int http_span_equals(const http_span* span, const char* s) {
+  const char* p = span->v;
+  const char* end = p + span->len;
+  while (p < end) {
+    char c = *p;
+    if (c == '%' && end - p >= 3 && hexval(p[1]) >= 0 && hexval(p[2]) >= 0) {
+      c = (char)(hexval(p[1]) << 4 | hexval(p[2]));
+      p += 3;
+    }
+    else {
+      if (c == '+') c = ' ';
+      ++p;
+    }
+    if (*s++ != c)
+      return 0;
+  }
+  return *s == 0;
+}
+
+int http_query_get(const char* query, size_t len, const char* name, http_span* val) {
+  if (!query || !name || !val) {
+    HTTP_LOG(HTTP_LOGERR, "[http_query_get] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  size_t iter = 0;
+  http_span key;
+  while (http_query_next(query, len, &iter, &key, val) == HTTP_SUCCESS) {
+    if (http_span_equals(&key, name))
+      return HTTP_SUCCESS;
+  }
+  return HTTP_FAILURE;
+}
+
+int http_span_decode(const http_span* span, char* out, size_t* out_len, int plus) {
+  if (!span || !out || !out_len) {
+    HTTP_LOG(HTTP_LOGERR, "[http_span_decode] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (span->len + 1 > *out_len) {
+    HTTP_LOG(HTTP_LOGERR, "[http_span_decode] invalid arguments - output buffer too small.\n");
+    return HTTP_FAILURE;
+  }
+  size_t len = span->len;
+  memcpy(out, span->v, len);
+  out[len] = 0;
+  if (http_uri_decode(out, &len, plus) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  *out_len = len;
+  return HTTP_SUCCESS;
+}
+
+/* percent-encodes everything a path can't carry as is, 'out' needs room for 3 * len + 1 bytes */
+size_t http_uri_encode(const char* s, size_t len, char* out) {
+  static const char hex[] = "0123456789ABCDEF";
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+        (c != 0 && strchr("/-._~!$&'()*+,;=:@", c)))
+      out[n++] = c;
+    else {
+      out[n++] = '%';
+      out[n++] = hex[c >> 4];
+      out[n++] = hex[c & 15];
+    }
+  }
+  out[n] = 0;
+  return n;
+}
@@ -0,0 +1,17 @@
+#ifndef HTTP_URI_H_
+#define HTTP_URI_H_
+#include "includes.h"
+
+typedef struct {
+  const char* v;
+  size_t len;
+} http_span;
+
+int http_uri_decode(char*, size_t*, int);
+int http_uri_normalize(char*, size_t*);
+int http_query_next(const char*, size_t, size_t*, http_span*, http_span*);
+int http_query_get(const char*, size_t, const char*, http_span*);
+int http_span_decode(const http_span*, char*, size_t*, int);
+size_t http_uri_encode(const char*, size_t, char*);
+
+#endif
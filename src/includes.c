@@ -1,10 +1,11 @@
 #include "includes.h"
+#include "http_memory.h"
 
 #ifdef HTTP_DEBUG
 
 int print_addr(struct sockaddr_in* addr) {
   char address[100];
-  getnameinfo((struct sockaddr*)addr, sizeof(addr), address, 100, NULL, 0, NI_NUMERICHOST);
+  getnameinfo((struct sockaddr*)addr, sizeof(*addr), address, 100, NULL, 0, NI_NUMERICHOST);
   printf("the client's address: %s\n", address);
   return HTTP_SUCCESS;
 }
@@ -24,10 +25,108 @@ http_constraints http_constraints_make_default() {
 	  .request_max_body_len = 1024 * 1024 * 2,    /* 2MB                */
 	  .request_max_uri_len = 2048,               /* 2KB: standard spec */
 	  .request_max_headers = 24,                 /* arbitrary          */
-	  .request_max_header_len = 1024 * 1024 * 8,  /* 8MB                */
+	  .request_max_header_len = 1024 * 64,        /* 64KB               */
+	  .response_max_body_len = 1024 * 1024 * 8,   /* 8MB, for clients   */
 	  .recv_len = 1024 * 1024,                    /* 1MB                */
 	  .send_len = 1024 * 1024,                    /* 1MB                */
-	  .public_folder = ""
+	  .public_folder = "",
+	  .listen_backlog = SOMAXCONN,
+	  .max_connections = FD_SETSIZE - 16,         /* select() limit     */
+	  .defer_accept = 0,                          /* seconds, 0 = off   */
+	  .fastopen_queue = 0,                        /* 0 = off            */
+	  .rate_limit = 0,                            /* requests/s per IP  */
+	  .rate_burst = 0,                            /* 0 = rate_limit     */
+	  .max_connections_per_ip = 0,                /* 0 = off            */
+	  .ws_max_message_len = 1024 * 1024,          /* 1MB                */
+	  .ws_ping_interval = 30000,                  /* ms, 0 = off        */
+	  .sse_max_backlog = 256,                     /* events             */
+	  .sse_slow_policy = 0,                       /* SSE_SLOW_DROP      */
+	  .h2_max_streams = 100,                      /* per connection, 0 = no HTTP/2 */
+	  .shutdown_grace = 30000,                    /* ms                 */
+	  .workers = 0,                               /* processes, 0 = serve in this one */
+	  .worker_affinity = 1,                       /* pin each worker to a CPU */
+	  /* socket tuning, set on the listeners and inherited by the connections */
+	  .tcp_nodelay = 1,
+	  .tcp_cork = 1,                              /* the head waits for the body, one segment for both */
+	  .send_buffer = 0,                           /* bytes, 0 = the kernel's autotuning */
+	  .recv_buffer = 0,                           /* bytes, 0 = the kernel's autotuning */
+	  .busy_poll = 0,                             /* us, 0 = off      */
+	  .reuse_port = 0,                            /* for one server per thread on the same port */
+	  .incoming_cpu = -1,                         /* the CPU this loop runs on, -1 = no hint */
+	  .huge_pages = 0,                            /* HUGE_PAGES_OFF, for the buffer pools */
+	  .memory_limit = 0                           /* bytes accounted, past it new connections are shed, 0 = off */
 	};
+	/* a build profile's limits are the ones that hold */
+	constraints.request_max_body_len   = HTTP_REQUEST_MAX_BODY_LEN(&constraints);
+	constraints.request_max_uri_len    = HTTP_REQUEST_MAX_URI_LEN(&constraints);
+	constraints.request_max_headers    = HTTP_REQUEST_MAX_HEADERS(&constraints);
+	constraints.request_max_header_len = HTTP_REQUEST_MAX_HEADER_LEN(&constraints);
+	constraints.recv_len               = HTTP_RECV_LEN(&constraints);
+	constraints.send_len               = HTTP_SEND_LEN(&constraints);
+	constraints.tcp_cork               = HTTP_TCP_CORK(&constraints);
 	return constraints;
 }
+
+void http_framing_reset(http_framing* framing) {
+  framing->termination = BODYTERMI_NONE;
+  framing->chunk_state = CHUNK_SIZE;
+  framing->length      = 0;
+  framing->chunk       = 0;
+}
+
+/* grows a body buffer to hold 'len' bytes and a terminator, doubling so appends stay amortized. while it's
+   allocated it's accounted as 'cap' + 1 bytes of MEMORY_BODIES */
+int http_body_reserve(char** body, size_t* cap, size_t len, size_t max) {
+  if (*body && len <= *cap)
+    return HTTP_SUCCESS;
+  if (len > max)
+    return HTTP_FAILURE;
+  size_t grown   = *cap * 2;
+  size_t new_cap = MAX(len, grown);
+  new_cap = MIN(new_cap, max);
+  char* new_body = realloc(*body, new_cap + 1);
+  if (!new_body) {
+    HTTP_LOG(HTTP_LOGERR, "[http_body_reserve] realloc() failed.\n");
+    return HTTP_FAILURE;
+  }
+  http_memory_add(MEMORY_BODIES, new_cap + 1 - (*body ? *cap + 1 : 0));
+  *body = new_body;
+  *cap  = new_cap;
+  return HTTP_SUCCESS;
+}
+
+void http_body_release(char** body, size_t* cap) {
+  if (*body)
+    http_memory_sub(MEMORY_BODIES, *cap + 1);
+  free(*body);
+  *body = NULL;
+  *cap  = 0;
+}
+
+int http_socket_set_nonblocking(SOCKET sockfd) {
+#ifdef _WIN32
+  u_long mode = 1;
+  return ioctlsocket(sockfd, FIONBIO, &mode) ? HTTP_FAILURE : HTTP_SUCCESS;
+#else
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return HTTP_FAILURE;
+  return HTTP_SUCCESS;
+#endif
+}
+
+/* monotonic, for measuring intervals only */
+uint64_t http_clock_ns(void) {
+#ifdef _WIN32
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&now);
+  return (uint64_t)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
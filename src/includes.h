@@ -1,14 +1,21 @@
 #ifndef HTTP_INCLUDES_H_
 #define HTTP_INCLUDES_H_
 #define _WIN32_WINNT 0x501
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <assert.h> 
+#include <stdarg.h>
+#include <time.h>
 #include "http_headers.h"
+#include "http_profile.h"
 #define SELECT_SEC 5
 #define SELECT_USEC 0
 #define MIN(a, b) ((a < b) ? (a) : (b))
@@ -20,6 +27,7 @@
 enum {
   HTTP_VERSION_1,
   HTTP_VERSION_1_1,
+  HTTP_VERSION_2,
   HTTP_VERSION_NONE
 };
 
@@ -29,24 +37,42 @@ enum {
 #define CLOSE_SOCKET(s) closesocket(s)
 #define GET_ERROR() WSAGetLastError()
 #define SIN_ADDR sin_addr.S_un.S_addr 
+#define WOULD_BLOCK(e) ((e) == WSAEWOULDBLOCK)
+#define SEND_FLAGS 0
+#define SEND_MORE 0
+#define strcasecmp _stricmp
+#define strncasecmp _strnicmp
 #else
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <strings.h>
 #define SOCKET int
 #define CLOSE_SOCKET(s) close(s)
 #define GET_ERROR() errno
 #define SIN_ADDR sin_addr.s_addr
 #define SOCKET_ERROR -1
+#define INVALID_SOCKET -1
+#define WOULD_BLOCK(e) ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#define SEND_FLAGS MSG_NOSIGNAL
+#ifdef MSG_MORE
+#define SEND_MORE MSG_MORE
+#else
+#define SEND_MORE 0
+#endif
 #endif
 
 #if defined(_DEBUG) || defined(DEBUG)
 #define HTTP_DEBUG 
 #endif
 #ifdef HTTP_DEBUG
-static int HTTP_LOG(FILE*, const char*, ...);
+int HTTP_LOG(FILE*, const char*, ...);
 int print_addr(struct sockaddr_in*);
 #ifndef HTTP_LOGOUT 
 #define HTTP_LOGOUT stdout
@@ -65,12 +91,39 @@ typedef struct {
   size_t request_max_uri_len;
   size_t request_max_headers;
   size_t request_max_header_len;
+  size_t response_max_body_len;
   size_t recv_len;
   size_t send_len;
   const char* public_folder; 
+  int listen_backlog;
+  size_t max_connections;
+  int defer_accept;
+  int fastopen_queue;
+  size_t rate_limit;
+  size_t rate_burst;
+  size_t max_connections_per_ip;
+  size_t ws_max_message_len;
+  size_t ws_ping_interval;
+  size_t sse_max_backlog;
+  int sse_slow_policy;
+  size_t h2_max_streams;
+  size_t shutdown_grace;
+  size_t workers;
+  int worker_affinity;
+  int tcp_nodelay;
+  int tcp_cork;
+  int send_buffer;
+  int recv_buffer;
+  int busy_poll;
+  int reuse_port;
+  int incoming_cpu;
+  int huge_pages;
+  size_t memory_limit;
 } http_constraints;
 
 http_constraints http_constraints_make_default();
+int http_socket_set_nonblocking(SOCKET);
+uint64_t http_clock_ns(void);
 
 enum {
   STATE_GOT_NOTHING,
@@ -83,7 +136,33 @@ enum {
 enum {
   BODYTERMI_LENGTH,
   BODYTERMI_CHUNKED,
+  BODYTERMI_CLOSE,
   BODYTERMI_NONE
 };
 
+enum {
+  CHUNK_SIZE,
+  CHUNK_DATA,
+  CHUNK_DATA_END,
+  CHUNK_TRAILERS,
+  CHUNK_DONE
+};
+
+typedef struct {
+  int termination;
+  int chunk_state;
+  size_t length;
+  size_t chunk;
+} http_framing;
+
+void http_framing_reset(http_framing*);
+int http_body_reserve(char**, size_t*, size_t, size_t);
+void http_body_release(char**, size_t*);
+
+enum {
+  EXPECT_NONE,
+  EXPECT_CONTINUE,
+  EXPECT_UNKNOWN
+};
+
 #endif
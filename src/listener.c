@@ -0,0 +1,210 @@
+#include "listener.h"
+#ifndef _WIN32
+#include <sys/un.h>
+#include <sys/stat.h>
+#endif
+
+int listener_tcp(struct http_listener* listener, const char* ip, const char* port) {
+  if (!listener || !ip || !port) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_tcp] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (strcmp(ip, "0.0.0.0") == 0)
+    ip = 0;
+  struct addrinfo hints;
+  struct addrinfo* binder;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags    = AI_PASSIVE;
+  int res = getaddrinfo(ip, port, &hints, &binder);
+  if (res) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_tcp] getaddrinfo failed - %d.\n", res);
+    return HTTP_FAILURE;
+  }
+  memset(listener, 0, sizeof(*listener));
+  listener->sockfd   = INVALID_SOCKET;
+  listener->family   = AF_INET;
+  listener->addr_len = (socklen_t)binder->ai_addrlen;
+  memcpy(&listener->addr, binder->ai_addr, binder->ai_addrlen);
+  freeaddrinfo(binder);
+  return HTTP_SUCCESS;
+}
+
+#ifndef _WIN32
+int listener_unix(struct http_listener* listener, const char* path) {
+  if (!listener || !path) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_unix] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  struct sockaddr_un* addr = (struct sockaddr_un*)&listener->addr;
+  size_t len = strlen(path);
+  if (len == 0 || len >= sizeof(addr->sun_path)) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_unix] invalid arguments - the path is empty or too long.\n");
+    return HTTP_FAILURE;
+  }
+#ifndef __linux__
+  if (path[0] == '@') {
+    HTTP_LOG(HTTP_LOGERR, "[listener_unix] there's no abstract namespace on this system.\n");
+    return HTTP_FAILURE;
+  }
+#endif
+  memset(listener, 0, sizeof(*listener));
+  listener->sockfd = INVALID_SOCKET;
+  listener->family = AF_UNIX;
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, path, len);
+  /* an abstract name is the bytes after the leading NUL, exactly as many as the length says */
+  if (path[0] == '@') {
+    addr->sun_path[0]  = '\0';
+    listener->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+  }
+  else
+    listener->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+  return HTTP_SUCCESS;
+}
+
+/* a socket file nobody accepts on any more is left over from a process that's gone, it's replaced. one
+   that's still served makes bind() fail, as a TCP port in use does */
+static void listener_unlink_stale(struct http_listener* listener) {
+  struct sockaddr_un* addr = (struct sockaddr_un*)&listener->addr;
+  struct stat st;
+  if (addr->sun_path[0] == '\0' || lstat(addr->sun_path, &st) || !S_ISSOCK(st.st_mode))
+    return;
+  SOCKET probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe == INVALID_SOCKET)
+    return;
+  if (connect(probe, (struct sockaddr*)addr, listener->addr_len) && GET_ERROR() == ECONNREFUSED)
+    unlink(addr->sun_path);
+  CLOSE_SOCKET(probe);
+}
+#else
+int listener_unix(struct http_listener* listener, const char* path) {
+  HTTP_LOG(HTTP_LOGERR, "[listener_unix] Unix sockets aren't supported on this system.\n");
+  return HTTP_FAILURE;
+}
+
+static void listener_unlink_stale(struct http_listener* listener) {
+}
+#endif
+
+/* the socket tuning constraints. they're set here once and every accepted connection inherits them: the
+   buffer sizes have to be in place before the handshake anyway, the window scale is fixed by the SYN */
+static void listener_tune(struct http_listener* listener, http_constraints* constraints) {
+  SOCKET sockfd = listener->sockfd;
+  int tcp = listener->family == AF_INET;
+  if (constraints->send_buffer > 0)
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, (const char*)&constraints->send_buffer, sizeof(int));
+  if (constraints->recv_buffer > 0)
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (const char*)&constraints->recv_buffer, sizeof(int));
+  if (!tcp)
+    return;
+#ifdef __linux__
+  /* other systems don't pass it on, http_server_accept() sets it there */
+  if (constraints->tcp_nodelay)
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &constraints->tcp_nodelay, sizeof(int));
+#endif
+#ifdef SO_REUSEPORT
+  /* several servers, one per thread, on the same port: the kernel spreads the connections across them */
+  if (constraints->reuse_port)
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &constraints->reuse_port, sizeof(int));
+#endif
+#ifdef SO_BUSY_POLL
+  /* select() spins on the device queue for this long before sleeping, with net.core.busy_poll set. raising
+     it past net.core.busy_read takes CAP_NET_ADMIN */
+  if (constraints->busy_poll > 0 && setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &constraints->busy_poll, sizeof(int))) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_open] SO_BUSY_POLL was refused - %d.\n", GET_ERROR());
+  }
+#endif
+#ifdef SO_INCOMING_CPU
+  /* among listeners sharing the port, a connection goes to the one whose CPU took its packets in */
+  if (constraints->incoming_cpu >= 0)
+    setsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &constraints->incoming_cpu, sizeof(int));
+#endif
+}
+
+int listener_open(struct http_listener* listener, http_constraints* constraints) {
+  int tcp = listener->family == AF_INET;
+  listener->sockfd = socket(listener->family, SOCK_STREAM, tcp ? IPPROTO_TCP : 0);
+  if (listener->sockfd == INVALID_SOCKET) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_open] socket() failed - %d.\n", GET_ERROR());
+    return HTTP_FAILURE;
+  }
+  if (tcp) {
+    int on = 1;
+    setsockopt(listener->sockfd, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+  }
+  else
+    listener_unlink_stale(listener);
+  listener_tune(listener, constraints);
+  if (bind(listener->sockfd, (struct sockaddr*)&listener->addr, (int)listener->addr_len)) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_open] bind() failed - %d.\n", GET_ERROR());
+    goto fail;
+  }
+  listener->owned = 1;
+#ifdef TCP_DEFER_ACCEPT
+  /* the connection is only reported once the request has started to arrive */
+  if (tcp && constraints->defer_accept > 0)
+    setsockopt(listener->sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &constraints->defer_accept, sizeof(int));
+#endif
+#ifdef TCP_FASTOPEN
+  if (tcp && constraints->fastopen_queue > 0)
+    setsockopt(listener->sockfd, IPPROTO_TCP, TCP_FASTOPEN, &constraints->fastopen_queue, sizeof(int));
+#endif
+  if (listen(listener->sockfd, constraints->listen_backlog)) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_open] listen() failed - %d.\n", GET_ERROR());
+    goto fail;
+  }
+  if (http_socket_set_nonblocking(listener->sockfd) == HTTP_FAILURE) {
+    HTTP_LOG(HTTP_LOGERR, "[listener_open] couldn't make the socket non-blocking - %d.\n", GET_ERROR());
+    goto fail;
+  }
+  return HTTP_SUCCESS;
+ fail:
+  CLOSE_SOCKET(listener->sockfd);
+  listener->sockfd = INVALID_SOCKET;
+  return HTTP_FAILURE;
+}
+
+/* takes the socket among 'sockets' that is bound where this listener would be, it's INVALID_SOCKET there
+   afterwards. HTTP_FAILURE when none is */
+int listener_adopt(struct http_listener* listener, SOCKET* sockets, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    if (sockets[i] == INVALID_SOCKET || getsockname(sockets[i], (struct sockaddr*)&addr, &addr_len))
+      continue;
+    if (addr.ss_family != listener->family || addr_len != listener->addr_len)
+      continue;
+    int same;
+    if (listener->family == AF_INET) {
+      const struct sockaddr_in* a = (const struct sockaddr_in*)&addr;
+      const struct sockaddr_in* b = (const struct sockaddr_in*)&listener->addr;
+      same = a->sin_port == b->sin_port && a->SIN_ADDR == b->SIN_ADDR;
+    }
+    else
+      same = memcmp(&addr, &listener->addr, addr_len) == 0;
+    if (same) {
+      listener->sockfd = sockets[i];
+      listener->owned  = 1;
+      sockets[i] = INVALID_SOCKET;
+      return HTTP_SUCCESS;
+    }
+  }
+  return HTTP_FAILURE;
+}
+
+/* the socket file goes too unless 'keep_path', the listener was handed over and it's the next process' */
+void listener_close(struct http_listener* listener, int keep_path) {
+  if (listener->sockfd != INVALID_SOCKET)
+    CLOSE_SOCKET(listener->sockfd);
+  listener->sockfd = INVALID_SOCKET;
+#ifndef _WIN32
+  const struct sockaddr_un* addr = (const struct sockaddr_un*)&listener->addr;
+  if (!keep_path && listener->owned && listener->family == AF_UNIX && addr->sun_path[0] != '\0')
+    unlink(addr->sun_path);
+#endif
+  if (!keep_path)
+    listener->owned = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef LISTENER_H_
+#define LISTENER_H_
+#include "includes.h"
+
+/* a socket a server accepts from, TCP or Unix. a Unix path starting with '@' names a socket in Linux's
+   abstract namespace, nothing is created on disk for it. the address is kept so a socket handed over by
+   another process can be matched with it */
+struct http_listener {
+  SOCKET    sockfd;
+  int       family;
+  int       owned;                              /* the socket file was created here or handed over */
+  socklen_t addr_len;
+  struct sockaddr_storage addr;
+};
+
+int listener_tcp(struct http_listener*, const char*, const char*);
+int listener_unix(struct http_listener*, const char*);
+int listener_open(struct http_listener*, http_constraints*);
+int listener_adopt(struct http_listener*, SOCKET*, size_t);
+void listener_close(struct http_listener*, int);
+
+#endif
@@ -3,8 +3,17 @@
 #endif
 
 #include "http_server.h"
+#include <signal.h>
 
+static http_server* server;
 
+/* the first ^C drains what's in flight, the handler is reset so a second one ends the process */
+static void on_stop(int sig) {
+  signal(sig, SIG_DFL);
+  http_server_stop(server);
+}
+
+#ifdef HTTP_DEBUG
 static int dump_headers(http_headers* headers) {
   size_t iter = 0;
   http_hdv* values;
@@ -16,19 +25,30 @@ static int dump_headers(http_headers* headers) {
   }
   return 0;
 }
+#endif
 
 void handler(http_request* request, http_response* response) {
+#ifdef HTTP_DEBUG
+  dump_headers(request->headers);
+#endif
   http_response_set_status(response, HTTP_STATUS_200);
-  http_response_set_body(response, "Hello from Kudos.", 17);
+  http_response_set_body(response, (const unsigned char*)"Hello from Kudos.", 17);
 }
 
-int main() {
+/* argv[1], when given, is the Unix socket restarts hand the listening socket over through: a new process
+   started with the same path takes it from the running one, which then finishes its connections and exits */
+int main(int argc, char** argv) {
   if (http_init() != HTTP_SUCCESS) {
     return 1;
   }
   
-  http_server* server = http_server_new("0.0.0.0", "8080", handler, NULL);
+  server = http_server_new("0.0.0.0", "8080", handler, NULL);
   if (server) {
+    http_server_set_metrics(server, "/metrics");
+    if (argc > 1)
+      http_server_set_handoff(server, argv[1]);
+    signal(SIGINT, on_stop);
+    signal(SIGTERM, on_stop);
     http_server_listen(server); 
     http_server_free(server);
   }
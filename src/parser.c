@@ -2,44 +2,304 @@
 #include "conn_info.h"
 #include "http_request.h"
 
+/* returns a pointer to the next "\r\n" in [q, end) or NULL if the line is incomplete */
+static char* find_crlf(char* q, char* end) {
+  while (q < end) {
+    char* lf = memchr(q, '\n', end - q);
+    if (!lf)
+      return NULL;
+    if (lf > q && lf[-1] == '\r')
+      return lf - 1;
+    q = lf + 1;
+  }
+  return NULL;
+}
+
+static int parse_length(const char* s, size_t* out) {
+  size_t value = 0;
+  if (!isdigit((unsigned char)*s))
+    return HTTP_FAILURE;
+  for (; isdigit((unsigned char)*s); ++s) {
+    size_t digit = (size_t)(*s - '0');
+    if (value > (SIZE_MAX - digit) / 10)
+      return HTTP_FAILURE;
+    value = value * 10 + digit;
+  }
+  while (*s == ' ' || *s == '\t') ++s;
+  if (*s)
+    return HTTP_FAILURE;
+  *out = value;
+  return HTTP_SUCCESS;
+}
+
+static int parse_chunk_size(const char* s, size_t* out) {
+  size_t value = 0;
+  int digits = 0;
+  for (;; ++s, ++digits) {
+    char c = *s;
+    size_t digit;
+    if (c >= '0' && c <= '9') digit = c - '0';
+    else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+    else break;
+    if (value > (SIZE_MAX >> 4))
+      return HTTP_FAILURE;
+    value = value << 4 | digit;
+  }
+  if (digits == 0)
+    return HTTP_FAILURE;
+  while (*s == ' ' || *s == '\t') ++s;
+  /* chunk extensions are accepted and ignored */
+  if (*s && *s != ';')
+    return HTTP_FAILURE;
+  *out = value;
+  return HTTP_SUCCESS;
+}
+
+/* case-insensitive comparison of a header token, ignoring surrounding whitespace */
+static int token_equals(const char* v, const char* token) {
+  while (*v == ' ' || *v == '\t') ++v;
+  size_t len = strlen(v);
+  while (len > 0 && (v[len - 1] == ' ' || v[len - 1] == '\t')) --len;
+  if (len != strlen(token))
+    return 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (tolower((unsigned char)v[i]) != token[i])
+      return 0;
+  }
+  return 1;
+}
+
+static int has_chunked_coding(const char* value) {
+  /* "chunked" has to be the final transfer coding of a request */
+  const char* last = strrchr(value, ',');
+  return token_equals(last ? last + 1 : value, "chunked");
+}
+
+static int parse_expect(http_request* req) {
+  http_hdv* expect = http_headers_get(req->headers, "Expect");
+  /* HTTP/1.0 clients don't know about interim responses, their expectations are ignored */
+  if (!expect || (HTTP_PROFILE_HTTP10 && req->version == HTTP_VERSION_1)) {
+    req->expect = EXPECT_NONE;
+    return HTTP_SUCCESS;
+  }
+  req->expect = EXPECT_CONTINUE;
+  for (; expect; expect = expect->next) {
+    if (!token_equals(expect->v, "100-continue"))
+      req->expect = EXPECT_UNKNOWN;
+  }
+  return HTTP_SUCCESS;
+}
+
+/* reads the framing headers shared by requests and responses, expecting neither to be a failure */
+static int parse_framing_headers(http_framing* framing, http_headers* headers, size_t max, int allow_oversize) {
+  http_hdv* tren   = http_headers_get(headers, "Transfer-Encoding");
+  http_hdv* length = http_headers_get(headers, "Content-Length");
+  framing->chunk_state = CHUNK_SIZE;
+  framing->chunk       = 0;
+  framing->length      = 0;
+  if (tren) {
+    if (length)
+      return HTTP_FAILURE;
+    if (tren->next || !has_chunked_coding(tren->v))
+      return HTTP_FAILURE;
+    framing->termination = BODYTERMI_CHUNKED;
+    return HTTP_SUCCESS;
+  }
+  if (length) {
+    size_t len;
+    if (parse_length(length->v, &len) == HTTP_FAILURE)
+      return HTTP_FAILURE;
+    for (http_hdv* other = length->next; other; other = other->next) {
+      size_t other_len;
+      if (parse_length(other->v, &other_len) == HTTP_FAILURE || other_len != len)
+        return HTTP_FAILURE;
+    }
+    if (len > max && !allow_oversize)
+      return HTTP_FAILURE;
+    framing->termination = BODYTERMI_LENGTH;
+    framing->length      = len;
+    framing->chunk_state = len == 0 ? CHUNK_DONE : CHUNK_DATA;
+    return HTTP_SUCCESS;
+  }
+  framing->termination = BODYTERMI_NONE;
+  framing->chunk_state = CHUNK_DONE;
+  return HTTP_SUCCESS;
+}
+
+static int parse_framing(http_request* req, http_constraints* constraints) {
+  parse_expect(req);
+  /* an oversized body the client is waiting to send gets a 413 from the server instead */
+  if (parse_framing_headers(&req->framing, req->headers, HTTP_REQUEST_MAX_BODY_LEN(constraints),
+                            req->expect == EXPECT_CONTINUE) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  if (!HTTP_PROFILE_CHUNKED_REQUESTS && req->framing.termination == BODYTERMI_CHUNKED)
+    return HTTP_FAILURE;
+  /* there's nothing to continue without a body, an expectation the server doesn't know still gets its 417 */
+  if (req->framing.chunk_state == CHUNK_DONE && req->expect == EXPECT_CONTINUE)
+    req->expect = EXPECT_NONE;
+  return HTTP_SUCCESS;
+}
+
+/* a start line or a chunk size line holds no control characters at all, a bare CR or LF in it would
+   split it differently for whoever reads it next */
+static int clean_line(const char* q, const char* eol) {
+  for (; q < eol; ++q) {
+    if ((unsigned char)*q < 0x20 || *q == 0x7f)
+      return 0;
+  }
+  return 1;
+}
+
+/* [begin, eol) is one field line. the name has to be a token right up to the colon and the value free of
+   control characters, or the line would mean something else to a peer reading it more loosely */
+static int parse_header_line(http_headers* headers, char* begin, char* eol, http_constraints* constraints) {
+  if (headers->len == HTTP_REQUEST_MAX_HEADERS(constraints))
+    return HTTP_FAILURE;
+  char* q = memchr(begin, ':', eol - begin);
+  if (!q)
+    return HTTP_FAILURE;
+  size_t name_len = (size_t)(q - begin);
+  if (!http_headers_valid_name(begin, name_len))
+    return HTTP_FAILURE;
+  *q++ = 0;
+  *eol = 0;
+  while (*q == ' ' || *q == '\t') ++q;
+  if (!http_headers_valid_value(q, (size_t)(eol - q)))
+    return HTTP_FAILURE;
+  if (name_len + (size_t)(eol - q) > HTTP_REQUEST_MAX_HEADER_LEN(constraints))
+    return HTTP_FAILURE;
+  return http_headers_set(headers, begin, q);
+}
+
+/* consumes as much of a Content-Length, chunked or close-delimited body as [*pq, end) holds,
+   the caller may empty the body between calls to stream it */
+static int parse_body(http_framing* framing, char** pq, char* end, char** body, size_t* body_len,
+                      size_t* body_cap, size_t max, http_headers* trailers, http_constraints* constraints) {
+  char* q = *pq;
+  char* eol;
+  size_t len;
+  while (q < end && framing->chunk_state != CHUNK_DONE) {
+    if (framing->termination == BODYTERMI_LENGTH) {
+      /* 'length' counts down what's left of the body */
+      len = MIN((size_t)(end - q), framing->length);
+      if (http_body_reserve(body, body_cap, *body_len + len, max) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      memcpy(*body + *body_len, q, len);
+      *body_len       += len;
+      framing->length -= len;
+      q += len;
+      if (framing->length == 0)
+        framing->chunk_state = CHUNK_DONE;
+    }
+
+    else if (framing->termination == BODYTERMI_CLOSE) {
+      len = (size_t)(end - q);
+      if (http_body_reserve(body, body_cap, *body_len + len, max) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      memcpy(*body + *body_len, q, len);
+      *body_len += len;
+      q += len;
+    }
+
+    else if (framing->chunk_state == CHUNK_SIZE) {
+      if (!(eol = find_crlf(q, end)))
+        break;
+      if (!clean_line(q, eol))
+        return HTTP_FAILURE;
+      *eol = 0;
+      if (parse_chunk_size(q, &framing->chunk) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      if (framing->chunk > max - *body_len)
+        return HTTP_FAILURE;
+      q = eol + 2;
+      framing->chunk_state = framing->chunk == 0 ? CHUNK_TRAILERS : CHUNK_DATA;
+    }
+
+    else if (framing->chunk_state == CHUNK_DATA) {
+      len = MIN((size_t)(end - q), framing->chunk);
+      if (http_body_reserve(body, body_cap, *body_len + len, max) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      memcpy(*body + *body_len, q, len);
+      *body_len      += len;
+      framing->chunk -= len;
+      q += len;
+      if (framing->chunk == 0)
+        framing->chunk_state = CHUNK_DATA_END;
+    }
+
+    else if (framing->chunk_state == CHUNK_DATA_END) {
+      if (end - q < 2)
+        break;
+      if (memcmp(q, "\r\n", 2) != 0)
+        return HTTP_FAILURE;
+      q += 2;
+      framing->chunk_state = CHUNK_SIZE;
+    }
+
+    else {
+      if (!(eol = find_crlf(q, end)))
+        break;
+      if (eol == q)
+        framing->chunk_state = CHUNK_DONE;
+      else {
+        if (parse_header_line(trailers, q, eol, constraints) == HTTP_FAILURE)
+          return HTTP_FAILURE;
+      }
+      q = eol + 2;
+    }
+  }
+  *pq = q;
+  return HTTP_SUCCESS;
+}
+
 int parse_request(http_request* req, char* buffer, size_t *buff_len, http_constraints* constraints) {
   size_t len = 0;
   char* q = buffer;
   char* begin = q;
   char* end = q + *buff_len;
+  char* eol = NULL;
   *end = 0;
-  
-  while (q < end && strstr(q, "\r\n")) {
+
+  while (q < end && req->state != STATE_GOT_ALL) {
+    /* the body is left in the buffer until the server answered the expectation */
+    if (req->state == STATE_GOT_HEADERS && req->expect != EXPECT_NONE)
+      break;
     if (req->state == STATE_GOT_NOTHING) {
+      if (!(eol = find_crlf(q, end)))
+        break;
+      if (!clean_line(q, eol))
+        return HTTP_FAILURE;
+      *eol = 0;
       begin = q;
       q = strchr(q, ' ');
       if (!q)
         return HTTP_FAILURE;
       *q = 0;
-      if (strcmp(begin, "GET") == 0)
+      if (HTTP_METHOD_ENABLED(METHOD_GET) && strcmp(begin, "GET") == 0)
         req->method = METHOD_GET;
-      else if (strcmp(begin, "HEAD") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_HEAD) && strcmp(begin, "HEAD") == 0)
         req->method = METHOD_HEAD;
-      else if (strcmp(begin, "POST") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_POST) && strcmp(begin, "POST") == 0)
         req->method = METHOD_POST;
-      else if (strcmp(begin, "PUT") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_PUT) && strcmp(begin, "PUT") == 0)
         req->method = METHOD_PUT;
-      else if (strcmp(begin, "DELETE") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_DELETE) && strcmp(begin, "DELETE") == 0)
         req->method = METHOD_DELETE;
-      else if (strcmp(begin, "CONNECT") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_CONNECT) && strcmp(begin, "CONNECT") == 0)
         req->method = METHOD_CONNECT;
-      else if (strcmp(begin, "OPTIONS") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_OPTIONS) && strcmp(begin, "OPTIONS") == 0)
         req->method = METHOD_OPTIONS;
-      else if (strcmp(begin, "TRACE") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_TRACE) && strcmp(begin, "TRACE") == 0)
         req->method = METHOD_TRACE;
-      else if (strcmp(begin, "PATCH") == 0)
+      else if (HTTP_METHOD_ENABLED(METHOD_PATCH) && strcmp(begin, "PATCH") == 0)
         req->method = METHOD_PATCH;
       else
-        return HTTP_FAILURE; 
+        return HTTP_FAILURE;
 
       ++q;
       begin = q;
-      if (q >= end)
+      if (q >= eol)
         return HTTP_FAILURE;
       if (*begin != '/')
         return HTTP_FAILURE;
@@ -47,122 +307,145 @@ int parse_request(http_request* req, char* buffer, size_t *buff_len, http_constr
       if (!q)
         return HTTP_FAILURE;
       *q = 0;
-      if ((len = strlen(begin)) > constraints->request_max_uri_len)
+      if ((len = strlen(begin)) > HTTP_REQUEST_MAX_URI_LEN(constraints))
         return HTTP_FAILURE;
-      if (strstr(begin, ".."))
+      if (http_request_set_target(req, begin, len) == HTTP_FAILURE)
         return HTTP_FAILURE;
-      memcpy(req->uri, begin, len);
-      req->uri[len] = 0;
-      req->uri_len  = len;
-      
-      ++q;
-      begin = q;
-      if (q >= end)
-        return HTTP_FAILURE;
-      q = strstr(q, "\r\n");
-      if (!q)
-        return HTTP_FAILURE;
-      *q = 0;
-      if (strcmp(begin, "HTTP/1.0") == 0) {
+
+      begin = q + 1;
+      if (HTTP_PROFILE_HTTP10 && strcmp(begin, "HTTP/1.0") == 0) {
         int method = req->method;
         if (method != METHOD_GET && method != METHOD_HEAD && method != METHOD_POST)
-          return HTTP_FAILURE; 
+          return HTTP_FAILURE;
         req->version = HTTP_VERSION_1;
       }
       else if (strcmp(begin, "HTTP/1.1") == 0)
         req->version = HTTP_VERSION_1_1;
       else
         return HTTP_FAILURE;
-      q += 2;
+      q = eol + 2;
 
       req->state = STATE_GOT_LINE;
     }
 
     else if (req->state == STATE_GOT_LINE) {
-      if (q < end && memcmp(q, "\r\n", 2) == 0) {
-        req->state = STATE_GOT_HEADERS;
+      if (!(eol = find_crlf(q, end)))
+        break;
+      if (eol == q) {
+        q += 2;
+        if (parse_framing(req, constraints) == HTTP_FAILURE)
+          return HTTP_FAILURE;
+        /* an expectation is answered before the request counts as complete, with or without a body */
+        int pending = req->framing.chunk_state != CHUNK_DONE || req->expect != EXPECT_NONE;
+        req->state  = pending ? STATE_GOT_HEADERS : STATE_GOT_ALL;
       }
       else {
-        if (req->headers->len == constraints->request_max_headers)
-          return HTTP_FAILURE;
-
-        len = 0;
-        begin = q;
-        q = strchr(q, ':');
-        if (!q)
-          return HTTP_FAILURE;
-        *q++ = 0;
-        len += strlen(begin);
-        if (q >= end)
-          return HTTP_FAILURE;
-
-        while (isspace(*q) && q < end) ++q;
-        if (q >= end)
+        if (parse_header_line(req->headers, q, eol, constraints) == HTTP_FAILURE)
           return HTTP_FAILURE;
-        char* p = strstr(q, "\r\n");
-        if (!p)
-          return HTTP_FAILURE;
-        *p = 0;
-        if (strchr(begin, '\n') || strchr(begin, '\r'))
-          return HTTP_FAILURE;
-        len += strlen(begin);
-        if (len > constraints->request_max_header_len)
-          return HTTP_FAILURE;
-        http_request_add_header(req, begin, q);
-        q = p + 2;
+        q = eol + 2;
       }
     }
-    
+
     else if (req->state == STATE_GOT_HEADERS) {
-      int method = req->method;
-      if (method != METHOD_POST && method != METHOD_PUT && method != METHOD_PATCH) {
+      if (parse_body(&req->framing, &q, end, &req->body, &req->body_len, &req->body_cap,
+                     HTTP_REQUEST_MAX_BODY_LEN(constraints), req->headers, constraints) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      if (req->framing.chunk_state == CHUNK_DONE)
         req->state = STATE_GOT_ALL;
-        return HTTP_SUCCESS; 
-      }
+      else
+        break;
+    }
+  }
+
+  if (req->state == STATE_GOT_ALL)
+    req->body[req->body_len] = 0;
+  *buff_len = (size_t)(end - q);
+  if (*buff_len > 0)
+    memmove(buffer, q, *buff_len);
+  return HTTP_SUCCESS;
+}
 
-      if (req->body_termination == BODYTERMI_LENGTH) {
-        size_t length = req->length;
-        if (req->length >= constraints->request_max_body_len)
+int parse_response(http_response* res, int method, char* buffer, size_t *buff_len, http_constraints* constraints) {
+  char* q = buffer;
+  char* end = q + *buff_len;
+  char* eol = NULL;
+  *end = 0;
+
+  while (q < end && res->state != STATE_GOT_ALL) {
+    if (res->state == STATE_GOT_NOTHING) {
+      if (!(eol = find_crlf(q, end)))
+        break;
+      if (!clean_line(q, eol))
+        return HTTP_FAILURE;
+      *eol = 0;
+      if (strncmp(q, "HTTP/1.1 ", 9) == 0)
+        res->version = HTTP_VERSION_1_1;
+      else if (strncmp(q, "HTTP/1.0 ", 9) == 0)
+        res->version = HTTP_VERSION_1;
+      else
+        return HTTP_FAILURE;
+      q += 9;
+      if (!isdigit((unsigned char)q[0]) || !isdigit((unsigned char)q[1]) ||
+          !isdigit((unsigned char)q[2]) || (q[3] != ' ' && q[3] != 0))
+        return HTTP_FAILURE;
+      res->status = http_response_status_from_code((q[0] - '0') * 100 + (q[1] - '0') * 10 + (q[2] - '0'));
+      if (res->status == HTTP_STATUS_NONE)
+        return HTTP_FAILURE;
+      q = eol + 2;
+      res->state = STATE_GOT_LINE;
+    }
+
+    else if (res->state == STATE_GOT_LINE) {
+      if (!(eol = find_crlf(q, end)))
+        break;
+      if (eol != q) {
+        if (parse_header_line(res->headers, q, eol, constraints) == HTTP_FAILURE)
           return HTTP_FAILURE;
-        while (q < end && req->body_len < length) 
-          req->body[req->body_len++] = *q++;
-        if (req->body_len == length)
-          req->state = STATE_GOT_ALL;
+        q = eol + 2;
+        continue;
       }
-      
-      if (req->body_termination == BODYTERMI_CHUNKED) {
-        if (req->chunk == 0) {
-          char hex[8] = { 0 };
-          char c = *q;
-          int i  = 0;
-          while (i < 7 && q < end && c >= '0' && c <= '9' || c >= 'a' && c <= 'f' || c >= 'A' && c <= 'F') {
-            hex[i++] = c;
-            c = *++q;
-          }
-          req->chunk = strtoul(hex, NULL, 16);
-          if (q >= end || memcmp(q, "\r\n", 2) != 0)
-            return HTTP_FAILURE;
-          q += 2;
-          if (req->chunk == 0) {
-            req->state = STATE_GOT_ALL;
-            return HTTP_SUCCESS;
-          }
-        }
-        size_t chunk = req->chunk;
-        while (q < end && chunk-- > 0)
-          req->body[req->body_len++] = *q++;
-        if (chunk == 0) {
-          if (q >= end || memcmp(q, "\r\n", 2) != 0)
-            return HTTP_FAILURE;
-          q += 2;
+      q += 2;
+      int code = http_response_status_code(res->status);
+      if (code < 200) {
+        /* interim responses like '100 Continue' precede the real one */
+        http_headers_reset(res->headers);
+        res->state = STATE_GOT_NOTHING;
+        continue;
+      }
+      if (method == METHOD_HEAD || code == 204 || code == 304) {
+        res->framing.termination = BODYTERMI_NONE;
+        res->framing.chunk_state = CHUNK_DONE;
+      }
+      else {
+        if (parse_framing_headers(&res->framing, res->headers, constraints->response_max_body_len, 0) == HTTP_FAILURE)
+          return HTTP_FAILURE;
+        /* without framing headers the body runs until the server closes the connection */
+        if (res->framing.termination == BODYTERMI_NONE) {
+          res->framing.termination = BODYTERMI_CLOSE;
+          res->framing.chunk_state = CHUNK_DATA;
         }
-        req->chunk = chunk;
       }
+      res->state = res->framing.chunk_state == CHUNK_DONE ? STATE_GOT_ALL : STATE_GOT_HEADERS;
     }
+
+    else {
+      if (parse_body(&res->framing, &q, end, &res->body_buffer, &res->body_len, &res->body_cap,
+                     constraints->response_max_body_len, res->headers, constraints) == HTTP_FAILURE)
+        return HTTP_FAILURE;
+      if (res->framing.chunk_state == CHUNK_DONE)
+        res->state = STATE_GOT_ALL;
+      else
+        break;
+    }
+  }
+
+  if (res->state == STATE_GOT_ALL) {
+    if (res->body_buffer)
+      res->body_buffer[res->body_len] = 0;
+    res->body_string = (const unsigned char*)res->body_buffer;
   }
-  
-  *buff_len = MAX(0, *buff_len - (q - buffer));
+  *buff_len = (size_t)(end - q);
   if (*buff_len > 0)
-    memcpy(buffer, q, *buff_len);
+    memmove(buffer, q, *buff_len);
   return HTTP_SUCCESS;
 }
@@ -5,4 +5,5 @@
 #include "includes.h"
 
 int parse_request(http_request*, char*, size_t*, http_constraints*);
+int parse_response(http_response*, int, char*, size_t*, http_constraints*);
 #endif
@@ -0,0 +1,256 @@
+#include "prefork.h"
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <sys/prctl.h>
+#endif
+
+static void prefork_child(int sig) {
+}
+
+#ifdef __linux__
+/* the NUMA node sysfs lists under the CPU, 0 on machines without any */
+static int prefork_node(int cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR* dir = opendir(path);
+  if (!dir)
+    return 0;
+  int node = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    if (strncmp(entry->d_name, "node", 4) == 0 && isdigit((unsigned char)entry->d_name[4])) {
+      node = atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+/* the CPUs this process may run on, dealt round-robin across NUMA nodes: with fewer workers than CPUs
+   every node still gets its share of them, and of its memory bandwidth */
+static size_t prefork_cpus(int* cpus) {
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set))
+    return 0;
+  int nodes[CPU_SETSIZE], ranks[CPU_SETSIZE];
+  size_t len = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &set))
+      continue;
+    int node = prefork_node(cpu), rank = 0;
+    for (size_t i = 0; i < len; ++i)
+      rank += nodes[i] == node;
+    cpus[len]  = cpu;
+    nodes[len] = node;
+    ranks[len] = rank;
+    ++len;
+  }
+  /* by rank within the node first, so the first CPU of each node comes before any node's second */
+  for (size_t i = 1; i < len; ++i) {
+    int cpu = cpus[i], node = nodes[i], rank = ranks[i];
+    size_t j = i;
+    for (; j > 0 && (ranks[j - 1] > rank || (ranks[j - 1] == rank && nodes[j - 1] > node)); --j) {
+      cpus[j]  = cpus[j - 1];
+      nodes[j] = nodes[j - 1];
+      ranks[j] = ranks[j - 1];
+    }
+    cpus[j]  = cpu;
+    nodes[j] = node;
+    ranks[j] = rank;
+  }
+  return len;
+}
+#endif
+
+/* 'pin' binds worker i to the i-th CPU of prefork_cpus(). the workers aren't started until prefork_spawn() */
+int prefork_init(struct prefork* prefork, size_t len, int pin, prefork_run run, void* ctx) {
+  if (!prefork || !run || len == 0) {
+    HTTP_LOG(HTTP_LOGERR, "[prefork_init] invalid arguments.\n");
+    return HTTP_FAILURE;
+  }
+  prefork->workers = calloc(len, sizeof(struct prefork_worker));
+  if (!prefork->workers) {
+    HTTP_LOG(HTTP_LOGERR, "[prefork_init] failed to allocate memory.\n");
+    return HTTP_FAILURE;
+  }
+  prefork->len      = len;
+  prefork->restarts = 0;
+  prefork->run      = run;
+  prefork->ctx      = ctx;
+  size_t cpus_len = 0;
+#ifdef __linux__
+  int cpus[CPU_SETSIZE];
+  if (pin)
+    cpus_len = prefork_cpus(cpus);
+#endif
+  for (size_t i = 0; i < len; ++i) {
+    prefork->workers[i].cpu     = -1;
+    prefork->workers[i].respawn = 1;
+#ifdef __linux__
+    if (cpus_len)
+      prefork->workers[i].cpu = cpus[i % cpus_len];
+#endif
+  }
+  /* without a handler SIGCHLD is discarded and a worker's death waits for the supervisor's next timeout */
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = prefork_child;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGCHLD, &action, NULL);
+  return HTTP_SUCCESS;
+}
+
+void prefork_free(struct prefork* prefork) {
+  signal(SIGCHLD, SIG_DFL);
+  free(prefork->workers);
+  prefork->workers = NULL;
+  prefork->len     = 0;
+}
+
+static void prefork_fork(struct prefork* prefork, struct prefork_worker* worker, uint64_t now) {
+#ifdef __linux__
+  pid_t parent = getpid();
+#endif
+  /* whatever stdio holds would be written again by the child */
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid < 0) {
+    HTTP_LOG(HTTP_LOGERR, "[prefork_spawn] fork() failed - %d.\n", GET_ERROR());
+    worker->respawn = now + (uint64_t)PREFORK_MIN_UPTIME * 1000000;
+    return;
+  }
+  if (pid > 0) {
+    worker->pid     = pid;
+    worker->started = now;
+    worker->respawn = 0;
+    return;
+  }
+  signal(SIGCHLD, SIG_DFL);
+#ifdef __linux__
+  /* a supervisor killed outright takes its workers along */
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  if (getppid() != parent)
+    _exit(1);
+  /* before the worker touches anything: the pages it copies on write and the buffers it grows are then
+     allocated on its own node */
+  if (worker->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+      HTTP_LOG(HTTP_LOGERR, "[prefork_spawn] couldn't pin the worker to CPU %d - %d.\n", worker->cpu, GET_ERROR());
+    }
+  }
+#endif
+  int ret = prefork->run(prefork->ctx);
+  fflush(NULL);
+  _exit(ret == HTTP_SUCCESS ? 0 : 1);
+}
+
+/* starts every worker that's due, the first time or again after it died */
+void prefork_spawn(struct prefork* prefork, uint64_t now) {
+  for (size_t i = 0; i < prefork->len; ++i) {
+    struct prefork_worker* worker = &prefork->workers[i];
+    if (worker->pid == 0 && worker->respawn && worker->respawn <= now)
+      prefork_fork(prefork, worker, now);
+  }
+}
+
+/* collects the workers that died. one that didn't live PREFORK_MIN_UPTIME is restarted only after as
+   long again, a handler crashing on every request doesn't turn into a fork loop */
+void prefork_reap(struct prefork* prefork, uint64_t now) {
+  for (size_t i = 0; i < prefork->len; ++i) {
+    struct prefork_worker* worker = &prefork->workers[i];
+    int status;
+    if (worker->pid == 0 || waitpid((pid_t)worker->pid, &status, WNOHANG) <= 0)
+      continue;
+    if (WIFSIGNALED(status)) {
+      HTTP_LOG(HTTP_LOGERR, "[prefork_reap] worker %ld was killed by signal %d.\n", worker->pid, WTERMSIG(status));
+    }
+    else {
+      HTTP_LOG(HTTP_LOGERR, "[prefork_reap] worker %ld exited with %d.\n", worker->pid, WEXITSTATUS(status));
+    }
+    uint64_t min_uptime = (uint64_t)PREFORK_MIN_UPTIME * 1000000;
+    worker->pid     = 0;
+    worker->respawn = now - worker->started < min_uptime ? now + min_uptime : now;
+    ++prefork->restarts;
+  }
+}
+
+/* ns until a worker is due to be started again, UINT64_MAX when none is */
+uint64_t prefork_next(struct prefork* prefork, uint64_t now) {
+  uint64_t next = UINT64_MAX;
+  for (size_t i = 0; i < prefork->len; ++i) {
+    struct prefork_worker* worker = &prefork->workers[i];
+    if (worker->pid == 0 && worker->respawn) {
+      uint64_t due = worker->respawn > now ? worker->respawn - now : 0;
+      next = MIN(next, due);
+    }
+  }
+  return next;
+}
+
+/* asks every worker to stop as http_server_stop() does and waits for them. 'grace' is theirs, in ns, those
+   still running PREFORK_KILL_DELAY after it are killed */
+void prefork_stop(struct prefork* prefork, uint64_t grace) {
+  for (size_t i = 0; i < prefork->len; ++i) {
+    struct prefork_worker* worker = &prefork->workers[i];
+    worker->respawn = 0;
+    if (worker->pid)
+      kill((pid_t)worker->pid, SIGTERM);
+  }
+  uint64_t deadline = http_clock_ns() + grace + (uint64_t)PREFORK_KILL_DELAY * 1000000;
+  int killed = 0;
+  while (1) {
+    size_t running = 0;
+    for (size_t i = 0; i < prefork->len; ++i) {
+      struct prefork_worker* worker = &prefork->workers[i];
+      if (worker->pid && waitpid((pid_t)worker->pid, NULL, killed ? 0 : WNOHANG) != 0)
+        worker->pid = 0;
+      running += worker->pid != 0;
+    }
+    if (running == 0)
+      break;
+    if (!killed && http_clock_ns() >= deadline) {
+      HTTP_LOG(HTTP_LOGERR, "[prefork_stop] killing %zu workers that outlived the grace period.\n", running);
+      for (size_t i = 0; i < prefork->len; ++i) {
+        if (prefork->workers[i].pid)
+          kill((pid_t)prefork->workers[i].pid, SIGKILL);
+      }
+      killed = 1;
+      continue;
+    }
+    struct timespec ts = { 0, 10 * 1000 * 1000 };
+    nanosleep(&ts, NULL);
+  }
+}
+
+#else
+
+int prefork_init(struct prefork* prefork, size_t len, int pin, prefork_run run, void* ctx) {
+  HTTP_LOG(HTTP_LOGERR, "[prefork_init] there's no fork() on this system.\n");
+  return HTTP_FAILURE;
+}
+
+void prefork_free(struct prefork* prefork) {
+}
+
+void prefork_spawn(struct prefork* prefork, uint64_t now) {
+}
+
+void prefork_reap(struct prefork* prefork, uint64_t now) {
+}
+
+uint64_t prefork_next(struct prefork* prefork, uint64_t now) {
+  return UINT64_MAX;
+}
+
+void prefork_stop(struct prefork* prefork, uint64_t grace) {
+}
+
+#endif
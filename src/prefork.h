@@ -0,0 +1,33 @@
+#ifndef PREFORK_H_
+#define PREFORK_H_
+#include "includes.h"
+#define PREFORK_MIN_UPTIME 1000                 /* ms, a worker dying sooner is restarted only after as long */
+#define PREFORK_KILL_DELAY 1000                 /* ms past the shutdown grace before workers are killed */
+
+typedef int (*prefork_run)(void*);
+
+struct prefork_worker {
+  long     pid;                                 /* 0 while not running */
+  int      cpu;                                 /* -1 = not pinned */
+  uint64_t started;
+  uint64_t respawn;                             /* when it's due to be started again, 0 = not due */
+};
+
+/* the worker processes of a supervisor. each one runs 'run' and exits with its result, one that dies is
+   started again on the same CPU. POSIX only, prefork_init() fails elsewhere */
+struct prefork {
+  struct prefork_worker* workers;
+  size_t   len;
+  size_t   restarts;
+  prefork_run run;
+  void*    ctx;
+};
+
+int prefork_init(struct prefork*, size_t, int, prefork_run, void*);
+void prefork_free(struct prefork*);
+void prefork_spawn(struct prefork*, uint64_t);
+void prefork_reap(struct prefork*, uint64_t);
+uint64_t prefork_next(struct prefork*, uint64_t);
+void prefork_stop(struct prefork*, uint64_t);
+
+#endif
@@ -0,0 +1,15 @@
+/* a JSON API behind a load balancer: HTTP/1.1 clients only, bodies sent with a length, nothing but the
+   usual methods. make PROFILE=src/profiles/api.h */
+#define HTTP_PROFILE_CHUNKED_REQUESTS 0
+#define HTTP_PROFILE_HTTP10 0
+#define HTTP_PROFILE_METHODS (HTTP_METHOD_BIT(METHOD_GET) | HTTP_METHOD_BIT(METHOD_HEAD) | \
+                              HTTP_METHOD_BIT(METHOD_POST) | HTTP_METHOD_BIT(METHOD_PUT) | \
+                              HTTP_METHOD_BIT(METHOD_DELETE) | HTTP_METHOD_BIT(METHOD_PATCH))
+
+#define HTTP_PROFILE_REQUEST_MAX_BODY_LEN (1024 * 1024 * 2)
+#define HTTP_PROFILE_REQUEST_MAX_URI_LEN 1024
+#define HTTP_PROFILE_REQUEST_MAX_HEADERS 24
+#define HTTP_PROFILE_REQUEST_MAX_HEADER_LEN (1024 * 8)
+#define HTTP_PROFILE_RECV_LEN (1024 * 256)
+#define HTTP_PROFILE_SEND_LEN (1024 * 256)
+#define HTTP_PROFILE_TCP_CORK 1
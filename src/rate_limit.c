@@ -0,0 +1,83 @@
+#include "rate_limit.h"
+
+/* 'rate' requests a second with bursts of up to 'burst', 'max_conns' connections at once, per address.
+   0 turns either off, the table is only allocated when one is on */
+struct rate_limit rate_limit_make(uint32_t rate, uint32_t burst, uint32_t max_conns) {
+  struct rate_limit limit = { 0 };
+  limit.interval  = rate ? 1000000000ull / rate : 0;
+  limit.burst     = (uint64_t)(burst ? burst - 1 : 0) * limit.interval;
+  limit.max_conns = max_conns;
+  if (!rate && !max_conns)
+    return limit;
+  limit.slots = (struct rate_slot*)calloc(RATE_LIMIT_SLOTS, sizeof(struct rate_slot));
+  if (!limit.slots) {
+    HTTP_LOG(HTTP_LOGERR, "[rate_limit_make] failed to allocate memory - clients won't be limited.\n");
+    return limit;
+  }
+  limit.mask = RATE_LIMIT_SLOTS - 1;
+  return limit;
+}
+
+int rate_limit_free(struct rate_limit* limit) {
+  if (!limit) {
+    HTTP_LOG(HTTP_LOGERR, "[rate_limit_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  free(limit->slots);
+  limit->slots = NULL;
+  return HTTP_SUCCESS;
+}
+
+/* the address' slot within a short probe, or the first free or idle one to take over when 'now' is set */
+static struct rate_slot* rate_limit_slot(struct rate_limit* limit, ipv4_t addr, uint64_t now) {
+  size_t i = (size_t)((addr * 0x9e3779b1u) >> 20) & limit->mask;
+  struct rate_slot* spare = NULL;
+  for (size_t n = 0; n < RATE_LIMIT_PROBE; ++n, i = (i + 1) & limit->mask) {
+    struct rate_slot* slot = &limit->slots[i];
+    if (slot->addr == addr)
+      return slot;
+    if (!spare && now && (slot->addr == 0 || (slot->conns == 0 && slot->tat <= now)))
+      spare = slot;
+  }
+  if (spare) {
+    spare->addr  = addr;
+    spare->conns = 0;
+    spare->tat   = 0;
+  }
+  return spare;
+}
+
+/* HTTP_FAILURE when the address already holds as many connections as it may */
+int rate_limit_connect(struct rate_limit* limit, ipv4_t addr, uint64_t now) {
+  if (!limit->slots || addr == 0)
+    return HTTP_SUCCESS;
+  struct rate_slot* slot = rate_limit_slot(limit, addr, now);
+  if (!slot)
+    return HTTP_SUCCESS;
+  if (limit->max_conns && slot->conns >= limit->max_conns)
+    return HTTP_FAILURE;
+  ++slot->conns;
+  return HTTP_SUCCESS;
+}
+
+void rate_limit_disconnect(struct rate_limit* limit, ipv4_t addr) {
+  if (!limit->slots || addr == 0)
+    return;
+  struct rate_slot* slot = rate_limit_slot(limit, addr, 0);
+  if (slot && slot->conns)
+    --slot->conns;
+}
+
+/* takes a token for a request, returns 0 when there was one or how many nanoseconds until there is */
+uint64_t rate_limit_request(struct rate_limit* limit, ipv4_t addr, uint64_t now) {
+  if (!limit->interval || !limit->slots || addr == 0)
+    return 0;
+  struct rate_slot* slot = rate_limit_slot(limit, addr, now);
+  if (!slot)
+    return 0;
+  uint64_t tat = MAX(slot->tat, now);
+  if (tat - now > limit->burst)
+    return tat - now - limit->burst;
+  slot->tat = tat + limit->interval;
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef RATE_LIMIT_H_
+#define RATE_LIMIT_H_
+#include "includes.h"
+#define RATE_LIMIT_SLOTS 4096
+#define RATE_LIMIT_PROBE 8
+
+/* 16 bytes, four to a cache line. 'tat' is when the bucket would be full again, so refilling is a
+   comparison with the clock and an idle slot is one whose tat has passed */
+struct rate_slot {
+  ipv4_t   addr;
+  uint32_t conns;
+  uint64_t tat;
+};
+
+/* owned by one event loop, nothing is locked. a client that can't get a slot isn't limited */
+struct rate_limit {
+  struct rate_slot* slots;
+  size_t   mask;
+  uint64_t interval;
+  uint64_t burst;
+  uint32_t max_conns;
+};
+
+struct rate_limit rate_limit_make(uint32_t, uint32_t, uint32_t);
+int rate_limit_free(struct rate_limit*);
+int rate_limit_connect(struct rate_limit*, ipv4_t, uint64_t);
+void rate_limit_disconnect(struct rate_limit*, ipv4_t);
+uint64_t rate_limit_request(struct rate_limit*, ipv4_t, uint64_t);
+
+#endif
@@ -0,0 +1,364 @@
+#include "sse.h"
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+static uint64_t sse_hash(const char* name) {
+  uint64_t hash = 14695981039346656037ull;
+  for (; *name; ++name) {
+    hash ^= (unsigned char)*name;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static struct sse_channel* sse_channel_find(http_server* server, const char* name, uint64_t hash) {
+  for (size_t i = 0; i < server->sse_channels_len; ++i) {
+    struct sse_channel* channel = server->sse_channels[i];
+    if (channel->hash == hash && strcmp(channel->name, name) == 0)
+      return channel;
+  }
+  return NULL;
+}
+
+static struct sse_channel* sse_channel_get(http_server* server, const char* name) {
+  uint64_t hash = sse_hash(name);
+  struct sse_channel* channel = sse_channel_find(server, name, hash);
+  if (channel)
+    return channel;
+  if (server->sse_channels_len == server->sse_channels_cap) {
+    size_t cap = server->sse_channels_cap ? server->sse_channels_cap * 2 : 8;
+    struct sse_channel** channels = realloc(server->sse_channels, cap * sizeof(struct sse_channel*));
+    if (!channels) {
+      HTTP_LOG(HTTP_LOGERR, "[sse_channel_get] realloc() failed.\n");
+      return NULL;
+    }
+    server->sse_channels     = channels;
+    server->sse_channels_cap = cap;
+  }
+  channel = (struct sse_channel*)calloc(1, sizeof(struct sse_channel));
+  if (!channel || !(channel->name = strdup(name))) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_channel_get] failed to allocate memory.\n");
+    free(channel);
+    return NULL;
+  }
+  channel->hash = hash;
+  server->sse_channels[server->sse_channels_len++] = channel;
+  return channel;
+}
+
+static void sse_event_release(struct sse_event* event) {
+  if (--event->refs == 0)
+    free(event);
+}
+
+/* writes "field: value\n" for every line of 'value', an empty value still makes one line */
+static size_t sse_field(char* out, const char* field, const char* value, size_t len) {
+  size_t n = 0;
+  size_t field_len = strlen(field);
+  do {
+    const char* nl = memchr(value, '\n', len);
+    size_t line = nl ? (size_t)(nl - value) : len;
+    if (out) {
+      memcpy(out + n, field, field_len);
+      memcpy(out + n + field_len, ": ", 2);
+      memcpy(out + n + field_len + 2, value, line);
+      out[n + field_len + 2 + line] = '\n';
+    }
+    n += field_len + 3 + line;
+    if (!nl)
+      break;
+    value += line + 1;
+    len   -= line + 1;
+  } while (1);
+  return n;
+}
+
+static struct sse_event* sse_event_make(const char* id, const char* event, const char* data, size_t len) {
+  size_t body = 0;
+  if (id)
+    body += sse_field(NULL, "id", id, strlen(id));
+  if (event)
+    body += sse_field(NULL, "event", event, strlen(event));
+  body += sse_field(NULL, "data", data, len) + 1;
+  struct sse_event* ev = (struct sse_event*)malloc(sizeof(struct sse_event) + SSE_CHUNK_ROOM + body + 2);
+  if (!ev) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_event_make] failed to allocate memory.\n");
+    return NULL;
+  }
+  char* out = ev->data + SSE_CHUNK_ROOM;
+  size_t n = 0;
+  if (id)
+    n += sse_field(out + n, "id", id, strlen(id));
+  if (event)
+    n += sse_field(out + n, "event", event, strlen(event));
+  n += sse_field(out + n, "data", data, len);
+  out[n++] = '\n';
+  memcpy(out + n, "\r\n", 2);
+  /* the size line is written right behind the payload, wherever its length puts it */
+  char hex[32];
+  int hex_len = snprintf(hex, sizeof(hex), "%zx\r\n", n);
+  memcpy(out - hex_len, hex, hex_len);
+  ev->refs  = 0;
+  ev->start = SSE_CHUNK_ROOM - hex_len;
+  ev->body  = SSE_CHUNK_ROOM;
+  ev->len   = SSE_CHUNK_ROOM + n + 2;
+  return ev;
+}
+
+static void sse_pop(struct sse_conn* sse) {
+  sse_event_release(sse->queue[sse->head]);
+  sse->head = (sse->head + 1) % sse->cap;
+  --sse->len;
+  sse->sent = 0;
+}
+
+/* where the next byte of a queued event starts and how much of it is left */
+static const char* sse_span(struct sse_conn* sse, struct sse_event* ev, size_t sent, size_t* len) {
+  size_t from = sse->chunked ? ev->start : ev->body;
+  size_t to   = sse->chunked ? ev->len : ev->len - 2;
+  *len = to - from - sent;
+  return ev->data + from + sent;
+}
+
+/* writes as much of the backlog as the socket takes, several events per call */
+static void sse_flush(struct sse_conn* sse) {
+  http_server* server = sse->server;
+  struct conn_info* conn = &server->conns.data[sse->index];
+  if (!conn_info_is(conn, CONN_UPGRADED) || sse->failed)
+    return;
+  size_t budget = HTTP_SEND_LEN(&server->constraints);
+  while (sse->len && budget > 0) {
+    /* TLS writes one record stream, the events go one at a time */
+    size_t batch = conn->tls ? 1 : SSE_IOV_MAX;
+    size_t count = MIN(sse->len, batch);
+    size_t total = 0;
+#ifdef _WIN32
+    WSABUF iov[SSE_IOV_MAX];
+    for (size_t i = 0; i < count; ++i) {
+      size_t len;
+      iov[i].buf = (char*)sse_span(sse, sse->queue[(sse->head + i) % sse->cap], i ? 0 : sse->sent, &len);
+      iov[i].len = (ULONG)len;
+      total += len;
+    }
+    DWORD sent = 0;
+    int ret = conn->tls ? conn_info_send(conn, iov[0].buf, iov[0].len)
+            : WSASend(conn->sockfd, iov, (DWORD)count, &sent, 0, NULL, NULL) == 0 ? (int)sent : SOCKET_ERROR;
+#else
+    struct iovec iov[SSE_IOV_MAX];
+    for (size_t i = 0; i < count; ++i) {
+      size_t len;
+      iov[i].iov_base = (void*)sse_span(sse, sse->queue[(sse->head + i) % sse->cap], i ? 0 : sse->sent, &len);
+      iov[i].iov_len  = len;
+      total += len;
+    }
+    struct msghdr msg = { 0 };
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = count;
+    ssize_t ret = conn->tls ? conn_info_send(conn, iov[0].iov_base, iov[0].iov_len)
+                            : sendmsg(conn->sockfd, &msg, SEND_FLAGS);
+#endif
+    ++server->stats.counters.send_calls;
+    if (ret == SOCKET_ERROR) {
+      if (!WOULD_BLOCK(GET_ERROR())) {
+        HTTP_LOG(HTTP_LOGERR, "[sse_flush] send() failed - %d.\n", GET_ERROR());
+        sse->failed = 1;
+      }
+      break;
+    }
+    server->stats.counters.bytes_out += ret;
+    conn->bytes_sent += ret;
+    size_t left = (size_t)ret;
+    budget = left >= budget ? 0 : budget - left;
+    while (left > 0) {
+      size_t len;
+      sse_span(sse, sse->queue[sse->head], sse->sent, &len);
+      if (left < len) {
+        sse->sent += left;
+        break;
+      }
+      left -= len;
+      sse_pop(sse);
+    }
+    if ((size_t)ret < total)
+      break;
+  }
+  conn_info_mark(conn, CONN_WRITE_PENDING, sse->len > 0);
+}
+
+/* a subscriber whose backlog is full either goes or keeps only what is half sent plus the newest event */
+static int sse_push(struct sse_conn* sse, struct sse_event* ev) {
+  http_server* server = sse->server;
+  if (sse->len == sse->cap) {
+    if (server->constraints.sse_slow_policy == SSE_SLOW_DROP) {
+      ++server->stats.counters.sse_dropped;
+      sse->failed = 1;
+      return HTTP_FAILURE;
+    }
+    size_t keep = sse->sent ? 1 : 0;
+    while (sse->len > keep) {
+      size_t last = (sse->head + sse->len - 1) % sse->cap;
+      sse_event_release(sse->queue[last]);
+      --sse->len;
+    }
+    ++server->stats.counters.sse_coalesced;
+  }
+  ++ev->refs;
+  sse->queue[(sse->head + sse->len) % sse->cap] = ev;
+  ++sse->len;
+  return HTTP_SUCCESS;
+}
+
+/* called from the request handler: answers with an event stream and subscribes the connection to
+   'channel'. events published before the head is out are queued behind it */
+int sse_subscribe(http_server* server, http_request* req, http_response* res, const char* channel) {
+  if (!server || !req || !res || !channel) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_subscribe] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (req->version == HTTP_VERSION_2) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_subscribe] invalid arguments - HTTP/2 streams can't subscribe.\n");
+    return HTTP_FAILURE;
+  }
+  struct conn_info* conn = (struct conn_info*)((char*)req - offsetof(struct conn_info, request));
+  if (conn->sse || conn->ws) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_subscribe] invalid arguments - the connection is already handed over.\n");
+    return HTTP_FAILURE;
+  }
+  /* room for a half sent event next to the newest one when coalescing */
+  size_t cap = MAX(server->constraints.sse_max_backlog, 2);
+  struct sse_channel* ch = sse_channel_get(server, channel);
+  struct sse_conn* sse = (struct sse_conn*)calloc(1, sizeof(struct sse_conn));
+  struct sse_event** queue = (struct sse_event**)malloc(cap * sizeof(struct sse_event*));
+  if (ch && ch->len == ch->cap) {
+    size_t subs_cap = ch->cap ? ch->cap * 2 : 16;
+    struct sse_conn** subs = realloc(ch->subs, subs_cap * sizeof(struct sse_conn*));
+    if (subs) {
+      ch->subs = subs;
+      ch->cap  = subs_cap;
+    }
+  }
+  if (!ch || !sse || !queue || ch->len == ch->cap) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_subscribe] failed to allocate memory.\n");
+    free(sse);
+    free(queue);
+    http_response_set_status(res, HTTP_STATUS_500);
+    return HTTP_FAILURE;
+  }
+
+  http_response_set_status(res, HTTP_STATUS_200);
+  http_response_set_header(res, "Content-Type", "text/event-stream");
+  http_response_set_header(res, "Cache-Control", "no-cache");
+  sse->chunked = req->version == HTTP_VERSION_1_1;
+  if (sse->chunked)
+    http_response_set_header(res, "Transfer-Encoding", "chunked");
+  /* the head is the whole HTTP response, the events follow it from the queue */
+  res->body_type   = BODYTYPE_STREAM;
+  res->body_len    = 0;
+  res->stream_done = 1;
+
+  sse->server  = server;
+  sse->index   = (size_t)(conn - server->conns.data);
+  sse->channel = ch;
+  sse->slot    = ch->len;
+  sse->queue   = queue;
+  sse->cap     = cap;
+  ch->subs[ch->len++] = sse;
+  ++server->sse_subscribers;
+  conn->sse = sse;
+  return HTTP_SUCCESS;
+}
+
+/* serializes the event once and queues it to every subscriber of 'channel'. returns how many got it */
+size_t sse_publish(http_server* server, const char* channel, const char* id, const char* event,
+                   const char* data, size_t len) {
+  if (!server || !channel || (!data && len)) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_publish] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  struct sse_channel* ch = sse_channel_find(server, channel, sse_hash(channel));
+  if (!ch || ch->len == 0)
+    return 0;
+  struct sse_event* ev = sse_event_make(id, event, data ? data : "", len);
+  if (!ev)
+    return 0;
+  ++server->stats.counters.sse_events;
+  /* held while queueing so a subscriber dropping it early doesn't free it */
+  ev->refs = 1;
+  size_t reached = 0;
+  for (size_t i = 0; i < ch->len; ++i) {
+    struct sse_conn* sse = ch->subs[i];
+    if (sse->failed || sse_push(sse, ev) == HTTP_FAILURE)
+      continue;
+    ++reached;
+    struct conn_info* conn = &server->conns.data[sse->index];
+    conn_info_mark(conn, CONN_WRITE_PENDING, conn_info_is(conn, CONN_UPGRADED));
+  }
+  sse_event_release(ev);
+  return reached;
+}
+
+size_t sse_subscribers(http_server* server, const char* channel) {
+  if (!server || !channel) {
+    HTTP_LOG(HTTP_LOGERR, "[sse_subscribers] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  struct sse_channel* ch = sse_channel_find(server, channel, sse_hash(channel));
+  return ch ? ch->len : 0;
+}
+
+/* the head is out: the connection only streams from now on */
+int sse_open(http_server* server, struct conn_info* conn) {
+  struct sse_conn* sse = conn->sse;
+  conn->buff_len = 0;
+  conn_info_shrink(conn);
+  conn_info_mark(conn, CONN_UPGRADED, 1);
+  sse->open = 1;
+  sse_flush(sse);
+  return sse->failed ? HTTP_FAILURE : HTTP_SUCCESS;
+}
+
+/* anything the client sends is ignored, reading only notices it going away */
+int sse_step(http_server* server, struct conn_info* conn, int readable, int writable) {
+  struct sse_conn* sse = conn->sse;
+  if (readable) {
+    char scratch[512];
+    int ret = conn_info_recv(conn, scratch, sizeof(scratch));
+    ++server->stats.counters.recv_calls;
+    if (ret == 0 || (ret < 0 && !WOULD_BLOCK(GET_ERROR())))
+      return HTTP_FAILURE;
+    if (ret > 0)
+      server->stats.counters.bytes_in += ret;
+  }
+  if (writable || sse->len)
+    sse_flush(sse);
+  return sse->failed ? HTTP_FAILURE : HTTP_SUCCESS;
+}
+
+void sse_detach(http_server* server, struct conn_info* conn) {
+  struct sse_conn* sse = conn->sse;
+  if (!sse)
+    return;
+  struct sse_channel* ch = sse->channel;
+  ch->subs[sse->slot] = ch->subs[--ch->len];
+  ch->subs[sse->slot]->slot = sse->slot;
+  --server->sse_subscribers;
+  while (sse->len)
+    sse_pop(sse);
+  free(sse->queue);
+  free(sse);
+  conn->sse           = NULL;
+  conn_info_mark(conn, CONN_UPGRADED | CONN_WRITE_PENDING, 0);
+}
+
+void sse_free_channels(http_server* server) {
+  for (size_t i = 0; i < server->sse_channels_len; ++i) {
+    free(server->sse_channels[i]->name);
+    free(server->sse_channels[i]->subs);
+    free(server->sse_channels[i]);
+  }
+  free(server->sse_channels);
+  server->sse_channels     = NULL;
+  server->sse_channels_len = 0;
+  server->sse_channels_cap = 0;
+}
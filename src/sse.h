@@ -0,0 +1,60 @@
+#ifndef SSE_H_
+#define SSE_H_
+#include "includes.h"
+#include "http_server.h"
+#define SSE_CHUNK_ROOM (2 * sizeof(size_t) + 2)
+#define SSE_IOV_MAX 16
+
+enum {
+  SSE_SLOW_DROP,        /* a subscriber with a full backlog is disconnected        */
+  SSE_SLOW_COALESCE     /* its unsent events are discarded in favour of the newest */
+};
+
+/* one published event, serialized once and framed as a chunk: the size line ends at 'body', the payload
+   runs to 'len' - 2. chunked subscribers send all of it, HTTP/1.0 ones only the payload. every subscriber
+   queueing it holds a reference, only the event loop that published it touches it */
+struct sse_event {
+  size_t refs;
+  size_t start;
+  size_t body;
+  size_t len;
+  char   data[];
+};
+
+struct sse_conn;
+
+struct sse_channel {
+  char*    name;
+  uint64_t hash;
+  struct sse_conn** subs;
+  size_t   len;
+  size_t   cap;
+};
+
+/* a subscriber: a ring of events waiting to go out, the first one possibly half sent */
+struct sse_conn {
+  http_server* server;
+  size_t   index;
+  struct sse_channel* channel;
+  size_t   slot;
+  char     chunked;
+  char     open;
+  char     failed;
+  struct sse_event** queue;
+  size_t   head;
+  size_t   len;
+  size_t   cap;
+  size_t   sent;
+};
+
+int sse_subscribe(http_server*, http_request*, http_response*, const char*);
+size_t sse_publish(http_server*, const char*, const char*, const char*, const char*, size_t);
+size_t sse_subscribers(http_server*, const char*);
+
+// internal use, driven by the server's event loop
+int sse_open(http_server*, struct conn_info*);
+int sse_step(http_server*, struct conn_info*, int, int);
+void sse_detach(http_server*, struct conn_info*);
+void sse_free_channels(http_server*);
+
+#endif
@@ -0,0 +1,92 @@
+#include "timer_heap.h"
+
+struct timer_heap timer_heap_make(void) {
+  struct timer_heap heap = { 0 };
+  heap.data = NULL;
+  heap.len  = 0;
+  heap.cap  = 0;
+  return heap;
+}
+
+int timer_heap_free(struct timer_heap* heap) {
+  if (!heap) {
+    HTTP_LOG(HTTP_LOGERR, "[timer_heap_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  free(heap->data);
+  heap->data = NULL;
+  heap->len  = 0;
+  heap->cap  = 0;
+  return HTTP_SUCCESS;
+}
+
+int timer_heap_push(struct timer_heap* heap, uint64_t due, timer_fire fire, void* ctx, size_t id, uint32_t serial) {
+  if (!heap || !fire) {
+    HTTP_LOG(HTTP_LOGERR, "[timer_heap_push] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (heap->len == heap->cap) {
+    size_t cap = heap->cap ? heap->cap * 2 : 64;
+    struct timer* data = realloc(heap->data, cap * sizeof(struct timer));
+    if (!data) {
+      HTTP_LOG(HTTP_LOGERR, "[timer_heap_push] realloc() failed.\n");
+      return HTTP_FAILURE;
+    }
+    heap->data = data;
+    heap->cap  = cap;
+  }
+  size_t i = heap->len++;
+  while (i > 0 && heap->data[(i - 1) / 2].due > due) {
+    heap->data[i] = heap->data[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  struct timer* timer = &heap->data[i];
+  timer->due    = due;
+  timer->fire   = fire;
+  timer->ctx    = ctx;
+  timer->id     = id;
+  timer->serial = serial;
+  return HTTP_SUCCESS;
+}
+
+/* nanoseconds until the earliest timer is due, UINT64_MAX when there is none */
+uint64_t timer_heap_next(struct timer_heap* heap, uint64_t now) {
+  if (!heap || heap->len == 0)
+    return UINT64_MAX;
+  return heap->data[0].due > now ? heap->data[0].due - now : 0;
+}
+
+static void timer_heap_pop(struct timer_heap* heap) {
+  struct timer last = heap->data[--heap->len];
+  size_t i = 0;
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= heap->len)
+      break;
+    if (child + 1 < heap->len && heap->data[child + 1].due < heap->data[child].due)
+      ++child;
+    if (heap->data[child].due >= last.due)
+      break;
+    heap->data[i] = heap->data[child];
+    i = child;
+  }
+  if (heap->len)
+    heap->data[i] = last;
+}
+
+/* fires everything due by 'now', including what the callbacks push for a time already past. returns how
+   many fired */
+size_t timer_heap_run(struct timer_heap* heap, uint64_t now) {
+  if (!heap) {
+    HTTP_LOG(HTTP_LOGERR, "[timer_heap_run] passed NULL pointers for mandatory parameters.\n");
+    return 0;
+  }
+  size_t fired = 0;
+  while (heap->len && heap->data[0].due <= now) {
+    struct timer timer = heap->data[0];
+    timer_heap_pop(heap);
+    timer.fire(timer.ctx, timer.id, timer.serial);
+    ++fired;
+  }
+  return fired;
+}
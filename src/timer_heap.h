@@ -0,0 +1,29 @@
+#ifndef TIMER_HEAP_H_
+#define TIMER_HEAP_H_
+#include "includes.h"
+
+typedef void (*timer_fire) (void*, size_t, uint32_t);
+
+/* timers are never cancelled: whatever 'id' names checks 'serial' when it fires and ignores a stale one */
+struct timer {
+  uint64_t   due;
+  timer_fire fire;
+  void*      ctx;
+  size_t     id;
+  uint32_t   serial;
+};
+
+/* a binary min-heap on 'due', owned by one event loop */
+struct timer_heap {
+  struct timer* data;
+  size_t len;
+  size_t cap;
+};
+
+struct timer_heap timer_heap_make(void);
+int timer_heap_free(struct timer_heap*);
+int timer_heap_push(struct timer_heap*, uint64_t, timer_fire, void*, size_t, uint32_t);
+uint64_t timer_heap_next(struct timer_heap*, uint64_t);
+size_t timer_heap_run(struct timer_heap*, uint64_t);
+
+#endif
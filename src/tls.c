@@ -0,0 +1,228 @@
+#include "tls.h"
+#ifdef HTTP_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+struct tls_context {
+  SSL_CTX* ctx;
+};
+
+/* the socket calls' callers only know would-block and failure, OpenSSL's answers are mapped onto those */
+static int tls_error(SSL* ssl, int ret) {
+  int err = SSL_get_error(ssl, ret);
+  if (err == SSL_ERROR_ZERO_RETURN)
+    return 0;
+  int would_block = err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+  if (!would_block)
+    ERR_clear_error();
+#ifdef _WIN32
+  WSASetLastError(would_block ? WSAEWOULDBLOCK : WSAECONNRESET);
+#else
+  errno = would_block ? EAGAIN : ECONNRESET;
+#endif
+  return SOCKET_ERROR;
+}
+
+/* h2 is offered only where the server would speak it, the client's preface then starts it as usual */
+static int tls_alpn(SSL* ssl, const unsigned char** out, unsigned char* out_len, const unsigned char* in,
+                    unsigned int in_len, void* arg) {
+  static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+  int h2 = SSL_get_app_data(ssl) != NULL;
+  const unsigned char* offer = h2 ? protocols : protocols + 3;
+  unsigned int offer_len = h2 ? sizeof(protocols) - 1 : sizeof(protocols) - 4;
+  if (SSL_select_next_proto((unsigned char**)out, out_len, offer, offer_len, in, in_len) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+struct tls_context* tls_context_new(const char* cert_file, const char* key_file) {
+  if (!cert_file || !key_file) {
+    HTTP_LOG(HTTP_LOGERR, "[tls_context_new] passed NULL pointers for mandatory parameters.\n");
+    return NULL;
+  }
+  struct tls_context* tls = (struct tls_context*)calloc(1, sizeof(struct tls_context));
+  if (!tls) {
+    HTTP_LOG(HTTP_LOGERR, "[tls_context_new] failed to allocate memory.\n");
+    return NULL;
+  }
+  tls->ctx = SSL_CTX_new(TLS_server_method());
+  if (!tls->ctx) {
+    HTTP_LOG(HTTP_LOGERR, "[tls_context_new] SSL_CTX_new() failed.\n");
+    free(tls);
+    return NULL;
+  }
+  SSL_CTX* ctx = tls->ctx;
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef SSL_OP_ENABLE_KTLS
+  /* records are encrypted by the kernel once the keys are agreed, where it and the cipher allow */
+  options |= SSL_OP_ENABLE_KTLS;
+#endif
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+  /* HTTP frames its own messages, a peer closing without close_notify is only closing */
+  options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+  SSL_CTX_set_options(ctx, options);
+  /* the event loop retries a write with whatever is queued by then, and idle connections hold no buffers */
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                   SSL_MODE_RELEASE_BUFFERS);
+  /* stateless tickets: a returning client resumes without the full handshake. the session cache isn't kept,
+   a prefork worker's would only serve the clients that happen to come back to it */
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_set_session_id_context(ctx, (const unsigned char*)"kudos", 5);
+  SSL_CTX_set_num_tickets(ctx, TLS_TICKETS);
+  SSL_CTX_set_alpn_select_cb(ctx, tls_alpn, NULL);
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    HTTP_LOG(HTTP_LOGERR, "[tls_context_new] couldn't load the certificate or key - %s, %s.\n", cert_file, key_file);
+    ERR_clear_error();
+    SSL_CTX_free(ctx);
+    free(tls);
+    return NULL;
+  }
+  return tls;
+}
+
+int tls_context_free(struct tls_context* tls) {
+  if (!tls) {
+    HTTP_LOG(HTTP_LOGERR, "[tls_context_free] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  SSL_CTX_free(tls->ctx);
+  free(tls);
+  return HTTP_SUCCESS;
+}
+
+/* the connection was just accepted, its handshake is driven by the event loop from here */
+int tls_accept(struct tls_context* tls, struct conn_info* conn, int h2) {
+  SSL* ssl = SSL_new(tls->ctx);
+  if (!ssl) {
+    HTTP_LOG(HTTP_LOGERR, "[tls_accept] SSL_new() failed.\n");
+    ERR_clear_error();
+    return HTTP_FAILURE;
+  }
+  if (SSL_set_fd(ssl, (int)conn->sockfd) != 1) {
+    HTTP_LOG(HTTP_LOGERR, "[tls_accept] SSL_set_fd() failed.\n");
+    ERR_clear_error();
+    SSL_free(ssl);
+    return HTTP_FAILURE;
+  }
+  SSL_set_accept_state(ssl);
+  SSL_set_app_data(ssl, h2 ? tls : NULL);
+  conn->tls = ssl;
+  conn_info_mark(conn, CONN_TLS | CONN_HANDSHAKING, 1);
+  return HTTP_SUCCESS;
+}
+
+/* takes the handshake as far as the socket allows. it waits on writability only when OpenSSL has to */
+int tls_handshake(struct conn_info* conn, http_counters* counters) {
+  SSL* ssl = conn->tls;
+  int ret = SSL_do_handshake(ssl);
+  conn_info_mark(conn, CONN_WRITE_PENDING, 0);
+  if (ret == 1) {
+    conn_info_mark(conn, CONN_HANDSHAKING, 0);
+    ++counters->tls_handshakes;
+    if (SSL_session_reused(ssl))
+      ++counters->tls_resumed;
+    if (tls_zero_copy(conn))
+      ++counters->tls_ktls;
+    return HTTP_SUCCESS;
+  }
+  int err = SSL_get_error(ssl, ret);
+  if (err == SSL_ERROR_WANT_READ)
+    return HTTP_SUCCESS;
+  if (err == SSL_ERROR_WANT_WRITE) {
+    conn_info_mark(conn, CONN_WRITE_PENDING, 1);
+    return HTTP_SUCCESS;
+  }
+  ERR_clear_error();
+  ++counters->tls_failures;
+  return HTTP_FAILURE;
+}
+
+int tls_recv(struct conn_info* conn, char* buffer, size_t len) {
+  int ret = SSL_read(conn->tls, buffer, (int)MIN(len, INT32_MAX));
+  return ret > 0 ? ret : tls_error(conn->tls, ret);
+}
+
+int tls_send(struct conn_info* conn, const char* data, size_t len) {
+  int ret = SSL_write(conn->tls, data, (int)MIN(len, INT32_MAX));
+  return ret > 0 ? ret : tls_error(conn->tls, ret);
+}
+
+/* only with kTLS on: the kernel reads the file and encrypts it, nothing is copied through here */
+int tls_sendfile(struct conn_info* conn, FILE* file, size_t offset, size_t len) {
+#if defined(__linux__) && !defined(OPENSSL_NO_KTLS)
+  ossl_ssize_t ret = SSL_sendfile(conn->tls, fileno(file), (off_t)offset, MIN(len, INT32_MAX), 0);
+  return ret > 0 ? (int)ret : tls_error(conn->tls, (int)ret);
+#else
+  errno = ENOTSUP;
+  return SOCKET_ERROR;
+#endif
+}
+
+int tls_zero_copy(const struct conn_info* conn) {
+  return conn->tls && BIO_get_ktls_send(SSL_get_wbio(conn->tls));
+}
+
+/* records OpenSSL already read off the socket, select() won't report them */
+int tls_pending(const struct conn_info* conn) {
+  return conn->tls && SSL_has_pending(conn->tls);
+}
+
+void tls_detach(struct conn_info* conn) {
+  if (!conn->tls)
+    return;
+  /* close_notify goes out if the socket takes it, a failed connection isn't waited on */
+  if (!conn_info_is(conn, CONN_HANDSHAKING))
+    SSL_shutdown(conn->tls);
+  ERR_clear_error();
+  SSL_free(conn->tls);
+  conn->tls = NULL;
+  conn_info_mark(conn, CONN_TLS | CONN_HANDSHAKING, 0);
+}
+
+#else
+
+struct tls_context* tls_context_new(const char* cert_file, const char* key_file) {
+  HTTP_LOG(HTTP_LOGERR, "[tls_context_new] built without TLS - define HTTP_TLS and link OpenSSL.\n");
+  return NULL;
+}
+
+int tls_context_free(struct tls_context* tls) {
+  return HTTP_FAILURE;
+}
+
+int tls_accept(struct tls_context* tls, struct conn_info* conn, int h2) {
+  return HTTP_FAILURE;
+}
+
+int tls_handshake(struct conn_info* conn, http_counters* counters) {
+  return HTTP_FAILURE;
+}
+
+int tls_recv(struct conn_info* conn, char* buffer, size_t len) {
+  return SOCKET_ERROR;
+}
+
+int tls_send(struct conn_info* conn, const char* data, size_t len) {
+  return SOCKET_ERROR;
+}
+
+int tls_sendfile(struct conn_info* conn, FILE* file, size_t offset, size_t len) {
+  return SOCKET_ERROR;
+}
+
+int tls_zero_copy(const struct conn_info* conn) {
+  return 0;
+}
+
+int tls_pending(const struct conn_info* conn) {
+  return 0;
+}
+
+void tls_detach(struct conn_info* conn) {
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef TLS_H_
+#define TLS_H_
+#include "includes.h"
+#include "conn_info.h"
+#include "http_stats.h"
+/* TLS needs OpenSSL and a build with HTTP_TLS defined ('make TLS=1'), without it tls_context_new() fails */
+#define TLS_TICKETS 2                           /* resumption tickets sent after a TLS 1.3 handshake */
+
+/* a certificate, its key and the ticket keys sessions are resumed with. it can be shared by servers on
+   other threads and has to outlive them all */
+struct tls_context;
+
+struct tls_context* tls_context_new(const char*, const char*);
+int tls_context_free(struct tls_context*);
+
+// internal use, the event loop's side of a TLS connection
+int tls_accept(struct tls_context*, struct conn_info*, int);
+int tls_handshake(struct conn_info*, http_counters*);
+int tls_recv(struct conn_info*, char*, size_t);
+int tls_send(struct conn_info*, const char*, size_t);
+int tls_sendfile(struct conn_info*, FILE*, size_t, size_t);
+int tls_zero_copy(const struct conn_info*);
+int tls_pending(const struct conn_info*);
+void tls_detach(struct conn_info*);
+
+#endif
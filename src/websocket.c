@@ -0,0 +1,627 @@
+#include "websocket.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static const char ws_base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint32_t ws_rol(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static void ws_sha1_block(uint32_t h[5], const unsigned char* p) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; ++i)
+    w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+  for (int i = 16; i < 80; ++i)
+    w[i] = ws_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+  for (int i = 0; i < 80; ++i) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    }
+    else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    }
+    else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    }
+    else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    uint32_t t = ws_rol(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ws_rol(b, 30);
+    b = a;
+    a = t;
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+/* only ever hashes a handshake key, speed doesn't matter */
+static void ws_sha1(const unsigned char* data, size_t len, unsigned char out[20]) {
+  uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64)
+    ws_sha1_block(h, data + i);
+  unsigned char tail[128] = { 0 };
+  size_t rest = len - i;
+  memcpy(tail, data + i, rest);
+  tail[rest] = 0x80;
+  size_t tail_len = rest + 9 <= 64 ? 64 : 128;
+  uint64_t bits = (uint64_t)len * 8;
+  for (int j = 0; j < 8; ++j)
+    tail[tail_len - 1 - j] = (unsigned char)(bits >> (8 * j));
+  ws_sha1_block(h, tail);
+  if (tail_len == 128)
+    ws_sha1_block(h, tail + 64);
+  for (int j = 0; j < 5; ++j) {
+    out[4 * j]     = (unsigned char)(h[j] >> 24);
+    out[4 * j + 1] = (unsigned char)(h[j] >> 16);
+    out[4 * j + 2] = (unsigned char)(h[j] >> 8);
+    out[4 * j + 3] = (unsigned char)h[j];
+  }
+}
+
+static size_t ws_base64(const unsigned char* in, size_t len, char* out) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t v = (uint32_t)in[i] << 16 | (i + 1 < len ? (uint32_t)in[i + 1] << 8 : 0) | (i + 2 < len ? in[i + 2] : 0);
+    out[n++] = ws_base64_chars[(v >> 18) & 63];
+    out[n++] = ws_base64_chars[(v >> 12) & 63];
+    out[n++] = i + 1 < len ? ws_base64_chars[(v >> 6) & 63] : '=';
+    out[n++] = i + 2 < len ? ws_base64_chars[v & 63] : '=';
+  }
+  out[n] = 0;
+  return n;
+}
+
+/* the key is 16 random bytes in base64, nothing else is accepted */
+static int ws_key_valid(const char* key) {
+  if (strlen(key) != 24 || key[22] != '=' || key[23] != '=')
+    return 0;
+  for (int i = 0; i < 22; ++i) {
+    if (!memchr(ws_base64_chars, key[i], 64))
+      return 0;
+  }
+  return 1;
+}
+
+static int ws_utf8_valid(const unsigned char* s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    /* ASCII runs are checked eight bytes at a time */
+    while (i + 8 <= len) {
+      uint64_t v;
+      memcpy(&v, s + i, 8);
+      if (v & 0x8080808080808080ull)
+        break;
+      i += 8;
+    }
+    if (i == len)
+      break;
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      ++i;
+      continue;
+    }
+    size_t n;
+    uint32_t cp;
+    if ((c & 0xe0) == 0xc0) {
+      n  = 1;
+      cp = c & 0x1f;
+    }
+    else if ((c & 0xf0) == 0xe0) {
+      n  = 2;
+      cp = c & 0x0f;
+    }
+    else if ((c & 0xf8) == 0xf0) {
+      n  = 3;
+      cp = c & 0x07;
+    }
+    else
+      return 0;
+    if (len - i <= n)
+      return 0;
+    for (size_t k = 1; k <= n; ++k) {
+      if ((s[i + k] & 0xc0) != 0x80)
+        return 0;
+      cp = cp << 6 | (s[i + k] & 0x3f);
+    }
+    if ((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000) ||
+        cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+      return 0;
+    i += n + 1;
+  }
+  return 1;
+}
+
+/* xors 'len' payload bytes into 'dst', 'pos' is how far into the frame they start. the mask repeats every
+   four bytes, so a sixteen byte copy of it lines up with any block */
+static void ws_unmask(char* dst, const unsigned char* src, size_t len, const uint8_t mask[4], size_t pos) {
+  unsigned char m[16];
+  for (int i = 0; i < 16; ++i)
+    m[i] = mask[(pos + i) & 3];
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i key = _mm_loadu_si128((const __m128i*)m);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(v, key));
+  }
+#endif
+  uint64_t word;
+  memcpy(&word, m, 8);
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    memcpy(&v, src + i, 8);
+    v ^= word;
+    memcpy(dst + i, &v, 8);
+  }
+  for (; i < len; ++i)
+    dst[i] = (char)(src[i] ^ m[i & 15]);
+}
+
+/* buffers of the pool's size go back to it, bigger ones were grown past it */
+static void ws_buffer_release(struct buffer_pool* pool, char** buffer, size_t* cap) {
+  if (!*buffer)
+    return;
+  if (*cap == pool->buff_len)
+    buffer_pool_put(pool, *buffer);
+  else
+    free(*buffer);
+  *buffer = NULL;
+  *cap    = 0;
+}
+
+static int ws_msg_reserve(struct ws_conn* ws, size_t len) {
+  struct buffer_pool* pool = &ws->server->ws_pool;
+  if (len < ws->msg_cap)
+    return HTTP_SUCCESS;
+  if (!ws->msg && len < pool->buff_len) {
+    ws->msg = buffer_pool_get(pool);
+    if (!ws->msg)
+      return HTTP_FAILURE;
+    ws->msg_cap = pool->buff_len;
+    return HTTP_SUCCESS;
+  }
+  size_t cap = MAX(len + 1, ws->msg_cap * 2);
+  char* msg = malloc(cap);
+  if (!msg) {
+    HTTP_LOG(HTTP_LOGERR, "[ws_msg_reserve] failed to allocate memory.\n");
+    return HTTP_FAILURE;
+  }
+  if (ws->msg_len)
+    memcpy(msg, ws->msg, ws->msg_len);
+  ws_buffer_release(pool, &ws->msg, &ws->msg_cap);
+  ws->msg     = msg;
+  ws->msg_cap = cap;
+  return HTTP_SUCCESS;
+}
+
+/* frames from the server aren't masked */
+static int ws_queue(struct ws_conn* ws, int opcode, const void* data, size_t len) {
+  if (ws->out_len + len + 10 > ws->out_cap) {
+    size_t cap = MAX(ws->out_len + len + 10, ws->out_cap * 2);
+    char* out = realloc(ws->out, cap);
+    if (!out) {
+      HTTP_LOG(HTTP_LOGERR, "[ws_queue] realloc() failed.\n");
+      return HTTP_FAILURE;
+    }
+    ws->out     = out;
+    ws->out_cap = cap;
+  }
+  unsigned char* p = (unsigned char*)ws->out + ws->out_len;
+  size_t n = 0;
+  p[n++] = (unsigned char)(0x80 | opcode);
+  if (len < 126)
+    p[n++] = (unsigned char)len;
+  else if (len < 65536) {
+    p[n++] = 126;
+    p[n++] = (unsigned char)(len >> 8);
+    p[n++] = (unsigned char)len;
+  }
+  else {
+    p[n++] = 127;
+    for (int i = 7; i >= 0; --i)
+      p[n++] = (unsigned char)((uint64_t)len >> (8 * i));
+  }
+  if (len)
+    memcpy(p + n, data, len);
+  ws->out_len += n + len;
+  return HTTP_SUCCESS;
+}
+
+static void ws_flush(struct ws_conn* ws) {
+  http_server* server = ws->server;
+  struct conn_info* conn = &server->conns.data[ws->index];
+  if (!conn_info_is(conn, CONN_UPGRADED) || ws->failed)
+    return;
+  while (ws->out_sent < ws->out_len) {
+    size_t len = MIN(ws->out_len - ws->out_sent, HTTP_SEND_LEN(&server->constraints));
+    int ret = conn_info_send(conn, ws->out + ws->out_sent, len);
+    ++server->stats.counters.send_calls;
+    if (ret == SOCKET_ERROR) {
+      if (!WOULD_BLOCK(GET_ERROR())) {
+        HTTP_LOG(HTTP_LOGERR, "[ws_flush] send() failed - %d.\n", GET_ERROR());
+        ws->failed = 1;
+      }
+      break;
+    }
+    ws->out_sent += ret;
+    server->stats.counters.bytes_out += ret;
+    conn->bytes_sent += ret;
+  }
+  conn_info_mark(conn, CONN_WRITE_PENDING, ws->out_sent < ws->out_len);
+  if (!conn_info_is(conn, CONN_WRITE_PENDING)) {
+    ws->out_len  = 0;
+    ws->out_sent = 0;
+    /* idle connections keep a small queue at most */
+    if (ws->out_cap > WS_POOL_BUFF) {
+      free(ws->out);
+      ws->out     = NULL;
+      ws->out_cap = 0;
+    }
+  }
+}
+
+static void ws_timer(void* ctx, size_t id, uint32_t serial) {
+  http_server* server = (http_server*)ctx;
+  if (id >= server->conns.cap)
+    return;
+  struct conn_info* conn = &server->conns.data[id];
+  struct ws_conn* ws = conn->ws;
+  if (!conn_info_is(conn, CONN_USED) || !ws || ws->serial != serial)
+    return;
+  /* the close handshake ran out of time, or nothing came back since the last ping */
+  if (ws->close_sent || ws->pinged) {
+    ws->expired = 1;
+    return;
+  }
+  ws->pinged = 1;
+  if (ws_queue(ws, WS_OP_PING, NULL, 0) == HTTP_FAILURE) {
+    ws->failed = 1;
+    return;
+  }
+  ws_flush(ws);
+  uint64_t interval = server->constraints.ws_ping_interval * 1000000ull;
+  timer_heap_push(&server->timers, http_clock_ns() + interval, ws_timer, server, id, serial);
+}
+
+static int ws_close_frame(struct ws_conn* ws, int code, const char* reason) {
+  unsigned char payload[125];
+  size_t len = 0;
+  if (code != WS_CLOSE_NO_STATUS) {
+    payload[0] = (unsigned char)(code >> 8);
+    payload[1] = (unsigned char)code;
+    len = 2;
+    if (reason) {
+      size_t reason_len = MIN(strlen(reason), sizeof(payload) - 2);
+      memcpy(payload + 2, reason, reason_len);
+      len += reason_len;
+    }
+  }
+  ws->close_sent = 1;
+  return ws_queue(ws, WS_OP_CLOSE, payload, len);
+}
+
+/* the peer broke the protocol: it's told why and nothing more is read */
+static void ws_fail(struct ws_conn* ws, int code) {
+  if (!ws->close_sent)
+    ws_close_frame(ws, code, NULL);
+  ws->close_code     = code;
+  ws->close_received = 1;
+}
+
+static int ws_close_valid(int code) {
+  return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+}
+
+static void ws_frame(struct ws_conn* ws) {
+  ws->pinged = 0;
+  if (ws->opcode == WS_OP_PING) {
+    if (!ws->close_sent && ws_queue(ws, WS_OP_PONG, ws->control, ws->control_len) == HTTP_FAILURE)
+      ws->failed = 1;
+  }
+  else if (ws->opcode == WS_OP_CLOSE) {
+    const unsigned char* p = (const unsigned char*)ws->control;
+    int code = ws->control_len >= 2 ? p[0] << 8 | p[1] : WS_CLOSE_NO_STATUS;
+    if (ws->control_len == 1 || (ws->control_len >= 2 && !ws_close_valid(code)) ||
+        !ws_utf8_valid(p + MIN(ws->control_len, 2), ws->control_len - MIN(ws->control_len, 2))) {
+      ws_fail(ws, WS_CLOSE_PROTOCOL);
+      return;
+    }
+    if (!ws->close_sent)
+      ws_close_frame(ws, code, NULL);
+    ws->close_code     = code;
+    ws->close_received = 1;
+  }
+  else if (ws->opcode != WS_OP_PONG && ws->fin) {
+    if (ws->msg_opcode == WS_OP_TEXT && !ws_utf8_valid((const unsigned char*)ws->msg, ws->msg_len)) {
+      ws_fail(ws, WS_CLOSE_INVALID);
+      return;
+    }
+    int opcode = ws->msg_opcode;
+    size_t len = ws->msg_len;
+    ws->msg_opcode = 0;
+    ws->msg_len    = 0;
+    if (ws->msg)
+      ws->msg[len] = 0;
+    if (ws->handlers->message)
+      ws->handlers->message(ws, opcode, ws->msg ? ws->msg : "", len, ws->userdata);
+    /* between messages a connection holds no buffer */
+    ws_buffer_release(&ws->server->ws_pool, &ws->msg, &ws->msg_cap);
+  }
+}
+
+/* consumes whole frame headers and whatever payload arrived, unmasking it where it belongs */
+static void ws_parse(struct ws_conn* ws) {
+  const size_t max = ws->server->constraints.ws_max_message_len;
+  const unsigned char* p = (const unsigned char*)ws->in;
+  const size_t len = ws->in_len;
+  size_t q = 0;
+  while (q < len && !ws->close_received && !ws->failed) {
+    if (!ws->in_frame) {
+      if (len - q < 2)
+        break;
+      uint8_t b0 = p[q];
+      uint8_t b1 = p[q + 1];
+      uint8_t opcode = b0 & 0x0f;
+      int control = (opcode & 0x8) != 0;
+      int fin = b0 >> 7;
+      uint64_t plen = b1 & 0x7f;
+      /* everything wrong with a header shows in its first two bytes */
+      if ((b0 & 0x70) || !(b1 & 0x80) || (opcode > WS_OP_BINARY && opcode < WS_OP_CLOSE) || opcode > WS_OP_PONG ||
+          (control && (!fin || plen > 125)) ||
+          (opcode == WS_OP_CONTINUATION && !ws->msg_opcode) ||
+          (!control && opcode != WS_OP_CONTINUATION && ws->msg_opcode)) {
+        ws_fail(ws, WS_CLOSE_PROTOCOL);
+        break;
+      }
+      size_t need = 2 + (plen == 126 ? 2 : plen == 127 ? 8 : 0) + 4;
+      if (len - q < need)
+        break;
+      size_t at = q + 2;
+      if (plen == 126) {
+        plen = (uint64_t)p[at] << 8 | p[at + 1];
+        at += 2;
+      }
+      else if (plen == 127) {
+        plen = 0;
+        for (int i = 0; i < 8; ++i)
+          plen = plen << 8 | p[at + i];
+        at += 8;
+      }
+      if (!control) {
+        if (plen > max - MIN(ws->msg_len, max)) {
+          ws_fail(ws, WS_CLOSE_TOO_BIG);
+          break;
+        }
+        if (ws_msg_reserve(ws, ws->msg_len + (size_t)plen) == HTTP_FAILURE) {
+          ws_fail(ws, WS_CLOSE_TOO_BIG);
+          break;
+        }
+        if (opcode != WS_OP_CONTINUATION)
+          ws->msg_opcode = opcode;
+      }
+      memcpy(ws->mask, p + at, 4);
+      ws->opcode      = opcode;
+      ws->fin         = (uint8_t)fin;
+      ws->remaining   = plen;
+      ws->mask_pos    = 0;
+      ws->control_len = 0;
+      ws->in_frame    = 1;
+      q = at + 4;
+    }
+    size_t take = (size_t)MIN((uint64_t)(len - q), ws->remaining);
+    if (ws->opcode & 0x8) {
+      ws_unmask(ws->control + ws->control_len, p + q, take, ws->mask, ws->mask_pos);
+      ws->control_len += take;
+    }
+    else {
+      ws_unmask(ws->msg + ws->msg_len, p + q, take, ws->mask, ws->mask_pos);
+      ws->msg_len += take;
+    }
+    ws->mask_pos   = (ws->mask_pos + take) & 3;
+    ws->remaining -= take;
+    q += take;
+    if (ws->remaining == 0) {
+      ws->in_frame = 0;
+      ws_frame(ws);
+    }
+  }
+  ws->in_len = len - q;
+  if (ws->in_len && q)
+    memmove(ws->in, ws->in + q, ws->in_len);
+}
+
+/* called from the request handler: checks the handshake and answers it. the connection switches once the
+   response is out, on failure 'res' is already the error to send */
+int ws_upgrade(http_server* server, http_request* req, http_response* res, const struct ws_handlers* handlers,
+               void* userdata) {
+  if (!server || !req || !res || !handlers) {
+    HTTP_LOG(HTTP_LOGERR, "[ws_upgrade] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  http_hdv* key = http_headers_get(req->headers, "Sec-WebSocket-Key");
+  http_hdv* version = http_headers_get(req->headers, "Sec-WebSocket-Version");
+  if (req->method != METHOD_GET || req->version != HTTP_VERSION_1_1 ||
+      !http_headers_has_token(req->headers, "Connection", "upgrade") ||
+      !http_headers_has_token(req->headers, "Upgrade", "websocket") ||
+      !key || key->next || !ws_key_valid(key->v)) {
+    http_response_set_status(res, HTTP_STATUS_400);
+    return HTTP_FAILURE;
+  }
+  if (!version || strcmp(version->v, "13") != 0) {
+    http_response_set_status(res, HTTP_STATUS_426);
+    http_response_set_header(res, "Sec-WebSocket-Version", "13");
+    return HTTP_FAILURE;
+  }
+  struct ws_conn* ws = (struct ws_conn*)calloc(1, sizeof(struct ws_conn));
+  if (!ws) {
+    HTTP_LOG(HTTP_LOGERR, "[ws_upgrade] failed to allocate memory.\n");
+    http_response_set_status(res, HTTP_STATUS_500);
+    return HTTP_FAILURE;
+  }
+
+  unsigned char material[24 + sizeof(WS_GUID) - 1];
+  unsigned char digest[20];
+  char accept[32];
+  memcpy(material, key->v, 24);
+  memcpy(material + 24, WS_GUID, sizeof(WS_GUID) - 1);
+  ws_sha1(material, sizeof(material), digest);
+  ws_base64(digest, sizeof(digest), accept);
+  http_response_set_status(res, HTTP_STATUS_101);
+  http_response_set_header(res, "Upgrade", "websocket");
+  http_response_set_header(res, "Connection", "Upgrade");
+  http_response_set_header(res, "Sec-WebSocket-Accept", accept);
+
+  struct conn_info* conn = (struct conn_info*)((char*)req - offsetof(struct conn_info, request));
+  ws->server     = server;
+  ws->index      = (size_t)(conn - server->conns.data);
+  ws->serial     = ++server->ws_serial;
+  ws->handlers   = handlers;
+  ws->userdata   = userdata;
+  ws->close_code = WS_CLOSE_ABNORMAL;
+  conn->ws = ws;
+  return HTTP_SUCCESS;
+}
+
+/* queues a text, binary or ping frame and writes what the socket takes now. fails once the connection is
+   closing or when the peer is too far behind */
+int ws_send(struct ws_conn* ws, int opcode, const void* data, size_t len) {
+  if (!ws || (!data && len)) {
+    HTTP_LOG(HTTP_LOGERR, "[ws_send] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (opcode != WS_OP_TEXT && opcode != WS_OP_BINARY && opcode != WS_OP_PING) {
+    HTTP_LOG(HTTP_LOGERR, "[ws_send] invalid arguments - not a data or ping opcode.\n");
+    return HTTP_FAILURE;
+  }
+  if (ws->close_sent || ws->failed || ws->expired || ws->out_len - ws->out_sent + len > WS_MAX_BACKLOG)
+    return HTTP_FAILURE;
+  if (ws_queue(ws, opcode, data, len) == HTTP_FAILURE)
+    return HTTP_FAILURE;
+  ws_flush(ws);
+  return HTTP_SUCCESS;
+}
+
+/* starts the close handshake, the connection goes once the peer answers or after WS_CLOSE_TIMEOUT */
+int ws_close(struct ws_conn* ws, int code, const char* reason) {
+  if (!ws) {
+    HTTP_LOG(HTTP_LOGERR, "[ws_close] passed NULL pointers for mandatory parameters.\n");
+    return HTTP_FAILURE;
+  }
+  if (ws->close_sent || ws->failed)
+    return HTTP_SUCCESS;
+  if (!ws_close_valid(code))
+    code = WS_CLOSE_NORMAL;
+  if (ws_close_frame(ws, code, reason) == HTTP_FAILURE) {
+    ws->failed = 1;
+    return HTTP_FAILURE;
+  }
+  ws->close_code = code;
+  ws_flush(ws);
+  http_server* server = ws->server;
+  timer_heap_push(&server->timers, http_clock_ns() + WS_CLOSE_TIMEOUT, ws_timer, server, ws->index, ws->serial);
+  return HTTP_SUCCESS;
+}
+
+/* the 101 is out: frames that came with the handshake are kept, the connection's own buffer goes back */
+int ws_open(http_server* server, struct conn_info* conn) {
+  struct ws_conn* ws = conn->ws;
+  if (conn->buff_len > WS_POOL_BUFF)
+    return HTTP_FAILURE;
+  if (conn->buff_len) {
+    ws->in = buffer_pool_get(&server->ws_pool);
+    if (!ws->in)
+      return HTTP_FAILURE;
+    memcpy(ws->in, conn->buffer, conn->buff_len);
+    ws->in_len = conn->buff_len;
+    conn->buff_len = 0;
+  }
+  conn_info_shrink(conn);
+  conn_info_mark(conn, CONN_UPGRADED, 1);
+  ws->open = 1;
+  ++server->websockets;
+  if (server->constraints.ws_ping_interval) {
+    uint64_t interval = server->constraints.ws_ping_interval * 1000000ull;
+    timer_heap_push(&server->timers, http_clock_ns() + interval, ws_timer, server, ws->index, ws->serial);
+  }
+  if (ws->handlers->open)
+    ws->handlers->open(ws, ws->userdata);
+  if (ws->in_len)
+    ws_parse(ws);
+  ws_flush(ws);
+  return ws->failed ? HTTP_FAILURE : HTTP_SUCCESS;
+}
+
+/* reads and writes what the socket allows. HTTP_FAILURE means the connection is done with and goes */
+int ws_step(http_server* server, struct conn_info* conn, int readable, int writable) {
+  struct ws_conn* ws = conn->ws;
+  struct buffer_pool* pool = &server->ws_pool;
+  size_t budget = HTTP_RECV_LEN(&server->constraints);
+  while (readable && !ws->close_received && !ws->failed && budget > 0) {
+    if (!ws->in && !(ws->in = buffer_pool_get(pool)))
+      return HTTP_FAILURE;
+    size_t space = MIN(pool->buff_len - ws->in_len, budget);
+    int ret = conn_info_recv(conn, ws->in + ws->in_len, space);
+    ++server->stats.counters.recv_calls;
+    if (ret < 0) {
+      if (WOULD_BLOCK(GET_ERROR()))
+        break;
+      return HTTP_FAILURE;
+    }
+    if (ret == 0)
+      return HTTP_FAILURE;
+    ws->in_len += ret;
+    budget     -= ret;
+    server->stats.counters.bytes_in += ret;
+    ws_parse(ws);
+    if ((size_t)ret < space)
+      break;
+  }
+  if (ws->in && ws->in_len == 0) {
+    buffer_pool_put(pool, ws->in);
+    ws->in = NULL;
+  }
+  if (writable || ws->out_sent < ws->out_len)
+    ws_flush(ws);
+  if (ws->failed || ws->expired)
+    return HTTP_FAILURE;
+  /* both sides sent their close frame */
+  if (ws->close_sent && ws->close_received && !conn_info_is(conn, CONN_WRITE_PENDING))
+    return HTTP_FAILURE;
+  return HTTP_SUCCESS;
+}
+
+void ws_detach(http_server* server, struct conn_info* conn) {
+  struct ws_conn* ws = conn->ws;
+  if (!ws)
+    return;
+  if (ws->open) {
+    --server->websockets;
+    /* nothing can be sent from the close handler */
+    ws->failed = 1;
+    if (ws->handlers->close)
+      ws->handlers->close(ws, ws->close_code, ws->userdata);
+  }
+  if (ws->in)
+    buffer_pool_put(&server->ws_pool, ws->in);
+  ws_buffer_release(&server->ws_pool, &ws->msg, &ws->msg_cap);
+  free(ws->out);
+  free(ws);
+  conn->ws            = NULL;
+  conn_info_mark(conn, CONN_UPGRADED | CONN_WRITE_PENDING, 0);
+}
@@ -0,0 +1,88 @@
+#ifndef WEBSOCKET_H_
+#define WEBSOCKET_H_
+#include "includes.h"
+#include "http_server.h"
+#define WS_POOL_BUFF (1024 * 16)
+#define WS_POOL_MAX_FREE 64
+#define WS_MAX_BACKLOG (1024 * 1024 * 4)
+#define WS_CLOSE_TIMEOUT (1000000000ull * 5)
+
+enum {
+  WS_OP_CONTINUATION = 0x0,
+  WS_OP_TEXT         = 0x1,
+  WS_OP_BINARY       = 0x2,
+  WS_OP_CLOSE        = 0x8,
+  WS_OP_PING         = 0x9,
+  WS_OP_PONG         = 0xa
+};
+
+enum {
+  WS_CLOSE_NORMAL      = 1000,
+  WS_CLOSE_GOING_AWAY  = 1001,
+  WS_CLOSE_PROTOCOL    = 1002,
+  WS_CLOSE_UNSUPPORTED = 1003,
+  WS_CLOSE_NO_STATUS   = 1005,
+  WS_CLOSE_ABNORMAL    = 1006,
+  WS_CLOSE_INVALID     = 1007,
+  WS_CLOSE_POLICY      = 1008,
+  WS_CLOSE_TOO_BIG     = 1009
+};
+
+struct ws_conn;
+
+/* all called from the event loop. 'message' gets whole messages, text is valid UTF-8 and NUL-terminated.
+   the connection is gone once 'close' returns */
+struct ws_handlers {
+  void (*open) (struct ws_conn*, void*);
+  void (*message) (struct ws_conn*, int, const char*, size_t, void*);
+  void (*close) (struct ws_conn*, int, void*);
+};
+
+struct ws_conn {
+  http_server* server;
+  size_t   index;
+  uint32_t serial;
+  const struct ws_handlers* handlers;
+  void*    userdata;
+  char     open;
+  char     close_sent;
+  char     close_received;
+  char     expired;
+  char     failed;
+  char     pinged;
+  int      close_code;
+
+  // the frame being read, its payload is unmasked straight into the message or 'control'
+  char     in_frame;
+  uint8_t  opcode;
+  uint8_t  fin;
+  uint8_t  mask[4];
+  size_t   mask_pos;
+  uint64_t remaining;
+  char     control[125];
+  size_t   control_len;
+
+  // a fragmented message is put back together here
+  int      msg_opcode;
+  char*    msg;
+  size_t   msg_len;
+  size_t   msg_cap;
+
+  char*    in;
+  size_t   in_len;
+  char*    out;
+  size_t   out_len;
+  size_t   out_sent;
+  size_t   out_cap;
+};
+
+int ws_upgrade(http_server*, http_request*, http_response*, const struct ws_handlers*, void*);
+int ws_send(struct ws_conn*, int, const void*, size_t);
+int ws_close(struct ws_conn*, int, const char*);
+
+// internal use, driven by the server's event loop
+int ws_open(http_server*, struct conn_info*);
+int ws_step(http_server*, struct conn_info*, int, int);
+void ws_detach(http_server*, struct conn_info*);
+
+#endif